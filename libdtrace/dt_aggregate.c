@@ -344,28 +344,6 @@ dt_aggregate_quantizedcmp(int64_t *lhs, int64_t *rhs)
 	return (0);
 }
 
-static void
-dt_aggregate_usym(dtrace_hdl_t *dtp, uint64_t *data)
-{
-	uint64_t tgid = data[1];
-	uint64_t *pc = &data[2];
-	pid_t pid;
-	GElf_Sym sym;
-
-	if (dtp->dt_vector != NULL)
-		return;
-
-	pid = dt_proc_grab_lock(dtp, tgid, DTRACE_PROC_WAITING |
-	    DTRACE_PROC_SHORTLIVED);
-	if (pid < 0)
-		return;
-
-	if (dt_Plookup_by_addr(dtp, pid, *pc, NULL, 0, &sym) == 0)
-		*pc = sym.st_value;
-
-	dt_proc_release_unlock(dtp, pid);
-}
-
 static void
 dt_aggregate_umod(dtrace_hdl_t *dtp, uint64_t *data)
 {
@@ -377,25 +355,14 @@ dt_aggregate_umod(dtrace_hdl_t *dtp, uint64_t *data)
 	if (dtp->dt_vector != NULL)
 		return;
 
-	pid = dt_proc_grab_lock(dtp, tgid, DTRACE_PROC_WAITING |
-	    DTRACE_PROC_SHORTLIVED);
+	pid = dt_proc_sym_grab(dtp, tgid);
 	if (pid < 0)
 		return;
 
 	if ((map = dt_Paddr_to_map(dtp, pid, *pc)) != NULL)
 		*pc = map->pr_vaddr;
 
-	dt_proc_release_unlock(dtp, pid);
-}
-
-static void
-dt_aggregate_sym(dtrace_hdl_t *dtp, uint64_t *data)
-{
-	GElf_Sym sym;
-	uint64_t *pc = data;
-
-	if (dtrace_lookup_by_addr(dtp, *pc, &sym, NULL) == 0)
-		*pc = sym.st_value;
+	dt_proc_sym_release(dtp, pid);
 }
 
 static void
@@ -445,6 +412,210 @@ dt_aggregate_mod(dtrace_hdl_t *dtp, uint64_t *addr)
 	}
 }
 
+/*
+ * Walk the records in an aggregation snapshot buffer, noting the location of
+ * every sym() and usym() key.  If ksyms and usyms are NULL, the keys are
+ * only counted.
+ */
+static int
+dt_aggregate_symkeys(dtrace_hdl_t *dtp, dtrace_bufdesc_t *buf,
+    uint64_t **ksyms, size_t *nksyms, uint64_t **usyms, size_t *nusyms)
+{
+	dtrace_epid_t id;
+	dtrace_aggdesc_t *agg;
+	dtrace_recdesc_t *rec;
+	size_t offs;
+	caddr_t addr;
+	int j, rval;
+
+	*nksyms = *nusyms = 0;
+
+	for (offs = 0; offs < buf->dtbd_size; offs += agg->dtagd_size) {
+		id = *((dtrace_epid_t *)((uintptr_t)buf->dtbd_data +
+		    (uintptr_t)offs));
+
+		/*
+		 * Skip alignment filler.
+		 */
+		while (id == DTRACE_AGGIDNONE) {
+			offs += sizeof (id);
+			if (offs >= buf->dtbd_size)
+				return (0);
+			id = *((dtrace_epid_t *)((uintptr_t)buf->dtbd_data +
+			    (uintptr_t)offs));
+		}
+
+		if ((rval = dt_aggid_lookup(dtp, id, &agg)) != 0)
+			return (rval);
+
+		addr = buf->dtbd_data + offs;
+
+		for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
+			rec = &agg->dtagd_rec[j];
+
+			switch (rec->dtrd_action) {
+			case DTRACEACT_SYM:
+				if (ksyms != NULL)
+					/* LINTED - alignment */
+					ksyms[*nksyms] = (uint64_t *)
+					    &addr[rec->dtrd_offset];
+				(*nksyms)++;
+				break;
+
+			case DTRACEACT_USYM:
+				if (dtp->dt_vector != NULL)
+					break;
+				if (usyms != NULL)
+					/* LINTED - alignment */
+					usyms[*nusyms] = (uint64_t *)
+					    &addr[rec->dtrd_offset];
+				(*nusyms)++;
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+
+	return (0);
+}
+
+static int
+dt_aggregate_usym_cmp(const void *lp, const void *rp)
+{
+	const uint64_t *lhs = *(const uint64_t **)lp;
+	const uint64_t *rhs = *(const uint64_t **)rp;
+
+	if (lhs[1] < rhs[1])
+		return (-1);
+	if (lhs[1] > rhs[1])
+		return (1);
+	return (0);
+}
+
+/*
+ * Normalize every sym() and usym() key in a snapshot buffer to the address of
+ * its symbol before any record is hashed.  Kernel addresses are resolved in a
+ * single batch, and user addresses in one batch per process, so that each
+ * process is grabbed only once per snapshot rather than once per key.
+ */
+static int
+dt_aggregate_symbolize(dtrace_hdl_t *dtp, dtrace_bufdesc_t *buf)
+{
+	uint64_t **ksyms = NULL, **usyms = NULL;
+	size_t nksyms, nusyms, i, j;
+	GElf_Addr *addrs = NULL;
+	GElf_Sym *syms = NULL;
+	dtrace_syminfo_t *sips = NULL;
+	praddrinfo_t *pra = NULL;
+	int rval;
+
+	if ((rval = dt_aggregate_symkeys(dtp, buf, NULL, &nksyms,
+	    NULL, &nusyms)) != 0)
+		return (rval);
+
+	if (nksyms == 0 && nusyms == 0)
+		return (0);
+
+	rval = -1;
+	if (nksyms > 0 &&
+	    ((ksyms = dt_alloc(dtp, nksyms * sizeof (uint64_t *))) == NULL ||
+	    (addrs = dt_alloc(dtp, nksyms * sizeof (GElf_Addr))) == NULL ||
+	    (syms = dt_alloc(dtp, nksyms * sizeof (GElf_Sym))) == NULL ||
+	    (sips = dt_alloc(dtp, nksyms * sizeof (dtrace_syminfo_t))) == NULL))
+		goto out;
+
+	if (nusyms > 0 &&
+	    ((usyms = dt_alloc(dtp, nusyms * sizeof (uint64_t *))) == NULL ||
+	    (pra = dt_alloc(dtp, nusyms * sizeof (praddrinfo_t))) == NULL))
+		goto out;
+
+	if ((rval = dt_aggregate_symkeys(dtp, buf, ksyms, &nksyms,
+	    usyms, &nusyms)) != 0)
+		goto out;
+
+	if (nksyms > 0) {
+		for (i = 0; i < nksyms; i++)
+			addrs[i] = *ksyms[i];
+
+		if (dtrace_lookup_by_addrs(dtp, addrs, nksyms, syms,
+		    sips) < 0) {
+			rval = -1;
+			goto out;
+		}
+
+		for (i = 0; i < nksyms; i++) {
+			if (sips[i].dts_name != NULL)
+				*ksyms[i] = syms[i].st_value;
+		}
+	}
+
+	/*
+	 * Each usym() key is a (tgid, pc) pair: sort them by tgid, then look
+	 * up each process's run of addresses together.
+	 */
+	if (nusyms > 0)
+		qsort(usyms, nusyms, sizeof (uint64_t *),
+		    dt_aggregate_usym_cmp);
+
+	for (i = 0; i < nusyms; i = j) {
+		uint64_t tgid = usyms[i][1];
+		size_t k;
+		pid_t pid;
+
+		for (j = i; j < nusyms && usyms[j][1] == tgid; j++)
+			pra[j - i].pra_addr = usyms[j][2];
+
+		pid = dt_proc_sym_grab(dtp, tgid);
+		if (pid < 0)
+			continue;
+
+		if (dt_Plookup_by_addrs(dtp, pid, pra, j - i) > 0) {
+			for (k = i; k < j; k++) {
+				const praddrinfo_t *frame = &pra[k - i];
+
+				if (frame->pra_name != NULL)
+					usyms[k][2] = frame->pra_sym.st_value;
+			}
+		}
+
+		dt_proc_sym_release(dtp, pid);
+	}
+
+	rval = 0;
+out:
+	dt_free(dtp, pra);
+	dt_free(dtp, sips);
+	dt_free(dtp, syms);
+	dt_free(dtp, addrs);
+	dt_free(dtp, usyms);
+	dt_free(dtp, ksyms);
+	return (rval);
+}
+
+/*
+ * With -xusnapshot, take a snapshot of the process behind every ustack() key of
+ * a newly-seen aggregation entry, so that it can still be symbolized when it is
+ * printed, even if the process has exited by then.  (usym() and umod() keys
+ * are looked up as they are snapshotted anyway.)
+ */
+static void
+dt_aggregate_usnapshot(dtrace_hdl_t *dtp, dtrace_aggdesc_t *agg, caddr_t addr)
+{
+	dtrace_recdesc_t *rec;
+	int j;
+
+	for (j = 0; j < agg->dtagd_nrecs - 1; j++) {
+		rec = &agg->dtagd_rec[j];
+
+		if (rec->dtrd_action == DTRACEACT_USTACK)
+			dt_proc_sym_snapshot(dtp,
+			    /* LINTED - alignment */
+			    (pid_t)*(uint64_t *)&addr[rec->dtrd_offset]);
+	}
+}
+
 static dtrace_aggvarid_t
 dt_aggregate_aggvarid(dt_ahashent_t *ent)
 {
@@ -520,6 +691,9 @@ dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
 		bzero(hash->dtah_hash, size);
 	}
 
+	if ((rval = dt_aggregate_symbolize(dtp, buf)) != 0)
+		return (rval);
+
 	for (offs = 0; offs < buf->dtbd_size; ) {
 		/*
 		 * We're guaranteed to have an ID.
@@ -547,24 +721,17 @@ dt_aggregate_snap_cpu(dtrace_hdl_t *dtp, processorid_t cpu)
 			rec = &agg->dtagd_rec[j];
 			roffs = rec->dtrd_offset;
 
+			/*
+			 * sym() and usym() keys have already been normalized
+			 * by dt_aggregate_symbolize().
+			 */
 			switch (rec->dtrd_action) {
-			case DTRACEACT_USYM:
-				dt_aggregate_usym(dtp,
-				    /* LINTED - alignment */
-				    (uint64_t *)&addr[roffs]);
-				break;
-
 			case DTRACEACT_UMOD:
 				dt_aggregate_umod(dtp,
 				    /* LINTED - alignment */
 				    (uint64_t *)&addr[roffs]);
 				break;
 
-			case DTRACEACT_SYM:
-				/* LINTED - alignment */
-				dt_aggregate_sym(dtp, (uint64_t *)&addr[roffs]);
-				break;
-
 			case DTRACEACT_MOD:
 				/* LINTED - alignment */
 				dt_aggregate_mod(dtp, (uint64_t *)&addr[roffs]);
@@ -653,6 +820,9 @@ hashnext:
 		h->dtahe_size = size;
 		(void) dt_aggregate_aggvarid(h);
 
+		if (dtp->dt_usnapshot && dtp->dt_vector == NULL)
+			dt_aggregate_usnapshot(dtp, agg, addr);
+
 		rec = &agg->dtagd_rec[agg->dtagd_nrecs - 1];
 
 		if (flags & DTRACE_A_PERCPU) {
@@ -1928,8 +2098,12 @@ dtrace_aggregate_print(dtrace_hdl_t *dtp, FILE *fp,
 	if (func == NULL)
 		func = dtrace_aggregate_walk_sorted;
 
-	if ((*func)(dtp, dt_print_agg, &pd) == -1)
+	dt_proc_session_begin(dtp);
+	if ((*func)(dtp, dt_print_agg, &pd) == -1) {
+		dt_proc_session_end(dtp);
 		return (dt_set_errno(dtp, dtp->dt_errno));
+	}
+	dt_proc_session_end(dtp);
 
 	return (0);
 }
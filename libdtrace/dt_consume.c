@@ -1035,11 +1035,11 @@ int
 dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
     caddr_t addr, int depth, int size)
 {
-	dtrace_syminfo_t dts;
-	GElf_Sym sym;
-	int i, indent;
+	dtrace_syminfo_t *dts;
+	GElf_Sym *sym;
+	GElf_Addr *pc;
+	int i, n, indent, err = 0;
 	char c[PATH_MAX * 2];
-	uint64_t pc;
 
 	if (dt_printf(dtp, fp, "\n") < 0)
 		return (-1);
@@ -1052,62 +1052,75 @@ dt_print_stack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 	else
 		indent = _dtrace_stkindent;
 
-	for (i = 0; i < depth; i++) {
-		switch (size) {
-		case sizeof (uint32_t):
-			/* LINTED - alignment */
-			pc = *((uint32_t *)addr);
-			break;
+	if (depth <= 0)
+		return (0);
 
-		case sizeof (uint64_t):
-			/* LINTED - alignment */
-			pc = *((uint64_t *)addr);
-			break;
+	if (size != sizeof (uint32_t) && size != sizeof (uint64_t))
+		return (dt_set_errno(dtp, EDT_BADSTACKPC));
 
-		default:
-			return (dt_set_errno(dtp, EDT_BADSTACKPC));
-		}
+	pc = dt_alloc(dtp, depth * sizeof (GElf_Addr));
+	sym = dt_alloc(dtp, depth * sizeof (GElf_Sym));
+	dts = dt_alloc(dtp, depth * sizeof (dtrace_syminfo_t));
+	if (pc == NULL || sym == NULL || dts == NULL) {
+		err = -1;
+		goto out;
+	}
 
-		if (pc == 0)
+	/*
+	 * Collect the whole stack, and look it up in one go.
+	 */
+	for (n = 0; n < depth; n++, addr += size) {
+		if (size == sizeof (uint32_t))
+			/* LINTED - alignment */
+			pc[n] = *((uint32_t *)addr);
+		else
+			/* LINTED - alignment */
+			pc[n] = *((uint64_t *)addr);
+
+		if (pc[n] == 0)
 			break;
+	}
 
-		addr += size;
+	if (dtrace_lookup_by_addrs(dtp, pc, n, sym, dts) < 0) {
+		err = -1;
+		goto out;
+	}
 
-		if (dt_printf(dtp, fp, "%*s", indent, "") < 0)
-			return (-1);
+	for (i = 0; i < n; i++) {
+		if ((err = dt_printf(dtp, fp, "%*s", indent, "")) < 0)
+			break;
 
-		if (dtrace_lookup_by_addr(dtp, pc, &sym, &dts) == 0) {
-			if (pc > sym.st_value) {
+		if (dts[i].dts_name != NULL) {
+			if (pc[i] > sym[i].st_value) {
 				(void) snprintf(c, sizeof (c), "%s`%s+0x%llx",
-				    dts.dts_object, dts.dts_name,
-				    (long long unsigned) pc - sym.st_value);
+				    dts[i].dts_object, dts[i].dts_name,
+				    (long long unsigned) pc[i] -
+				    sym[i].st_value);
 			} else {
 				(void) snprintf(c, sizeof (c), "%s`%s",
-				    dts.dts_object, dts.dts_name);
+				    dts[i].dts_object, dts[i].dts_name);
 			}
+		} else if (dts[i].dts_object != NULL) {
+			(void) snprintf(c, sizeof (c), "%s`0x%llx",
+			    dts[i].dts_object, (long long unsigned) pc[i]);
 		} else {
-			/*
-			 * We'll repeat the lookup, but this time we'll specify
-			 * a NULL GElf_Sym -- indicating that we're only
-			 * interested in the containing module.
-			 */
-			if (dtrace_lookup_by_addr(dtp, pc, NULL, &dts) == 0) {
-				(void) snprintf(c, sizeof (c), "%s`0x%llx",
-				    dts.dts_object, (long long unsigned) pc);
-			} else {
-				(void) snprintf(c, sizeof (c), "0x%llx",
-				    (long long unsigned) pc);
-			}
+			(void) snprintf(c, sizeof (c), "0x%llx",
+			    (long long unsigned) pc[i]);
 		}
 
-		if (dt_printf(dtp, fp, format, c) < 0)
-			return (-1);
+		if ((err = dt_printf(dtp, fp, format, c)) < 0)
+			break;
 
-		if (dt_printf(dtp, fp, "\n") < 0)
-			return (-1);
+		if ((err = dt_printf(dtp, fp, "\n")) < 0)
+			break;
 	}
 
-	return (0);
+out:
+	dt_free(dtp, pc);
+	dt_free(dtp, sym);
+	dt_free(dtp, dts);
+
+	return (err < 0 ? -1 : 0);
 }
 
 int
@@ -1122,9 +1135,9 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 	const char *str = strsize ? strbase : NULL;
 	int err = 0;
 
-	char name[PATH_MAX], objname[PATH_MAX], c[PATH_MAX * 2];
-	GElf_Sym sym;
-	int i, indent;
+	char c[PATH_MAX * 2];
+	praddrinfo_t *pra = NULL;
+	int i, n, indent;
 	pid_t pid = -1, tgid;
 
 	if (depth == 0)
@@ -1149,49 +1162,71 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 	 * this is a vector open, we just print the raw address or string.
 	 */
 	if (dtp->dt_vector == NULL)
-		pid = dt_proc_grab_lock(dtp, tgid, DTRACE_PROC_WAITING |
-		    DTRACE_PROC_SHORTLIVED);
+		pid = dt_proc_sym_grab(dtp, tgid);
 
-	for (i = 0; i < depth && pc[i] != 0; i++) {
-		const prmap_t *map;
+	for (n = 0; n < depth && pc[n] != 0; n++)
+		continue;
+
+	/*
+	 * Look up every frame at once.  If the process has gone away, all the
+	 * lookups simply fail.
+	 */
+	if (pid >= 0 && n > 0) {
+		if ((pra = dt_alloc(dtp, n * sizeof (praddrinfo_t))) == NULL) {
+			dt_proc_sym_release(dtp, pid);
+			return (-1);
+		}
+
+		for (i = 0; i < n; i++) {
+			pra[i].pra_addr = pc[i];
+			pra[i].pra_map = NULL;
+			pra[i].pra_object = NULL;
+			pra[i].pra_name = NULL;
+		}
+
+		(void) dt_Plookup_by_addrs(dtp, pid, pra, n);
+	}
+
+	for (i = 0; i < n; i++) {
+		const praddrinfo_t *frame = pra != NULL ? &pra[i] : NULL;
+		char *objname = NULL;
+
+		if (frame != NULL && frame->pra_object != NULL)
+			objname = dt_basename((char *)frame->pra_object);
 
 		if ((err = dt_printf(dtp, fp, "%*s", indent, "")) < 0)
 			break;
 		if (dtp->dt_options[DTRACEOPT_NORESOLVE] != DTRACEOPT_UNSET
-		    && pid >= 0) {
-			if (dt_Pobjname(dtp, pid, pc[i], objname,
-			    sizeof(objname)) != NULL) {
-				const prmap_t *pmap = NULL;
+		    && frame != NULL) {
+			if (objname != NULL) {
 				uint64_t offset = pc[i];
 
-				pmap = dt_Paddr_to_map(dtp, pid, pc[i]);
-
-				if (pmap)
-					offset = pc[i] - pmap->pr_vaddr;
+				if (frame->pra_map)
+					offset = pc[i] - frame->pra_map->pr_vaddr;
 
 				(void) snprintf(c, sizeof(c), "%s:0x%llx",
-				    dt_basename(objname), (u_longlong_t)offset);
+				    objname, (u_longlong_t)offset);
 
 			} else
 				(void) snprintf(c, sizeof(c), "0x%llx",
 				    (u_longlong_t)pc[i]);
 
-		} else if (pid >= 0 && dt_Plookup_by_addr(dtp, pid, pc[i],
-		    name, sizeof (name), &sym) == 0) {
-			(void) dt_Pobjname(dtp, pid, pc[i], objname, sizeof (objname));
+		} else if (frame != NULL && frame->pra_name != NULL &&
+		    objname != NULL) {
+			const GElf_Sym *sym = &frame->pra_sym;
 
-			if (pc[i] > sym.st_value) {
+			if (pc[i] > sym->st_value) {
 				(void) snprintf(c, sizeof (c),
-				    "%s`%s+0x%llx", dt_basename(objname), name,
-				    (u_longlong_t)(pc[i] - sym.st_value));
+				    "%s`%s+0x%llx", objname, frame->pra_name,
+				    (u_longlong_t)(pc[i] - sym->st_value));
 			} else {
 				(void) snprintf(c, sizeof (c),
-				    "%s`%s", dt_basename(objname), name);
+				    "%s`%s", objname, frame->pra_name);
 			}
 		} else if (str != NULL && str[0] != '\0' && str[0] != '@' &&
-		    (pid >= 0 &&
-			((map = dt_Paddr_to_map(dtp, pid, pc[i])) == NULL ||
-			    (map->pr_mflags & MA_WRITE)))) {
+		    (frame != NULL &&
+			(frame->pra_map == NULL ||
+			    (frame->pra_map->pr_mflags & MA_WRITE)))) {
 			/*
 			 * If the current string pointer in the string table
 			 * does not point to an empty string _and_ the program
@@ -1207,10 +1242,9 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 			 */
 			(void) snprintf(c, sizeof (c), "%s", str);
 		} else {
-			if (pid >= 0 && dt_Pobjname(dtp, pid, pc[i], objname,
-			    sizeof (objname)) != NULL) {
+			if (objname != NULL) {
 				(void) snprintf(c, sizeof (c), "%s`0x%llx",
-				    dt_basename(objname), (u_longlong_t)pc[i]);
+				    objname, (u_longlong_t)pc[i]);
 			} else {
 				(void) snprintf(c, sizeof (c), "0x%llx",
 				    (u_longlong_t)pc[i]);
@@ -1249,8 +1283,10 @@ dt_print_ustack(dtrace_hdl_t *dtp, FILE *fp, const char *format,
 		}
 	}
 
+	dt_free(dtp, pra);
+
 	if (pid >= 0)
-		dt_proc_release_unlock(dtp, pid);
+		dt_proc_sym_release(dtp, pid);
 
 	return (err);
 }
@@ -1269,15 +1305,14 @@ dt_print_usym(dtrace_hdl_t *dtp, FILE *fp, caddr_t addr, dtrace_actkind_t act)
 	if (act == DTRACEACT_USYM && dtp->dt_vector == NULL) {
 		pid_t pid;
 
-		pid = dt_proc_grab_lock(dtp, tgid, DTRACE_PROC_WAITING |
-		    DTRACE_PROC_SHORTLIVED);
+		pid = dt_proc_sym_grab(dtp, tgid);
 		if (pid >= 0) {
 			GElf_Sym sym;
 
 			if (dt_Plookup_by_addr(dtp, pid, pc, NULL, 0, &sym) == 0)
 				pc = sym.st_value;
 
-			dt_proc_release_unlock(dtp, pid);
+			dt_proc_sym_release(dtp, pid);
 		}
 	}
 
@@ -1309,8 +1344,7 @@ dt_print_umod(dtrace_hdl_t *dtp, FILE *fp, const char *format, caddr_t addr)
 	 * printing raw addresses in the vectored case.
 	 */
 	if (dtp->dt_vector == NULL)
-		pid = dt_proc_grab_lock(dtp, tgid, DTRACE_PROC_WAITING |
-				 DTRACE_PROC_SHORTLIVED);
+		pid = dt_proc_sym_grab(dtp, tgid);
 
 	if (pid >= 0 && dt_Pobjname(dtp, pid, pc, objname,
 		sizeof (objname)) != NULL) {
@@ -1322,7 +1356,7 @@ dt_print_umod(dtrace_hdl_t *dtp, FILE *fp, const char *format, caddr_t addr)
 	err = dt_printf(dtp, fp, format, c);
 
 	if (pid >= 0)
-		dt_proc_release_unlock(dtp, pid);
+		dt_proc_sym_release(dtp, pid);
 
 	return (err);
 }
@@ -2474,8 +2508,8 @@ dt_consume_begin(dtrace_hdl_t *dtp, FILE *fp, dtrace_bufdesc_t *buf,
 	return (rval);
 }
 
-int
-dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
+static int
+dt_consume(dtrace_hdl_t *dtp, FILE *fp,
     dtrace_consume_probe_f *pf, dtrace_consume_rec_f *rf, void *arg)
 {
 	dtrace_bufdesc_t *buf = &dtp->dt_buf;
@@ -2574,3 +2608,20 @@ dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
 
 	return (dt_consume_cpu(dtp, fp, dtp->dt_endedon, buf, pf, rf, arg));
 }
+
+/*
+ * Consume all the buffers in one grab session, so that each process whose
+ * stacks or symbols are printed is grabbed once per pass, not once per record.
+ */
+int
+dtrace_consume(dtrace_hdl_t *dtp, FILE *fp,
+    dtrace_consume_probe_f *pf, dtrace_consume_rec_f *rf, void *arg)
+{
+	int rval;
+
+	dt_proc_session_begin(dtp);
+	rval = dt_consume(dtp, fp, pf, rf, arg);
+	dt_proc_session_end(dtp);
+
+	return (rval);
+}
@@ -90,6 +90,14 @@ typedef struct dt_modsym {
 	uint_t dms_next;	/* index of next element in hash chain */
 } dt_modsym_t;
 
+/*
+ * A run of consecutive lines of /proc/kallmodsyms belonging to one module.
+ */
+typedef struct dt_kernsym_span {
+	off_t dks_off;		/* offset of first line */
+	size_t dks_len;		/* length of all lines, in bytes */
+} dt_kernsym_span_t;
+
 typedef struct dt_module {
 	dt_list_t dm_list;	/* list forward/back pointers */
 	char dm_name[DTRACE_MODNAMELEN]; /* string name of module */
@@ -121,6 +129,8 @@ typedef struct dt_module {
 	 * Kernel modules only.
 	 */
 	dt_symtab_t *dm_kernsyms; /* module kernel symbol table */
+	dt_kernsym_span_t *dm_kernsym_spans; /* where its symbols are */
+	size_t dm_kernsym_nspans; /* number of entries */
 
 	/*
 	 * Userspace modules only.
@@ -147,12 +157,24 @@ typedef struct dt_kern_path {
 	char *dkp_path;		       /* full name including path */
 } dt_kern_path_t;
 
+/*
+ * An address range of a module, in the sorted table of all modules' ranges
+ * used by dtrace_lookup_by_addrs().
+ */
+typedef struct dt_modrange {
+	GElf_Addr dmr_va;	/* start of range */
+	GElf_Xword dmr_size;	/* size of range */
+	dt_module_t *dmr_module; /* module it belongs to */
+} dt_modrange_t;
+
 #define DT_DM_LOADED	0x1	/* module symbol and type data is loaded */
 #define DT_DM_KERNEL	0x2	/* module is associated with a kernel object */
 #define DT_DM_BUILTIN	0x4	/* module is linked into the core kernel */
 #define DT_DM_SHARED	0x8	/* module is linked into shared_ctf.ko */
 #define DT_DM_CTF_ARCHIVED  0x10 /* module found in a CTF archive */
 #define DT_DM_KERN_UNLOADED 0x20 /* module not loaded into the kernel */
+#define DT_DM_KERNSYMS	0x40	/* kernel symbol table has been built */
+#define DT_DM_KERNSYMS_QUEUED 0x80 /* queued for a kernel symbol table */
 
 typedef struct dt_provmod {
 	char *dp_name;				/* name of provider module */
@@ -225,11 +247,14 @@ struct dtrace_hdl {
 	dt_module_t **dt_mods;	/* hash table of dt_module_t's */
 	uint_t dt_modbuckets;	/* number of module hash buckets */
 	uint_t dt_nmods;	/* number of modules in hash and list */
+	dt_modrange_t *dt_modranges; /* sorted address ranges of all modules */
+	size_t dt_nmodranges;	/* number of entries */
 	Elf *dt_ctf_elf;	/* ELF handle to the special 'ctf' module */
 	ctf_archive_t *dt_ctfa; /* ctf archive for the entire kernel tree */
 	ctf_file_t *dt_shared_ctf; /* Handle to the shared CTF */
 	uint_t dt_ctf_elf_ref;  /* Number of references to this handle */
 	char *dt_ctfa_path;	/* path to vmlinux.ctfa */
+	int dt_ctfa_missing;	/* no usable CTF archive at dt_ctfa_path */
 	const dt_modops_t *dt_ctf_ops; /* data model's ops vector for CTF module */
 	dt_list_t dt_kernpathlist; /* linked list of dt_kern_path_t's */
 	dt_kern_path_t **dt_kernpaths; /* hash table of dt_kern_path_t's */
@@ -276,6 +301,7 @@ struct dtrace_hdl {
 	char *dt_sysslice;	/* the systemd system slice: set via -xsysslice */
 	uint_t dt_lazyload;	/* boolean:  set via -xlazyload */
 	uint_t dt_droptags;	/* boolean:  set via -xdroptags */
+	uint_t dt_usnapshot;	/* boolean:  set via -xusnapshot */
 	uint_t dt_active;	/* boolean:  set once tracing is active */
 	uint_t dt_stopped;	/* boolean:  set once tracing is stopped */
 	processorid_t dt_beganon; /* CPU that executed BEGIN probe (if any) */
@@ -299,6 +325,8 @@ struct dtrace_hdl {
 	int dt_cdefs_fd;	/* file descriptor for C CTF debugging cache */
 	int dt_ddefs_fd;	/* file descriptor for D CTF debugging cache */
 	int dt_stdout_fd;	/* file descriptor for saved stdout */
+	int dt_poll_fd;		/* epoll file descriptor for dtrace_pollfd() */
+	int dt_timer_fd;	/* timerfd for the next dtrace_work() deadline */
 	dtrace_handle_err_f *dt_errhdlr; /* error handler, if any */
 	void *dt_errarg;	/* error handler argument */
 	dtrace_prog_t *dt_errprog; /* error handler program, if any */
@@ -682,6 +710,8 @@ extern int _dtrace_intbuckets;		/* number of hash buckets for ints */
 extern uint_t _dtrace_stkindent;	/* default indent for stack/ustack */
 extern uint_t _dtrace_pidbuckets;	/* number of hash buckets for pids */
 extern uint_t _dtrace_pidlrulim;	/* number of proc handles to cache */
+extern size_t _dtrace_symcachesize;	/* memory for symbolization handles */
+extern uint_t _dtrace_pidctlthreads;	/* number of process-control threads */
 extern size_t _dtrace_bufsize;		/* default dt_buf_create() size */
 extern int _dtrace_argmax;		/* default maximum probe arguments */
 extern int _dtrace_debug_assert;	/* turn on expensive assertions */
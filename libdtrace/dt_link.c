@@ -24,6 +24,8 @@
 #include <wait.h>
 #include <assert.h>
 #include <sys/ipc.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include <dt_impl.h>
 #include <dt_provider.h>
@@ -1066,19 +1068,11 @@ dt_modtext(dtrace_hdl_t *dtp, char *p, int isenabled, GElf_Rela *rela,
 #error unknown ISA
 #endif
 
-/*PRINTFLIKE5*/
-_dt_printflike_(5,6)
-static int
-dt_link_error(dtrace_hdl_t *dtp, Elf *elf, int fd, dt_link_pair_t *bufs,
-    const char *format, ...)
+static void
+dt_link_cleanup(dtrace_hdl_t *dtp, Elf *elf, int fd, dt_link_pair_t *bufs)
 {
-	va_list ap;
 	dt_link_pair_t *pair;
 
-	va_start(ap, format);
-	dt_set_errmsg(dtp, NULL, NULL, NULL, 0, format, ap);
-	va_end(ap);
-
 	if (elf != NULL)
 		(void) elf_end(elf);
 
@@ -1091,42 +1085,337 @@ dt_link_error(dtrace_hdl_t *dtp, Elf *elf, int fd, dt_link_pair_t *bufs,
 		dt_free(dtp, pair->dlp_sym);
 		dt_free(dtp, pair);
 	}
+}
+
+/*PRINTFLIKE5*/
+_dt_printflike_(5,6)
+static int
+dt_link_error(dtrace_hdl_t *dtp, Elf *elf, int fd, dt_link_pair_t *bufs,
+    const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	dt_set_errmsg(dtp, NULL, NULL, NULL, 0, format, ap);
+	va_end(ap);
+
+	dt_link_cleanup(dtp, elf, fd, bufs);
 
 	return (dt_set_errno(dtp, EDT_COMPILER));
 }
 
+/*
+ * Object files are processed in two phases.  process_obj() rewrites each
+ * object and records the probe sites it finds; it runs in several threads at
+ * once, so it must leave the dtrace handle alone.  The sites are then defined
+ * by dt_link_obj_define(), one object at a time and in command-line order, so
+ * that the generated DOF does not depend on thread scheduling.
+ */
+typedef struct dt_link_site {
+	struct dt_link_site *dls_next;	/* next site in the same object */
+	char *dls_prov;			/* provider name */
+	char *dls_name;			/* probe name */
+	char *dls_func;			/* function containing the site */
+	char *dls_rname;		/* relocation name, or NULL */
+	uint32_t dls_off;		/* offset of the site */
+	int dls_eprobe;			/* site is an is-enabled probe */
+} dt_link_site_t;
+
+typedef struct dt_link_obj {
+	const char *dlo_obj;		/* object file name */
+	struct dt_link_obj *dlo_first;	/* first entry for the same file */
+	dt_link_site_t *dlo_sites;	/* probe sites, in relocation order */
+	dt_link_site_t **dlo_tail;	/* where to append the next site */
+	int dlo_eprobes;		/* object has is-enabled probes */
+	int dlo_err;			/* processing failed */
+	char *dlo_errmsg;		/* error message (may be NULL) */
+} dt_link_obj_t;
+
+typedef struct dt_link_work {
+	dtrace_hdl_t *dlw_hdl;		/* dtrace handle */
+	dt_link_obj_t *dlw_objs;	/* objects to process */
+	int dlw_nobjs;			/* number of objects */
+	int dlw_next;			/* next object to hand out */
+	pthread_mutex_t dlw_lock;	/* protects dlw_next */
+} dt_link_work_t;
+
+/*
+ * An object file that has been rewritten records a hash of its contents (see
+ * dt_link_obj_hash()) in a section of this name.  If the hash still matches
+ * when the object is linked again, the object is known to be unchanged since
+ * and it is only read.
+ */
+static const char DTRACE_HASHSCN[] = ".SUNW_dtrace_hash";
+
+#define	DT_LINK_FNV_BASIS	0xcbf29ce484222325ULL
+#define	DT_LINK_FNV_PRIME	0x100000001b3ULL
+
+/*PRINTFLIKE6*/
+_dt_printflike_(6,7)
+static int
+dt_link_obj_error(dtrace_hdl_t *dtp, dt_link_obj_t *dlo, Elf *elf, int fd,
+    dt_link_pair_t *bufs, const char *format, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, format);
+	len = vsnprintf(NULL, 0, format, ap);
+	va_end(ap);
+
+	if (len >= 0 && (dlo->dlo_errmsg = malloc(len + 1)) != NULL) {
+		va_start(ap, format);
+		(void) vsnprintf(dlo->dlo_errmsg, len + 1, format, ap);
+		va_end(ap);
+	}
+
+	dt_link_cleanup(dtp, elf, fd, bufs);
+	dlo->dlo_err = 1;
+
+	return (-1);
+}
+
+static int
+dt_link_site_add(dt_link_obj_t *dlo, const char *prov, const char *name,
+    const char *func, const char *rname, uint32_t off, int eprobe)
+{
+	dt_link_site_t *dls;
+	size_t plen = strlen(prov) + 1;
+	size_t nlen = strlen(name) + 1;
+	size_t flen = strlen(func) + 1;
+	size_t rlen = rname != NULL ? strlen(rname) + 1 : 0;
+	char *p;
+
+	if ((dls = malloc(sizeof (*dls) + plen + nlen + flen + rlen)) == NULL)
+		return (-1);
+
+	p = (char *)(dls + 1);
+	dls->dls_prov = memcpy(p, prov, plen);
+	p += plen;
+	dls->dls_name = strhyphenate(memcpy(p, name, nlen));
+	p += nlen;
+	dls->dls_func = memcpy(p, func, flen);
+	p += flen;
+	dls->dls_rname = rname != NULL ? memcpy(p, rname, rlen) : NULL;
+	dls->dls_off = off;
+	dls->dls_eprobe = eprobe;
+	dls->dls_next = NULL;
+
+	*dlo->dlo_tail = dls;
+	dlo->dlo_tail = &dls->dls_next;
+
+	return (0);
+}
+
+/*
+ * FNV-1a, taken a 64-bit word at a time rather than a byte at a time.
+ */
+static uint64_t
+dt_link_hash(uint64_t h, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t w;
+
+	for (; len >= sizeof (w); len -= sizeof (w), p += sizeof (w)) {
+		memcpy(&w, p, sizeof (w));
+		h ^= w;
+		h *= DT_LINK_FNV_PRIME;
+	}
+
+	while (len-- > 0) {
+		h ^= *p++;
+		h *= DT_LINK_FNV_PRIME;
+	}
+
+	return (h);
+}
+
 static int
-process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
+dt_link_hash_data(Elf *elf, size_t ndx, uint64_t *hp)
+{
+	Elf_Scn *scn;
+	Elf_Data *data;
+	GElf_Shdr shdr;
+
+	if ((scn = elf_getscn(elf, ndx)) == NULL ||
+	    gelf_getshdr(scn, &shdr) == NULL)
+		return (-1);
+
+	*hp = dt_link_hash(*hp, &ndx, sizeof (ndx));
+	*hp = dt_link_hash(*hp, &shdr.sh_type, sizeof (shdr.sh_type));
+
+	if (shdr.sh_type == SHT_NOBITS)
+		return (0);
+
+	for (data = elf_getdata(scn, NULL); data != NULL;
+	    data = elf_getdata(scn, data)) {
+		if (data->d_buf != NULL)
+			*hp = dt_link_hash(*hp, data->d_buf, data->d_size);
+	}
+
+	return (0);
+}
+
+/*
+ * Hash the parts of an object that process_obj() reads or rewrites: the symbol
+ * tables and their string tables, and the relocation sections for executable
+ * sections along with the sections themselves.  Debugging information and the
+ * like are left out, so hashing costs little next to rewriting.  The section
+ * name string table is left out too, since it has to grow to name the hash
+ * section (it may double as the symbol string table).  Data is hashed in its
+ * in-memory representation, so a hash computed just before elf_update()
+ * matches one computed after reading the file back.
+ */
+static int
+dt_link_obj_hash(Elf *elf, size_t shstrndx, uint64_t *hp)
+{
+	Elf_Scn *scn = NULL, *scn_tgt;
+	GElf_Shdr shdr, shdr_tgt;
+	uint64_t h = DT_LINK_FNV_BASIS;
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		if (gelf_getshdr(scn, &shdr) == NULL)
+			return (-1);
+
+		switch (shdr.sh_type) {
+		case SHT_SYMTAB:
+			if (dt_link_hash_data(elf, elf_ndxscn(scn), &h) != 0 ||
+			    (shdr.sh_link != shstrndx &&
+			    dt_link_hash_data(elf, shdr.sh_link, &h) != 0))
+				return (-1);
+			break;
+		case SHT_REL:
+		case SHT_RELA:
+			if ((scn_tgt = elf_getscn(elf, shdr.sh_info)) == NULL ||
+			    gelf_getshdr(scn_tgt, &shdr_tgt) == NULL)
+				return (-1);
+
+			if (!(shdr_tgt.sh_flags & SHF_EXECINSTR))
+				break;
+
+			if (dt_link_hash_data(elf, elf_ndxscn(scn), &h) != 0 ||
+			    dt_link_hash_data(elf, shdr.sh_info, &h) != 0)
+				return (-1);
+			break;
+		}
+	}
+
+	*hp = h;
+	return (0);
+}
+
+static Elf_Scn *
+dt_link_hash_scn(Elf *elf, size_t shstrndx)
+{
+	Elf_Scn *scn = NULL;
+	GElf_Shdr shdr;
+	const char *name;
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		if (gelf_getshdr(scn, &shdr) == NULL)
+			return (NULL);
+
+		name = elf_strptr(elf, shstrndx, shdr.sh_name);
+		if (name != NULL && strcmp(name, DTRACE_HASHSCN) == 0)
+			return (scn);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Add an empty hash section to an object, growing the section name string
+ * table to hold its name.  As with the symbol table, the new string table
+ * buffer is put on the bufs list to be freed once the elf handle is gone.
+ */
+static Elf_Scn *
+dt_link_hash_newscn(Elf *elf, size_t shstrndx, dt_link_pair_t **bufsp)
+{
+	Elf_Scn *scn_shstr, *scn;
+	Elf_Data *data_shstr, *data;
+	GElf_Shdr shdr_shstr, shdr;
+	dt_link_pair_t *pair;
+
+	if ((scn_shstr = elf_getscn(elf, shstrndx)) == NULL ||
+	    gelf_getshdr(scn_shstr, &shdr_shstr) == NULL ||
+	    (data_shstr = elf_getdata(scn_shstr, NULL)) == NULL)
+		return (NULL);
+
+	if ((pair = malloc(sizeof (*pair))) == NULL)
+		return (NULL);
+
+	pair->dlp_sym = NULL;
+	if ((pair->dlp_str = malloc(data_shstr->d_size +
+	    sizeof (DTRACE_HASHSCN))) == NULL) {
+		free(pair);
+		return (NULL);
+	}
+
+	pair->dlp_next = *bufsp;
+	*bufsp = pair;
+
+	if ((scn = elf_newscn(elf)) == NULL ||
+	    gelf_getshdr(scn, &shdr) == NULL ||
+	    (data = elf_newdata(scn)) == NULL)
+		return (NULL);
+
+	bcopy(data_shstr->d_buf, pair->dlp_str, data_shstr->d_size);
+	bcopy(DTRACE_HASHSCN, (char *)pair->dlp_str + data_shstr->d_size,
+	    sizeof (DTRACE_HASHSCN));
+
+	shdr.sh_name = data_shstr->d_size;
+	shdr.sh_type = SHT_PROGBITS;
+	shdr.sh_flags = SHF_EXCLUDE;
+	shdr.sh_addralign = sizeof (uint64_t);
+	shdr.sh_size = sizeof (uint64_t);
+	(void) gelf_update_shdr(scn, &shdr);
+
+	data->d_type = ELF_T_BYTE;
+	data->d_align = sizeof (uint64_t);
+	data->d_version = EV_CURRENT;
+
+	data_shstr->d_buf = pair->dlp_str;
+	data_shstr->d_size += sizeof (DTRACE_HASHSCN);
+	(void) elf_flagdata(data_shstr, ELF_C_SET, ELF_F_DIRTY);
+
+	shdr_shstr.sh_size += sizeof (DTRACE_HASHSCN);
+	(void) gelf_update_shdr(scn_shstr, &shdr_shstr);
+
+	return (scn);
+}
+
+static int
+process_obj(dtrace_hdl_t *dtp, dt_link_obj_t *dlo)
 {
 	static const char dt_prefix[] = "__dtrace";
 	static const char dt_enabled[] = "enabled";
 	static const char dt_symprefix[] = "$dtrace";
 	static const char dt_symfmt[] = "%s%d.%s";
-	int fd, i, ndx, eprobe, mod = 0;
+	const char *obj = dlo->dlo_obj;
+	int fd, i, ndx, eprobe, mod = 0, verified = 0;
 	Elf *elf = NULL;
 	GElf_Ehdr ehdr;
-	Elf_Scn *scn_rel, *scn_sym, *scn_str, *scn_tgt;
-	Elf_Data *data_rel, *data_sym, *data_str, *data_tgt;
+	Elf_Scn *scn_rel, *scn_sym, *scn_str, *scn_tgt, *scn_hash;
+	Elf_Data *data_rel, *data_sym, *data_str, *data_tgt, *data_hash;
 	GElf_Shdr shdr_rel, shdr_sym, shdr_str, shdr_tgt;
 	GElf_Sym rsym, fsym, dsym;
 	GElf_Rela rela;
 	char *s, *p, *r;
 	char pname[DTRACE_PROVNAMELEN];
-	dt_provider_t *pvp;
-	dt_probe_t *prp;
 	uint32_t off, eclass, emachine1, emachine2;
-	size_t symsize, nsym, isym, istr, len;
+	size_t symsize, nsym, isym, istr, len, shstrndx;
+	uint64_t hash;
 	key_t objkey;
 	dt_link_pair_t *pair, *bufs = NULL;
 	dt_strtab_t *strtab;
 
 	if ((fd = open64(obj, O_RDWR)) == -1) {
-		return (dt_link_error(dtp, elf, fd, bufs,
+		return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
 		    "failed to open %s: %s", obj, strerror(errno)));
 	}
 
 	if ((elf = elf_begin(fd, ELF_C_RDWR_MMAP, NULL)) == NULL) {
-		return (dt_link_error(dtp, elf, fd, bufs,
+		return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
 		    "failed to process %s: %s", obj, elf_errmsg(elf_errno())));
 	}
 
@@ -1134,17 +1423,17 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 	case ELF_K_ELF:
 		break;
 	case ELF_K_AR:
-		return (dt_link_error(dtp, elf, fd, bufs, "archives are not "
-		    "permitted; use the contents of the archive instead: %s",
-		    obj));
+		return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
+		    "archives are not permitted; use the contents of the "
+		    "archive instead: %s", obj));
 	default:
-		return (dt_link_error(dtp, elf, fd, bufs,
+		return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
 		    "invalid file type: %s", obj));
 	}
 
 	if (gelf_getehdr(elf, &ehdr) == NULL) {
-		return (dt_link_error(dtp, elf, fd, bufs, "corrupt file: %s",
-		    obj));
+		return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
+		    "corrupt file: %s", obj));
 	}
 
 	if (dtp->dt_oflags & DTRACE_O_ILP32) {
@@ -1169,12 +1458,12 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 	}
 
 	if (ehdr.e_ident[EI_CLASS] != eclass) {
-		return (dt_link_error(dtp, elf, fd, bufs,
+		return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
 		    "incorrect ELF class for object file: %s", obj));
 	}
 
 	if (ehdr.e_machine != emachine1 && ehdr.e_machine != emachine2) {
-		return (dt_link_error(dtp, elf, fd, bufs,
+		return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
 		    "incorrect ELF machine type for object file: %s", obj));
 	}
 
@@ -1184,10 +1473,32 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 	 * the same name which contain identially named local symbols.
 	 */
 	if ((objkey = ftok(obj, 0)) == (key_t)-1) {
-		return (dt_link_error(dtp, elf, fd, bufs,
+		return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
 		    "failed to generate unique key for object file: %s", obj));
 	}
 
+	if (elf_getshdrstrndx(elf, &shstrndx) == -1)
+		goto err;
+
+	/*
+	 * If we rewrote this object in an earlier link invocation and it has
+	 * not changed since, all the modifications below are in place already:
+	 * the relocations are only read to find the probe sites again, and the
+	 * file is left alone.  Otherwise the hash section is reused when the
+	 * object is rewritten.
+	 */
+	if ((scn_hash = dt_link_hash_scn(elf, shstrndx)) != NULL) {
+		if ((data_hash = elf_getdata(scn_hash, NULL)) == NULL ||
+		    dt_link_obj_hash(elf, shstrndx, &hash) != 0)
+			goto err;
+
+		verified = data_hash->d_size == sizeof (hash) &&
+		    memcmp(data_hash->d_buf, &hash, sizeof (hash)) == 0;
+		if (verified)
+			dt_dprintf("%s is unchanged since it was last "
+			    "processed\n", obj);
+	}
+
 	scn_rel = NULL;
 	while ((scn_rel = elf_nextscn(elf, scn_rel)) != NULL) {
 		if (gelf_getshdr(scn_rel, &shdr_rel) == NULL)
@@ -1255,14 +1566,16 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 		 *
 		 * We take a first pass through all the relocations to
 		 * populate our string table and count the number of extra
-		 * symbols we'll require.
+		 * symbols we'll require.  An unchanged object already has
+		 * all the aliases it needs.
 		 */
 		strtab = dt_strtab_create(1);
 		nsym = 0;
 		isym = data_sym->d_size / symsize;
 		istr = data_str->d_size;
 
-		for (i = 0; i < shdr_rel.sh_size / shdr_rel.sh_entsize; i++) {
+		for (i = 0; !verified &&
+		    i < shdr_rel.sh_size / shdr_rel.sh_entsize; i++) {
 
 			if (shdr_rel.sh_type == SHT_RELA) {
 				if (gelf_getrela(data_rel, i, &rela) == NULL)
@@ -1309,13 +1622,14 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 			 */
 			if (GELF_ST_TYPE(fsym.st_info) != STT_FUNC) {
 				dt_strtab_destroy(strtab);
-				return (dt_link_error(dtp, elf, fd, bufs,
-				    "expected %s to be of type function", s));
+				return (dt_link_obj_error(dtp, dlo, elf, fd,
+				    bufs, "expected %s to be of type function",
+				    s));
 			}
 
 			len = snprintf(NULL, 0, dt_symfmt, dt_symprefix,
 			    objkey, s) + 1;
-			if ((p = dt_alloc(dtp, len)) == NULL) {
+			if ((p = malloc(len)) == NULL) {
 				dt_strtab_destroy(strtab);
 				goto err;
 			}
@@ -1327,7 +1641,7 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 				(void) dt_strtab_insert(strtab, p);
 			}
 
-			dt_free(dtp, p);
+			free(p);
 		}
 
 		/*
@@ -1350,19 +1664,19 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 
 			dt_strtab_destroy(strtab);
 
-			if ((pair = dt_alloc(dtp, sizeof (*pair))) == NULL)
+			if ((pair = malloc(sizeof (*pair))) == NULL)
 				goto err;
 
-			if ((pair->dlp_str = dt_alloc(dtp, data_str->d_size +
+			if ((pair->dlp_str = malloc(data_str->d_size +
 			    len)) == NULL) {
-				dt_free(dtp, pair);
+				free(pair);
 				goto err;
 			}
 
-			if ((pair->dlp_sym = dt_alloc(dtp, data_sym->d_size +
+			if ((pair->dlp_sym = malloc(data_sym->d_size +
 			    nsym * symsize)) == NULL) {
-				dt_free(dtp, pair->dlp_str);
-				dt_free(dtp, pair);
+				free(pair->dlp_str);
+				free(pair);
 				goto err;
 			}
 
@@ -1429,7 +1743,7 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 			    sizeof (dt_enabled) - 1) == 0) {
 				s += sizeof (dt_enabled) - 1;
 				eprobe = 1;
-				*eprobesp = 1;
+				dlo->dlo_eprobes = 1;
 				dt_dprintf("is-enabled probe\n");
 			} else {
 				eprobe = 0;
@@ -1446,7 +1760,7 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 			bcopy(s, pname, p - s);
 			pname[p - s] = '\0';
 
-			p = strhyphenate(p + 3); /* strlen("___") */
+			p += 3; /* strlen("___") */
 
 			if (dt_elf_symtab_lookup(data_sym, isym, rela.r_offset,
 			    shdr_rel.sh_info, &fsym) != 0)
@@ -1470,6 +1784,13 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 			r = NULL;
 
 			if (GELF_ST_BIND(fsym.st_info) == STB_LOCAL) {
+				/*
+				 * Only the aliases can be found for
+				 * an object we rewrote before.
+				 */
+				if (verified)
+					goto err;
+
 				dsym = fsym;
 				dsym.st_name = istr;
 				dsym.st_info = GELF_ST_INFO(STB_GLOBAL,
@@ -1492,29 +1813,28 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 				s++;
 			}
 
-			if ((pvp = dt_provider_lookup(dtp, pname)) == NULL) {
-				return (dt_link_error(dtp, elf, fd, bufs,
-				    "no such provider %s", pname));
-			}
-
-			if ((prp = dt_probe_lookup(pvp, p)) == NULL) {
-				return (dt_link_error(dtp, elf, fd, bufs,
-				    "no such probe %s", p));
-			}
-
 			assert(fsym.st_value <= rela.r_offset);
 
+			/*
+			 * The text of an unchanged object holds the nops
+			 * already, so dt_modtext() only adjusts the offset.
+			 */
 			off = rela.r_offset - fsym.st_value;
 			if (dt_modtext(dtp, data_tgt->d_buf, eprobe,
 			    &rela, &off) != 0) {
 				goto err;
 			}
 
-			if (dt_probe_define(pvp, prp, s, r, off, eprobe) != 0) {
-				return (dt_link_error(dtp, elf, fd, bufs,
-				    "failed to allocate space for probe"));
+			if (dt_link_site_add(dlo, pname, p, s, r, off,
+			    eprobe) != 0) {
+				return (dt_link_obj_error(dtp, dlo, elf, fd,
+				    bufs, "failed to allocate space for "
+				    "probe"));
 			}
 
+			if (verified)
+				continue;
+
 			mod = 1;
 			(void) elf_flagdata(data_tgt, ELF_C_SET, ELF_F_DIRTY);
 
@@ -1550,26 +1870,247 @@ process_obj(dtrace_hdl_t *dtp, const char *obj, int *eprobesp)
 		}
 	}
 
-	if (mod && elf_update(elf, ELF_C_WRITE) == -1)
-		goto err;
+	/*
+	 * Record the hash of the rewritten object, so that the next link can
+	 * tell whether it needs rewriting again.
+	 */
+	if (mod) {
+		if (scn_hash == NULL &&
+		    (scn_hash = dt_link_hash_newscn(elf, shstrndx,
+		    &bufs)) == NULL)
+			goto err;
 
-	(void) elf_end(elf);
-	(void) close(fd);
+		if ((data_hash = elf_getdata(scn_hash, NULL)) == NULL ||
+		    dt_link_obj_hash(elf, shstrndx, &hash) != 0)
+			goto err;
 
-	while ((pair = bufs) != NULL) {
-		bufs = pair->dlp_next;
-		dt_free(dtp, pair->dlp_str);
-		dt_free(dtp, pair->dlp_sym);
-		dt_free(dtp, pair);
+		data_hash->d_buf = &hash;
+		data_hash->d_size = sizeof (hash);
+		(void) elf_flagdata(data_hash, ELF_C_SET, ELF_F_DIRTY);
+
+		if (elf_update(elf, ELF_C_WRITE) == -1)
+			goto err;
 	}
 
+	dt_link_cleanup(dtp, elf, fd, bufs);
+
 	return (0);
 
 err:
-	return (dt_link_error(dtp, elf, fd, bufs,
+	return (dt_link_obj_error(dtp, dlo, elf, fd, bufs,
 	    "an error was encountered while processing %s", obj));
 }
 
+static void *
+dt_link_worker(void *arg)
+{
+	dt_link_work_t *dlw = arg;
+	int i;
+
+	for (;;) {
+		(void) pthread_mutex_lock(&dlw->dlw_lock);
+		i = dlw->dlw_next++;
+		(void) pthread_mutex_unlock(&dlw->dlw_lock);
+
+		if (i >= dlw->dlw_nobjs)
+			break;
+
+		if (dlw->dlw_objs[i].dlo_first == NULL)
+			(void) process_obj(dlw->dlw_hdl, &dlw->dlw_objs[i]);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Define the probes found in an object.  A file named more than once was only
+ * processed for its first entry, and its sites are defined again for each of
+ * the others, as they would have been if it had been processed again.
+ */
+static int
+dt_link_obj_define(dtrace_hdl_t *dtp, dt_link_obj_t *dlo, int *eprobesp)
+{
+	dt_link_site_t *dls;
+	dt_provider_t *pvp;
+	dt_probe_t *prp;
+
+	if (dlo->dlo_first != NULL)
+		dlo = dlo->dlo_first;
+
+	if (dlo->dlo_eprobes)
+		*eprobesp = 1;
+
+	if (dlo->dlo_err) {
+		if (dlo->dlo_errmsg == NULL) {
+			return (dt_link_error(dtp, NULL, -1, NULL,
+			    "an error was encountered while processing %s",
+			    dlo->dlo_obj));
+		}
+
+		return (dt_link_error(dtp, NULL, -1, NULL, "%s",
+		    dlo->dlo_errmsg));
+	}
+
+	for (dls = dlo->dlo_sites; dls != NULL; dls = dls->dls_next) {
+		if ((pvp = dt_provider_lookup(dtp, dls->dls_prov)) == NULL) {
+			return (dt_link_error(dtp, NULL, -1, NULL,
+			    "no such provider %s", dls->dls_prov));
+		}
+
+		if ((prp = dt_probe_lookup(pvp, dls->dls_name)) == NULL) {
+			return (dt_link_error(dtp, NULL, -1, NULL,
+			    "no such probe %s", dls->dls_name));
+		}
+
+		if (dt_probe_define(pvp, prp, dls->dls_func, dls->dls_rname,
+		    dls->dls_off, dls->dls_eprobe) != 0) {
+			return (dt_link_error(dtp, NULL, -1, NULL,
+			    "failed to allocate space for probe"));
+		}
+	}
+
+	return (0);
+}
+
+typedef struct dt_link_file {
+	dev_t dlf_dev;
+	ino_t dlf_ino;
+	int dlf_ndx;
+} dt_link_file_t;
+
+static int
+dt_link_file_cmp(const void *ap, const void *bp)
+{
+	const dt_link_file_t *a = ap;
+	const dt_link_file_t *b = bp;
+
+	if (a->dlf_dev != b->dlf_dev)
+		return (a->dlf_dev < b->dlf_dev ? -1 : 1);
+	if (a->dlf_ino != b->dlf_ino)
+		return (a->dlf_ino < b->dlf_ino ? -1 : 1);
+
+	return (a->dlf_ndx - b->dlf_ndx);
+}
+
+/*
+ * Two workers must never rewrite the same file at once, whether it is named
+ * twice or reached through different links, so every entry that refers to the
+ * same file as an earlier one is pointed at that one and not processed itself.
+ * Files that cannot be stat()ed are left for process_obj() to complain about.
+ */
+static int
+dt_link_obj_dedup(dtrace_hdl_t *dtp, dt_link_obj_t *objs, int objc)
+{
+	dt_link_file_t *files;
+	struct stat64 st;
+	int i, n = 0;
+
+	if ((files = dt_alloc(dtp, objc * sizeof (dt_link_file_t))) == NULL)
+		return (-1);
+
+	for (i = 0; i < objc; i++) {
+		if (stat64(objs[i].dlo_obj, &st) != 0)
+			continue;
+
+		files[n].dlf_dev = st.st_dev;
+		files[n].dlf_ino = st.st_ino;
+		files[n].dlf_ndx = i;
+		n++;
+	}
+
+	qsort(files, n, sizeof (dt_link_file_t), dt_link_file_cmp);
+
+	for (i = 1; i < n; i++) {
+		dt_link_obj_t *prev = &objs[files[i - 1].dlf_ndx];
+
+		if (files[i].dlf_dev != files[i - 1].dlf_dev ||
+		    files[i].dlf_ino != files[i - 1].dlf_ino)
+			continue;
+
+		objs[files[i].dlf_ndx].dlo_first =
+		    prev->dlo_first != NULL ? prev->dlo_first : prev;
+	}
+
+	dt_free(dtp, files);
+
+	return (0);
+}
+
+/*
+ * Process all the object files, spreading them over one thread per online CPU
+ * (the calling thread included), and then define the probes found in them.
+ * If a thread cannot be created, the threads that exist simply process more
+ * of the objects.
+ */
+static int
+process_objs(dtrace_hdl_t *dtp, int objc, char *const objv[], int *eprobesp)
+{
+	dt_link_work_t dlw;
+	dt_link_obj_t *objs;
+	dt_link_site_t *dls;
+	pthread_t *tids;
+	long nthreads;
+	int i, n, ret = 0;
+
+	if ((objs = dt_zalloc(dtp, objc * sizeof (dt_link_obj_t))) == NULL)
+		return (-1); /* errno is set for us */
+
+	for (i = 0; i < objc; i++) {
+		objs[i].dlo_obj = objv[i];
+		objs[i].dlo_tail = &objs[i].dlo_sites;
+	}
+
+	if (dt_link_obj_dedup(dtp, objs, objc) != 0) {
+		dt_free(dtp, objs);
+		return (-1); /* errno is set for us */
+	}
+
+	if ((nthreads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		nthreads = 1;
+	if (nthreads > objc)
+		nthreads = objc;
+
+	dlw.dlw_hdl = dtp;
+	dlw.dlw_objs = objs;
+	dlw.dlw_nobjs = objc;
+	dlw.dlw_next = 0;
+	(void) pthread_mutex_init(&dlw.dlw_lock, NULL);
+
+	tids = alloca(nthreads * sizeof (pthread_t));
+	for (n = 0; n < nthreads - 1; n++) {
+		if (pthread_create(&tids[n], NULL, dt_link_worker, &dlw) != 0)
+			break;
+	}
+
+	dt_dprintf("processing %d object files in %d threads\n", objc, n + 1);
+
+	(void) dt_link_worker(&dlw);
+
+	for (i = 0; i < n; i++)
+		(void) pthread_join(tids[i], NULL);
+
+	(void) pthread_mutex_destroy(&dlw.dlw_lock);
+
+	/*
+	 * Later entries for a file use the sites of its first entry, so none
+	 * are freed until all have been defined.
+	 */
+	for (i = 0; i < objc && ret == 0; i++)
+		ret = dt_link_obj_define(dtp, &objs[i], eprobesp);
+
+	for (i = 0; i < objc; i++) {
+		while ((dls = objs[i].dlo_sites) != NULL) {
+			objs[i].dlo_sites = dls->dls_next;
+			free(dls);
+		}
+		free(objs[i].dlo_errmsg);
+	}
+
+	dt_free(dtp, objs);
+
+	return (ret);
+}
+
 int
 dtrace_program_link(dtrace_hdl_t *dtp, dtrace_prog_t *pgp, uint_t dflags,
     const char *file, int objc, char *const objv[])
@@ -1627,10 +2168,8 @@ dtrace_program_link(dtrace_hdl_t *dtp, dtrace_prog_t *pgp, uint_t dflags,
 		return (0);
 	}
 
-	for (i = 0; i < objc; i++) {
-		if (process_obj(dtp, objv[i], &eprobes) != 0)
-			return (-1); /* errno is set for us */
-	}
+	if (objc > 0 && process_objs(dtp, objc, objv, &eprobes) != 0)
+		return (-1); /* errno is set for us */
 
 	/*
 	 * If there are is-enabled probes then we need to force use of DOF
@@ -30,7 +30,8 @@
 #include <dt_string.h>
 
 #define KSYM_NAME_MAX 128		    /* from kernel/scripts/kallsyms.c */
-#define GZCHUNKSIZE (1024*512)		    /* gzip uncompression chunk size */
+#define GZCHUNKSIZE (1024*512)		    /* minimum gzip output buffer size */
+#define GZMAXRATIO 1032			    /* maximum deflate compression ratio */
 
 static void
 dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp);
@@ -261,25 +262,61 @@ dt_module_load_sect(dtrace_hdl_t *dtp, dt_module_t *dmp, ctf_sect_t *ctsp)
 	return (0);
 }
 
+/*
+ * Guess the uncompressed size of a CTF section.  gzip streams record the
+ * length of their input (modulo 2^32) in their last four bytes: zlib streams
+ * record nothing, so assume a typical compression ratio.  Either way, never
+ * guess more than deflate could possibly have compressed the data by.
+ */
+static size_t
+dt_ctf_uncompressed_size(const ctf_sect_t *ctsp)
+{
+	const unsigned char *data = ctsp->cts_data;
+	size_t max = ctsp->cts_size * GZMAXRATIO;
+	size_t size = 0;
+
+	if (ctsp->cts_size > 18 && data[0] == 0x1f && data[1] == 0x8b) {
+		const unsigned char *isize = &data[ctsp->cts_size - 4];
+
+		size = (size_t)isize[0] | ((size_t)isize[1] << 8) |
+		    ((size_t)isize[2] << 16) | ((size_t)isize[3] << 24);
+	}
+
+	if (size == 0 || size > max)
+		size = ctsp->cts_size * 4;
+
+	if (size < GZCHUNKSIZE)
+		size = GZCHUNKSIZE;
+
+	return (size);
+}
+
 /*
  * Only used for linked-in modules.  Archived modules are uncompressed
  * automatically.
+ *
+ * The output buffer is sized up front from dt_ctf_uncompressed_size() and
+ * inflated into directly, so that a well-formed gzip section is uncompressed
+ * in a single pass with no copying.  If the guess is short, the buffer is
+ * doubled.
  */
 static void *dt_ctf_uncompress(dt_module_t *dmp, ctf_sect_t *ctsp)
 {
 	z_stream s;
 	int ret;
-	unsigned char out[GZCHUNKSIZE];
-	char *output = NULL;
-	size_t out_size = 0;
+	char *output;
+	size_t out_size = dt_ctf_uncompressed_size(ctsp);
+
+	if ((output = malloc(out_size)) == NULL)
+		goto oom;
 
 	s.opaque = Z_NULL;
 	s.zalloc = Z_NULL;
 	s.zfree = Z_NULL;
 	s.avail_in = ctsp->cts_size;
 	s.next_in = (void *)ctsp->cts_data;
-	s.next_out = out;
-	s.avail_out = GZCHUNKSIZE;
+	s.next_out = (unsigned char *)output;
+	s.avail_out = out_size;
 
 	switch (inflateInit2(&s, 15 + 32)) {
 	case Z_OK: break;
@@ -288,14 +325,26 @@ static void *dt_ctf_uncompress(dt_module_t *dmp, ctf_sect_t *ctsp)
 	}
 
 	do {
-		char *new_output;
 		ret = inflate(&s, Z_NO_FLUSH);
 		switch (ret) {
 		case Z_STREAM_END:
 			break;
 		case Z_BUF_ERROR:
 		case Z_OK:
-			if (s.avail_out == GZCHUNKSIZE) {
+			if (s.avail_out == 0) {
+				char *new_output;
+
+				new_output = realloc(output, out_size * 2);
+				if (new_output == NULL) {
+					inflateEnd(&s);
+					goto oom;
+				}
+				output = new_output;
+				s.next_out = (unsigned char *)output + out_size;
+				s.avail_out = out_size;
+				out_size *= 2;
+				ret = Z_OK;
+			} else if (ret == Z_BUF_ERROR && s.total_out == 0) {
 				s.msg = "no output possible after inflate round";
 				goto zerr;
 			}
@@ -304,27 +353,26 @@ static void *dt_ctf_uncompress(dt_module_t *dmp, ctf_sect_t *ctsp)
 			inflateEnd(&s);
 			goto uncompressed;
 		case Z_MEM_ERROR:
+			inflateEnd(&s);
 			goto oom;
 		default:
 			goto zerr;
 		}
+	} while ((ret != Z_STREAM_END) && (ret != Z_BUF_ERROR));
 
-		new_output = realloc(output, out_size +
-		    (GZCHUNKSIZE - s.avail_out));
-
-		if (new_output == NULL)
-			goto oom;
-		output = new_output;
+	inflateEnd(&s);
 
-		memcpy(output + out_size, out, (GZCHUNKSIZE - s.avail_out));
-		out_size += (GZCHUNKSIZE - s.avail_out);
-		s.next_out = out;
-		s.avail_out = GZCHUNKSIZE;
+	/*
+	 * Give back whatever a short zlib stream left unused.
+	 */
+	if (s.total_out < out_size && s.total_out > 0) {
+		char *new_output = realloc(output, s.total_out);
 
-	} while ((ret != Z_STREAM_END) && (ret != Z_BUF_ERROR));
+		if (new_output != NULL)
+			output = new_output;
+	}
 
-	inflateEnd(&s);
-	ctsp->cts_size = out_size;
+	ctsp->cts_size = s.total_out;
 	ctsp->cts_data = output;
 
 	return output;
@@ -430,8 +478,8 @@ dt_module_load(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	}
 
 	/*
-	 * Nothing more to do for loaded kernel modules: we already have their
-	 * symbols loaded into the dm_kernsyms.
+	 * Nothing more to do for loaded kernel modules: their symbols are
+	 * loaded into the dm_kernsyms on demand, by dt_kern_module_symtab().
 	 */
 
 	if ((dmp->dm_flags & DT_DM_KERNEL) &&
@@ -625,6 +673,10 @@ dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp)
 
 	dt_symtab_destroy(dmp->dm_kernsyms);
 	dmp->dm_kernsyms = NULL;
+	free(dmp->dm_kernsym_spans);
+	dmp->dm_kernsym_spans = NULL;
+	dmp->dm_kernsym_nspans = 0;
+	dmp->dm_flags &= ~DT_DM_KERNSYMS;
 
 	dmp->dm_symfree = 0;
 	dmp->dm_nsymbuckets = 0;
@@ -642,6 +694,13 @@ dt_module_unload(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	dt_idhash_destroy(dmp->dm_extern);
 	dmp->dm_extern = NULL;
 
+	/*
+	 * The address ranges have gone: so has the table of all of them.
+	 */
+	free(dtp->dt_modranges);
+	dtp->dt_modranges = NULL;
+	dtp->dt_nmodranges = 0;
+
 	/*
 	 * Built-in modules may be sharing their libelf handle with other
 	 * modules, so should not close it until its refcount falls to zero.
@@ -895,9 +954,12 @@ dt_kern_module_find_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	 * Modules in the CTF archive are simpler: they just pull their CTF
 	 * straight out of dt_ctfa, as needed.
 	 *
-	 * Check for a CTF archive containing the specified module.
+	 * Check for a CTF archive containing the specified module.  The archive
+	 * is mapped, not read, by ctf_arc_open(), and each module's dictionary
+	 * is only opened out of it when that module is loaded.  If there is no
+	 * archive, do not keep looking for it every time a module is loaded.
 	 */
-	if (dtp->dt_ctfa == NULL) {
+	if (dtp->dt_ctfa == NULL && !dtp->dt_ctfa_missing) {
 		char *ctfa_name;
 		char *to;
 
@@ -936,6 +998,9 @@ dt_kern_module_find_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 			}
 		}
 
+		if (dtp->dt_ctfa == NULL)
+			dtp->dt_ctfa_missing = 1;
+
 		if (dtp->dt_ctfa_path == NULL)
 			free(ctfa_name);
 	}
@@ -1056,50 +1121,145 @@ dt_kern_module_find_ctf(dtrace_hdl_t *dtp, dt_module_t *dmp)
 	}
 }
 
+/*
+ * Parse a line of /proc/kallmodsyms.  Returns 0 on success, 1 if the line is
+ * empty, or -1 if it is malformed.  mod_name must be at least PATH_MAX bytes
+ * long, and sym_name at least KSYM_NAME_MAX.
+ */
+static int
+dt_modsym_parse(const char *line, GElf_Addr *sym_addr, GElf_Xword *sym_size,
+    char *sym_type, char *sym_name, char *mod_name)
+{
+	strcpy(mod_name, "vmlinux]");		/* note trailing ] */
+
+	if ((line[0] == '\n') || (line[0] == 0))
+		return 1;
+
+	if (sscanf(line, "%llx %llx %c %s [%s", (long long unsigned *)sym_addr,
+		(long long unsigned *)sym_size, sym_type,
+		sym_name, mod_name) < 4) {
+		dt_dprintf("malformed /proc/kallmodsyms line: %s\n", line);
+		return -1;
+	}
+
+	mod_name[strlen(mod_name)-1] = '\0';	/* chop trailing ] */
+
+	/*
+	 * Special case: rename the 'ctf' module to 'shared_ctf': the
+	 * parent-name lookup code presumes that names that appear in CTF's
+	 * parent section are the names of modules, but the ctf module's CTF
+	 * section is special-cased to contain the contents of the shared_ctf
+	 * repository, not ctf.ko's types.
+	 */
+	if (strcmp(mod_name, "ctf") == 0)
+		strcpy(mod_name, "shared_ctf");
+
+	return 0;
+}
+
+/*
+ * Some very voluminous and unuseful symbols are silently skipped, being used
+ * to update ranges but not added to the kernel symbol table.  It doesn't
+ * matter much if this net is cast too wide, since we only care if a symbol is
+ * present if control flow or data lookups might pass through it while a probe
+ * fires, and that won't happen to any of these symbols.
+ */
+static int
+dt_modsym_skip(const char *sym_name)
+{
+#define strstarts(var, x) (strncmp(var, x, strlen (x)) == 0)
+	return ((strstarts(sym_name, "__crc_")) ||
+	    (strstarts(sym_name, "__ksymtab_")) ||
+	    (strstarts(sym_name, "__kcrctab_")) ||
+	    (strstarts(sym_name, "__kstrtab_")) ||
+	    (strstarts(sym_name, "__param_")) ||
+	    (strstarts(sym_name, "__syscall_meta__")) ||
+	    (strstarts(sym_name, "__p_syscall_meta__")) ||
+	    (strstarts(sym_name, "__event_")) ||
+	    (strstarts(sym_name, "event_")) ||
+	    (strstarts(sym_name, "ftrace_event_")) ||
+	    (strstarts(sym_name, "types__")) ||
+	    (strstarts(sym_name, "args__")) ||
+	    (strstarts(sym_name, "__tracepoint_")) ||
+	    (strstarts(sym_name, "__tpstrtab_")) ||
+	    (strstarts(sym_name, "__tpstrtab__")) ||
+	    (strstarts(sym_name, "__initcall_")) ||
+	    (strstarts(sym_name, "__setup_")) ||
+	    (strstarts(sym_name, "__pci_fixup_")));
+#undef strstarts
+}
+
+/*
+ * Note that the line of /proc/kallmodsyms at the given offset belongs to this
+ * module, extending the last recorded span of lines if they are adjacent.
+ */
+static int
+dt_modsym_add_span(dt_module_t *dmp, off_t off, size_t len)
+{
+	dt_kernsym_span_t *span;
+
+	if (dmp->dm_kernsym_nspans > 0) {
+		span = &dmp->dm_kernsym_spans[dmp->dm_kernsym_nspans - 1];
+		if (span->dks_off + span->dks_len == off) {
+			span->dks_len += len;
+			return 0;
+		}
+	}
+
+	span = realloc(dmp->dm_kernsym_spans, sizeof (dt_kernsym_span_t) *
+	    (dmp->dm_kernsym_nspans + 1));
+	if (span == NULL)
+		return -1;
+
+	dmp->dm_kernsym_spans = span;
+	span += dmp->dm_kernsym_nspans++;
+	span->dks_off = off;
+	span->dks_len = len;
+
+	return 0;
+}
+
 /*
  * Update our module cache.  For each line in /proc/kallmodsyms, create or
  * populate the dt_module_t for this module (if necessary), extend its address
- * ranges as needed, and add the symbol in this line to the module's kernel
- * symbol table.
+ * ranges as needed, and note where in /proc/kallmodsyms the line was, so that
+ * the module's kernel symbol table can be built from it on demand by
+ * dt_kern_module_symtab().
  *
  * If we return non-NULL, we might have a changing /proc/kallmodsyms,
  * probably due to module unloading during read.  Perhaps this case should
  * trigger a retry.
  */
 static int
-dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
+dt_modsym_update(dtrace_hdl_t *dtp, const char *line, off_t off, size_t len)
 {
 	static int kernel_flag = 1;
 	static dt_module_t *last_dmp = NULL;
 	static int last_sym_text = -1;
 
 	GElf_Addr sym_addr;
-	long long unsigned sym_size;
+	GElf_Xword sym_size;
 	char sym_type;
 	int sym_text;
 	dt_module_t *dmp;
 	dtrace_addr_range_t *range = NULL;
 	char sym_name[KSYM_NAME_MAX];
-	char mod_name[PATH_MAX] = "vmlinux]";	/* note trailing ] */
-	int skip = 0;
+	char mod_name[PATH_MAX];
 
 	/*
 	 * Read symbol.
 	 */
 
-	if ((line[0] == '\n') || (line[0] == 0))
+	switch (dt_modsym_parse(line, &sym_addr, &sym_size, &sym_type,
+		sym_name, mod_name)) {
+	case 1:
 		return 0;
-
-	if (sscanf(line, "%llx %llx %c %s [%s", (long long unsigned *)&sym_addr,
-		(long long unsigned *)&sym_size, &sym_type,
-		sym_name, mod_name) < 4) {
-		dt_dprintf("malformed /proc/kallmodsyms line: %s\n", line);
+	case -1:
 		return EDT_CORRUPT_KALLSYMS;
 	}
 
 	sym_text = (sym_type == 't') || (sym_type == 'T')
 	     || (sym_type == 'w') || (sym_type == 'W');
-	mod_name[strlen(mod_name)-1] = '\0';	/* chop trailing ] */
 
 	/*
 	 * Symbols of "absolute" type are typically defined per CPU.  Their
@@ -1128,16 +1288,6 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 	else if (kernel_flag == 0)
 		kernel_flag = -1;
 
-	/*
-	 * Special case: rename the 'ctf' module to 'shared_ctf': the
-	 * parent-name lookup code presumes that names that appear in CTF's
-	 * parent section are the names of modules, but the ctf module's CTF
-	 * section is special-cased to contain the contents of the shared_ctf
-	 * repository, not ctf.ko's types.
-	 */
-	if (strcmp(mod_name, "ctf") == 0)
-		strcpy(mod_name, "shared_ctf");
-
 	/*
 	 * Get module.
 	 */
@@ -1156,48 +1306,11 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 	}
 
 	/*
-	 * Add the symbol to the module's kernel symbol table.
-	 *
-	 * Some very voluminous and unuseful symbols are silently skipped, being
-	 * used to update ranges but not added to the kernel symbol table.
-	 * It doesn't matter much if this net is cast too wide, since we only
-	 * care if a symbol is present if control flow or data lookups might
-	 * pass through it while a probe fires, and that won't happen to any
-	 * of these symbols.
+	 * Remember where the symbol was, for the module's kernel symbol table.
 	 */
-#define strstarts(var, x) (strncmp(var, x, strlen (x)) == 0)
-	if ((strstarts(sym_name, "__crc_")) ||
-	    (strstarts(sym_name, "__ksymtab_")) ||
-	    (strstarts(sym_name, "__kcrctab_")) ||
-	    (strstarts(sym_name, "__kstrtab_")) ||
-	    (strstarts(sym_name, "__param_")) ||
-	    (strstarts(sym_name, "__syscall_meta__")) ||
-	    (strstarts(sym_name, "__p_syscall_meta__")) ||
-	    (strstarts(sym_name, "__event_")) ||
-	    (strstarts(sym_name, "event_")) ||
-	    (strstarts(sym_name, "ftrace_event_")) ||
-	    (strstarts(sym_name, "types__")) ||
-	    (strstarts(sym_name, "args__")) ||
-	    (strstarts(sym_name, "__tracepoint_")) ||
-	    (strstarts(sym_name, "__tpstrtab_")) ||
-	    (strstarts(sym_name, "__tpstrtab__")) ||
-	    (strstarts(sym_name, "__initcall_")) ||
-	    (strstarts(sym_name, "__setup_")) ||
-	    (strstarts(sym_name, "__pci_fixup_")))
-		skip = 1;
-#undef strstarts
-
-	if (!skip) {
-		if (dmp->dm_kernsyms == NULL)
-			dmp->dm_kernsyms = dt_symtab_create();
-
-		if (dmp->dm_kernsyms == NULL)
-			return EDT_NOMEM;
-
-		if (dt_symbol_insert(dmp->dm_kernsyms, sym_name, sym_addr, sym_size,
-			sym_type_to_info(sym_type)) == NULL)
-			return EDT_NOMEM;
-	}
+	if (!dt_modsym_skip(sym_name) &&
+	    dt_modsym_add_span(dmp, off, len) != 0)
+		return EDT_NOMEM;
 
 	/*
 	 * Expand the appropriate address range for this module.
@@ -1262,6 +1375,270 @@ dt_modsym_update(dtrace_hdl_t *dtp, const char *line)
 	return 0;
 }
 
+/*
+ * Add the symbol on one line of /proc/kallmodsyms to a module's kernel symbol
+ * table.  If strict, the line is expected to belong to this module, and 1 is
+ * returned if it does not; otherwise, lines for other modules are ignored.
+ */
+static int
+dt_kern_module_symtab_add(dtrace_hdl_t *dtp, dt_module_t *dmp,
+    const char *line, int strict)
+{
+	GElf_Addr sym_addr;
+	GElf_Xword sym_size;
+	char sym_type;
+	char sym_name[KSYM_NAME_MAX];
+	char mod_name[PATH_MAX];
+
+	if (dt_modsym_parse(line, &sym_addr, &sym_size, &sym_type,
+		sym_name, mod_name) != 0 ||
+	    strcmp(mod_name, dmp->dm_name) != 0)
+		return strict;
+
+	if ((sym_type == 'a') || (sym_type == 'A') || dt_modsym_skip(sym_name))
+		return 0;
+
+	if (dt_symbol_insert(dmp->dm_kernsyms, sym_name, sym_addr, sym_size,
+		sym_type_to_info(sym_type)) == NULL)
+		return dt_set_errno(dtp, EDT_NOMEM);
+
+	return 0;
+}
+
+typedef struct dt_kernsym_pass {
+	dt_kernsym_span_t *dkp_span;	/* span of /proc/kallmodsyms */
+	dt_module_t *dkp_module;	/* module it belongs to */
+	size_t dkp_done;		/* bytes of it read so far */
+} dt_kernsym_pass_t;
+
+static int
+dt_kernsym_pass_cmp(const void *lp, const void *rp)
+{
+	const dt_kernsym_pass_t *lhs = lp;
+	const dt_kernsym_pass_t *rhs = rp;
+
+	if (lhs->dkp_span->dks_off < rhs->dkp_span->dks_off)
+		return -1;
+	if (lhs->dkp_span->dks_off > rhs->dkp_span->dks_off)
+		return 1;
+	return 0;
+}
+
+/*
+ * Build the symbol tables of several kernel modules, for those of them which
+ * do not have one yet, from the spans of /proc/kallmodsyms recorded for them
+ * by dt_modsym_update().  The dmps array is reordered.
+ *
+ * /proc/kallmodsyms is a seq_file: the kernel regenerates it from the start up
+ * to any offset sought, so it is read once, in order, up to the end of the
+ * last span wanted, and each line is kept only if it falls in one of the
+ * spans.  Callers that know of several modules they need load them together.
+ * If /proc/kallmodsyms has changed since, so that some module's spans contain
+ * other modules' symbols, those modules are rebuilt from a second pass over
+ * the whole file.
+ */
+static int
+dt_kern_module_symtabs(dtrace_hdl_t *dtp, dt_module_t **dmps, size_t ndmps)
+{
+	dt_kernsym_pass_t *pass = NULL;
+	FILE *fd = NULL;
+	char *line = NULL;
+	size_t line_n = 0;
+	size_t i, j, npass = 0, nstale = 0;
+	off_t off = 0;
+	ssize_t n;
+	int err = 0;
+
+	/*
+	 * Pick out the modules that still need a table, once each, and their
+	 * spans.
+	 */
+	for (i = 0, j = 0; i < ndmps; i++) {
+		dt_module_t *dmp = dmps[i];
+
+		if (dmp->dm_flags & (DT_DM_KERNSYMS | DT_DM_KERNSYMS_QUEUED))
+			continue;
+
+		if (dmp->dm_kernsym_nspans == 0) {
+			dmp->dm_flags |= DT_DM_KERNSYMS;
+			continue;
+		}
+
+		dmp->dm_flags |= DT_DM_KERNSYMS_QUEUED;
+		dmps[j++] = dmp;
+		npass += dmp->dm_kernsym_nspans;
+	}
+	ndmps = j;
+
+	if (ndmps == 0)
+		return 0;
+
+	if ((pass = dt_zalloc(dtp, npass * sizeof (dt_kernsym_pass_t))) == NULL) {
+		err = -1; /* dt_errno is set for us */
+		goto out;
+	}
+
+	dt_dprintf("reading /proc/kallmodsyms for %zu modules\n", ndmps);
+
+	for (i = 0, npass = 0; i < ndmps; i++) {
+		dt_module_t *dmp = dmps[i];
+
+		for (j = 0; j < dmp->dm_kernsym_nspans; j++, npass++) {
+			pass[npass].dkp_span = &dmp->dm_kernsym_spans[j];
+			pass[npass].dkp_module = dmp;
+		}
+
+		if ((dmp->dm_kernsyms = dt_symtab_create()) == NULL) {
+			err = dt_set_errno(dtp, EDT_NOMEM);
+			goto out;
+		}
+	}
+
+	qsort(pass, npass, sizeof (dt_kernsym_pass_t), dt_kernsym_pass_cmp);
+
+	if ((fd = fopen("/proc/kallmodsyms", "r")) == NULL) {
+		err = dt_set_errno(dtp, EDT_NOSYMADDR);
+		goto out;
+	}
+
+	/*
+	 * A line that belongs to some other module, or a span that does not
+	 * start and end on line boundaries, means the file has changed: note
+	 * the module as stale by clearing its table, and carry on.
+	 */
+	for (i = 0; i < npass && (n = getline(&line, &line_n, fd)) > 0;
+	    off += n) {
+		dt_kernsym_span_t *span;
+		dt_module_t *dmp;
+
+		while (i < npass && pass[i].dkp_span->dks_off +
+		    pass[i].dkp_span->dks_len <= off)
+			i++;
+
+		if (i == npass || off < pass[i].dkp_span->dks_off)
+			continue;
+
+		span = pass[i].dkp_span;
+		dmp = pass[i].dkp_module;
+		pass[i].dkp_done += n;
+
+		if (dmp->dm_kernsyms == NULL)
+			continue;
+
+		err = dt_kern_module_symtab_add(dtp, dmp, line, 1);
+		if (err < 0)
+			goto out;
+
+		if (err > 0 || off + n > span->dks_off + span->dks_len) {
+			dt_symtab_destroy(dmp->dm_kernsyms);
+			dmp->dm_kernsyms = NULL;
+			err = 0;
+		}
+	}
+
+	for (i = 0; i < npass; i++) {
+		dt_module_t *dmp = pass[i].dkp_module;
+
+		if (pass[i].dkp_done != pass[i].dkp_span->dks_len &&
+		    dmp->dm_kernsyms != NULL) {
+			dt_symtab_destroy(dmp->dm_kernsyms);
+			dmp->dm_kernsyms = NULL;
+		}
+	}
+
+	for (i = 0; i < ndmps; i++) {
+		dt_module_t *dmp = dmps[i];
+
+		if (dmp->dm_kernsyms != NULL)
+			continue;
+
+		dt_dprintf("/proc/kallmodsyms changed: rescanning for "
+		    "symbols of module %s\n", dmp->dm_name);
+
+		if ((dmp->dm_kernsyms = dt_symtab_create()) == NULL) {
+			err = dt_set_errno(dtp, EDT_NOMEM);
+			goto out;
+		}
+		dmps[i] = dmps[nstale];
+		dmps[nstale++] = dmp;
+	}
+
+	if (nstale > 0) {
+		rewind(fd);
+		while (err == 0 && getline(&line, &line_n, fd) > 0) {
+			for (i = 0; i < nstale && err == 0; i++)
+				err = dt_kern_module_symtab_add(dtp, dmps[i],
+				    line, 0);
+		}
+	}
+
+out:
+	free(line);
+	if (fd != NULL)
+		fclose(fd);
+
+	for (i = 0; i < ndmps; i++) {
+		dt_module_t *dmp = dmps[i];
+
+		dmp->dm_flags &= ~DT_DM_KERNSYMS_QUEUED;
+		if (err != 0) {
+			dt_symtab_destroy(dmp->dm_kernsyms);
+			dmp->dm_kernsyms = NULL;
+			continue;
+		}
+
+		dt_symtab_sort(dmp->dm_kernsyms);
+		dt_symtab_purge(dmp->dm_kernsyms);
+		dt_symtab_pack(dmp->dm_kernsyms);
+		dmp->dm_flags |= DT_DM_KERNSYMS;
+	}
+
+	dt_free(dtp, pass);
+	return err;
+}
+
+/*
+ * Build a kernel module's symbol table, the first time a symbol lookup lands
+ * in it.
+ */
+static int
+dt_kern_module_symtab(dtrace_hdl_t *dtp, dt_module_t *dmp)
+{
+	if (dmp->dm_flags & DT_DM_KERNSYMS)
+		return 0;
+
+	return dt_kern_module_symtabs(dtp, &dmp, 1);
+}
+
+/*
+ * Build the symbol tables of the first n modules of the module list starting
+ * at dmp that are loaded kernel modules matching mask and bits, all at once.
+ * This is only an optimization: failures are left to dt_kern_module_symtab().
+ */
+static void
+dt_kern_module_symtabs_from(dtrace_hdl_t *dtp, dt_module_t *dmp, uint_t n,
+    uint_t mask, uint_t bits)
+{
+	dt_module_t **kmods;
+	size_t nkmods = 0;
+
+	if ((kmods = dt_alloc(dtp, n * sizeof (dt_module_t *))) == NULL)
+		return;
+
+	for (; n > 0; n--, dmp = dt_list_next(dmp)) {
+		if ((dmp->dm_flags & mask) != bits ||
+		    !(dmp->dm_flags & DT_DM_KERNEL) ||
+		    (dmp->dm_flags & (DT_DM_KERN_UNLOADED | DT_DM_KERNSYMS)))
+			continue;
+
+		if (dt_module_load(dtp, dmp) == 0)
+			kmods[nkmods++] = dmp;
+	}
+
+	dt_kern_module_symtabs(dtp, kmods, nkmods);
+	dt_free(dtp, kmods);
+}
+
 /*
  * Unload all the loaded modules and then refresh the module cache with the
  * latest list of loaded modules and their address ranges.
@@ -1284,28 +1661,20 @@ dtrace_update(dtrace_hdl_t *dtp)
 	if ((fd = fopen("/proc/kallmodsyms", "r")) != NULL) {
 		char *line = NULL;
 		size_t line_n = 0;
-		while ((getline(&line, &line_n, fd)) > 0)
-			if (dt_modsym_update(dtp, line) != 0) {
+		off_t off = 0;
+		ssize_t n;
+
+		while ((n = getline(&line, &line_n, fd)) > 0) {
+			if (dt_modsym_update(dtp, line, off, n) != 0) {
 				/* TODO: waiting on a warning infrastructure */
 				dt_dprintf("warning: module CTF loading "
 				    "failed on kallmodsyms line %s\n", line);
 				break; /* no hope of (much) CTF */
 			}
+			off += n;
+		}
 		free(line);
 		fclose(fd);
-
-		/*
-		 * Work over all modules, now they are fully populated.
-		 */
-
-		for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
-		    dmp = dt_list_next(dmp)) {
-			if (dmp->dm_kernsyms != NULL) {
-				dt_symtab_sort(dmp->dm_kernsyms);
-				dt_symtab_purge(dmp->dm_kernsyms);
-				dt_symtab_pack(dmp->dm_kernsyms);
-			}
-		}
 	} else {
 		/* TODO: waiting on a warning infrastructure */
 		dt_dprintf("warning: /proc/kallmodsyms is not "
@@ -1408,7 +1777,7 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 {
 	dt_module_t *dmp;
 	dt_ident_t *idp;
-	uint_t n;
+	uint_t n, nkmods = 0;
 	GElf_Sym sym;
 
 	uint_t mask = 0; /* mask of dt_module flags to match */
@@ -1448,6 +1817,19 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 		    (!(dmp->dm_flags & DT_DM_KERN_UNLOADED))) {
 			dt_symbol_t *dt_symp;
 
+			/*
+			 * A name not found in the first kernel module needing
+			 * a symbol table is likely to be looked for in many:
+			 * build the tables of all the rest in one read of
+			 * /proc/kallmodsyms.
+			 */
+			if (!(dmp->dm_flags & DT_DM_KERNSYMS) && nkmods++ == 1)
+				dt_kern_module_symtabs_from(dtp, dmp, n,
+				    mask, bits);
+
+			if (dt_kern_module_symtab(dtp, dmp) != 0)
+				continue;
+
 			if (!dmp->dm_kernsyms)
 				continue;
 
@@ -1461,7 +1843,7 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 				sip->dts_name = dt_symbol_name(dmp->dm_kernsyms, dt_symp);
 				sip->dts_id = 0;	/* undefined */
 			}
-			dt_symbol_to_elfsym(dtp, dt_symp, symp);
+			dt_symbol_to_elfsym(dtp, dmp->dm_kernsyms, dt_symp, symp);
 
 			return (0);
 		} else {
@@ -1504,6 +1886,69 @@ dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object, const char *name,
 	return (dt_set_errno(dtp, EDT_NOSYM));
 }
 
+/*
+ * Look up a symbol by address in a module already known to contain it.
+ */
+static int
+dt_module_lookup_by_addr(dtrace_hdl_t *dtp, dt_module_t *dmp, GElf_Addr addr,
+    GElf_Sym *symp, dtrace_syminfo_t *sip)
+{
+	uint_t id;
+
+	if (dt_module_load(dtp, dmp) == -1)
+		return (-1); /* dt_errno is set for us */
+
+	if (dmp->dm_flags & DT_DM_KERNEL) {
+		dt_symbol_t *dt_symp;
+
+		if (dt_kern_module_symtab(dtp, dmp) != 0)
+			return (-1); /* dt_errno is set for us */
+
+		/*
+		 * This is probably a non-loaded kernel module.  Looking
+		 * anything up by address in this case is hopeless.
+		 */
+		if (!dmp->dm_kernsyms)
+			return (dt_set_errno(dtp, EDT_NOSYMADDR));
+
+		dt_symp = dt_symbol_by_addr(dmp->dm_kernsyms, addr);
+
+		if (!dt_symp)
+			return (dt_set_errno(dtp, EDT_NOSYMADDR));
+
+		if (sip != NULL) {
+		    sip->dts_object = dmp->dm_name;
+		    sip->dts_name = dt_symbol_name(dmp->dm_kernsyms, dt_symp);
+		    sip->dts_id = 0;	/* undefined */
+		}
+
+		if (symp != NULL)
+		    dt_symbol_to_elfsym(dtp, dmp->dm_kernsyms, dt_symp, symp);
+
+		return (0);
+	} else {
+		if (symp != NULL) {
+			if (dmp->dm_ops->do_symaddr(dmp, addr, symp, &id) == NULL)
+				return (dt_set_errno(dtp, EDT_NOSYMADDR));
+		}
+
+		if (sip != NULL) {
+			sip->dts_object = dmp->dm_name;
+
+			if (symp != NULL) {
+				sip->dts_name = (const char *)
+				    dmp->dm_strtab.cts_data + symp->st_name;
+				sip->dts_id = id;
+			} else {
+				sip->dts_name = NULL;
+				sip->dts_id = 0;
+			}
+		}
+	}
+
+	return (0);
+}
+
 /*
  * Exported interface to look up a symbol by address.  We return the (possibly
  * partial) GElf_Sym and complete symbol information for the matching symbol.
@@ -1518,7 +1963,6 @@ dtrace_lookup_by_addr(dtrace_hdl_t *dtp, GElf_Addr addr,
     GElf_Sym *symp, dtrace_syminfo_t *sip)
 {
 	dt_module_t *dmp;
-	uint_t id;
 	const dtrace_vector_t *v = dtp->dt_vector;
 
 	if (v != NULL)
@@ -1546,55 +1990,252 @@ dtrace_lookup_by_addr(dtrace_hdl_t *dtp, GElf_Addr addr,
 		return (dt_set_errno(dtp, EDT_NOSYMADDR));
 	}
 
-	if (dt_module_load(dtp, dmp) == -1)
-		return (-1); /* dt_errno is set for us */
+	return (dt_module_lookup_by_addr(dtp, dmp, addr, symp, sip));
+}
 
-	if (dmp->dm_flags & DT_DM_KERNEL) {
-		dt_symbol_t *dt_symp;
+static int
+dt_modrange_cmp(const void *lp, const void *rp)
+{
+	const dt_modrange_t *lhs = lp;
+	const dt_modrange_t *rhs = rp;
 
-		/*
-		 * This is probably a non-loaded kernel module.  Looking
-		 * anything up by address in this case is hopeless.
-		 */
-		if (!dmp->dm_kernsyms)
-			return (dt_set_errno(dtp, EDT_NOSYMADDR));
+	if (lhs->dmr_va < rhs->dmr_va)
+		return -1;
+	if (lhs->dmr_va > rhs->dmr_va)
+		return 1;
+	return 0;
+}
 
-		dt_symp = dt_symbol_by_addr(dmp->dm_kernsyms, addr);
+static int
+dt_modrange_search_cmp(const void *addr_, const void *range_)
+{
+	const GElf_Addr *addr = addr_;
+	const dt_modrange_t *range = range_;
 
-		if (!dt_symp)
-			return (dt_set_errno(dtp, EDT_NOSYMADDR));
+	if (*addr < range->dmr_va)
+		return -1;
+	if (*addr >= range->dmr_va + range->dmr_size)
+		return 1;
+	return 0;
+}
 
-		if (sip != NULL) {
-		    sip->dts_object = dmp->dm_name;
-		    sip->dts_name = dt_symbol_name(dmp->dm_kernsyms, dt_symp);
-		    sip->dts_id = 0;	/* undefined */
+/*
+ * Build the sorted table of the text and data ranges of all modules, if it is
+ * not already built.  It is thrown away whenever any module is unloaded.
+ */
+static int
+dt_modranges_build(dtrace_hdl_t *dtp)
+{
+	dt_module_t *dmp;
+	dt_modrange_t *dmrp;
+	size_t i, n = 0;
+
+	if (dtp->dt_modranges != NULL)
+		return 0;
+
+	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+	    dmp = dt_list_next(dmp))
+		n += dmp->dm_text_addrs_size + dmp->dm_data_addrs_size;
+
+	if (n == 0)
+		return 0;
+
+	if ((dmrp = dt_alloc(dtp, n * sizeof (dt_modrange_t))) == NULL)
+		return -1;
+
+	dtp->dt_modranges = dmrp;
+	dtp->dt_nmodranges = n;
+
+	for (dmp = dt_list_next(&dtp->dt_modlist); dmp != NULL;
+	    dmp = dt_list_next(dmp)) {
+		for (i = 0; i < dmp->dm_text_addrs_size; i++, dmrp++) {
+			dmrp->dmr_va = dmp->dm_text_addrs[i].dar_va;
+			dmrp->dmr_size = dmp->dm_text_addrs[i].dar_size;
+			dmrp->dmr_module = dmp;
+		}
+		for (i = 0; i < dmp->dm_data_addrs_size; i++, dmrp++) {
+			dmrp->dmr_va = dmp->dm_data_addrs[i].dar_va;
+			dmrp->dmr_size = dmp->dm_data_addrs[i].dar_size;
+			dmrp->dmr_module = dmp;
 		}
+	}
 
-		if (symp != NULL)
-		    dt_symbol_to_elfsym(dtp, dt_symp, symp);
+	qsort(dtp->dt_modranges, n, sizeof (dt_modrange_t), dt_modrange_cmp);
+
+	return 0;
+}
+
+static int
+dt_addr_sort_cmp(const void *lp, const void *rp, void *arg)
+{
+	const GElf_Addr *addrs = arg;
+	GElf_Addr lhs = addrs[*(const size_t *)lp];
+	GElf_Addr rhs = addrs[*(const size_t *)rp];
+
+	if (lhs < rhs)
+		return -1;
+	if (lhs > rhs)
+		return 1;
+	return 0;
+}
+
+/*
+ * Exported interface to look up many symbols by address at once, as when
+ * printing a stack.  This is equivalent to calling dtrace_lookup_by_addr()
+ * for each address, and then calling it again with a NULL symp for those
+ * addresses it fails on, to find their module.
+ *
+ * For each address, sips[i].dts_object is set to the name of the containing
+ * module, or NULL if there is none, and sips[i].dts_name to the name of the
+ * containing symbol, or NULL if there is none.  If syms is non-NULL, syms[i]
+ * is filled out for every address with a symbol.  The addresses are processed
+ * in sorted order, so that each module's range and symbol table are located
+ * once for each run of addresses within it: results are nonetheless returned
+ * in the order of the addresses passed in.
+ *
+ * Returns the number of addresses resolved to symbols, or -1 on error.
+ */
+int
+dtrace_lookup_by_addrs(dtrace_hdl_t *dtp, const GElf_Addr *addrs,
+    size_t naddrs, GElf_Sym *syms, dtrace_syminfo_t *sips)
+{
+	const dt_modrange_t *dmrp = NULL;
+	dt_module_t *dmp;
+	dt_module_t **kmods;
+	size_t *order;
+	size_t i, n, nkmods = 0;
+	GElf_Sym sym;
+	int found = 0;
 
+	if (naddrs == 0)
 		return (0);
-	} else {
-		if (symp != NULL) {
-			if (dmp->dm_ops->do_symaddr(dmp, addr, symp, &id) == NULL)
-				return (dt_set_errno(dtp, EDT_NOSYMADDR));
+
+	if (dtp->dt_vector != NULL) {
+		for (i = 0; i < naddrs; i++) {
+			GElf_Sym *symp = syms != NULL ? &syms[i] : &sym;
+
+			if (dtrace_lookup_by_addr(dtp, addrs[i], symp,
+				&sips[i]) == 0)
+				found++;
+			else if (dtrace_lookup_by_addr(dtp, addrs[i], NULL,
+				&sips[i]) == 0)
+				sips[i].dts_name = NULL;
+			else
+				sips[i].dts_object = sips[i].dts_name = NULL;
 		}
+		return (found);
+	}
 
-		if (sip != NULL) {
-			sip->dts_object = dmp->dm_name;
+	if (dt_modranges_build(dtp) != 0)
+		return (-1); /* dt_errno is set for us */
 
-			if (symp != NULL) {
-				sip->dts_name = (const char *)
-				    dmp->dm_strtab.cts_data + symp->st_name;
-				sip->dts_id = id;
-			} else {
-				sip->dts_name = NULL;
-				sip->dts_id = 0;
+	if ((order = dt_alloc(dtp, naddrs * sizeof (size_t))) == NULL)
+		return (-1); /* dt_errno is set for us */
+
+	for (i = 0; i < naddrs; i++) {
+		order[i] = i;
+		sips[i].dts_object = NULL;
+		sips[i].dts_name = NULL;
+		sips[i].dts_id = 0;
+	}
+
+	qsort_r(order, naddrs, sizeof (size_t), dt_addr_sort_cmp,
+	    (void *) addrs);
+
+	/*
+	 * Build the symbol tables of all the kernel modules the addresses fall
+	 * in with one read of /proc/kallmodsyms, rather than one each.  This
+	 * is only an optimization: failures are left to the lookups below.
+	 */
+	if ((kmods = dt_alloc(dtp, naddrs * sizeof (dt_module_t *))) != NULL) {
+		for (i = 0; i < naddrs; i++) {
+			GElf_Addr addr = addrs[order[i]];
+
+			if (dmrp != NULL &&
+			    dt_modrange_search_cmp(&addr, dmrp) == 0)
+				continue;
+
+			dmrp = bsearch(&addr, dtp->dt_modranges,
+			    dtp->dt_nmodranges, sizeof (dt_modrange_t),
+			    dt_modrange_search_cmp);
+
+			if (dmrp == NULL)
+				continue;
+
+			/*
+			 * vmlinux's ranges interleave with those of built-in
+			 * modules, so it may come up again: repeats are
+			 * skipped by dt_kern_module_symtabs().
+			 */
+			dmp = dmrp->dmr_module;
+			if ((dmp->dm_flags & DT_DM_KERNEL) &&
+			    !(dmp->dm_flags & DT_DM_KERNSYMS))
+				kmods[nkmods++] = dmp;
+		}
+
+		for (i = 0, n = 0; i < nkmods; i++) {
+			if (dt_module_load(dtp, kmods[i]) == 0)
+				kmods[n++] = kmods[i];
+		}
+
+		dt_kern_module_symtabs(dtp, kmods, n);
+		dt_free(dtp, kmods);
+		dmrp = NULL;
+	}
+
+	for (i = 0; i < naddrs; i++) {
+		size_t j = order[i];
+		GElf_Addr addr = addrs[j];
+		GElf_Sym *symp = syms != NULL ? &syms[j] : &sym;
+		dtrace_syminfo_t *sip = &sips[j];
+
+		/*
+		 * Duplicate addresses (recursion, mostly) need no new lookup.
+		 */
+		if (i > 0 && addrs[order[i - 1]] == addr) {
+			size_t prev = order[i - 1];
+
+			*sip = sips[prev];
+			if (sip->dts_name != NULL) {
+				if (syms != NULL)
+					syms[j] = syms[prev];
+				found++;
+			}
+			continue;
+		}
+
+		if (dmrp == NULL || dt_modrange_search_cmp(&addr, dmrp) != 0) {
+			if (dt_modranges_build(dtp) != 0) {
+				found = -1; /* dt_errno is set for us */
+				break;
 			}
+
+			dmrp = bsearch(&addr, dtp->dt_modranges,
+			    dtp->dt_nmodranges, sizeof (dt_modrange_t),
+			    dt_modrange_search_cmp);
+		}
+
+		if (dmrp == NULL)
+			continue;
+
+		dmp = dmrp->dmr_module;
+		if (dt_module_lookup_by_addr(dtp, dmp, addr, symp, sip) == 0)
+			found++;
+		else {
+			sip->dts_object = dmp->dm_name;
+			sip->dts_name = NULL;
 		}
+
+		/*
+		 * A module that failed to load is unloaded again, throwing
+		 * the range table away.
+		 */
+		if (dtp->dt_modranges == NULL)
+			dmrp = NULL;
 	}
 
-	return (0);
+	dt_free(dtp, order);
+	return (found);
 }
 
 int
@@ -656,6 +656,9 @@ uint_t _dtrace_strsize = 256;	/* default size of string intrinsic type */
 uint_t _dtrace_stkindent = 14;	/* default whitespace indent for stack/ustack */
 uint_t _dtrace_pidbuckets = 64; /* default number of pid hash buckets */
 uint_t _dtrace_pidlrulim = 8;	/* default number of pid handles to cache */
+size_t _dtrace_symcachesize = 64 * 1024 * 1024; /* default memory for
+						  symbolization handles */
+uint_t _dtrace_pidctlthreads = 4; /* default number of process-control threads */
 size_t _dtrace_bufsize = 512;	/* default dt_buf_create() size */
 int _dtrace_argmax = 32;	/* default maximum number of probe arguments */
 
@@ -887,6 +890,8 @@ alloc:
 	dtp->dt_cdefs_fd = -1;
 	dtp->dt_ddefs_fd = -1;
 	dtp->dt_stdout_fd = -1;
+	dtp->dt_poll_fd = -1;
+	dtp->dt_timer_fd = -1;
 	dtp->dt_modbuckets = _dtrace_strbuckets;
 	dtp->dt_mods = calloc(dtp->dt_modbuckets, sizeof (dt_module_t *));
 	dtp->dt_kernpathbuckets = _dtrace_strbuckets;
@@ -1352,6 +1357,10 @@ dtrace_close(dtrace_hdl_t *dtp)
 		(void) close(dtp->dt_ddefs_fd);
 	if (dtp->dt_stdout_fd != -1)
 		(void) close(dtp->dt_stdout_fd);
+	if (dtp->dt_poll_fd != -1)
+		(void) close(dtp->dt_poll_fd);
+	if (dtp->dt_timer_fd != -1)
+		(void) close(dtp->dt_timer_fd);
 
 	dt_epid_destroy(dtp);
 	dt_aggid_destroy(dtp);
@@ -317,6 +317,7 @@ dt_opt_ctfa_path(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 
 	free(dtp->dt_ctfa_path);
 	dtp->dt_ctfa_path = ctfa;
+	dtp->dt_ctfa_missing = 0;
 
 	return (0);
 }
@@ -555,6 +556,15 @@ dt_opt_useruid(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_usnapshot(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	dtp->dt_usnapshot = 1;
+
+	return (0);
+}
+
 /*ARGSUSED*/
 static int
 dt_opt_xlate(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
@@ -737,6 +747,38 @@ dt_opt_size(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 	return (0);
 }
 
+/*ARGSUSED*/
+static int
+dt_opt_symcachesize(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	dtrace_optval_t val;
+
+	if (arg == NULL || dt_optval_parse(arg, &val) != 0)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	dtp->dt_procs->dph_symsizelim = val;
+	return (0);
+}
+
+/*ARGSUSED*/
+static int
+dt_opt_procmon(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
+{
+	if (arg == NULL)
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	if (strcmp(arg, "auto") == 0)
+		dtp->dt_procs->dph_procmon = DT_PROC_MON_AUTO;
+	else if (strcmp(arg, "waitfd") == 0)
+		dtp->dt_procs->dph_procmon = DT_PROC_MON_WAITFD;
+	else if (strcmp(arg, "pidfd") == 0)
+		dtp->dt_procs->dph_procmon = DT_PROC_MON_PIDFD;
+	else
+		return (dt_set_errno(dtp, EDT_BADOPTVAL));
+
+	return (0);
+}
+
 static int
 dt_opt_pcapsize(dtrace_hdl_t *dtp, const char *arg, uintptr_t option)
 {
@@ -1055,9 +1097,11 @@ static const dt_option_t _dtrace_ctoptions[] = {
 	{ "pgmax", dt_opt_pgmax },
 	{ "preallocate", dt_opt_preallocate },
 	{ "procfspath", dt_opt_procfs_path },
+	{ "procmon", dt_opt_procmon },
 	{ "pspec", dt_opt_cflags, DTRACE_C_PSPEC },
 	{ "stdc", dt_opt_stdc },
 	{ "strip", dt_opt_dflags, DTRACE_D_STRIP },
+	{ "symcachesize", dt_opt_symcachesize },
 	{ "syslibdir", dt_opt_syslibdir },
 	{ "sysslice", dt_opt_sysslice },
 	{ "tree", dt_opt_tree },
@@ -1066,6 +1110,7 @@ static const dt_option_t _dtrace_ctoptions[] = {
 	{ "undef", dt_opt_cpp_opts, (uintptr_t)"-U" },
 	{ "unodefs", dt_opt_cflags, DTRACE_C_UNODEF },
 	{ "useruid", dt_opt_useruid },
+	{ "usnapshot", dt_opt_usnapshot },
 	{ "verbose", dt_opt_cflags, DTRACE_C_DIFV },
 	{ "version", dt_opt_version },
 	{ "zdefs", dt_opt_cflags, DTRACE_C_ZDEFS },
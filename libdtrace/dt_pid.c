@@ -24,6 +24,20 @@
 #include <dt_pid.h>
 #include <dt_string.h>
 
+/*
+ * Functions matching a pid probe description are collected from the symbol
+ * table of each module first, and only then are probes created in them, in
+ * batches of DT_PID_BATCH probe specs.  A progress report is logged every
+ * DT_PID_PROGRESS functions, since a big C++ program has hundreds of thousands.
+ */
+#define	DT_PID_BATCH	256
+#define	DT_PID_PROGRESS	10000
+
+typedef struct dt_pid_match {
+	GElf_Sym dpm_sym;		/* matching function */
+	size_t dpm_name;		/* offset of its name in dpp_names */
+} dt_pid_match_t;
+
 typedef struct dt_pid_probe {
 	dtrace_hdl_t *dpp_dtp;
 	dt_pcb_t *dpp_pcb;
@@ -31,6 +45,8 @@ typedef struct dt_pid_probe {
 	struct ps_prochandle *dpp_pr;
 	const char *dpp_mod;
 	char *dpp_func;
+	dt_glob_t dpp_modglob;
+	dt_glob_t dpp_funcglob;
 	const char *dpp_name;
 	const char *dpp_obj;
 	uintptr_t dpp_pc;
@@ -40,6 +56,12 @@ typedef struct dt_pid_probe {
 	uint64_t dpp_stret[4];
 	GElf_Sym dpp_last;
 	uint_t dpp_last_taken;
+	dt_pid_match_t *dpp_matches;
+	uint_t dpp_nmatched;
+	uint_t dpp_matchsz;
+	char *dpp_names;
+	size_t dpp_nameslen;
+	size_t dpp_namesz;
 } dt_pid_probe_t;
 
 /*
@@ -102,6 +124,15 @@ dt_pid_create_fbt_probe(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	return (1);
 }
 
+/*
+ * Offset probes are handed to fasttrap as the function's address and size and
+ * the offset glob itself: fasttrap decodes the function's instructions and
+ * places a probe at each boundary the glob matches (or rejects an offset that
+ * is not a boundary).  So there is no instruction-offset analysis in here to
+ * cache.  What we do per function, finding it in the symbol table, is already
+ * shared between every process mapping the same file (see file_syms_t in
+ * libproc).
+ */
 static int
 dt_pid_create_glob_offset_probes(struct ps_prochandle *P, dtrace_hdl_t *dtp,
     fasttrap_probe_spec_t *ftp, const GElf_Sym *symp, const char *pattern)
@@ -122,47 +153,31 @@ dt_pid_create_glob_offset_probes(struct ps_prochandle *P, dtrace_hdl_t *dtp,
 	return (1);
 }
 
+/*
+ * Create the probes in one function, given a probe spec with its pid, module
+ * and function already filled in.
+ */
 static int
-dt_pid_per_sym(dt_pid_probe_t *pp, const GElf_Sym *symp, const char *func)
+dt_pid_per_sym(dt_pid_probe_t *pp, fasttrap_probe_spec_t *ftp,
+    const GElf_Sym *symp, const char *func)
 {
 	dtrace_hdl_t *dtp = pp->dpp_dtp;
 	dt_pcb_t *pcb = pp->dpp_pcb;
 	dt_proc_t *dpr = pp->dpp_dpr;
-	fasttrap_probe_spec_t *ftp;
 	uint64_t off;
 	char *end;
 	uint_t nmatches = 0;
-	ulong_t sz;
 	int glob;
 	int isdash = strcmp("-", func) == 0;
-	pid_t pid;
 
-	/*
-	 * We can just use the P member directly, since the PID does not change
-	 * under exec().
-	 */
-	pid = Pgetpid(pp->dpp_pr);
-
-	dt_dprintf("creating probe pid%d:%s:%s:%s at %lx\n", (int)pid,
-	    pp->dpp_obj, func, pp->dpp_name, symp->st_value);
-
-	sz = sizeof (fasttrap_probe_spec_t) + strlen(pp->dpp_name);
-
-	if ((ftp = dt_zalloc(dtp, sz)) == NULL) {
-		dt_dprintf("proc_per_sym: dt_alloc(%lu) failed\n", sz);
-		return (1); /* errno is set for us */
-	}
-
-	ftp->ftps_pid = pid;
-	(void) strncpy(ftp->ftps_func, func, sizeof (ftp->ftps_func));
-
-	dt_pid_objname(ftp->ftps_mod, sizeof (ftp->ftps_mod), pp->dpp_lmid,
-	    pp->dpp_obj);
+	dt_dprintf("creating probe pid%d:%s:%s:%s at %lx\n",
+	    (int)ftp->ftps_pid, pp->dpp_obj, func, pp->dpp_name,
+	    symp->st_value);
 
 	if (!isdash && gmatch("return", pp->dpp_name)) {
 		if (dt_pid_create_fbt_probe(pp->dpp_pr, dtp, ftp, symp,
 		    DTFTP_RETURN) < 0) {
-			return (dt_pid_error(dtp, pcb, dpr, ftp,
+			return (dt_pid_error(dtp, pcb, dpr, NULL,
 			    D_PROC_CREATEFAIL, "failed to create return probe "
 			    "for '%s': %s", func,
 			    dtrace_errmsg(dtp, dtrace_errno(dtp))));
@@ -174,7 +189,7 @@ dt_pid_per_sym(dt_pid_probe_t *pp, const GElf_Sym *symp, const char *func)
 	if (!isdash && gmatch("entry", pp->dpp_name)) {
 		if (dt_pid_create_fbt_probe(pp->dpp_pr, dtp, ftp, symp,
 		    DTFTP_ENTRY) < 0) {
-			return (dt_pid_error(dtp, pcb, dpr, ftp,
+			return (dt_pid_error(dtp, pcb, dpr, NULL,
 			    D_PROC_CREATEFAIL, "failed to create entry probe "
 			    "for '%s': %s", func,
 			    dtrace_errmsg(dtp, dtrace_errno(dtp))));
@@ -187,19 +202,19 @@ dt_pid_per_sym(dt_pid_probe_t *pp, const GElf_Sym *symp, const char *func)
 	if (!glob && nmatches == 0) {
 		off = strtoull(pp->dpp_name, &end, 16);
 		if (*end != '\0') {
-			return (dt_pid_error(dtp, pcb, dpr, ftp, D_PROC_NAME,
+			return (dt_pid_error(dtp, pcb, dpr, NULL, D_PROC_NAME,
 			    "'%s' is an invalid probe name", pp->dpp_name));
 		}
 
 		if (off >= symp->st_size) {
-			return (dt_pid_error(dtp, pcb, dpr, ftp, D_PROC_OFF,
+			return (dt_pid_error(dtp, pcb, dpr, NULL, D_PROC_OFF,
 			    "offset 0x%llx outside of function '%s'",
 			    (u_longlong_t)off, func));
 		}
 
 		if (dt_pid_create_glob_offset_probes(pp->dpp_pr, pp->dpp_dtp,
 		    ftp, symp, pp->dpp_name) < 0) {
-			return (dt_pid_error(dtp, pcb, dpr, ftp,
+			return (dt_pid_error(dtp, pcb, dpr, NULL,
 			    D_PROC_CREATEFAIL, "failed to create probes at "
 			    "'%s+0x%llx': %s", func, (u_longlong_t)off,
 			    dtrace_errmsg(dtp, dtrace_errno(dtp))));
@@ -209,7 +224,7 @@ dt_pid_per_sym(dt_pid_probe_t *pp, const GElf_Sym *symp, const char *func)
 	} else if (glob && !isdash) {
 		if (dt_pid_create_glob_offset_probes(pp->dpp_pr, pp->dpp_dtp,
 		    ftp, symp, pp->dpp_name) < 0) {
-			return (dt_pid_error(dtp, pcb, dpr, ftp,
+			return (dt_pid_error(dtp, pcb, dpr, NULL,
 			    D_PROC_CREATEFAIL,
 			    "failed to create offset probes in '%s': %s", func,
 			    dtrace_errmsg(dtp, dtrace_errno(dtp))));
@@ -220,11 +235,147 @@ dt_pid_per_sym(dt_pid_probe_t *pp, const GElf_Sym *symp, const char *func)
 
 	pp->dpp_nmatches += nmatches;
 
-	dt_free(dtp, ftp);
+	return (0);
+}
+
+/*
+ * Note a function matched in the current module, for dt_pid_per_syms().  The
+ * symbol table walk starts again from the beginning if the process exec()s in
+ * the middle of it, which shows up here as addresses going backwards: forget
+ * what the previous walk found.
+ */
+static int
+dt_pid_sym_collect(dt_pid_probe_t *pp, const GElf_Sym *symp, const char *func)
+{
+	dtrace_hdl_t *dtp = pp->dpp_dtp;
+	size_t len = strlen(func) + 1;
+	dt_pid_match_t *dpm;
+
+	if (pp->dpp_nmatched > 0 && symp->st_value <
+	    pp->dpp_matches[pp->dpp_nmatched - 1].dpm_sym.st_value) {
+		pp->dpp_nmatched = 0;
+		pp->dpp_nameslen = 0;
+	}
+
+	if (pp->dpp_nmatched == pp->dpp_matchsz) {
+		uint_t sz = pp->dpp_matchsz == 0 ? 64 : pp->dpp_matchsz * 2;
+		dt_pid_match_t *matches;
+
+		if ((matches = dt_alloc(dtp, sz * sizeof (dt_pid_match_t))) ==
+		    NULL)
+			return (1); /* errno is set for us */
+
+		if (pp->dpp_nmatched > 0)
+			memcpy(matches, pp->dpp_matches,
+			    pp->dpp_nmatched * sizeof (dt_pid_match_t));
+		dt_free(dtp, pp->dpp_matches);
+		pp->dpp_matches = matches;
+		pp->dpp_matchsz = sz;
+	}
+
+	if (pp->dpp_nameslen + len > pp->dpp_namesz) {
+		size_t sz = MAX(pp->dpp_namesz * 2, pp->dpp_nameslen + len);
+		char *names;
+
+		sz = MAX(sz, 4096);
+		if ((names = dt_alloc(dtp, sz)) == NULL)
+			return (1); /* errno is set for us */
+
+		if (pp->dpp_nameslen > 0)
+			memcpy(names, pp->dpp_names, pp->dpp_nameslen);
+		dt_free(dtp, pp->dpp_names);
+		pp->dpp_names = names;
+		pp->dpp_namesz = sz;
+	}
+
+	dpm = &pp->dpp_matches[pp->dpp_nmatched++];
+	dpm->dpm_sym = *symp;
+	dpm->dpm_name = pp->dpp_nameslen;
+	memcpy(pp->dpp_names + pp->dpp_nameslen, func, len);
+	pp->dpp_nameslen += len;
 
 	return (0);
 }
 
+/*
+ * Create probes in all the functions collected from the current module.  Their
+ * probe specs differ only in function name and address, so they are built a
+ * batch at a time in one arena, with the pid and module filled in once, and
+ * then submitted one after another.
+ */
+static int
+dt_pid_per_syms(dt_pid_probe_t *pp)
+{
+	dtrace_hdl_t *dtp = pp->dpp_dtp;
+	fasttrap_probe_spec_t *ftp;
+	dt_pid_match_t *dpm;
+	uint_t nmatches = pp->dpp_nmatches;
+	hrtime_t start = gethrtime();
+	char *arena;
+	size_t sz;
+	uint_t i, j, n;
+	int ret = 0;
+
+	if (pp->dpp_nmatched == 0)
+		return (0);
+
+	sz = P2ROUNDUP(sizeof (fasttrap_probe_spec_t) + strlen(pp->dpp_name),
+	    sizeof (uint64_t));
+	n = MIN(pp->dpp_nmatched, DT_PID_BATCH);
+
+	if ((arena = dt_zalloc(dtp, n * sz)) == NULL) {
+		dt_dprintf("proc_per_syms: dt_alloc(%lu) failed\n", n * sz);
+		return (1); /* errno is set for us */
+	}
+
+	/*
+	 * We can just use the P member directly, since the PID does not change
+	 * under exec().
+	 */
+	ftp = (fasttrap_probe_spec_t *)arena;
+	ftp->ftps_pid = Pgetpid(pp->dpp_pr);
+	dt_pid_objname(ftp->ftps_mod, sizeof (ftp->ftps_mod), pp->dpp_lmid,
+	    pp->dpp_obj);
+
+	for (j = 1; j < n; j++)
+		memcpy(arena + j * sz, ftp, sizeof (fasttrap_probe_spec_t));
+
+	for (i = 0; i < pp->dpp_nmatched && ret == 0; i += n) {
+		n = MIN(pp->dpp_nmatched - i, DT_PID_BATCH);
+
+		for (j = 0; j < n; j++) {
+			ftp = (fasttrap_probe_spec_t *)(arena + j * sz);
+			dpm = &pp->dpp_matches[i + j];
+			(void) strncpy(ftp->ftps_func,
+			    pp->dpp_names + dpm->dpm_name,
+			    sizeof (ftp->ftps_func));
+		}
+
+		for (j = 0; j < n && ret == 0; j++) {
+			ftp = (fasttrap_probe_spec_t *)(arena + j * sz);
+			dpm = &pp->dpp_matches[i + j];
+			ret = dt_pid_per_sym(pp, ftp, &dpm->dpm_sym,
+			    pp->dpp_names + dpm->dpm_name);
+		}
+
+		if ((i + n) / DT_PID_PROGRESS != i / DT_PID_PROGRESS)
+			dt_dprintf("pid%d:%s: probes created in %u of %u "
+			    "functions\n", (int)Pgetpid(pp->dpp_pr),
+			    pp->dpp_obj, i + n, pp->dpp_nmatched);
+	}
+
+	dt_dprintf("pid%d:%s: %u probes created in %u functions in %llu us\n",
+	    (int)Pgetpid(pp->dpp_pr), pp->dpp_obj,
+	    pp->dpp_nmatches - nmatches, pp->dpp_nmatched,
+	    (u_longlong_t)(gethrtime() - start) / 1000);
+
+	dt_free(dtp, arena);
+	pp->dpp_nmatched = 0;
+	pp->dpp_nameslen = 0;
+
+	return (ret);
+}
+
 static int
 dt_pid_sym_filt(void *arg, const GElf_Sym *symp, const char *func)
 {
@@ -251,15 +402,33 @@ dt_pid_sym_filt(void *arg, const GElf_Sym *symp, const char *func)
 		if (strcmp(func, "_init") == 0 || strcmp(func, "_fini") == 0)
 			return (0);
 
-		if ((pp->dpp_last_taken = gmatch(func, pp->dpp_func)) != 0) {
+		if ((pp->dpp_last_taken = dt_glob_match(&pp->dpp_funcglob,
+			    func)) != 0) {
 			pp->dpp_last = *symp;
-			return (dt_pid_per_sym(pp, symp, func));
+			return (dt_pid_sym_collect(pp, symp, func));
 		}
 	}
 
 	return (0);
 }
 
+/*
+ * Walk the functions in one symbol table of a module that might match the
+ * function pattern.  If the pattern has a literal prefix, only the functions
+ * whose names begin with it are visited.
+ */
+static int
+dt_pid_sym_iter(dt_pid_probe_t *pp, pid_t pid, const char *obj, int which)
+{
+	if (pp->dpp_funcglob.dg_prefixlen > 0)
+		return (dt_Psymbol_iter_by_prefix(pp->dpp_dtp, pid, obj, which,
+			BIND_ANY | TYPE_FUNC, pp->dpp_funcglob.dg_prefix,
+			dt_pid_sym_filt, pp));
+
+	return (dt_Psymbol_iter_by_addr(pp->dpp_dtp, pid, obj, which,
+		BIND_ANY | TYPE_FUNC, dt_pid_sym_filt, pp));
+}
+
 static int
 dt_pid_per_mod(void *arg, const prmap_t *pmp, const char *obj)
 {
@@ -273,6 +442,9 @@ dt_pid_per_mod(void *arg, const prmap_t *pmp, const char *obj)
 	if (obj == NULL)
 		return (0);
 
+	pp->dpp_nmatched = 0;
+	pp->dpp_nameslen = 0;
+
 	dt_Plmid(pp->dpp_dtp, pid, pmp->pr_vaddr, &pp->dpp_lmid);
 
 	/*
@@ -366,27 +538,22 @@ dt_pid_per_mod(void *arg, const prmap_t *pmp, const char *obj)
 		dt_Plookup_by_addr(pp->dpp_dtp, pid, sym.st_value,
 		    pp->dpp_func, DTRACE_FUNCNAMELEN, &sym);
 
-		return (dt_pid_per_sym(pp, &sym, pp->dpp_func));
+		if (dt_pid_sym_collect(pp, &sym, pp->dpp_func) != 0)
+			return (1);
 	} else {
-		uint_t nmatches = pp->dpp_nmatches;
-
-		if (dt_Psymbol_iter_by_addr(pp->dpp_dtp, pid, obj, PR_SYMTAB,
-			BIND_ANY | TYPE_FUNC, dt_pid_sym_filt, pp) == 1)
+		if (dt_pid_sym_iter(pp, pid, obj, PR_SYMTAB) == 1)
 			return (1);
 
-		if (nmatches == pp->dpp_nmatches) {
-			/*
-			 * If we didn't match anything in the PR_SYMTAB, try
-			 * the PR_DYNSYM.
-			 */
-			if (dt_Psymbol_iter_by_addr(pp->dpp_dtp, pid, obj,
-				PR_DYNSYM, BIND_ANY | TYPE_FUNC,
-				dt_pid_sym_filt, pp) == 1)
-				return (1);
-		}
+		/*
+		 * If we didn't match anything in the PR_SYMTAB, try the
+		 * PR_DYNSYM.
+		 */
+		if (pp->dpp_nmatched == 0 &&
+		    dt_pid_sym_iter(pp, pid, obj, PR_DYNSYM) == 1)
+			return (1);
 	}
 
-	return (0);
+	return (dt_pid_per_syms(pp));
 }
 
 static int
@@ -401,7 +568,7 @@ dt_pid_mod_filt(void *arg, const prmap_t *pmp, const char *obj)
 	else
 		pp->dpp_obj++;
 
-	if (gmatch(pp->dpp_obj, pp->dpp_mod))
+	if (dt_glob_match(&pp->dpp_modglob, pp->dpp_obj))
 		return (dt_pid_per_mod(pp, pmp, obj));
 
 	dt_Plmid(pp->dpp_dtp, Pgetpid(dpr->dpr_proc), pmp->pr_vaddr,
@@ -409,7 +576,7 @@ dt_pid_mod_filt(void *arg, const prmap_t *pmp, const char *obj)
 
 	dt_pid_objname(name, sizeof (name), pp->dpp_lmid, pp->dpp_obj);
 
-	if (gmatch(name, pp->dpp_mod))
+	if (dt_glob_match(&pp->dpp_modglob, name))
 		return (dt_pid_per_mod(pp, pmp, obj));
 
 	return (0);
@@ -472,6 +639,10 @@ dt_pid_create_pid_probes(dtrace_probedesc_t *pdp, dtrace_hdl_t *dtp,
 	pp.dpp_pr = dpr->dpr_proc;
 	pp.dpp_pcb = pcb;
 	pp.dpp_nmatches = 0;
+	pp.dpp_matches = NULL;
+	pp.dpp_nmatched = pp.dpp_matchsz = 0;
+	pp.dpp_names = NULL;
+	pp.dpp_nameslen = pp.dpp_namesz = 0;
 
 	/*
 	 * Prohibit self-grabs.  (This is banned anyway by libproc, but this way
@@ -518,6 +689,19 @@ dt_pid_create_pid_probes(dtrace_probedesc_t *pdp, dtrace_hdl_t *dtp,
 		}
 	}
 
+	/*
+	 * Both patterns are matched against many names, so compile them.
+	 */
+	if (dt_glob_compile(&pp.dpp_modglob, pp.dpp_mod) != 0)
+		return (dt_pid_error(dtp, pcb, dpr, NULL, D_PROC_CREATEFAIL,
+		    "failed to create probes: %s", strerror(errno)));
+
+	if (dt_glob_compile(&pp.dpp_funcglob, pp.dpp_func) != 0) {
+		dt_glob_free(&pp.dpp_modglob);
+		return (dt_pid_error(dtp, pcb, dpr, NULL, D_PROC_CREATEFAIL,
+		    "failed to create probes: %s", strerror(errno)));
+	}
+
 	/*
 	 * If pp.dpp_mod contains any globbing meta-characters, we need
 	 * to iterate over each module and compare its name against the
@@ -544,6 +728,11 @@ dt_pid_create_pid_probes(dtrace_probedesc_t *pdp, dtrace_hdl_t *dtp,
 		}
 	}
 
+	dt_free(dtp, pp.dpp_matches);
+	dt_free(dtp, pp.dpp_names);
+	dt_glob_free(&pp.dpp_modglob);
+	dt_glob_free(&pp.dpp_funcglob);
+
 	return (ret);
 }
 
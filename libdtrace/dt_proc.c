@@ -10,11 +10,17 @@
  *
  * This library provides several mechanisms in the libproc control layer:
  *
- * Process Control: a control thread is created for each process to provide
+ * Process Control: a control context is created for each process to provide
  * callbacks on process exit, to handle ptrace()-related signal dispatch tasks,
  * and to provide a central point that all ptrace()-related requests from the
  * rest of DTrace can flow through, working around the limitation that ptrace()
- * is per-thread and that libproc makes extensive use of it.
+ * is per-thread and that libproc makes extensive use of it.  The contexts are
+ * multiplexed over a small pool of control threads (at most
+ * _dtrace_pidctlthreads), each waiting in epoll_wait() on the waitfds (or, on
+ * kernels without waitfd(), the pidfds) of its processes and switching into
+ * whichever context has work to do; a process never moves between control
+ * threads.  Below, "control thread" means the
+ * control context of one process running on its thread.
  *
  * MT-Safety: due to the above ptrace() limitations, libproc is not MT-Safe or
  * even capable of multithreading, so a marshalling and proxying layer is
@@ -35,6 +41,17 @@
  * created but not retired, and the current limit on the number of actively
  * cached entries.
  *
+ * Processes which are only needed to turn addresses into names, for ustack(),
+ * usym() and friends, are not grabbed like this unless they are already under
+ * control for some other reason: instead, a lightweight noninvasive handle with
+ * no control thread is kept in a separate cache (see dt_proc_sym_grab()).  The
+ * dt_P*() functions route calls for such pids straight to libproc.  That cache
+ * is bounded by the memory its handles hold (dph_symsizelim), not by their
+ * number, since a handle costs nothing else and a profile may see hundreds of
+ * processes.
+ *
+ * Both caches count hits, misses and evictions: see dtrace_proc_cachestat().
+ *
  * The control threads currently invoke processes, resume them when
  * dt_proc_continue() is called, manage ptrace()-related signal dispatch and
  * breakpoint handling tasks, handle libproc requests from the rest of DTrace
@@ -45,7 +62,9 @@
  * dtrace_handle_proc() for notification of process death.  When this event
  * occurs, the dt_proc_t itself is enqueued on a notification list and the
  * control thread broadcasts to dph_cv.  dtrace_sleep() will wake up using this
- * condition and will then call the client handler as necessary.
+ * condition and will then call the client handler as necessary.  Clients with
+ * event loops of their own poll dtrace_pollfd() instead: once that has been
+ * called, every broadcast also writes to the dph_notify_fd eventfd behind it.
  *
  * The locking in this file is crucial, to stop the process-control threads
  * from running before dtrace is ready for them, to coordinate proxy calls
@@ -72,13 +91,20 @@
  */
 
 #include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <signal.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <port.h>
-#include <poll.h>
+#include <sched.h>
 #include <setjmp.h>
+#include <ucontext.h>
+#include <unistd.h>
 
 #include <mutex.h>
 
@@ -125,6 +151,627 @@ dt_unwinder_pad(struct ps_prochandle *unused)
 	return &unwinder_pad;
 }
 
+/*
+ * Process-control thread pool.
+ *
+ * Each process under control has a control context: what used to be the stack
+ * of a thread of its own, running dt_proc_control().  The contexts are spread
+ * over at most _dtrace_pidctlthreads control threads, each of which sits in
+ * epoll_wait() on the waitfds or pidfds of its processes and on a wakeup
+ * eventfd from the main thread, and switches into whichever context has
+ * something to do.  A context switches back out wherever a thread per process
+ * would have blocked: in dt_proc_loop(), on a contended dpr_lock, and in the
+ * blocking waits libproc makes for a process to stop, as in Ptrace(), Pcreate()
+ * and Pgrab() (see dt_proc_pwait_block()).  So the breakpoint-handling and
+ * exec-retry code, which may stop and wait many frames deep, runs exactly as
+ * it did when every process had its own thread, without holding up the other
+ * processes on the same control thread.
+ *
+ * Proxy requests tend to come in quick succession, so both ends of a round
+ * trip spin briefly before sleeping: the main thread waiting for its reply (see
+ * dt_proc_proxy_spin()), and a control thread that has just served a request
+ * waiting for the next (see dt_proc_ctl_spin()).  While a control thread is
+ * spinning, kicking it needs no eventfd write.  Each spin budget adapts to how
+ * long replies actually take, and there is no spinning on a single CPU.
+ *
+ * A waitfd becomes readable whenever waitid(WEXITED | WSTOPPED) would report
+ * something, which is just what Pwait() waits for.  Stock kernels have no
+ * waitfd() syscall, so there we use a pidfd instead (see dt_proc_open_fd()).
+ * A pidfd only becomes readable when its process exits, so while any process
+ * with a pidfd is waiting for a state change, its control thread also polls
+ * them for ptrace() stops with waitid(WNOHANG | WNOWAIT), more often when they
+ * have lately been busy (see dt_proc_ctl_poll()).  SIGCHLD would be a better
+ * wakeup, but the disposition of SIGCHLD belongs to the program we are linked
+ * into.
+ */
+
+#define	DT_PROC_CTX_STACKSIZE	(2 * 1024 * 1024)
+#define	DT_PROC_CTL_NEVENTS	64
+#define	DT_PROC_LOCK_SPINS	64
+#define	DT_PROC_SPIN_MIN	1000		/* ns */
+#define	DT_PROC_SPIN_MAX	50000		/* ns */
+#define	DT_PROC_POLL_MIN	1		/* ms */
+#define	DT_PROC_POLL_MAX	16		/* ms */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define	dt_proc_cpu_relax()	__builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define	dt_proc_cpu_relax()	__asm__ __volatile__("yield" ::: "memory")
+#else
+#define	dt_proc_cpu_relax()	__asm__ __volatile__("" ::: "memory")
+#endif
+
+/*
+ * The context running on this control thread, if any.
+ */
+static __thread dt_proc_ctx_t *current_ctx;
+
+static void dt_proc_control(void *arg);
+static void dt_proc_control_cleanup(void *arg);
+
+/*
+ * Signals blocked in the control threads and contexts.
+ */
+static void
+dt_proc_ctl_sigmask(sigset_t *set)
+{
+	(void) sigfillset(set);
+	(void) sigdelset(set, SIGABRT);	/* unblocked for assert() */
+}
+
+/*
+ * The initial spin budget: none at all if there is nobody to spin against.
+ */
+static uint_t
+dt_proc_spin_initial(void)
+{
+	return sysconf(_SC_NPROCESSORS_ONLN) > 1 ? DT_PROC_SPIN_MAX / 4 : 0;
+}
+
+/*
+ * Adapt a spin budget after a spin of 'spent' ns.  After a success, the
+ * budget drifts towards twice the time it took; after a failure, it halves.
+ */
+static void
+dt_proc_spin_adapt(uint_t *budget, hrtime_t spent, int success)
+{
+	if (success)
+		*budget = MIN(*budget / 2 + spent, DT_PROC_SPIN_MAX);
+	else
+		*budget /= 2;
+
+	*budget = MAX(*budget, DT_PROC_SPIN_MIN);
+}
+
+static int
+dt_proc_ctl_wake(dt_proc_ctl_t *ctl)
+{
+	uint64_t one = 1;
+
+	while (write(ctl->dpc_wake_fd, &one, sizeof(one)) < 0) {
+		/*
+		 * An eventfd that cannot be added to already has a wakeup
+		 * pending.
+		 */
+		if (errno == EAGAIN)
+			return 0;
+		if (errno != EINTR)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Poll the kicked list briefly after serving a request, since another tends
+ * to follow.  Returns nonzero if one arrived.
+ */
+static int
+dt_proc_ctl_spin(dt_proc_ctl_t *ctl)
+{
+	hrtime_t start = gethrtime();
+	uint_t i;
+	int found;
+
+	pthread_mutex_lock(&ctl->dpc_lock);
+	ctl->dpc_spinning = 1;
+	pthread_mutex_unlock(&ctl->dpc_lock);
+
+	for (i = 1; __atomic_load_n(&ctl->dpc_kicked, __ATOMIC_ACQUIRE) == NULL;
+	     i++) {
+		dt_proc_cpu_relax();
+		if (i % 64 == 0 && gethrtime() - start >= ctl->dpc_spin)
+			break;
+	}
+
+	/*
+	 * A kick that saw us spinning did not wake us: check again under the
+	 * lock once kicks can see that we have stopped.
+	 */
+	pthread_mutex_lock(&ctl->dpc_lock);
+	ctl->dpc_spinning = 0;
+	found = ctl->dpc_kicked != NULL;
+	pthread_mutex_unlock(&ctl->dpc_lock);
+
+	dt_proc_spin_adapt(&ctl->dpc_spin, gethrtime() - start, found);
+
+	return found;
+}
+
+/*
+ * Switch from a context back to the scheduler of its control thread, noting
+ * what it is waiting for.  The unwinder pad and errno belong to the context,
+ * not to the thread, so keep them across the switch.
+ */
+static void
+dt_proc_ctx_yield(dt_proc_ctx_t *ctx, int wait)
+{
+	int err = errno;
+
+	ctx->dcx_wait = wait;
+	ctx->dcx_unwinder_pad = unwinder_pad;
+	swapcontext(&ctx->dcx_uc, &ctx->dcx_ctl->dpc_sched);
+	unwinder_pad = ctx->dcx_unwinder_pad;
+	errno = err;
+}
+
+/*
+ * Wait, switched out, for any of the DT_PROC_CTX_* events in mask, and return
+ * which of those happened.  Other events are left pending.
+ *
+ * The process fd is registered one-shot and rearmed here, so a process that
+ * changes state while its context is busy (or waiting for its lock) does not
+ * keep waking the control thread.  dt_proc_ctl_poll() also only polls armed
+ * contexts.
+ */
+static int
+dt_proc_ctx_wait_events(dt_proc_t *dpr, int mask)
+{
+	dt_proc_ctx_t *ctx = dpr->dpr_ctx;
+	struct epoll_event ev;
+	int want_proc = (mask & DT_PROC_CTX_PROC) != 0;
+	int revents;
+
+	if (want_proc != ctx->dcx_armed) {
+		ev.events = EPOLLONESHOT | (want_proc ? EPOLLIN : 0);
+		ev.data.ptr = ctx;
+		if (epoll_ctl(ctx->dcx_ctl->dpc_epfd, EPOLL_CTL_MOD,
+			dpr->dpr_fd, &ev) < 0)
+			dt_dprintf("%i: cannot rearm process fd: %s\n",
+			    dpr->dpr_pid, strerror(errno));
+		else
+			ctx->dcx_armed = want_proc;
+	}
+
+	while ((ctx->dcx_revents & mask) == 0)
+		dt_proc_ctx_yield(ctx, DT_PROC_CTX_WAIT_EVENT);
+
+	revents = ctx->dcx_revents & mask;
+	ctx->dcx_revents &= ~mask;
+
+	return revents;
+}
+
+/*
+ * Wait, switched out, for a request from the main thread or (if want_proc) a
+ * state change in the process, and return which of those happened.
+ */
+static int
+dt_proc_ctx_wait(dt_proc_t *dpr, int want_proc)
+{
+	return dt_proc_ctx_wait_events(dpr, DT_PROC_CTX_PROXY |
+	    (want_proc ? DT_PROC_CTX_PROC : 0));
+}
+
+/*
+ * Take the dpr_lock from a control context.  The main thread usually holds it
+ * only briefly, so spin for a while; after that, let the other processes on
+ * this thread run while we wait.
+ */
+static void
+dt_proc_ctx_lock(dt_proc_t *dpr)
+{
+	int spins = 0;
+
+	while (pthread_mutex_trylock(&dpr->dpr_lock) != 0) {
+		if (spins++ < DT_PROC_LOCK_SPINS)
+			sched_yield();
+		else
+			dt_proc_ctx_yield(dpr->dpr_ctx, DT_PROC_CTX_WAIT_LOCK);
+	}
+}
+
+/*
+ * Tell the control context of a process that the main thread has a request
+ * for it.  Called under the dpr_lock, and only while dpr_done is unset: after
+ * that, the context may be freed at any time.
+ */
+static int
+dt_proc_ctx_kick(dt_proc_t *dpr)
+{
+	dt_proc_ctx_t *ctx = dpr->dpr_ctx;
+	dt_proc_ctl_t *ctl = ctx->dcx_ctl;
+	int wake = 0;
+
+	pthread_mutex_lock(&ctl->dpc_lock);
+	if (!ctx->dcx_kicked) {
+		ctx->dcx_kicked = 1;
+		ctx->dcx_kick_next = ctl->dpc_kicked;
+		wake = ctl->dpc_kicked == NULL && !ctl->dpc_spinning;
+		__atomic_store_n(&ctl->dpc_kicked, ctx, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&ctl->dpc_lock);
+
+	/*
+	 * If other contexts were already queued, the thread is already due to
+	 * wake up and look at the queue; if it is spinning, it will see ours.
+	 */
+	if (wake)
+		return dt_proc_ctl_wake(ctl);
+
+	return 0;
+}
+
+/*
+ * Clean up after a process and finish its control context for good: the
+ * equivalent of pthread_exit() from the thread per process of old.
+ */
+_dt_noreturn_
+static void
+dt_proc_ctx_exit(dt_proc_t *dpr)
+{
+	dt_proc_ctx_t *ctx = dpr->dpr_ctx;
+
+	dt_proc_control_cleanup(dpr);
+
+	/*
+	 * After this point, the dpr may already have been freed.
+	 */
+	ctx->dcx_exited = 1;
+	setcontext(&ctx->dcx_ctl->dpc_sched);
+	abort();
+}
+
+static void
+dt_proc_ctx_start(void)
+{
+	dt_proc_ctx_t *ctx = current_ctx;
+
+	/*
+	 * The kick that started us is not a proxy request.
+	 */
+	ctx->dcx_revents = 0;
+	dt_proc_control(ctx->dcx_data);
+}
+
+static dt_proc_ctx_t *
+dt_proc_ctx_create(dtrace_hdl_t *dtp, dt_proc_ctl_t *ctl, void *data)
+{
+	dt_proc_ctx_t *ctx;
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+
+	if ((ctx = dt_zalloc(dtp, sizeof(dt_proc_ctx_t))) == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/*
+	 * The stack is only touched as deeply as it is used; its lowest page
+	 * is a guard page.
+	 */
+	ctx->dcx_stacksize = DT_PROC_CTX_STACKSIZE;
+	ctx->dcx_stack = mmap(NULL, ctx->dcx_stacksize, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if (ctx->dcx_stack == MAP_FAILED) {
+		dt_free(dtp, ctx);
+		return NULL;
+	}
+	(void) mprotect(ctx->dcx_stack, pagesize, PROT_NONE);
+
+	if (getcontext(&ctx->dcx_uc) < 0) {
+		munmap(ctx->dcx_stack, ctx->dcx_stacksize);
+		dt_free(dtp, ctx);
+		return NULL;
+	}
+	ctx->dcx_uc.uc_stack.ss_sp = (char *)ctx->dcx_stack + pagesize;
+	ctx->dcx_uc.uc_stack.ss_size = ctx->dcx_stacksize - pagesize;
+	ctx->dcx_uc.uc_link = NULL;
+	dt_proc_ctl_sigmask(&ctx->dcx_uc.uc_sigmask);
+	makecontext(&ctx->dcx_uc, dt_proc_ctx_start, 0);
+
+	ctx->dcx_ctl = ctl;
+	ctx->dcx_data = data;
+
+	return ctx;
+}
+
+static void
+dt_proc_ctx_free(dt_proc_ctl_t *ctl, dt_proc_ctx_t *ctx)
+{
+	munmap(ctx->dcx_stack, ctx->dcx_stacksize);
+	dt_free(ctl->dpc_hdl, ctx);
+}
+
+/*
+ * Switch into a context until it waits again or exits.
+ */
+static void
+dt_proc_ctx_run(dt_proc_ctl_t *ctl, dt_proc_ctx_t *ctx, dt_proc_ctx_t **dead)
+{
+	if (ctx->dcx_exited)
+		return;
+
+	current_ctx = ctx;
+	swapcontext(&ctl->dpc_sched, &ctx->dcx_uc);
+	current_ctx = NULL;
+	unwinder_pad = NULL;
+
+	if (ctx->dcx_exited) {
+		ctx->dcx_dead_next = *dead;
+		*dead = ctx;
+	} else if (ctx->dcx_wait == DT_PROC_CTX_WAIT_LOCK &&
+	    !ctx->dcx_retrying) {
+		ctx->dcx_retrying = 1;
+		ctx->dcx_retry_next = ctl->dpc_retry;
+		ctl->dpc_retry = ctx;
+	}
+}
+
+/*
+ * Check the armed contexts of processes with pidfds for the stops and exits
+ * that a waitfd would have reported, and run those that need attention.  The
+ * polling interval halves when something was found, and doubles when not.
+ * Returns nonzero if any of these processes is being waited for.
+ */
+static int
+dt_proc_ctl_poll(dt_proc_ctl_t *ctl, dt_proc_ctx_t **dead)
+{
+	dt_proc_ctx_t *ctx, *next;
+	siginfo_t info;
+	int armed = 0, found = 0;
+
+	for (ctx = ctl->dpc_polled; ctx != NULL; ctx = next) {
+		next = ctx->dcx_poll_next;
+		if (!ctx->dcx_armed)
+			continue;
+
+		armed++;
+		info.si_pid = 0;
+		if (waitid(P_PID, ctx->dcx_poll_pid, &info, WEXITED | WSTOPPED |
+			WNOHANG | WNOWAIT | __WALL) < 0 || info.si_pid == 0)
+			continue;
+
+		found++;
+		ctx->dcx_armed = 0;
+		ctx->dcx_revents |= DT_PROC_CTX_PROC;
+		dt_proc_ctx_run(ctl, ctx, dead);
+	}
+
+	if (found)
+		ctl->dpc_poll_ms = MAX(ctl->dpc_poll_ms / 2, DT_PROC_POLL_MIN);
+	else if (armed)
+		ctl->dpc_poll_ms = MIN(ctl->dpc_poll_ms * 2, DT_PROC_POLL_MAX);
+
+	return armed;
+}
+
+/*
+ * Main loop of a process-control thread.  Contexts waiting for their dpr_lock
+ * are retried every millisecond, and processes with pidfds are polled (see
+ * dt_proc_ctl_poll()); everything else is event-driven.
+ */
+static void *
+dt_proc_ctl_thread(void *arg)
+{
+	dt_proc_ctl_t *ctl = arg;
+	struct epoll_event evs[DT_PROC_CTL_NEVENTS];
+	dt_proc_ctx_t *ctx, *next, *dead = NULL, **dpp;
+	int i, n, quit, polled, pending = 0;
+
+	for (;;) {
+		/*
+		 * Free contexts that have exited, unless the main thread
+		 * queued a request for them just before they did: the loop
+		 * over dpc_kicked below dequeues those.
+		 */
+		pthread_mutex_lock(&ctl->dpc_lock);
+		for (dpp = &dead; (ctx = *dpp) != NULL; ) {
+			if (ctx->dcx_kicked) {
+				dpp = &ctx->dcx_dead_next;
+				continue;
+			}
+			*dpp = ctx->dcx_dead_next;
+			dt_proc_ctx_free(ctl, ctx);
+			ctl->dpc_nprocs--;
+		}
+		quit = ctl->dpc_quit && ctl->dpc_nprocs == 0;
+		pthread_mutex_unlock(&ctl->dpc_lock);
+
+		if (quit)
+			break;
+
+		polled = dt_proc_ctl_poll(ctl, &dead);
+
+		n = epoll_wait(ctl->dpc_epfd, evs, DT_PROC_CTL_NEVENTS,
+		    dead != NULL || pending ? 0 : ctl->dpc_retry != NULL ? 1 :
+		    polled ? ctl->dpc_poll_ms : -1);
+		pending = 0;
+		if (n < 0) {
+			if (errno != EINTR)
+				dt_dprintf("control thread epoll_wait() "
+				    "failed: %s\n", strerror(errno));
+			n = 0;
+		}
+
+		for (i = 0; i < n; i++) {
+			if ((ctx = evs[i].data.ptr) == NULL) {
+				uint64_t count;
+
+				(void) read(ctl->dpc_wake_fd, &count,
+				    sizeof(count));
+				continue;
+			}
+
+			ctx->dcx_armed = 0;
+			ctx->dcx_revents |= DT_PROC_CTX_PROC;
+			dt_proc_ctx_run(ctl, ctx, &dead);
+		}
+
+		/*
+		 * Contexts with requests from the main thread.  Each stays
+		 * marked as kicked until just before it runs, so that a new
+		 * kick cannot relink it while we walk the list.
+		 */
+		pthread_mutex_lock(&ctl->dpc_lock);
+		ctx = ctl->dpc_kicked;
+		ctl->dpc_kicked = NULL;
+		pthread_mutex_unlock(&ctl->dpc_lock);
+
+		for (; ctx != NULL; ctx = next) {
+			pthread_mutex_lock(&ctl->dpc_lock);
+			next = ctx->dcx_kick_next;
+			ctx->dcx_kicked = 0;
+			pthread_mutex_unlock(&ctl->dpc_lock);
+
+			ctx->dcx_revents |= DT_PROC_CTX_PROXY;
+			dt_proc_ctx_run(ctl, ctx, &dead);
+			ctl->dpc_poll_ms = DT_PROC_POLL_MIN;
+			pending = 1;
+		}
+
+		/*
+		 * Contexts waiting for their dpr_lock.
+		 */
+		ctx = ctl->dpc_retry;
+		ctl->dpc_retry = NULL;
+
+		for (; ctx != NULL; ctx = next) {
+			next = ctx->dcx_retry_next;
+			ctx->dcx_retrying = 0;
+
+			if (ctx->dcx_wait == DT_PROC_CTX_WAIT_LOCK)
+				dt_proc_ctx_run(ctl, ctx, &dead);
+		}
+
+		/*
+		 * If we served a request, another may be on its way.
+		 */
+		if (pending && ctl->dpc_spin > 0)
+			pending = dt_proc_ctl_spin(ctl);
+		else
+			pending = 0;
+	}
+
+	return NULL;
+}
+
+static int
+dt_proc_ctl_start(dtrace_hdl_t *dtp, dt_proc_ctl_t *ctl)
+{
+	struct epoll_event ev;
+	sigset_t nset, oset;
+	int err;
+
+	ctl->dpc_hdl = dtp;
+	ctl->dpc_spin = dt_proc_spin_initial();
+	ctl->dpc_poll_ms = DT_PROC_POLL_MIN;
+	if ((ctl->dpc_epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return errno;
+
+	if ((ctl->dpc_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+		err = errno;
+		close(ctl->dpc_epfd);
+		return err;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(ctl->dpc_epfd, EPOLL_CTL_ADD, ctl->dpc_wake_fd,
+		&ev) < 0) {
+		err = errno;
+		goto fail;
+	}
+
+	(void) pthread_mutex_init(&ctl->dpc_lock, NULL);
+
+	dt_proc_ctl_sigmask(&nset);
+	(void) pthread_sigmask(SIG_SETMASK, &nset, &oset);
+	err = pthread_create(&ctl->dpc_tid, NULL, dt_proc_ctl_thread, ctl);
+	(void) pthread_sigmask(SIG_SETMASK, &oset, NULL);
+
+	if (err == 0)
+		return 0;
+
+	pthread_mutex_destroy(&ctl->dpc_lock);
+fail:
+	close(ctl->dpc_wake_fd);
+	close(ctl->dpc_epfd);
+	return err;
+}
+
+/*
+ * Stop a control thread.  All its processes must already have been destroyed.
+ */
+static void
+dt_proc_ctl_stop(dt_proc_ctl_t *ctl)
+{
+	pthread_mutex_lock(&ctl->dpc_lock);
+	ctl->dpc_quit = 1;
+	pthread_mutex_unlock(&ctl->dpc_lock);
+
+	dt_proc_ctl_wake(ctl);
+	pthread_join(ctl->dpc_tid, NULL);
+
+	close(ctl->dpc_wake_fd);
+	close(ctl->dpc_epfd);
+	pthread_mutex_destroy(&ctl->dpc_lock);
+}
+
+/*
+ * Choose the control thread for a new process: an idle thread if there is one,
+ * otherwise a new thread while the pool is below its limit, otherwise the least
+ * loaded thread.  The chosen thread's process count is bumped.
+ */
+static dt_proc_ctl_t *
+dt_proc_ctl_assign(dtrace_hdl_t *dtp, int *errp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_proc_ctl_t *ctl, *best = NULL;
+	uint_t i, nprocs, best_nprocs = UINT_MAX;
+
+	for (i = 0; i < dph->dph_nctls; i++) {
+		ctl = &dph->dph_ctls[i];
+
+		pthread_mutex_lock(&ctl->dpc_lock);
+		nprocs = ctl->dpc_nprocs;
+		pthread_mutex_unlock(&ctl->dpc_lock);
+
+		if (nprocs < best_nprocs) {
+			best = ctl;
+			best_nprocs = nprocs;
+		}
+	}
+
+	*errp = ENOMEM;
+	if ((best == NULL || best_nprocs > 0) &&
+	    dph->dph_nctls < dph->dph_ctllim) {
+		ctl = &dph->dph_ctls[dph->dph_nctls];
+
+		if ((*errp = dt_proc_ctl_start(dtp, ctl)) == 0) {
+			dph->dph_nctls++;
+			best = ctl;
+		}
+	}
+
+	if (best == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&best->dpc_lock);
+	best->dpc_nprocs++;
+	pthread_mutex_unlock(&best->dpc_lock);
+
+	return best;
+}
+
 static void
 dt_proc_notify(dtrace_hdl_t *dtp, dt_proc_hash_t *dph, dt_proc_t *dpr,
 	       pid_t pid, const char *msg, int lock, int broadcast)
@@ -149,8 +796,14 @@ dt_proc_notify(dtrace_hdl_t *dtp, dt_proc_hash_t *dph, dt_proc_t *dpr,
 		dprn->dprn_pid = pid;
 		dph->dph_notify = dprn;
 
-		if (broadcast)
+		if (broadcast) {
+			uint64_t one = 1;
+
 			(void) pthread_cond_broadcast(&dph->dph_cv);
+			if (dph->dph_notify_fd >= 0)
+				(void) write(dph->dph_notify_fd, &one,
+				    sizeof (one));
+		}
 		if (lock)
 			(void) pthread_mutex_unlock(&dph->dph_lock);
 	}
@@ -646,11 +1299,43 @@ dt_proc_error(dtrace_hdl_t *dtp, dt_proc_t *dpr, const char *format, ...)
  * exec-retry protocol.)
  */
 
+/*
+ * Most proxy requests are answered within microseconds, far sooner than a
+ * sleep on the dpr_msg_cv and its wakeup would take: so spin for a while with
+ * the dpr_lock dropped, just as pthread_cond_wait() would drop it, before
+ * falling back to sleeping.  The reply itself is read under the lock.
+ */
+static void
+dt_proc_proxy_spin(dt_proc_t *dpr)
+{
+	dt_proc_hash_t *dph = dpr->dpr_hdl->dt_procs;
+	hrtime_t start;
+	uint_t i;
+	int answered = 0;
+
+	if (dph->dph_proxy_spin == 0)
+		return;
+
+	start = gethrtime();
+	pthread_mutex_unlock(&dpr->dpr_lock);
+	for (i = 1; ; i++) {
+		if (__atomic_load_n(&dpr->dpr_proxy_rq, __ATOMIC_ACQUIRE) ==
+		    NULL) {
+			answered = 1;
+			break;
+		}
+		dt_proc_cpu_relax();
+		if (i % 64 == 0 && gethrtime() - start >= dph->dph_proxy_spin)
+			break;
+	}
+	pthread_mutex_lock(&dpr->dpr_lock);
+
+	dt_proc_spin_adapt(&dph->dph_proxy_spin, gethrtime() - start, answered);
+}
+
 static long
 proxy_call(dt_proc_t *dpr, long (*proxy_rq)(), int exec_retry)
 {
-	char junk = '\0'; /* unimportant */
-
 	dpr->dpr_proxy_rq = proxy_rq;
 
 	/*
@@ -662,14 +1347,14 @@ proxy_call(dt_proc_t *dpr, long (*proxy_rq)(), int exec_retry)
 		return(-1);
 	}
 
-	errno = 0;
-	while (write(dpr->dpr_proxy_fd[1], &junk, 1) < 0 && errno == EINTR);
-	if (errno != 0 && errno != EINTR) {
-		dt_proc_error(dpr->dpr_hdl, dpr, "Cannot write to proxy pipe "
-		    "for Pwait(), deadlock is certain: %s\n", strerror(errno));
+	if (dt_proc_ctx_kick(dpr) < 0) {
+		dt_proc_error(dpr->dpr_hdl, dpr, "Cannot wake control thread "
+		    "for proxy request, deadlock is certain: %s\n",
+		    strerror(errno));
 		return (-1);
 	}
 
+	dt_proc_proxy_spin(dpr);
 	while (dpr->dpr_proxy_rq != NULL)
 		pthread_cond_wait(&dpr->dpr_msg_cv, &dpr->dpr_lock);
 
@@ -725,6 +1410,35 @@ proxy_ptrace(enum __ptrace_request request, void *arg, pid_t pid, void *addr,
 	return proxy_call(dpr, proxy_ptrace, 1);
 }
 
+/*
+ * Like proxy_ptrace(), but issues a whole batch of requests in one round trip.
+ */
+static long
+proxy_ptrace_batch(ptrace_req_t *reqs, void *arg, size_t n)
+{
+	dt_proc_t *dpr = arg;
+	size_t i;
+
+	assert_self_locked(dpr);
+
+	if (pthread_equal(dpr->dpr_tid, pthread_self())) {
+		for (i = 0; i < n; i++) {
+			errno = 0;
+			reqs[i].pr_ret = ptrace(reqs[i].pr_request,
+			    reqs[i].pr_pid, reqs[i].pr_addr, reqs[i].pr_data);
+			reqs[i].pr_errno = errno;
+			if (errno != 0)
+				return i + 1;
+		}
+		return n;
+	}
+
+	dpr->dpr_proxy_args.dpr_ptrace_batch.reqs = reqs;
+	dpr->dpr_proxy_args.dpr_ptrace_batch.n = n;
+
+	return proxy_call(dpr, proxy_ptrace_batch, 1);
+}
+
 /*
  * This proxy request serves to force the controlling thread to recreate its
  * ps_prochandle after an exec().
@@ -782,34 +1496,132 @@ proxy_quit(dt_proc_t *dpr, int err)
 
 	/*
 	 * If we are already in the right thread, respond to the proxy message
-	 * and terminate the thread.  We do not unlock at all: the unlock
-	 * happens late in the cleanup handler, by which point the thread has
-	 * finished tidying up after itself.
+	 * and terminate the control context.  We do not unlock at all: the
+	 * unlock happens late in the cleanup handler, by which point the
+	 * context has finished tidying up after itself.
 	 */
 	if (pthread_equal(dpr->dpr_tid, pthread_self())) {
 		dpr->dpr_proxy_errno = err;
 		dpr->dpr_proxy_rq = NULL;
 		dpr->dpr_proxy_ret = err;
 		pthread_cond_signal(&dpr->dpr_msg_cv);
-		pthread_exit(NULL);
+		dt_proc_ctx_exit(dpr);
 	}
 
 	dpr->dpr_proxy_args.dpr_quit.err = err;
 	return proxy_call(dpr, proxy_quit, 0);
 }
 
+/*
+ * Get a pollable fd for a process under control, and add it (disarmed) to the
+ * epoll set of its control thread.  Which kind of fd depends on dph_procmon: by
+ * default a waitfd, or if the kernel has no waitfd() syscall, a pidfd, which
+ * also puts the context on the list of those its control thread polls.
+ */
+static int
+dt_proc_open_fd(dt_proc_t *dpr)
+{
+	dt_proc_ctx_t *ctx = dpr->dpr_ctx;
+	dt_proc_ctl_t *ctl = ctx->dcx_ctl;
+	int procmon = dpr->dpr_hdl->dt_procs->dph_procmon;
+	struct epoll_event ev;
+	int err;
+
+	dpr->dpr_fd = -1;
+	if (procmon != DT_PROC_MON_PIDFD)
+		dpr->dpr_fd = waitfd(P_PID, dpr->dpr_pid, WEXITED | WSTOPPED,
+		    0);
+
+	if (dpr->dpr_fd < 0 && (procmon == DT_PROC_MON_PIDFD ||
+		(procmon == DT_PROC_MON_AUTO && errno == ENOSYS))) {
+		dpr->dpr_fd = pidfd_open(dpr->dpr_pid, 0);
+		dpr->dpr_pidfd = dpr->dpr_fd >= 0;
+	}
+
+	if (dpr->dpr_fd < 0)
+		return -1;
+
+	dt_dprintf("%i: monitoring via %s\n", dpr->dpr_pid,
+	    dpr->dpr_pidfd ? "pidfd" : "waitfd");
+
+	ev.events = EPOLLONESHOT;
+	ev.data.ptr = ctx;
+	if (epoll_ctl(ctl->dpc_epfd, EPOLL_CTL_ADD, dpr->dpr_fd, &ev) < 0) {
+		err = errno;
+		close(dpr->dpr_fd);
+		dpr->dpr_fd = -1;
+		dpr->dpr_pidfd = 0;
+		errno = err;
+		return -1;
+	}
+
+	if (dpr->dpr_pidfd) {
+		ctx->dcx_poll_pid = dpr->dpr_pid;
+		ctx->dcx_poll_next = ctl->dpc_polled;
+		ctl->dpc_polled = ctx;
+	}
+
+	return 0;
+}
+
+/*
+ * Remove a process fd from the epoll set of its control thread, and stop
+ * polling the process, before closing the fd.
+ */
+static void
+dt_proc_close_fd(dt_proc_t *dpr)
+{
+	dt_proc_ctx_t *ctx = dpr->dpr_ctx;
+	dt_proc_ctl_t *ctl = ctx->dcx_ctl;
+	dt_proc_ctx_t **cpp;
+
+	epoll_ctl(ctl->dpc_epfd, EPOLL_CTL_DEL, dpr->dpr_fd, NULL);
+	close(dpr->dpr_fd);
+
+	if (dpr->dpr_pidfd) {
+		for (cpp = &ctl->dpc_polled; *cpp != NULL;
+		     cpp = &(*cpp)->dcx_poll_next) {
+			if (*cpp == ctx) {
+				*cpp = ctx->dcx_poll_next;
+				break;
+			}
+		}
+		dpr->dpr_pidfd = 0;
+	}
+	dpr->dpr_fd = -1;
+}
+
+/*
+ * libproc's blocking-wait hook.  A blocking wait for a process from its own
+ * control context, whether in Pwait() (often deep inside Ptrace()) or while
+ * Pcreate() or Pgrab() wait for the first stop, lets the other processes on
+ * this control thread run until this one changes state.  The waits in
+ * Pcreate() and Pgrab() come before dt_proc_control() gets the process fd, so
+ * it is opened here if need be.  Anywhere else, waits block as usual.
+ */
+static int
+dt_proc_pwait_block(struct ps_prochandle *P, void *arg)
+{
+	dt_proc_t *dpr = arg;
+
+	if (dpr == NULL || dpr->dpr_ctx == NULL || current_ctx != dpr->dpr_ctx)
+		return -1;
+
+	if (dpr->dpr_fd <= 0) {
+		dpr->dpr_pid = Pgetpid(P);
+		if (dt_proc_open_fd(dpr) < 0)
+			return -1;
+	}
+
+	dt_proc_ctx_wait_events(dpr, DT_PROC_CTX_PROC);
+	return 0;
+}
+
 typedef struct dt_proc_control_data {
 	dtrace_hdl_t *dpcd_hdl;			/* DTrace handle */
 	dt_proc_t *dpcd_proc;			/* process to control */
 	int dpcd_flags;
 
-	/*
-	 * This pipe contains data only when the dt_proc.proxy_rq contains a
-	 * proxy request that needs handling on behalf of DTrace's main thread.
-	 * DTrace will be waiting for the response on the dpr_msg_cv.
-	 */
-	int dpcd_proxy_fd[2];
-
 	/*
 	 * The next two are only valid while the master thread is calling
 	 * dt_proc_create(), and only useful when dpr_created is true.
@@ -818,21 +1630,21 @@ typedef struct dt_proc_control_data {
 	char * const *dpcd_start_proc_argv;
 } dt_proc_control_data_t;
 
-static void dt_proc_control_cleanup(void *arg);
-
 /*
- * Entry point for all victim process control threads.	We initialize all the
+ * Entry point for all victim process control contexts.  We initialize all the
  * appropriate /proc control mechanisms, start the process and halt it, notify
  * the caller of this, then wait for the caller to indicate its readiness and
  * resume the process: only then do we enter the main control loop (above).  We
  * exit when the victim dies.
  *
- * The control thread synchronizes the use of dpr_proc with other libdtrace
+ * The control context synchronizes the use of dpr_proc with other libdtrace
  * threads using dpr_lock.  We hold the lock for all of our operations except
  * waiting while the process is running.  If the libdtrace client wishes to exit
- * or abort our wait, thread cancellation can be used.
+ * or abort our wait, it sends a proxy_quit() request.  Waits for the process to
+ * stop made by libproc while we hold the lock still switch out of the context,
+ * so that other processes on this control thread are served meanwhile.
  */
-static void *
+static void
 dt_proc_control(void *arg)
 {
 	dt_proc_control_data_t * volatile datap = arg;
@@ -846,25 +1658,19 @@ dt_proc_control(void *arg)
 	 * are * grabbed or created.
 	 */
 	Pset_ptrace_lock_hook(dt_proc_ptrace_lock);
+	Pset_pwait_block_hook(dt_proc_pwait_block);
 	Pset_libproc_unwinder_pad(dt_unwinder_pad);
 
-	/*
-	 * Arrange to clean up when cancelled by dt_proc_destroy() on shutdown.
-	 */
-	pthread_cleanup_push(dt_proc_control_cleanup, dpr);
-
 	/*
 	 * Lock our mutex, preventing races between cv broadcasts to our
 	 * controlling thread and dt_proc_continue() or process destruction.
 	 *
-	 * It is eventually unlocked by dt_proc_control_cleanup(), and
-	 * temporarily unlocked (while waiting) by dt_proc_loop().
+	 * It is eventually unlocked by dt_proc_control_cleanup() (called from
+	 * dt_proc_ctx_exit()), and temporarily unlocked (while waiting) by
+	 * dt_proc_loop().
 	 */
 	dt_proc_lock(dpr);
 
-	dpr->dpr_proxy_fd[0] = datap->dpcd_proxy_fd[0];
-	dpr->dpr_proxy_fd[1] = datap->dpcd_proxy_fd[1];
-
 	/*
 	 * Either create the process, or grab it.  Whichever, on failure, quit
 	 * and let our cleanup run (signalling failure to
@@ -879,7 +1685,7 @@ dt_proc_control(void *arg)
 			dt_proc_error(dtp, dpr, "failed to execute %s: %s\n",
 			    datap->dpcd_start_proc,
 			    strerror(err));
-			pthread_exit(NULL);
+			dt_proc_ctx_exit(dpr);
 		}
 		dpr->dpr_pid = Pgetpid(dpr->dpr_proc);
 	} else {
@@ -910,20 +1716,20 @@ dt_proc_control(void *arg)
 			    dpr, &err)) == NULL) {
 			dt_proc_error(dtp, dpr, "failed to grab pid %li: %s\n",
 			    (long) dpr->dpr_pid, strerror(err));
-			pthread_exit(NULL);
+			dt_proc_ctx_exit(dpr);
 		}
 
 		/*
-		 * If this was a noninvasive grab, quietly exit without calling
-		 * the cleanup handlers: the process is running, but does not
-		 * need a monitoring thread.  Process termination detection is
+		 * If this was a noninvasive grab, quietly exit without
+		 * reporting process death: the process is running, but does
+		 * not need a monitoring context.  Process termination detection is
 		 * handled in the parent process, via the subreaper already set
 		 * up.
 		 */
 		if (noninvasive && !Ptraceable(dpr->dpr_proc)) {
-			dt_dprintf("%i: noninvasive grab, control thread "
+			dt_dprintf("%i: noninvasive grab, control context "
 			    "suiciding\n", dpr->dpr_pid);
-			pthread_exit(NULL);
+			dt_proc_ctx_exit(dpr);
 		}
 	}
 
@@ -933,14 +1739,15 @@ dt_proc_control(void *arg)
 	 */
 	Pset_pwait_wrapper(dpr->dpr_proc, proxy_pwait);
 	Pset_ptrace_wrapper(dpr->dpr_proc, proxy_ptrace);
+	Pset_ptrace_batch_wrapper(dpr->dpr_proc, proxy_ptrace_batch);
 
 	/*
-	 * Make a waitfd to this process, and set up polling structures
-	 * appropriately.  WEXITED | WSTOPPED is what Pwait() waits for.
+	 * Get a waitfd or pidfd for this process, and add it (disarmed) to our
+	 * control thread's epoll set, unless dt_proc_pwait_block() already did.
 	 */
-	if ((dpr->dpr_fd = waitfd(P_PID, dpr->dpr_pid, WEXITED | WSTOPPED, 0)) < 0) {
-		dt_proc_error(dtp, dpr, "failed to get waitfd() for pid %li: %s\n",
-		    (long) dpr->dpr_pid, strerror(errno));
+	if (dpr->dpr_fd <= 0 && dt_proc_open_fd(dpr) < 0) {
+		dt_proc_error(dtp, dpr, "failed to get waitfd() or pidfd for "
+		    "pid %li: %s\n", (long) dpr->dpr_pid, strerror(errno));
 		/*
 		 * Demote this to a mandatorily noninvasive grab: if we
 		 * Pcreate()d it, dpr_created is still set, so it will still get
@@ -959,7 +1766,7 @@ dt_proc_control(void *arg)
 		}
 
 		dtp->dt_procs->dph_noninvasive_created++;
-		pthread_exit(NULL);
+		dt_proc_ctx_exit(dpr);
 	}
 
 	/*
@@ -982,7 +1789,7 @@ dt_proc_control(void *arg)
 			dt_proc_error(dtp, dpr,
 			    "failed to regrab pid %li after exec(): %s\n",
 			    (long) dpr->dpr_pid, strerror(err));
-			pthread_exit(NULL);
+			dt_proc_ctx_exit(dpr);
 		}
 	} else {
 		unwinder_pad = &exec_jmp;
@@ -1033,9 +1840,7 @@ dt_proc_control(void *arg)
 	 * clean up.
 	 */
 	dt_proc_resume(dpr);
-	pthread_cleanup_pop(1);
-
-	return (NULL);
+	dt_proc_ctx_exit(dpr);
 }
 
 /*
@@ -1049,54 +1854,30 @@ dt_proc_control(void *arg)
 static int
 dt_proc_loop(dt_proc_t *dpr, int awaiting_continue)
 {
-	volatile struct pollfd pfd[2];
-
 	assert(MUTEX_HELD(&dpr->dpr_lock));
 
 	/*
-	 * We always want to listen on the proxy pipe; we only want to listen on
-	 * the process's waitfd pipe sometimes.
-	 */
-
-	pfd[0].events = POLLIN;
-	pfd[1].fd = dpr->dpr_proxy_fd[0];
-	pfd[1].events = POLLIN;
-
-	/*
-	 * If we're only proxying while waiting for a dt_proc_continue(),
-	 * avoid waiting on the process's fd.
-	 */
-	if (awaiting_continue)
-		pfd[0].fd = dpr->dpr_fd * -1;
-
-	/*
-	 * Wait for the process corresponding to this control thread to stop,
+	 * Wait for the process corresponding to this control context to stop,
 	 * process the event, and then set it running again.  We want to sleep
 	 * with dpr_lock *unheld* so that other parts of libdtrace can send
 	 * requests to us, which is protected by that lock.  It is impossible
-	 * for them, or any thread but this one, to modify the Pstate(), so we
+	 * for them, or any context but this one, to modify the Pstate(), so we
 	 * can call that without grabbing the lock.
 	 */
 	for (;;) {
 		volatile int did_proxy_pwait = 0;
+		int revents;
 
 		dt_proc_unlock(dpr);
 
 		/*
-		 * If we should stop monitoring the process and only listen for
-		 * proxy requests, avoid waiting on its fd.
+		 * We always want to hear about proxy requests; we only want to
+		 * hear about the process sometimes.  If we're only proxying
+		 * while waiting for a dt_proc_continue(), or should stop
+		 * monitoring the process, avoid waiting on its fd.
 		 */
-
-		if (!awaiting_continue) {
-			if (!dpr->dpr_monitoring)
-				pfd[0].fd = dpr->dpr_fd * -1;
-			else
-				pfd[0].fd = dpr->dpr_fd;
-		}
-
-		while (errno = EINTR,
-		    poll((struct pollfd *) pfd, 2, -1) <= 0 && errno == EINTR)
-			continue;
+		revents = dt_proc_ctx_wait(dpr, !awaiting_continue &&
+		    dpr->dpr_monitoring);
 
 		/*
 		 * We can block for arbitrarily long periods on this lock if the
@@ -1121,21 +1902,15 @@ dt_proc_loop(dt_proc_t *dpr, int awaiting_continue)
 		dt_proc_lock(dpr);
 
 		/*
-		 * Incoming proxy request.  Drain this byte out of the pipe, and
-		 * handle it, with a new jmp_buf set up so as to redirect
-		 * execve() detections back the calling thread.  (Multiple bytes
-		 * cannot land on the pipe, so we don't need to consider this
-		 * case -- but if they do, it is harmless, because the
-		 * dpr_proxy_rq will be NULL in subsequent calls.)
+		 * Incoming proxy request.  Handle it, with a new jmp_buf set
+		 * up so as to redirect execve() detections back the calling
+		 * thread.  (A stale wakeup with no request pending is
+		 * harmless, because the dpr_proxy_rq will be NULL.)
 		 */
-		if (pfd[1].revents != 0) {
-			char junk;
+		if (revents & DT_PROC_CTX_PROXY) {
 			jmp_buf this_exec_jmp, *old_exec_jmp;
 			volatile int did_exec_retry = 0;
 
-			read(dpr->dpr_proxy_fd[0], &junk, 1);
-			pfd[1].revents = 0;
-
 			/*
 			 * execve() detected during a proxy request: notify the
 			 * calling thread.  Do not rejump: we want to keep
@@ -1176,6 +1951,14 @@ dt_proc_loop(dt_proc_t *dpr, int awaiting_continue)
 						dpr->dpr_proxy_args.dpr_ptrace.pid,
 						dpr->dpr_proxy_args.dpr_ptrace.addr,
 						dpr->dpr_proxy_args.dpr_ptrace.data);
+				} else if (dpr->dpr_proxy_rq == proxy_ptrace_batch) {
+					dt_dprintf("%d: Handling a proxy batch of "
+					    "%zi ptrace()s\n", dpr->dpr_pid,
+					    dpr->dpr_proxy_args.dpr_ptrace_batch.n);
+					dpr->dpr_proxy_ret = proxy_ptrace_batch
+					    (dpr->dpr_proxy_args.dpr_ptrace_batch.reqs,
+						dpr,
+						dpr->dpr_proxy_args.dpr_ptrace_batch.n);
 				/*
 				 * Other thread in dt_proc_continue().
 				 */
@@ -1243,12 +2026,12 @@ dt_proc_loop(dt_proc_t *dpr, int awaiting_continue)
 
 		/*
 		 * The process needs attention. Pwait() for it (which will make
-		 * the waitfd transition back to empty).
+		 * the waitfd transition back to empty, or consume what
+		 * dt_proc_ctl_poll() found).
 		 */
-		if (pfd[0].revents != 0) {
+		if (revents & DT_PROC_CTX_PROC) {
 			dt_dprintf("%d: Handling a process state change\n",
 			    dpr->dpr_pid);
-			pfd[0].revents = 0;
 			Pwait(dpr->dpr_proc, B_FALSE);
 
 			switch (Pstate(dpr->dpr_proc)) {
@@ -1357,8 +2140,11 @@ dt_proc_control_cleanup(void *arg)
 	/*
 	 * Proxy cleanup.
 	 *
-	 * fd closing must be done with some care.  The thread may be cancelled
-	 * before any of these fds have been assigned!
+	 * fd closing must be done with some care.  The context may exit
+	 * before the process fd has been assigned!  It must leave the epoll set
+	 * explicitly, since a child forked by another context may still hold a
+	 * copy of it, and a pidfd must leave the polled list before the context
+	 * is freed.
 	 *
 	 * No new incoming proxy calls are permitted after this point.  Flip
 	 * dpr_done to ensure that none will be attempted, even if a proxyer is
@@ -1367,14 +2153,8 @@ dt_proc_control_cleanup(void *arg)
 	 */
 
 	dpr->dpr_done = B_TRUE;
-	if (dpr->dpr_fd)
-	    close(dpr->dpr_fd);
-
-	if (dpr->dpr_proxy_fd[0])
-	    close(dpr->dpr_proxy_fd[0]);
-
-	if (dpr->dpr_proxy_fd[1])
-	    close(dpr->dpr_proxy_fd[1]);
+	if (dpr->dpr_fd > 0)
+		dt_proc_close_fd(dpr);
 
 	/*
 	 * A proxy request may have come in since the last time we checked for
@@ -1503,11 +2283,27 @@ static int dt_proc_monitor(dt_proc_t *dpr, int monitor)
 	return 0;
 }
 
+/*
+ * Hash a pid into one of nbuckets buckets.  Pids are handed out sequentially,
+ * and forking workloads tend to stride through them, so take the high bits of a
+ * multiplicative hash rather than the low bits of the pid; this also works for
+ * any number of buckets.
+ */
+static uint_t
+dt_proc_hash_pid(pid_t pid, uint_t nbuckets)
+{
+	uint32_t h = (uint32_t)pid * 2654435761U;
+
+	return ((uint64_t)h * nbuckets) >> 32;
+}
+
 static dt_proc_t *
 dt_proc_lookup_remove(dtrace_hdl_t *dtp, pid_t pid, int remove)
 {
 	dt_proc_hash_t *dph = dtp->dt_procs;
-	dt_proc_t *dpr, **dpp = &dph->dph_hash[pid & (dph->dph_hashlen - 1)];
+	dt_proc_t *dpr, **dpp;
+
+	dpp = &dph->dph_hash[dt_proc_hash_pid(pid, dph->dph_hashlen)];
 
 	for (dpr = *dpp; dpr != NULL; dpr = dpr->dpr_hash) {
 		if (dpr->dpr_pid == pid)
@@ -1658,8 +2454,7 @@ dt_proc_create_thread(dtrace_hdl_t *dtp, dt_proc_t *dpr, uint_t stop,
     int flags, const char *file, char *const *argv)
 {
 	dt_proc_control_data_t data;
-	sigset_t nset, oset;
-	pthread_attr_t a;
+	dt_proc_ctl_t *ctl;
 	int err;
 
 	(void) pthread_mutex_lock(&dpr->dpr_lock);
@@ -1668,40 +2463,41 @@ dt_proc_create_thread(dtrace_hdl_t *dtp, dt_proc_t *dpr, uint_t stop,
 	if (flags & DTRACE_PROC_NOTIFIABLE)
 		dpr->dpr_notifiable = 1;
 
-	(void) pthread_attr_init(&a);
-	(void) pthread_attr_setdetachstate(&a, PTHREAD_CREATE_DETACHED);
-
-	(void) sigfillset(&nset);
-	(void) sigdelset(&nset, SIGABRT);	/* unblocked for assert() */
-
 	data.dpcd_hdl = dtp;
 	data.dpcd_proc = dpr;
 	data.dpcd_start_proc = file;
 	data.dpcd_start_proc_argv = argv;
 	data.dpcd_flags = flags;
 
-	if (pipe(data.dpcd_proxy_fd) < 0) {
-		err = errno;
-		(void) dt_proc_error(dpr->dpr_hdl, dpr,
-		    "failed to create communicating pipe for pid %d: %s\n",
-		    (int)dpr->dpr_pid, strerror(err));
-
-		(void) pthread_mutex_unlock(&dpr->dpr_lock);
-		(void) pthread_attr_destroy(&a);
-		return (err);
+	/*
+	 * Give the process a control context on one of the pool's threads, and
+	 * kick it to start it.  It starts by taking the dpr_lock, which it
+	 * gets once we wait below.
+	 */
+	if ((ctl = dt_proc_ctl_assign(dtp, &err)) != NULL) {
+		if ((dpr->dpr_ctx = dt_proc_ctx_create(dtp, ctl,
+			    &data)) == NULL) {
+			err = errno;
+			pthread_mutex_lock(&ctl->dpc_lock);
+			ctl->dpc_nprocs--;
+			pthread_mutex_unlock(&ctl->dpc_lock);
+		} else {
+			dpr->dpr_tid = ctl->dpc_tid;
+			if (dt_proc_ctx_kick(dpr) < 0)
+				dt_dprintf("%i: cannot wake control thread: "
+				    "%s\n", (int)dpr->dpr_pid,
+				    strerror(errno));
+			err = 0;
+		}
 	}
 
-	(void) pthread_sigmask(SIG_SETMASK, &nset, &oset);
-	err = pthread_create(&dpr->dpr_tid, &a, dt_proc_control, &data);
-	(void) pthread_sigmask(SIG_SETMASK, &oset, NULL);
-
 	/*
-	 * If the control thread was created, then wait on dpr_cv for either
-	 * dpr_done to be set (the victim died, the control thread failed, or no
-	 * control thread was ultimately needed) or DT_PROC_STOP_IDLE to be set,
-	 * indicating that the victim is now stopped and the control thread is
-	 * at the rendezvous event.  On success, we return with the process and
-	 * control thread stopped: the caller can then apply
+	 * If the control context was created, then wait on dpr_cv for either
+	 * dpr_done to be set (the victim died, the control context failed, or
+	 * no control context was ultimately needed) or DT_PROC_STOP_IDLE to be
+	 * set, indicating that the victim is now stopped and the control
+	 * context is at the rendezvous event.  On success, we return with the
+	 * process and control context stopped: the caller can then apply
 	 * dt_proc_continue() to resume both.
 	 */
 	if (err == 0) {
@@ -1727,7 +2523,6 @@ dt_proc_create_thread(dtrace_hdl_t *dtp, dt_proc_t *dpr, uint_t stop,
 	}
 
 	(void) pthread_mutex_unlock(&dpr->dpr_lock);
-	(void) pthread_attr_destroy(&a);
 
 	return (err);
 }
@@ -1740,6 +2535,7 @@ dt_proc_create(dtrace_hdl_t *dtp, const char *file, char *const *argv,
 	dt_proc_t *dpr;
 	pthread_mutexattr_t attr;
 	pthread_mutexattr_t *attrp = NULL;
+	uint_t h;
 
 	if ((dpr = dt_zalloc(dtp, sizeof (dt_proc_t))) == NULL)
 		return (NULL); /* errno is set for us */
@@ -1779,9 +2575,10 @@ dt_proc_create(dtrace_hdl_t *dtp, const char *file, char *const *argv,
 		return (NULL); /* dt_proc_error() has been called for us */
 	}
 
+	h = dt_proc_hash_pid(dpr->dpr_pid, dph->dph_hashlen);
 	dph->dph_lrucnt++;
-	dpr->dpr_hash = dph->dph_hash[dpr->dpr_pid & (dph->dph_hashlen - 1)];
-	dph->dph_hash[dpr->dpr_pid & (dph->dph_hashlen - 1)] = dpr;
+	dpr->dpr_hash = dph->dph_hash[h];
+	dph->dph_hash[h] = dpr;
 	dt_list_prepend(&dph->dph_lrulist, dpr);
 
 	dt_dprintf("created pid %d\n", (int)dpr->dpr_pid);
@@ -1801,7 +2598,7 @@ static dt_proc_t *
 dt_proc_grab(dtrace_hdl_t *dtp, pid_t pid, int flags)
 {
 	dt_proc_hash_t *dph = dtp->dt_procs;
-	uint_t h = pid & (dph->dph_hashlen - 1);
+	uint_t h = dt_proc_hash_pid(pid, dph->dph_hashlen);
 	dt_proc_t *dpr, *opr;
 	pthread_mutexattr_t attr;
 	pthread_mutexattr_t *attrp = NULL;
@@ -1838,6 +2635,7 @@ dt_proc_grab(dtrace_hdl_t *dtp, pid_t pid, int flags)
 			dt_list_delete(&dph->dph_lrulist, dpr);
 			dt_list_prepend(&dph->dph_lrulist, dpr);
 			dpr->dpr_refs++;
+			dph->dph_hits++;
 
 			if (dt_proc_retired(dpr->dpr_proc)) {
 				/* not retired any more */
@@ -1899,6 +2697,7 @@ dt_proc_grab(dtrace_hdl_t *dtp, pid_t pid, int flags)
 	}
 
 	dph->dph_lrucnt++;
+	dph->dph_misses++;
 	dpr->dpr_hash = dph->dph_hash[h];
 	dph->dph_hash[h] = dpr;
 	dt_list_prepend(&dph->dph_lrulist, dpr);
@@ -1923,6 +2722,7 @@ dt_proc_grab(dtrace_hdl_t *dtp, pid_t pid, int flags)
 			if (opr->dpr_refs == 0 && !dt_proc_retired(opr->dpr_proc)) {
 				dt_proc_retire(opr->dpr_proc);
 				dph->dph_lrucnt--;
+				dph->dph_evictions++;
 				break;
 			}
 		}
@@ -1952,6 +2752,7 @@ dt_proc_release(dtrace_hdl_t *dtp, dt_proc_t *dpr)
 	    !dt_proc_retired(dpr->dpr_proc)) {
 		dt_proc_retire(dpr->dpr_proc);
 		dph->dph_lrucnt--;
+		dph->dph_evictions++;
 	}
 
 	if (dpr->dpr_done) {
@@ -1982,8 +2783,8 @@ dt_proc_continue(dtrace_hdl_t *dtp, dt_proc_t *dpr)
 	assert(!pthread_equal(dpr->dpr_tid, pthread_self()));
 
 	/*
-	 * A continue has two phases.  First, we send a signal down the proxy
-	 * pipe to tell the control thread to awaken its child; then we wait for
+	 * A continue has two phases.  First, we kick the control context to
+	 * tell it to awaken its child; then we wait for
 	 * its cv signal to tell us that it has completed detaching that child.
 	 * Without this, we may grab the dpr_lock before it can be re-grabbed by
 	 * the control thread and used to detach, leading to unbalanced
@@ -2000,16 +2801,12 @@ dt_proc_continue(dtrace_hdl_t *dtp, dt_proc_t *dpr)
 		return 0;
 	}
 
-	if (dpr->dpr_stop & DT_PROC_STOP_IDLE) {
-		char junk = '\0'; /* unimportant */
-
+	if ((dpr->dpr_stop & DT_PROC_STOP_IDLE) && !dpr->dpr_done) {
 		dpr->dpr_stop &= ~DT_PROC_STOP_IDLE;
 		dpr->dpr_proxy_rq = dt_proc_continue;
-		errno = 0;
-		while (write(dpr->dpr_proxy_fd[1], &junk, 1) < 0 && errno == EINTR);
-		if (errno != 0 && errno != EINTR) {
-			dt_proc_error(dpr->dpr_hdl, dpr, "Cannot write to "
-			    "proxy pipe for dt_proc_continue(), deadlock is "
+		if (dt_proc_ctx_kick(dpr) < 0) {
+			dt_proc_error(dpr->dpr_hdl, dpr, "Cannot wake control "
+			    "thread for dt_proc_continue(), deadlock is "
 			    "certain: %s\n", strerror(errno));
 			return (-1);
 		}
@@ -2038,7 +2835,10 @@ dt_proc_lock(dt_proc_t *dpr)
 	if (!pthread_equal(dpr->dpr_lock_holder, pthread_self()) ||
 	    *lock_count == 0) {
 		dt_dprintf("%i: Taking out lock\n", dpr->dpr_pid);
-		pthread_mutex_lock(&dpr->dpr_lock);
+		if (lock_count == &dpr->dpr_lock_count_ctrl)
+			dt_proc_ctx_lock(dpr);
+		else
+			pthread_mutex_lock(&dpr->dpr_lock);
 		dpr->dpr_lock_holder = pthread_self();
 		dt_dprintf("%i: Taken out lock\n", dpr->dpr_pid);
 	}
@@ -2096,15 +2896,171 @@ dt_proc_ptrace_lock(struct ps_prochandle *P, void *arg, int ptracing)
 		dt_proc_unlock(dpr);
 }
 
+static dt_symproc_t *
+dt_proc_sym_lookup(dtrace_hdl_t *dtp, pid_t pid)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_symproc_t *dsp;
+
+	if (dph->dph_symhash == NULL)
+		return NULL;
+
+	for (dsp = dph->dph_symhash[dt_proc_hash_pid(pid, dph->dph_symbuckets)];
+	     dsp != NULL; dsp = dsp->dsp_hash) {
+		if (dsp->dsp_pid == pid)
+			break;
+	}
+
+	return dsp;
+}
+
+static void
+dt_proc_sym_destroy(dtrace_hdl_t *dtp, dt_symproc_t *dsp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_symproc_t **dpp;
+	uint_t h = dt_proc_hash_pid(dsp->dsp_pid, dph->dph_symbuckets);
+
+	for (dpp = &dph->dph_symhash[h]; *dpp != dsp; dpp = &(*dpp)->dsp_hash)
+		assert(*dpp != NULL);
+	*dpp = dsp->dsp_hash;
+
+	dt_list_delete(&dph->dph_symlrulist, dsp);
+	dph->dph_symcnt--;
+	dph->dph_symsize -= dsp->dsp_size;
+
+	Prelease(dsp->dsp_proc, PS_RELEASE_NORMAL);
+	Pfree(dsp->dsp_proc);
+	dt_free(dtp, dsp);
+}
+
+/*
+ * Grow the symproc hash if it has more entries than buckets.  Failure to grow
+ * is harmless: the chains just get longer.
+ */
+static void
+dt_proc_sym_hash_grow(dtrace_hdl_t *dtp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	uint_t nbuckets = dph->dph_symbuckets * 2;
+	dt_symproc_t **symhash, *dsp, *next;
+	uint_t i;
+
+	if (dph->dph_symcnt <= dph->dph_symbuckets)
+		return;
+
+	if ((symhash = dt_zalloc(dtp, sizeof (dt_symproc_t *) * nbuckets)) ==
+	    NULL)
+		return;
+
+	for (i = 0; i < dph->dph_symbuckets; i++) {
+		for (dsp = dph->dph_symhash[i]; dsp != NULL; dsp = next) {
+			uint_t h = dt_proc_hash_pid(dsp->dsp_pid, nbuckets);
+
+			next = dsp->dsp_hash;
+			dsp->dsp_hash = symhash[h];
+			symhash[h] = dsp;
+		}
+	}
+
+	dt_dprintf("grew symbolization handle hash to %u buckets\n", nbuckets);
+	dt_free(dtp, dph->dph_symhash);
+	dph->dph_symhash = symhash;
+	dph->dph_symbuckets = nbuckets;
+}
+
+/*
+ * Recompute the memory charged to the cache for a symbolization handle, which
+ * grows as its symbol tables are read in, and drop least-recently-used
+ * unreferenced handles until the cache is back within its limit.
+ */
+static void
+dt_proc_sym_charge(dtrace_hdl_t *dtp, dt_symproc_t *dsp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_symproc_t *osp, *psp;
+
+	dph->dph_symsize -= dsp->dsp_size;
+	dsp->dsp_size = Pmemsize(dsp->dsp_proc);
+	dph->dph_symsize += dsp->dsp_size;
+
+	for (osp = dt_list_prev(&dph->dph_symlrulist);
+	     osp != NULL && dph->dph_symsize > dph->dph_symsizelim; osp = psp) {
+		psp = dt_list_prev(osp);
+		if (osp->dsp_refs == 0) {
+			dt_dprintf("dropping symbolization handle for pid %d "
+			    "(%zi bytes)\n", (int)osp->dsp_pid, osp->dsp_size);
+			dt_proc_sym_destroy(dtp, osp);
+			dph->dph_symevictions++;
+		}
+	}
+}
+
+/*
+ * Drop a reference to a symbolization handle, making it evictable once unused.
+ */
+static void
+dt_proc_sym_drop(dtrace_hdl_t *dtp, dt_symproc_t *dsp)
+{
+	assert(dsp->dsp_refs != 0);
+	if (--dsp->dsp_refs == 0)
+		dt_proc_sym_charge(dtp, dsp);
+}
+
+/*
+ * Reread the mappings of a symbolization-only handle after a failed lookup,
+ * unless that has already been done since it was grabbed.  Returns nonzero if
+ * the lookup is worth retrying.
+ *
+ * A snapshot of a process that has exited is never reread, since that would
+ * throw it away.  (If the process exits between the check and the reread, the
+ * snapshot is lost: this is no worse than not having taken one.)
+ */
+static int
+dt_proc_sym_refresh(dtrace_hdl_t *dtp, dt_symproc_t *dsp)
+{
+	if (dsp->dsp_fresh)
+		return 0;
+
+	dsp->dsp_fresh = 1;
+	if (!Pexists(dsp->dsp_pid))
+		return 0;
+
+	if (dtp->dt_usnapshot)
+		Pupdate_syms(dsp->dsp_proc);
+	else
+		Pinvalidate_maps(dsp->dsp_proc);
+	return 1;
+}
+
 /*
  * Define the public interface to a libproc function from the rest of DTrace,
  * automatically proxying via the process-control thread and retrying on
  * exec().
  */
 #define DEFINE_dt_Pfunction(function, err_ret, ...)		\
+	DEFINE_dt_Pfunction_missed(function, err_ret, ret == (err_ret), \
+	    ## __VA_ARGS__)
+
+/*
+ * As above, but with an explicit condition on ret indicating that the lookup
+ * found nothing.  Symbolization-only handles are not told when the process maps
+ * or unmaps anything, so such a miss rereads the mappings and tries again (at
+ * most once per grab).
+ */
+#define DEFINE_dt_Pfunction_missed(function, err_ret, missed, ...) \
 	dt_proc_t * volatile dpr = dt_proc_lookup(dtp, pid);	\
 	jmp_buf this_exec_jmp, *old_exec_jmp; \
 	\
+	if (dpr == NULL) { \
+		dt_symproc_t *dsp = dt_proc_sym_lookup(dtp, pid); \
+		\
+		assert(dsp != NULL && dsp->dsp_refs > 0); \
+		ret = function(dsp->dsp_proc, ## __VA_ARGS__); \
+		if ((missed) && dt_proc_sym_refresh(dtp, dsp)) \
+			ret = function(dsp->dsp_proc, ## __VA_ARGS__); \
+		return ret; \
+	} \
 	assert(MUTEX_HELD(&dpr->dpr_lock)); \
 	old_exec_jmp = unwinder_pad; \
 	if (setjmp(this_exec_jmp)) { \
@@ -2127,6 +3083,16 @@ dt_Plookup_by_addr(dtrace_hdl_t *dtp, pid_t pid, uintptr_t addr,
 	return ret;
 }
 
+int
+dt_Plookup_by_addrs(dtrace_hdl_t *dtp, pid_t pid, praddrinfo_t *addrs,
+    size_t n)
+{
+	int ret;
+	DEFINE_dt_Pfunction_missed(Plookup_by_addrs, -1, ret < (int)n, addrs,
+	    n);
+	return ret;
+}
+
 const prmap_t *
 dt_Paddr_to_map(dtrace_hdl_t *dtp, pid_t pid, uintptr_t addr)
 {
@@ -2204,6 +3170,17 @@ dt_Psymbol_iter_by_addr(dtrace_hdl_t *dtp, pid_t pid, const char *object_name,
 	return ret;
 }
 
+int
+dt_Psymbol_iter_by_prefix(dtrace_hdl_t *dtp, pid_t pid,
+    const char *object_name, int which, int mask, const char *prefix,
+    proc_sym_f *func, void *cd)
+{
+	int ret;
+	DEFINE_dt_Pfunction(Psymbol_iter_by_prefix, -1, object_name, which,
+	    mask, prefix, func, cd);
+	return ret;
+}
+
 int
 dt_Pobject_iter(dtrace_hdl_t *dtp, pid_t pid, proc_map_f *func, void *cd)
 {
@@ -2229,9 +3206,29 @@ dt_proc_hash_create(dtrace_hdl_t *dtp)
 
 		(void) pthread_mutex_init(&dtp->dt_procs->dph_lock, NULL);
 		(void) pthread_cond_init(&dtp->dt_procs->dph_cv, NULL);
+		dtp->dt_procs->dph_notify_fd = -1;
 
 		dtp->dt_procs->dph_hashlen = _dtrace_pidbuckets;
 		dtp->dt_procs->dph_lrulim = _dtrace_pidlrulim;
+		dtp->dt_procs->dph_symsizelim = _dtrace_symcachesize;
+
+		/*
+		 * If this fails, symbolization falls back to full grabs.
+		 */
+		dtp->dt_procs->dph_symbuckets = MAX(_dtrace_pidbuckets, 1);
+		dtp->dt_procs->dph_symhash = dt_zalloc(dtp,
+		    sizeof (dt_symproc_t *) * dtp->dt_procs->dph_symbuckets);
+
+		/*
+		 * Control threads are started as processes need them.  If this
+		 * fails, grabs and creations fail.
+		 */
+		dtp->dt_procs->dph_ctllim = MAX(_dtrace_pidctlthreads, 1);
+		dtp->dt_procs->dph_proxy_spin = dt_proc_spin_initial();
+		dtp->dt_procs->dph_ctls = dt_zalloc(dtp,
+		    sizeof (dt_proc_ctl_t) * dtp->dt_procs->dph_ctllim);
+		if (dtp->dt_procs->dph_ctls == NULL)
+			dtp->dt_procs->dph_ctllim = 0;
 	}
 }
 
@@ -2240,7 +3237,22 @@ dt_proc_hash_destroy(dtrace_hdl_t *dtp)
 {
 	dt_proc_hash_t *dph = dtp->dt_procs;
 	dt_proc_t *dpr, *old_dpr = NULL;
+	dt_symproc_t *dsp;
 	dt_proc_notify_t *npr, **npp;
+	dtrace_proc_cachestat_t stat;
+	uint_t i;
+
+	dtrace_proc_cachestat(dtp, &stat);
+	dt_dprintf("process handles: %llu hits, %llu misses, %llu evictions; "
+	    "symbolization handles: %llu hits, %llu misses, %llu evictions, "
+	    "%llu of %llu bytes used\n", (unsigned long long)stat.dtpc_hits,
+	    (unsigned long long)stat.dtpc_misses,
+	    (unsigned long long)stat.dtpc_evictions,
+	    (unsigned long long)stat.dtpc_sym_hits,
+	    (unsigned long long)stat.dtpc_sym_misses,
+	    (unsigned long long)stat.dtpc_sym_evictions,
+	    (unsigned long long)stat.dtpc_sym_size,
+	    (unsigned long long)stat.dtpc_sym_limit);
 
 	for (dpr = dt_list_next(&dph->dph_lrulist);
 	     dpr != NULL; dpr = dt_list_next(dpr)) {
@@ -2250,6 +3262,18 @@ dt_proc_hash_destroy(dtrace_hdl_t *dtp)
 	}
 	dt_free(dtp, old_dpr);
 
+	for (i = 0; i < dph->dph_nctls; i++)
+		dt_proc_ctl_stop(&dph->dph_ctls[i]);
+	dt_free(dtp, dph->dph_ctls);
+
+	if (dph->dph_notify_fd >= 0)
+		close(dph->dph_notify_fd);
+
+	while ((dsp = dt_list_next(&dph->dph_symlrulist)) != NULL)
+		dt_proc_sym_destroy(dtp, dsp);
+	dt_free(dtp, dph->dph_symhash);
+	dt_free(dtp, dph->dph_sesspids);
+
 	/*
 	 * Wipe out the notification enqueues, since we will never need them
 	 * again now DTrace is closing down.
@@ -2347,6 +3371,300 @@ dt_proc_release_unlock(dtrace_hdl_t *dtp, pid_t pid)
 	dt_proc_release(dtp, dpr);
 }
 
+/*
+ * Find or create the noninvasive symbolization handle for a process, and take a
+ * reference to it.  Returns NULL on error.
+ *
+ * With -xusnapshot, new handles read in all their symbol tables at once, while
+ * the process and its files are still there to read, and handles of processes
+ * that have since exited are kept and used as snapshots (still subject to the
+ * cache's memory limit), so that short-lived processes can be symbolized after
+ * they are gone.
+ */
+static dt_symproc_t *
+dt_proc_sym_hold(dtrace_hdl_t *dtp, pid_t pid)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_symproc_t *dsp;
+	unsigned long long start;
+	uint_t h;
+	int err;
+
+	dsp = dt_proc_sym_lookup(dtp, pid);
+
+	if ((start = Pstart_time(pid)) == 0) {
+		if (dsp != NULL && dtp->dt_usnapshot) {
+			dt_dprintf("pid %d has exited, using snapshot\n",
+			    (int)pid);
+			dt_list_delete(&dph->dph_symlrulist, dsp);
+			dt_list_prepend(&dph->dph_symlrulist, dsp);
+			dsp->dsp_refs++;
+			dsp->dsp_fresh = 1;
+			dph->dph_symhits++;
+			return dsp;
+		}
+
+		dt_dprintf("pid %d does not exist, cannot symbolize\n",
+		    (int)pid);
+		dt_set_errno(dtp, ESRCH);
+		return NULL;
+	}
+
+	/*
+	 * If this pid is cached but its start time has changed, it now belongs
+	 * to a different process: throw the old handle away.
+	 */
+	if (dsp != NULL && dsp->dsp_start != start) {
+		dt_dprintf("pid %d reused, dropping symbolization handle\n",
+		    (int)pid);
+		assert(dsp->dsp_refs == 0);
+		dt_proc_sym_destroy(dtp, dsp);
+		dsp = NULL;
+	}
+
+	if (dsp != NULL) {
+		dt_list_delete(&dph->dph_symlrulist, dsp);
+		dt_list_prepend(&dph->dph_symlrulist, dsp);
+		dsp->dsp_refs++;
+		dsp->dsp_fresh = 0;
+		dph->dph_symhits++;
+		return dsp;
+	}
+
+	dph->dph_symmisses++;
+
+	if ((dsp = dt_zalloc(dtp, sizeof (dt_symproc_t))) == NULL)
+		return NULL; /* errno is set for us */
+
+	if ((dsp->dsp_proc = Pgrab(pid, 2, 0, NULL, &err)) == NULL) {
+		dt_dprintf("noninvasive Pgrab(%d) failed: %s\n", (int)pid,
+		    strerror(err));
+		dt_free(dtp, dsp);
+		dt_set_errno(dtp, err);
+		return NULL;
+	}
+
+	if (dtp->dt_usnapshot)
+		Pupdate_syms(dsp->dsp_proc);
+
+	/*
+	 * A fresh handle reads the mappings on first use anyway.
+	 */
+	dsp->dsp_pid = pid;
+	dsp->dsp_start = start;
+	dsp->dsp_refs = 1;
+	dsp->dsp_fresh = 1;
+	h = dt_proc_hash_pid(pid, dph->dph_symbuckets);
+	dsp->dsp_hash = dph->dph_symhash[h];
+	dph->dph_symhash[h] = dsp;
+	dt_list_prepend(&dph->dph_symlrulist, dsp);
+	dph->dph_symcnt++;
+	dt_proc_sym_hash_grow(dtp);
+
+	dt_dprintf("grabbed pid %d for symbolization\n", (int)pid);
+
+	dt_proc_sym_charge(dtp, dsp);
+
+	return dsp;
+}
+
+/*
+ * Grab sessions.
+ *
+ * Formatting a buffer full of ustack() or usym() records would otherwise grab
+ * and release the same few processes once per record.  While a session is open
+ * (for one pass of dtrace_consume() or dtrace_aggregate_print()), the first
+ * dt_proc_sym_grab() of each process keeps it held, and locked if it is under
+ * control, until dt_proc_session_end(): later grabs of it in the same session
+ * return at once, and releases do nothing.
+ *
+ * Sessions nest: only the outermost releases anything.
+ */
+void
+dt_proc_session_begin(dtrace_hdl_t *dtp)
+{
+	dtp->dt_procs->dph_sessdepth++;
+}
+
+/*
+ * Add a pid to the current session.  Returns zero if the session cannot hold
+ * it, in which case it is released as usual.
+ */
+static int
+dt_proc_session_add(dtrace_hdl_t *dtp, pid_t pid)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+
+	if (dph->dph_nsesspids == dph->dph_sesspidsz) {
+		uint_t sz = dph->dph_sesspidsz == 0 ? 16 :
+		    dph->dph_sesspidsz * 2;
+		pid_t *pids;
+
+		if ((pids = dt_alloc(dtp, sz * sizeof (pid_t))) == NULL)
+			return 0;
+
+		if (dph->dph_nsesspids > 0)
+			memcpy(pids, dph->dph_sesspids,
+			    dph->dph_nsesspids * sizeof (pid_t));
+		dt_free(dtp, dph->dph_sesspids);
+		dph->dph_sesspids = pids;
+		dph->dph_sesspidsz = sz;
+	}
+
+	dph->dph_sesspids[dph->dph_nsesspids++] = pid;
+	return 1;
+}
+
+void
+dt_proc_session_end(dtrace_hdl_t *dtp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_proc_t *dpr;
+	dt_symproc_t *dsp;
+	uint_t i;
+
+	assert(dph->dph_sessdepth > 0);
+	if (--dph->dph_sessdepth > 0)
+		return;
+
+	/*
+	 * A process held by the session for symbolization alone may have come
+	 * under full control later in the same session, so it may be held
+	 * both ways: release each independently.
+	 */
+	for (i = 0; i < dph->dph_nsesspids; i++) {
+		pid_t pid = dph->dph_sesspids[i];
+
+		if ((dsp = dt_proc_sym_lookup(dtp, pid)) != NULL &&
+		    dsp->dsp_session) {
+			dsp->dsp_session = 0;
+			dt_proc_sym_drop(dtp, dsp);
+		}
+
+		if ((dpr = dt_proc_lookup(dtp, pid)) != NULL &&
+		    dpr->dpr_session) {
+			dpr->dpr_session = 0;
+			dt_proc_release_unlock(dtp, pid);
+		}
+	}
+
+	if (dph->dph_nsesspids > 0)
+		dt_dprintf("grab session ended, %u processes released\n",
+		    dph->dph_nsesspids);
+	dph->dph_nsesspids = 0;
+}
+
+/*
+ * Grab a process only in order to symbolize its addresses, returning its pid,
+ * or -1 on error.  Release with dt_proc_sym_release().
+ *
+ * If the process is already under full control, that is used, since it knows
+ * about link maps and has its mappings kept up to date by rtld events.
+ * Otherwise, a cached noninvasive handle is used or created: no ptrace(), no
+ * control thread, nothing done to the process at all.
+ */
+pid_t
+dt_proc_sym_grab(dtrace_hdl_t *dtp, pid_t pid)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_proc_t *dpr = dt_proc_lookup(dtp, pid);
+	dt_symproc_t *dsp;
+
+	if (dph->dph_sessdepth > 0) {
+		if (dpr != NULL && dpr->dpr_session)
+			return pid;
+		if (dpr == NULL &&
+		    (dsp = dt_proc_sym_lookup(dtp, pid)) != NULL &&
+		    dsp->dsp_session)
+			return pid;
+	}
+
+	if (dph->dph_symhash != NULL && dpr == NULL) {
+		if ((dsp = dt_proc_sym_hold(dtp, pid)) == NULL)
+			return -1;
+
+		if (dph->dph_sessdepth > 0 && dt_proc_session_add(dtp, pid))
+			dsp->dsp_session = 1;
+		return pid;
+	}
+
+	/*
+	 * Snapshot even processes under full control, since they are torn
+	 * down as soon as they die.
+	 */
+	if (dtp->dt_usnapshot)
+		dt_proc_sym_snapshot(dtp, pid);
+
+	if (dt_proc_grab_lock(dtp, pid, DTRACE_PROC_WAITING |
+		DTRACE_PROC_SHORTLIVED) < 0)
+		return -1;
+
+	if (dph->dph_sessdepth > 0 &&
+	    (dpr = dt_proc_lookup(dtp, pid)) != NULL &&
+	    dt_proc_session_add(dtp, pid))
+		dpr->dpr_session = 1;
+
+	return pid;
+}
+
+/*
+ * Make sure a snapshot of a process exists for -xusnapshot, so that it can be
+ * symbolized by dt_proc_sym_grab() even after it exits.
+ */
+void
+dt_proc_sym_snapshot(dtrace_hdl_t *dtp, pid_t pid)
+{
+	dt_symproc_t *dsp;
+
+	if (dtp->dt_procs->dph_symhash == NULL)
+		return;
+
+	if ((dsp = dt_proc_sym_hold(dtp, pid)) != NULL) {
+		dsp->dsp_refs--;
+		dt_proc_sym_charge(dtp, dsp);
+	}
+}
+
+void
+dt_proc_sym_release(dtrace_hdl_t *dtp, pid_t pid)
+{
+	dt_proc_t *dpr;
+	dt_symproc_t *dsp;
+
+	if ((dpr = dt_proc_lookup(dtp, pid)) != NULL) {
+		if (!dpr->dpr_session)
+			dt_proc_release_unlock(dtp, pid);
+		return;
+	}
+
+	dsp = dt_proc_sym_lookup(dtp, pid);
+	if (dsp == NULL || dsp->dsp_session)
+		return;
+
+	dt_proc_sym_drop(dtp, dsp);
+}
+
+void
+dtrace_proc_cachestat(dtrace_hdl_t *dtp, dtrace_proc_cachestat_t *stat)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+
+	memset(stat, 0, sizeof (dtrace_proc_cachestat_t));
+	if (dph == NULL)
+		return;
+
+	stat->dtpc_hits = dph->dph_hits;
+	stat->dtpc_misses = dph->dph_misses;
+	stat->dtpc_evictions = dph->dph_evictions;
+	stat->dtpc_handles = dph->dph_lrucnt;
+	stat->dtpc_sym_hits = dph->dph_symhits;
+	stat->dtpc_sym_misses = dph->dph_symmisses;
+	stat->dtpc_sym_evictions = dph->dph_symevictions;
+	stat->dtpc_sym_handles = dph->dph_symcnt;
+	stat->dtpc_sym_size = dph->dph_symsize;
+	stat->dtpc_sym_limit = dph->dph_symsizelim;
+}
+
 /*
  * Note: no proxying. Our tracking of the process is about to be destroyed: we
  * do not care if it exec()s.
@@ -12,12 +12,16 @@
 #include <libproc.h>
 #include <dtrace.h>
 #include <pthread.h>
+#include <setjmp.h>
+#include <ucontext.h>
 #include <dt_list.h>
 
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
+struct dt_proc_ctx;
+
 typedef struct dt_proc {
 	dt_list_t dpr_list;		/* prev/next pointers for lru chain */
 	struct dt_proc *dpr_hash;	/* next pointer for pid hash chain */
@@ -33,9 +37,10 @@ typedef struct dt_proc {
 	pthread_cond_t dpr_cv;		/* cond for startup/stop/quit/done */
 	pthread_cond_t dpr_msg_cv;	/* cond for msgs from main thread */
 	pthread_t dpr_tid;		/* control thread (or zero if none) */
+	struct dt_proc_ctx *dpr_ctx;	/* control context (valid until
+					   dpr_done is set) */
 	pid_t dpr_pid;			/* pid of process */
-	int dpr_fd;			/* waitfd for process */
-	int dpr_proxy_fd[2];		/* proxy request pipe from main thread */
+	int dpr_fd;			/* waitfd or pidfd for process */
 	uint_t dpr_refs;		/* reference count */
 	uint8_t dpr_stop;		/* stop mask: see flag bits below */
 	uint8_t dpr_done;		/* done flag: ctl thread has exited */
@@ -52,6 +57,8 @@ typedef struct dt_proc {
 	uint8_t dpr_awaiting_dlactivity; /* true if a dlopen()/dlclose() has
 					    been seen and the victim ld.so is
 					    not yet in a consistent state */
+	uint8_t dpr_session;		/* held by the current grab session */
+	uint8_t dpr_pidfd;		/* dpr_fd is a pidfd: stops are polled */
 
 	/*
 	 * Proxying. These structures encode the return type and parameters of
@@ -63,8 +70,10 @@ typedef struct dt_proc {
 	 * degenerates to an immediate call if it is executed from the
 	 * process-control thread itself.
 	 *
-	 * Currently proxied requests are proxy_pwait(), proxy_ptrace() and
-	 * dt_proc_continue(): the latter takes no arguments.  In all these
+	 * Currently proxied requests are proxy_pwait(), proxy_ptrace(),
+	 * proxy_ptrace_batch() and dt_proc_continue(): the latter takes no
+	 * arguments.  proxy_ptrace_batch() carries a whole batch of ptrace()
+	 * requests in one round trip.  In all these
 	 * cases, if an exec is detected, dpr_proxy_exec_retry is set on return:
 	 * it is then the proxy's responsibility to rethrow and unwind all the
 	 * way out, destroy and reattach to the libproc structure, and retry
@@ -87,6 +96,11 @@ typedef struct dt_proc {
 			void *data;
 		} dpr_ptrace;
 
+		struct {
+			ptrace_req_t *reqs;
+			size_t n;
+		} dpr_ptrace_batch;
+
 		struct {
 			struct ps_prochandle *P;
 			boolean_t block;
@@ -131,20 +145,131 @@ typedef struct dtrace_proc {
 #define	DT_PROC_STOP_POSTINIT	0x40	/* wait on dpr_cv at rtld postinit */
 #define	DT_PROC_STOP_MAIN	0x80	/* wait on dpr_cv at a.out`main() */
 
+/*
+ * A process-control thread.  A small pool of these multiplexes all the
+ * processes under control: each waits in epoll_wait() on the waitfds (or
+ * pidfds) of all its processes and on a wakeup eventfd written by the main
+ * thread, and switches to the control context of whichever process needs
+ * attention.  A process stays on the thread that grabbed or created it, since
+ * ptrace() is per-thread.
+ */
+typedef struct dt_proc_ctl {
+	pthread_t dpc_tid;		/* thread ID */
+	dtrace_hdl_t *dpc_hdl;		/* back pointer to libdtrace handle */
+	int dpc_epfd;			/* epoll fd for process fds and wakeups */
+	int dpc_wake_fd;		/* wakeup eventfd from main thread */
+	pthread_mutex_t dpc_lock;	/* lock protecting the fields below */
+	struct dt_proc_ctx *dpc_kicked;	/* contexts with pending requests */
+	uint_t dpc_nprocs;		/* number of contexts on this thread */
+	uint8_t dpc_quit;		/* exit once dpc_nprocs drops to zero */
+	uint8_t dpc_spinning;		/* polling dpc_kicked: no wakeup needed */
+	ucontext_t dpc_sched;		/* scheduler context (thread-private) */
+	struct dt_proc_ctx *dpc_retry;	/* contexts waiting for their dpr_lock
+					   (thread-private) */
+	uint_t dpc_spin;		/* ns to poll for the next request
+					   (thread-private) */
+	struct dt_proc_ctx *dpc_polled;	/* contexts of processes with pidfds,
+					   polled for stops (thread-private) */
+	int dpc_poll_ms;		/* ms between polls of dpc_polled
+					   (thread-private) */
+} dt_proc_ctl_t;
+
+/*
+ * The control context of one process: the stack and saved registers of what
+ * used to be a whole thread per process.  It runs dt_proc_control() and
+ * switches back to its control thread's scheduler whenever it would once have
+ * blocked in poll(), or (after brief spinning) on its dpr_lock.
+ */
+typedef struct dt_proc_ctx {
+	ucontext_t dcx_uc;		/* saved context while switched out */
+	void *dcx_stack;		/* mmap()ed stack, with guard page */
+	size_t dcx_stacksize;		/* size of dcx_stack */
+	jmp_buf *dcx_unwinder_pad;	/* unwinder pad while switched out */
+	dt_proc_ctl_t *dcx_ctl;		/* owning control thread */
+	void *dcx_data;			/* dt_proc_control() argument */
+	struct dt_proc_ctx *dcx_kick_next; /* next on dpc_kicked */
+	struct dt_proc_ctx *dcx_retry_next; /* next on dpc_retry */
+	struct dt_proc_ctx *dcx_dead_next; /* next exited context to free */
+	struct dt_proc_ctx *dcx_poll_next; /* next on dpc_polled */
+	pid_t dcx_poll_pid;		/* process to poll for stops */
+	uint8_t dcx_kicked;		/* on dpc_kicked (under dpc_lock) */
+	uint8_t dcx_retrying;		/* on dpc_retry */
+	uint8_t dcx_armed;		/* process fd armed in the epoll set */
+	uint8_t dcx_wait;		/* what the context is waiting for */
+	uint8_t dcx_revents;		/* DT_PROC_CTX_* events since last wait */
+	uint8_t dcx_exited;		/* context has finished running */
+} dt_proc_ctx_t;
+
+#define	DT_PROC_CTX_PROC	0x01	/* process state change */
+#define	DT_PROC_CTX_PROXY	0x02	/* request from the main thread */
+
+#define	DT_PROC_CTX_WAIT_EVENT	1	/* waiting for DT_PROC_CTX_* events */
+#define	DT_PROC_CTX_WAIT_LOCK	2	/* waiting for the dpr_lock */
+
+/*
+ * A process grabbed only to turn its addresses into names.  These handles are
+ * noninvasive: there is no control thread and no ptrace(), only the mappings
+ * and the ELF files behind them.  They are cached by pid, and revalidated
+ * against the process start time so that a reused pid is never mistaken for
+ * the process that used to have it.
+ */
+typedef struct dt_symproc {
+	dt_list_t dsp_list;		/* prev/next pointers for lru chain */
+	struct dt_symproc *dsp_hash;	/* next pointer for pid hash chain */
+	struct ps_prochandle *dsp_proc;	/* proc handle for libproc calls */
+	pid_t dsp_pid;			/* pid of process */
+	unsigned long long dsp_start;	/* start time of process */
+	uint_t dsp_refs;		/* reference count */
+	uint8_t dsp_fresh;		/* mappings reread since last grab */
+	uint8_t dsp_session;		/* held by the current grab session */
+	size_t dsp_size;		/* memory charged to the cache */
+} dt_symproc_t;
+
 typedef struct dt_proc_hash {
 	pthread_mutex_t dph_lock;	/* lock protecting dph_notify list */
 	pthread_cond_t dph_cv;		/* cond for waiting for dph_notify */
 	dt_proc_notify_t *dph_notify;	/* list of pending proc notifications */
+	int dph_notify_fd;		/* eventfd for dtrace_pollfd(), or -1 */
 	dt_list_t dph_lrulist;		/* list of dt_proc_t's in lru order */
 	uint_t dph_lrulim;		/* limit on number of procs to hold */
 	uint_t dph_lrucnt;		/* count of cached process handles */
 	uint_t dph_hashlen;		/* size of hash chains array */
 	uint_t dph_noninvasive_created;	/* count of noninvasive -c procs */
+	uint64_t dph_hits;		/* grabs finding a cached dt_proc_t */
+	uint64_t dph_misses;		/* grabs creating a dt_proc_t */
+	uint64_t dph_evictions;		/* dt_proc_t's retired by the lru */
+	dt_list_t dph_symlrulist;	/* list of dt_symproc_t's in lru order */
+	size_t dph_symsizelim;		/* limit on memory of symprocs held */
+	size_t dph_symsize;		/* memory of cached symprocs */
+	uint_t dph_symcnt;		/* count of cached symprocs */
+	uint_t dph_symbuckets;		/* size of symproc hash chains array */
+	dt_symproc_t **dph_symhash;	/* symproc hash chains array */
+	uint64_t dph_symhits;		/* symproc grabs finding a cached one */
+	uint64_t dph_symmisses;		/* symproc grabs creating one */
+	uint64_t dph_symevictions;	/* symprocs dropped by the lru */
+	uint_t dph_sessdepth;		/* nesting depth of grab sessions */
+	pid_t *dph_sesspids;		/* pids held by the grab session */
+	uint_t dph_nsesspids;		/* number of pids in dph_sesspids */
+	uint_t dph_sesspidsz;		/* allocated size of dph_sesspids */
+	dt_proc_ctl_t *dph_ctls;	/* process-control thread pool */
+	uint_t dph_nctls;		/* number of control threads started */
+	uint_t dph_ctllim;		/* limit on number of control threads */
+	uint_t dph_proxy_spin;		/* ns to spin awaiting a proxy reply */
+	int dph_procmon;		/* process fd kind: DT_PROC_MON_* */
 	dt_proc_t *dph_hash[1];		/* hash chains array */
 } dt_proc_hash_t;
 
+#define	DT_PROC_MON_AUTO	0	/* waitfd if the kernel has it, else pidfd */
+#define	DT_PROC_MON_WAITFD	1	/* waitfd only */
+#define	DT_PROC_MON_PIDFD	2	/* pidfd only */
+
 extern pid_t dt_proc_grab_lock(dtrace_hdl_t *dtp, pid_t pid, int flags);
 extern void dt_proc_release_unlock(dtrace_hdl_t *, pid_t);
+extern pid_t dt_proc_sym_grab(dtrace_hdl_t *, pid_t);
+extern void dt_proc_sym_release(dtrace_hdl_t *, pid_t);
+extern void dt_proc_sym_snapshot(dtrace_hdl_t *, pid_t);
+extern void dt_proc_session_begin(dtrace_hdl_t *);
+extern void dt_proc_session_end(dtrace_hdl_t *);
 extern void dt_proc_lock(dt_proc_t *dpr);
 extern void dt_proc_unlock(dt_proc_t *dpr);
 extern dt_proc_t *dt_proc_lookup(dtrace_hdl_t *, pid_t);
@@ -155,6 +280,7 @@ extern void dt_proc_enqueue_exits(dtrace_hdl_t *dtp);
  */
 extern int dt_Plookup_by_addr(dtrace_hdl_t *, pid_t, uintptr_t, char *, size_t,
     GElf_Sym *);
+extern int dt_Plookup_by_addrs(dtrace_hdl_t *, pid_t, praddrinfo_t *, size_t);
 extern const prmap_t *dt_Paddr_to_map(dtrace_hdl_t *, pid_t, uintptr_t);
 extern const prmap_t *dt_Plmid_to_map(dtrace_hdl_t *, pid_t, Lmid_t,
     const char *);
@@ -167,6 +293,8 @@ extern int dt_Pxlookup_by_name(dtrace_hdl_t *, pid_t, Lmid_t, const char *,
 extern int dt_Pwritable_mapping(dtrace_hdl_t *, pid_t, uintptr_t);
 extern int dt_Psymbol_iter_by_addr(dtrace_hdl_t *, pid_t, const char *, int,
     int, proc_sym_f *, void *);
+extern int dt_Psymbol_iter_by_prefix(dtrace_hdl_t *, pid_t, const char *,
+    int, int, const char *, proc_sym_f *, void *);
 extern int dt_Pobject_iter(dtrace_hdl_t *, pid_t, proc_map_f *, void *);
 extern ssize_t dt_Pread(dtrace_hdl_t *, pid_t, void *, size_t, uintptr_t);
 
@@ -10,6 +10,7 @@
 #include <errno.h>
 #include <ctype.h>
 
+#include <port.h>
 #include <dt_string.h>
 
 /*
@@ -271,6 +272,71 @@ strisglob(const char *s)
 	return (0);
 }
 
+/*
+ * Compile a glob pattern for dt_glob_match().  The pattern must outlive the
+ * compiled form.  The literal prefix runs up to the first unescaped '*', '?' or
+ * '[' (a trailing '\\' ends it too, and is left to gmatch()).
+ */
+int
+dt_glob_compile(dt_glob_t *gp, const char *pattern)
+{
+	const char *p = pattern;
+	char *q;
+
+	if ((gp->dg_prefix = q = malloc(strlen(pattern) + 1)) == NULL)
+		return (-1);
+
+	while (*p != '\0' && *p != '*' && *p != '?' && *p != '[') {
+		if (*p == '\\') {
+			if (p[1] == '\0')
+				break;
+			p++;
+		}
+		*q++ = *p++;
+	}
+	*q = '\0';
+
+	gp->dg_pattern = pattern;
+	gp->dg_prefixlen = q - gp->dg_prefix;
+
+	if (*p == '\0')
+		gp->dg_kind = DT_GLOB_EXACT;
+	else if (strcmp(p, "*") == 0)
+		gp->dg_kind = DT_GLOB_PREFIX;
+	else
+		gp->dg_kind = DT_GLOB_OTHER;
+
+	return (0);
+}
+
+/*
+ * Match a string against a compiled glob pattern, as gmatch() would.  Only
+ * strings beginning with the literal prefix get as far as gmatch(), and only if
+ * the prefix alone does not settle the matter.
+ */
+int
+dt_glob_match(const dt_glob_t *gp, const char *s)
+{
+	if (strncmp(s, gp->dg_prefix, gp->dg_prefixlen) != 0)
+		return (0);
+
+	switch (gp->dg_kind) {
+	case DT_GLOB_EXACT:
+		return (s[gp->dg_prefixlen] == '\0');
+	case DT_GLOB_PREFIX:
+		return (1);
+	default:
+		return (gmatch(s, gp->dg_pattern));
+	}
+}
+
+void
+dt_glob_free(dt_glob_t *gp)
+{
+	free(gp->dg_prefix);
+	gp->dg_prefix = NULL;
+}
+
 /*
  * Hyphenate a string in-place by converting any instances of "__" to "-",
  * which we use for probe names to improve readability, and return the string.
@@ -22,6 +22,26 @@ extern const char *strbasename(const char *);
 extern const char *strbadidnum(const char *);
 extern int strisglob(const char *);
 extern char *strhyphenate(char *);
+
+/*
+ * A glob pattern compiled for matching against many strings: the literal
+ * prefix that every matching string begins with, and what is left to check
+ * once that prefix has matched.
+ */
+typedef struct dt_glob {
+	const char *dg_pattern;		/* the pattern */
+	char *dg_prefix;		/* its literal prefix, unescaped */
+	size_t dg_prefixlen;		/* length of dg_prefix */
+	int dg_kind;			/* DT_GLOB_* */
+} dt_glob_t;
+
+#define	DT_GLOB_EXACT	0		/* no metacharacters: just the prefix */
+#define	DT_GLOB_PREFIX	1		/* the prefix followed by "*" */
+#define	DT_GLOB_OTHER	2		/* anything else: gmatch() */
+
+extern int dt_glob_compile(dt_glob_t *, const char *);
+extern int dt_glob_match(const dt_glob_t *, const char *);
+extern void dt_glob_free(dt_glob_t *);
 #ifndef HAVE_STRRSTR
 extern char *strrstr(const char *, const char *);
 #endif
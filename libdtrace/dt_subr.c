@@ -858,8 +858,7 @@ dtrace_uaddr2str(dtrace_hdl_t *dtp, pid_t pid,
 	char *obj;
 
 	if (pid != 0)
-		pid = dt_proc_grab_lock(dtp, pid, DTRACE_PROC_WAITING |
-		    DTRACE_PROC_SHORTLIVED);
+		pid = dt_proc_sym_grab(dtp, pid);
 
 	if (pid < 0) {
 		(void) snprintf(c, sizeof (c), "0x%llx", (unsigned long long) addr);
@@ -905,7 +904,7 @@ dtrace_uaddr2str(dtrace_hdl_t *dtp, pid_t pid,
 		    (unsigned long long) addr);
 	}
 
-	dt_proc_release_unlock(dtp, pid);
+	dt_proc_sym_release(dtp, pid);
 
 	return (dt_string2str(c, str, nbytes));
 }
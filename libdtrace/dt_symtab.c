@@ -5,7 +5,12 @@
  * kernel symbols have no ELF symbol table.  Thus, this module implements a
  * simple, reasonably memory-efficient symbol table manager.
  *
- * TODO: increase efficiency (perhaps Huffman-coding symbol names?)
+ * Symbols are kept as a structure of arrays indexed by symbol number: one
+ * array each for addresses, sizes, ELF info bytes, name offsets and name-hash
+ * chain links.  Names live in a single string table in which identical names
+ * are stored only once, so that every name is reachable via a 32-bit offset.
+ * Kernels have on the order of 150,000 symbols, so avoiding a separate
+ * allocation (and several pointers) per symbol matters.
  */
 
 /*
@@ -16,27 +21,17 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <dt_symtab.h>
 #include <dt_impl.h>
-#include <dt_list.h>
 #include <unistd.h>
 
 #define DT_ST_SORTED 0x01		/* Sorted, ready for searching. */
 #define DT_ST_PACKED 0x02		/* Symbol table packed
 					 * (necessarily sorted too) */
 
-struct dt_symbol {
-	dt_list_t dts_list;		/* list forward/back pointers */
-	union {
-		char *str;		/* symbol name */
-		size_t off;		/* symbol offset in strtab */
-	} dts_name;
-	GElf_Addr dts_addr;		/* symbol address */
-	GElf_Xword dts_size;		/* symbol size */
-	unsigned char dts_info;		/* ELF symbol information */
-	struct dt_symbol *dts_next;	/* hash chain pointer */
-};
+#define DT_ST_NOSYM ((uint32_t) -1)	/* end of a hash chain */
 
 /*
  * Symbol address ranges might overlap.  E.g., one symbol might have a broad
@@ -51,20 +46,66 @@ struct dt_symbol {
 typedef struct dt_symrange {
 	GElf_Addr dtsr_lo;
 	GElf_Addr dtsr_hi;
-	dt_symbol_t *dtsr_sym;
+	uint32_t dtsr_sym;		/* symbol index */
 } dt_symrange_t;
 
+/*
+ * Once a symtab is packed, the ranges are rearranged for searching: their
+ * lower bounds go into one array in Eytzinger (breadth-first binary tree)
+ * order, and everything else goes into a parallel payload array.  A search
+ * then descends through the lower bounds from the front of the array, so the
+ * first few levels of every search share a handful of cache lines, and the
+ * next levels can be prefetched before they are needed.
+ */
+typedef struct dt_symrange_val {
+	GElf_Addr dtsrv_hi;
+	uint32_t dtsrv_sym;		/* symbol index */
+} dt_symrange_val_t;
+
 struct dt_symtab {
-	dt_list_t dtst_symlist;		/* symbol list */
-	dt_symbol_t **dtst_syms_by_name;/* symbol name->addr hash buckets */
+	GElf_Addr *dtst_addrs;		/* symbol addresses */
+	GElf_Xword *dtst_sizes;		/* symbol sizes */
+	unsigned char *dtst_info;	/* ELF symbol information */
+	uint32_t *dtst_names;		/* symbol name offsets in dtst_strtab */
+	uint32_t *dtst_next;		/* hash chain links */
+	uint_t dtst_num_sym;		/*   - number of symbols */
+	uint_t dtst_num_sym_alloc;	/*   - number of symbols allocated */
+	uint32_t *dtst_syms_by_name;	/* symbol name->addr hash buckets */
 	uint_t dtst_symbuckets;		/* number of buckets */
 	char *dtst_strtab;		/* string table of symbol names */
+	size_t dtst_strsz;		/*   - bytes used */
+	size_t dtst_strsz_alloc;	/*   - bytes allocated */
 	dt_symrange_t *dtst_ranges;	/* range->symbol mapping */
 	uint_t dtst_num_range;		/*   - number of ranges */
 	uint_t dtst_num_range_alloc;	/*   - number of ranges allocated */
+	GElf_Addr *dtst_range_lo;	/* packed: Eytzinger-ordered range lows */
+	dt_symrange_val_t *dtst_range_val; /* packed: range payloads */
 	int dtst_flags;			/* symbol table flags */
 };
 
+/*
+ * A dt_symbol_t is never dereferenced: it points at the symbol's entry in
+ * dtst_addrs, which yields the index into all the other per-symbol arrays.
+ * It is only valid until the next insertion into (or packing of) the symtab.
+ */
+static inline uint32_t
+dt_symbol_idx(const dt_symtab_t *symtab, const dt_symbol_t *symbol)
+{
+	return (const GElf_Addr *) symbol - symtab->dtst_addrs;
+}
+
+static inline dt_symbol_t *
+dt_symbol_at(const dt_symtab_t *symtab, uint32_t i)
+{
+	return (dt_symbol_t *) &symtab->dtst_addrs[i];
+}
+
+static inline const char *
+dt_symtab_name(const dt_symtab_t *symtab, uint32_t i)
+{
+	return &symtab->dtst_strtab[symtab->dtst_names[i]];
+}
+
 /*
  * Grow the range->symbol mapping.
  */
@@ -83,6 +124,136 @@ dt_symtab_grow_ranges(dt_symtab_t *symtab)
 	return new_ranges;
 }
 
+/*
+ * Grow the per-symbol arrays.  The recorded allocation size is only updated
+ * once all of them have been successfully reallocated.
+ */
+static int
+dt_symtab_grow_syms(dt_symtab_t *symtab)
+{
+	uint_t num_alloc = (symtab->dtst_num_sym_alloc + 1) * 2;
+	void *p;
+
+	if ((p = realloc(symtab->dtst_addrs,
+		    sizeof (GElf_Addr) * num_alloc)) == NULL)
+		return -1;
+	symtab->dtst_addrs = p;
+
+	if ((p = realloc(symtab->dtst_sizes,
+		    sizeof (GElf_Xword) * num_alloc)) == NULL)
+		return -1;
+	symtab->dtst_sizes = p;
+
+	if ((p = realloc(symtab->dtst_info,
+		    sizeof (unsigned char) * num_alloc)) == NULL)
+		return -1;
+	symtab->dtst_info = p;
+
+	if ((p = realloc(symtab->dtst_names,
+		    sizeof (uint32_t) * num_alloc)) == NULL)
+		return -1;
+	symtab->dtst_names = p;
+
+	if ((p = realloc(symtab->dtst_next,
+		    sizeof (uint32_t) * num_alloc)) == NULL)
+		return -1;
+	symtab->dtst_next = p;
+
+	symtab->dtst_num_sym_alloc = num_alloc;
+	return 0;
+}
+
+/*
+ * Rehash the name->symbol hash into a larger number of buckets, to keep the
+ * chains short no matter how large the symbol table gets.
+ */
+static int
+dt_symtab_rehash(dt_symtab_t *symtab)
+{
+	uint_t nbuckets = symtab->dtst_symbuckets * 4 + 1;
+	uint32_t *buckets = malloc(nbuckets * sizeof (uint32_t));
+	uint_t i;
+
+	if (buckets == NULL)
+		return -1;
+
+	memset(buckets, 0xff, nbuckets * sizeof (uint32_t));
+
+	/*
+	 * Walk the old chains rather than all symbols, so that symbols purged
+	 * from the hash stay purged.  Walking in bucket order reverses chain
+	 * order, which doesn't matter: there is at most one symbol with any
+	 * given name in a chain once purged.
+	 */
+	for (i = 0; i < symtab->dtst_symbuckets; i++) {
+		uint32_t j, next;
+
+		for (j = symtab->dtst_syms_by_name[i]; j != DT_ST_NOSYM;
+		     j = next) {
+			uint_t h = dt_strtab_hash(dt_symtab_name(symtab, j),
+			    NULL) % nbuckets;
+
+			next = symtab->dtst_next[j];
+			symtab->dtst_next[j] = buckets[h];
+			buckets[h] = j;
+		}
+	}
+
+	free(symtab->dtst_syms_by_name);
+	symtab->dtst_syms_by_name = buckets;
+	symtab->dtst_symbuckets = nbuckets;
+
+	return 0;
+}
+
+/*
+ * Look up a name in the name->symbol hash, returning the symbol's index or
+ * DT_ST_NOSYM.
+ */
+static uint32_t
+dt_symtab_lookup(dt_symtab_t *symtab, const char *name, ulong_t hval)
+{
+	uint32_t i;
+
+	for (i = symtab->dtst_syms_by_name[hval % symtab->dtst_symbuckets];
+	     i != DT_ST_NOSYM; i = symtab->dtst_next[i])
+		if (strcmp(dt_symtab_name(symtab, i), name) == 0)
+			return i;
+
+	return DT_ST_NOSYM;
+}
+
+/*
+ * Add a name to the string table, returning its offset, or -1 on error.
+ */
+static ssize_t
+dt_symtab_add_name(dt_symtab_t *symtab, const char *name, size_t len)
+{
+	size_t off = symtab->dtst_strsz;
+
+	if (off + len + 1 > UINT32_MAX)
+		return -1;
+
+	if (off + len + 1 > symtab->dtst_strsz_alloc) {
+		size_t sz = symtab->dtst_strsz_alloc * 2;
+		char *strtab;
+
+		if (sz < off + len + 1)
+			sz = off + len + 1 + 4096;
+
+		if ((strtab = realloc(symtab->dtst_strtab, sz)) == NULL)
+			return -1;
+
+		symtab->dtst_strtab = strtab;
+		symtab->dtst_strsz_alloc = sz;
+	}
+
+	memcpy(&symtab->dtst_strtab[off], name, len + 1);
+	symtab->dtst_strsz += len + 1;
+
+	return off;
+}
+
 /*
  * Sort dtst_ranges.
  *
@@ -93,40 +264,43 @@ dt_symtab_grow_ranges(dt_symtab_t *symtab)
  * - we demote the name "cleanup_module"
  */
 static int
-dt_symrange_sort_cmp(const void *lp, const void *rp)
+dt_symrange_sort_cmp(const void *lp, const void *rp, void *arg)
 {
-	dt_symbol_t *lhs = ((dt_symrange_t *) lp)->dtsr_sym;
-	dt_symbol_t *rhs = ((dt_symrange_t *) rp)->dtsr_sym;
-
-	if (lhs->dts_addr < rhs->dts_addr)
+	dt_symtab_t *symtab = arg;
+	uint32_t lhs = ((dt_symrange_t *) lp)->dtsr_sym;
+	uint32_t rhs = ((dt_symrange_t *) rp)->dtsr_sym;
+	unsigned char linfo = symtab->dtst_info[lhs];
+	unsigned char rinfo = symtab->dtst_info[rhs];
+	const char *lname, *rname;
+
+	if (symtab->dtst_addrs[lhs] < symtab->dtst_addrs[rhs])
 		return -1;
-	if (lhs->dts_addr > rhs->dts_addr)
+	if (symtab->dtst_addrs[lhs] > symtab->dtst_addrs[rhs])
 		return +1;
 
-	if (lhs->dts_size > rhs->dts_size)
+	if (symtab->dtst_sizes[lhs] > symtab->dtst_sizes[rhs])
 		return -1;
-	if (lhs->dts_size < rhs->dts_size)
+	if (symtab->dtst_sizes[lhs] < symtab->dtst_sizes[rhs])
 		return +1;
 
-	if ((GELF_ST_TYPE(lhs->dts_info) == STT_NOTYPE) !=
-	    (GELF_ST_TYPE(rhs->dts_info) == STT_NOTYPE))
-		return GELF_ST_TYPE(lhs->dts_info) == STT_NOTYPE ? 1 : -1;
+	if ((GELF_ST_TYPE(linfo) == STT_NOTYPE) !=
+	    (GELF_ST_TYPE(rinfo) == STT_NOTYPE))
+		return GELF_ST_TYPE(linfo) == STT_NOTYPE ? 1 : -1;
 
-	if ((GELF_ST_BIND(lhs->dts_info) == STB_WEAK) !=
-	    (GELF_ST_BIND(rhs->dts_info) == STB_WEAK))
-		return GELF_ST_BIND(lhs->dts_info) == STB_WEAK ? 1 : -1;
+	if ((GELF_ST_BIND(linfo) == STB_WEAK) !=
+	    (GELF_ST_BIND(rinfo) == STB_WEAK))
+		return GELF_ST_BIND(linfo) == STB_WEAK ? 1 : -1;
 
-	/*
-	 * Note: packed strtabs must already be sorted and can be
-	 * neither changed nor resorted.
-	 */
-	if (strcmp(lhs->dts_name.str, "cleanup_module") &&
-	    strcmp(rhs->dts_name.str, "cleanup_module") == 0)
+	lname = dt_symtab_name(symtab, lhs);
+	rname = dt_symtab_name(symtab, rhs);
+
+	if (strcmp(lname, "cleanup_module") &&
+	    strcmp(rname, "cleanup_module") == 0)
 		return -1;
-	if (strcmp(rhs->dts_name.str, "cleanup_module") &&
-	    strcmp(lhs->dts_name.str, "cleanup_module") == 0)
+	if (strcmp(rname, "cleanup_module") &&
+	    strcmp(lname, "cleanup_module") == 0)
 		return +1;
-	return (strcmp(lhs->dts_name.str, rhs->dts_name.str));
+	return (strcmp(lname, rname));
 }
 
 /*
@@ -155,14 +329,15 @@ dt_symtab_create(void)
 	bzero(symtab, sizeof (struct dt_symtab));
 
 	symtab->dtst_symbuckets = _dtrace_strbuckets;
-	symtab->dtst_syms_by_name = calloc(symtab->dtst_symbuckets,
-	    sizeof (struct dt_symbol *));
+	symtab->dtst_syms_by_name = malloc(symtab->dtst_symbuckets *
+	    sizeof (uint32_t));
 
 	if (symtab->dtst_syms_by_name == NULL) {
-		free(symtab->dtst_syms_by_name);
 		free(symtab);
 		return NULL;
 	}
+	memset(symtab->dtst_syms_by_name, 0xff, symtab->dtst_symbuckets *
+	    sizeof (uint32_t));
 
 	return symtab;
 }
@@ -170,25 +345,19 @@ dt_symtab_create(void)
 void
 dt_symtab_destroy(dt_symtab_t *symtab)
 {
-	dt_symbol_t *dtsp;
-	dt_symbol_t *last_dtsp = NULL;
-
 	if (!symtab)
 		return;
 
 	free(symtab->dtst_ranges);
+	free(symtab->dtst_range_lo);
+	free(symtab->dtst_range_val);
 	free(symtab->dtst_syms_by_name);
 	free(symtab->dtst_strtab);
-
-	for (dtsp = dt_list_next(&symtab->dtst_symlist); dtsp != NULL;
-	     dtsp = dt_list_next(dtsp)) {
-		if (!(symtab->dtst_flags & DT_ST_PACKED))
-			free(dtsp->dts_name.str);
-		free(last_dtsp);
-		last_dtsp = dtsp;
-	}
-	free(last_dtsp);
-
+	free(symtab->dtst_addrs);
+	free(symtab->dtst_sizes);
+	free(symtab->dtst_info);
+	free(symtab->dtst_names);
+	free(symtab->dtst_next);
 	free(symtab);
 }
 
@@ -196,8 +365,11 @@ dt_symbol_t *
 dt_symbol_insert(dt_symtab_t *symtab, const char *name,
     GElf_Addr addr, GElf_Xword size, unsigned char info)
 {
+	ulong_t hval;
 	uint_t h;
-	dt_symbol_t *dtsp;
+	uint32_t i, prev;
+	ssize_t off;
+	size_t len;
 
 	/*
 	 * No insertion into packed symtabs.
@@ -205,26 +377,35 @@ dt_symbol_insert(dt_symtab_t *symtab, const char *name,
 	if (symtab->dtst_flags & DT_ST_PACKED)
 		return NULL;
 
-	if ((dtsp = malloc(sizeof (dt_symbol_t))) == NULL)
+	if (symtab->dtst_num_sym >= DT_ST_NOSYM - 1)
 		return NULL;
 
+	if (symtab->dtst_num_sym >= symtab->dtst_num_sym_alloc)
+		if (dt_symtab_grow_syms(symtab) < 0)
+			return NULL;
+
 	if (symtab->dtst_num_range >= symtab->dtst_num_range_alloc)
-		if (dt_symtab_grow_ranges(symtab) == NULL) {
-			free(dtsp);
+		if (dt_symtab_grow_ranges(symtab) == NULL)
 			return NULL;
-		}
 
-	bzero(dtsp, sizeof (dt_symbol_t));
-	dtsp->dts_name.str = strdup(name);
-	dtsp->dts_addr = addr;
-	dtsp->dts_size = size;
-	dtsp->dts_info = info;
+	if (symtab->dtst_num_sym >= symtab->dtst_symbuckets * 2)
+		if (dt_symtab_rehash(symtab) < 0)
+			return NULL;
 
-	if (dtsp->dts_name.str == NULL) {
-		free(dtsp->dts_name.str);
-		free(dtsp);
+	/*
+	 * Names are stored only once: duplicates share a string table offset.
+	 */
+	hval = dt_strtab_hash(name, &len);
+	if ((prev = dt_symtab_lookup(symtab, name, hval)) != DT_ST_NOSYM)
+		off = symtab->dtst_names[prev];
+	else if ((off = dt_symtab_add_name(symtab, name, len)) < 0)
 		return NULL;
-	}
+
+	i = symtab->dtst_num_sym++;
+	symtab->dtst_addrs[i] = addr;
+	symtab->dtst_sizes[i] = size;
+	symtab->dtst_info[i] = info;
+	symtab->dtst_names[i] = off;
 
 	/*
 	 * Address->symbol mapping.  Zero-size symbols do not
@@ -233,47 +414,66 @@ dt_symbol_insert(dt_symtab_t *symtab, const char *name,
 	 */
 
 	if (size > 0) {
-		symtab->dtst_ranges[symtab->dtst_num_range].dtsr_sym = dtsp;
+		symtab->dtst_ranges[symtab->dtst_num_range].dtsr_sym = i;
 		symtab->dtst_num_range++;
 	}
 
-	/*
-	 * Append to the doubly linked list.
-	 */
-	dt_list_append(&symtab->dtst_symlist, dtsp);
-
 	/*
 	 * Add to lookup-by-name hash table.
 	 */
-	h = dt_strtab_hash(name, NULL) % symtab->dtst_symbuckets;
-	dtsp->dts_next = symtab->dtst_syms_by_name[h];
-	symtab->dtst_syms_by_name[h] = dtsp;
+	h = hval % symtab->dtst_symbuckets;
+	symtab->dtst_next[i] = symtab->dtst_syms_by_name[h];
+	symtab->dtst_syms_by_name[h] = i;
 
 	symtab->dtst_flags &= ~DT_ST_SORTED;
 
-	return dtsp;
+	return dt_symbol_at(symtab, i);
 }
 
 dt_symbol_t *
 dt_symbol_by_name(dt_symtab_t *symtab, const char *name)
 {
-	uint_t h = dt_strtab_hash(name, NULL) % symtab->dtst_symbuckets;
-	dt_symbol_t *dtsp;
-	int packed = symtab->dtst_flags & DT_ST_PACKED;
-
-	for (dtsp = symtab->dtst_syms_by_name[h]; dtsp != NULL;
-	     dtsp = dtsp->dts_next) {
-		if (packed) {
-			if (strcmp(&symtab->dtst_strtab[dtsp->dts_name.off],
-				name) == 0)
-				return (dtsp);
-		}
-		else
-			if (strcmp(dtsp->dts_name.str, name) == 0)
-				return (dtsp);
+	uint32_t i = dt_symtab_lookup(symtab, name,
+	    dt_strtab_hash(name, NULL));
+
+	if (i == DT_ST_NOSYM)
+		return NULL;
+
+	return dt_symbol_at(symtab, i);
+}
+
+/*
+ * Search the Eytzinger-ordered ranges of a packed symtab.
+ *
+ * Each step descends to the left child (2k) if the address is below the
+ * node's lower bound, or to the right child (2k+1) otherwise.  When we fall
+ * off the bottom of the tree, the trailing zero bits of k record the left
+ * turns taken since the last right turn: shifting them and that right turn
+ * away leaves the last node whose lower bound was <= the address, i.e. the
+ * only range that can contain it.
+ */
+static dt_symbol_t *
+dt_symbol_by_addr_packed(dt_symtab_t *symtab, GElf_Addr dts_addr)
+{
+	const GElf_Addr *lo = symtab->dtst_range_lo;
+	const dt_symrange_val_t *val;
+	ulong_t n = symtab->dtst_num_range;
+	ulong_t k = 1;
+
+	while (k <= n) {
+		__builtin_prefetch(lo + k * 8);
+		k = 2 * k + (lo[k] <= dts_addr);
 	}
+	k >>= __builtin_ffsl(k);
+
+	if (k == 0)
+		return NULL;
 
-	return NULL;
+	val = &symtab->dtst_range_val[k];
+	if (dts_addr >= val->dtsrv_hi)
+		return NULL;
+
+	return dt_symbol_at(symtab, val->dtsrv_sym);
 }
 
 dt_symbol_t *
@@ -281,6 +481,9 @@ dt_symbol_by_addr(dt_symtab_t *symtab, GElf_Addr dts_addr)
 {
 	dt_symrange_t *sympp;
 
+	if (symtab->dtst_range_lo != NULL)
+		return dt_symbol_by_addr_packed(symtab, dts_addr);
+
 	if (symtab->dtst_ranges == NULL)
 		return NULL;
 
@@ -293,7 +496,7 @@ dt_symbol_by_addr(dt_symtab_t *symtab, GElf_Addr dts_addr)
 	if (sympp == NULL)
 		return NULL;
 
-	return sympp->dtsr_sym;
+	return dt_symbol_at(symtab, sympp->dtsr_sym);
 }
 
 static int
@@ -329,6 +532,8 @@ dt_symtab_form_ranges(dt_symtab_t *symtab)
 	 * alias of B) not at all.
 	 */
 	dt_symrange_t *old_ranges = symtab->dtst_ranges;
+	const GElf_Addr *addrs = symtab->dtst_addrs;
+	const GElf_Xword *sizes = symtab->dtst_sizes;
 	dt_symrange_t *new_ranges;
 	uint_t num_alloc = symtab->dtst_num_range_alloc;
 	uint_t num_range = 0;
@@ -352,7 +557,7 @@ dt_symtab_form_ranges(dt_symtab_t *symtab)
 
 		/* guess that the next range will be the next symbol */
 
-		dt_symbol_t *sym = old_ranges[i].dtsr_sym;
+		uint32_t sym = old_ranges[i].dtsr_sym;
 
 		/*
 		 * Set the low and high for this range.
@@ -361,41 +566,41 @@ dt_symtab_form_ranges(dt_symtab_t *symtab)
 		 *   - to move beyond this symbol altogether
 		 */
 
-		lo = sym->dts_addr;
+		lo = addrs[sym];
 		if (lo < hi) {
 			lo = hi;
-			if (sym->dts_addr + sym->dts_size <= hi) {
+			if (addrs[sym] + sizes[sym] <= hi) {
 				i++;
 				continue;
 			}
 		}
-		hi = sym->dts_addr + sym->dts_size;
+		hi = addrs[sym] + sizes[sym];
 
 		/* check for other candidate symbols for this range */
 
 		for (j = i + 1; j < symtab->dtst_num_range; j++) {
-			dt_symbol_t *sym2 = old_ranges[j].dtsr_sym;
+			uint32_t sym2 = old_ranges[j].dtsr_sym;
 			GElf_Addr hi2;
 
 			/* if sym2 is too high, all others will be as well */
-			if (sym2->dts_addr >= hi)
+			if (addrs[sym2] >= hi)
 				break;
 
 			/* break range down if necessary */
-			if (sym2->dts_addr > lo) {
-				hi = sym2->dts_addr;
+			if (addrs[sym2] > lo) {
+				hi = addrs[sym2];
 				break;
 			}
-			hi2 = sym2->dts_addr + sym2->dts_size;
+			hi2 = addrs[sym2] + sizes[sym2];
 			if (hi2 <= lo)
 				continue;
 			if (hi2 < hi)
 				hi = hi2;
 
 			/* decide whether sym2 should win over sym */
-			if ((sym2->dts_addr > sym->dts_addr) ||
-			    ((sym2->dts_addr == sym->dts_addr) &&
-			    (sym2->dts_size < sym->dts_size)))
+			if ((addrs[sym2] > addrs[sym]) ||
+			    ((addrs[sym2] == addrs[sym]) &&
+			    (sizes[sym2] < sizes[sym])))
 				sym = sym2;
 		}
 
@@ -446,8 +651,8 @@ dt_symtab_sort(dt_symtab_t *symtab)
 	if (symtab->dtst_flags & DT_ST_SORTED)
 		return;
 
-	qsort(symtab->dtst_ranges, symtab->dtst_num_range,
-	    sizeof (dt_symrange_t), dt_symrange_sort_cmp);
+	qsort_r(symtab->dtst_ranges, symtab->dtst_num_range,
+	    sizeof (dt_symrange_t), dt_symrange_sort_cmp, symtab);
 
 	if (dt_symtab_form_ranges(symtab))
 		return;
@@ -456,16 +661,16 @@ dt_symtab_sort(dt_symtab_t *symtab)
 }
 
 /*
- * Get next item on the linked list, keeping or eliminating the current item.
+ * Get next item on the hash chain, keeping or eliminating the current item.
  */
 static
-dt_symbol_t **
-next_symp(dt_symbol_t **p, int *nelim, int keep) {
+uint32_t *
+next_symp(dt_symtab_t *symtab, uint32_t *p, int *nelim, int keep) {
 	if (keep)
-		return &((*p)->dts_next);
+		return &symtab->dtst_next[*p];
 	else {
-		dt_symbol_t *tmp = (*p)->dts_next;
-		(*p)->dts_next = NULL;
+		uint32_t tmp = symtab->dtst_next[*p];
+		symtab->dtst_next[*p] = DT_ST_NOSYM;
 		*p = tmp;
 		*nelim += 1;
 		return p;
@@ -487,45 +692,72 @@ dt_symtab_purge(dt_symtab_t *symtab)
 	/* loop over buckets */
 	for (i = 0; i < symtab->dtst_symbuckets; i++) {
 
-		/* walk the bucket's linked list */
-		dt_symbol_t **p1;
-		for (p1 = &symtab->dtst_syms_by_name[i]; *p1; ) {
+		/* walk the bucket's hash chain */
+		uint32_t *p1;
+		for (p1 = &symtab->dtst_syms_by_name[i]; *p1 != DT_ST_NOSYM; ) {
 			int nelim = 0;
-			char *myname = (*p1)->dts_name.str;
-			dt_symbol_t **p2;
+			uint32_t myname = symtab->dtst_names[*p1];
+			uint32_t *p2;
 
 			/*
-			 * Walk from the next item to the end of the list,
+			 * Walk from the next item to the end of the chain,
 			 * keeping only symbols whose names differ from myname.
-			 * (Compare symbol names by looking at dts_name.str,
-			 * since symtab is not packed yet.)
+			 * (Names are stored only once, so it suffices to
+			 * compare string table offsets.)
 			 */
-			for (p2 = &((*p1)->dts_next); *p2; )
-				p2 = next_symp(p2, &nelim,
-				    strcmp((*p2)->dts_name.str, myname));
+			for (p2 = &symtab->dtst_next[*p1]; *p2 != DT_ST_NOSYM; )
+				p2 = next_symp(symtab, p2, &nelim,
+				    symtab->dtst_names[*p2] != myname);
 
 			/*
 			 * Advance p1, keeping the current item only if no
 			 * other symbols were eliminated (duplicated p1).
 			 */
-			p1 = next_symp(p1, &nelim, nelim == 0);
+			p1 = next_symp(symtab, p1, &nelim, nelim == 0);
 		}
 	}
 }
 
+/*
+ * Shrink an array to its final size.  Failure is harmless: we just keep the
+ * larger allocation.
+ */
+static void *
+dt_symtab_shrink(void *p, size_t size)
+{
+	void *np;
+
+	if (size == 0)
+		return p;
+
+	np = realloc(p, size);
+	return np != NULL ? np : p;
+}
+
+/*
+ * Lay out the sorted ranges in Eytzinger order by an in-order walk of the
+ * implicit tree rooted at node k.  Returns the index of the next sorted range
+ * to place.
+ */
+static uint_t
+dt_symtab_eytzinger(dt_symtab_t *symtab, uint_t i, ulong_t k)
+{
+	if (k <= symtab->dtst_num_range) {
+		i = dt_symtab_eytzinger(symtab, i, 2 * k);
+		symtab->dtst_range_lo[k] = symtab->dtst_ranges[i].dtsr_lo;
+		symtab->dtst_range_val[k].dtsrv_hi =
+		    symtab->dtst_ranges[i].dtsr_hi;
+		symtab->dtst_range_val[k].dtsrv_sym =
+		    symtab->dtst_ranges[i].dtsr_sym;
+		i = dt_symtab_eytzinger(symtab, i + 1, 2 * k + 1);
+	}
+	return i;
+}
+
 void
 dt_symtab_pack(dt_symtab_t *symtab)
 {
-	dt_symbol_t *dtsp;
-	size_t strsz = 0, offset = 0;
-
-	/*
-	 * For now, merely pack the symbols into a string table.
-	 *
-	 * In future, Huffman-coding the symbols seems sensible: they have many
-	 * identical components (a property which scripts/kallsyms.c also takes
-	 * advantage of).
-	 */
+	uint_t n;
 
 	if (symtab->dtst_flags & DT_ST_PACKED)
 		return;
@@ -533,73 +765,104 @@ dt_symtab_pack(dt_symtab_t *symtab)
 	dt_symtab_sort(symtab);
 
 	/*
-	 * Size and allocate the string table: give up if we can't.
+	 * Everything is already stored compactly: all that is left to do is
+	 * to trim the slack off the end of the growable arrays.
 	 */
-	for (dtsp = dt_list_next(&symtab->dtst_symlist); dtsp != NULL;
-	     dtsp = dt_list_next(dtsp))
-		strsz += strlen(dtsp->dts_name.str) + 1;
-
-	symtab->dtst_strtab = malloc(strsz);
-	if (symtab->dtst_strtab == NULL)
-		return;
+	n = symtab->dtst_num_sym;
+	symtab->dtst_addrs = dt_symtab_shrink(symtab->dtst_addrs,
+	    n * sizeof (GElf_Addr));
+	symtab->dtst_sizes = dt_symtab_shrink(symtab->dtst_sizes,
+	    n * sizeof (GElf_Xword));
+	symtab->dtst_info = dt_symtab_shrink(symtab->dtst_info,
+	    n * sizeof (unsigned char));
+	symtab->dtst_names = dt_symtab_shrink(symtab->dtst_names,
+	    n * sizeof (uint32_t));
+	symtab->dtst_next = dt_symtab_shrink(symtab->dtst_next,
+	    n * sizeof (uint32_t));
+	symtab->dtst_num_sym_alloc = n;
+
+	symtab->dtst_strtab = dt_symtab_shrink(symtab->dtst_strtab,
+	    symtab->dtst_strsz);
+	symtab->dtst_strsz_alloc = symtab->dtst_strsz;
 
 	/*
-	 * Fill it out.
+	 * Convert the sorted ranges into their search layout.  Element 0 of
+	 * each array is unused, so that node k's children are 2k and 2k+1.
+	 * If we are out of memory, we keep the sorted ranges and go on using
+	 * binary search.
 	 */
-	for (dtsp = dt_list_next(&symtab->dtst_symlist); dtsp != NULL;
-	     dtsp = dt_list_next(dtsp)) {
-		size_t len = strlen(dtsp->dts_name.str) + 1;
-
-		memcpy(&symtab->dtst_strtab[offset], dtsp->dts_name.str, len);
-		free(dtsp->dts_name.str);
-		dtsp->dts_name.off = offset;
-		offset += len;
+	if (symtab->dtst_flags & DT_ST_SORTED && symtab->dtst_num_range > 0) {
+		uint_t nr = symtab->dtst_num_range + 1;
+
+		symtab->dtst_range_lo = malloc(nr * sizeof (GElf_Addr));
+		symtab->dtst_range_val = malloc(nr * sizeof (dt_symrange_val_t));
+		if (symtab->dtst_range_lo == NULL ||
+		    symtab->dtst_range_val == NULL) {
+			free(symtab->dtst_range_lo);
+			free(symtab->dtst_range_val);
+			symtab->dtst_range_lo = NULL;
+			symtab->dtst_range_val = NULL;
+		} else {
+			dt_symtab_eytzinger(symtab, 0, 1);
+			free(symtab->dtst_ranges);
+			symtab->dtst_ranges = NULL;
+			symtab->dtst_num_range_alloc = 0;
+		}
+	}
+
+	if (symtab->dtst_ranges != NULL) {
+		symtab->dtst_ranges = dt_symtab_shrink(symtab->dtst_ranges,
+		    symtab->dtst_num_range * sizeof (dt_symrange_t));
+		symtab->dtst_num_range_alloc = symtab->dtst_num_range;
 	}
 
 	symtab->dtst_flags |= DT_ST_PACKED;
 }
 
 /*
- * Return the name of a symbol.  Currently redundant, this will become useful
- * when dt_symtab_pack() starts compressing symbol names.  TODO: we must retain
- * ownership of the expanded string, even in this case: it is part of the
- * libdtrace API.  This is distinctly tricky: it may be simpler to change the
- * API to require caller-frees semantics.
+ * Return the name of a symbol.  The name belongs to the symtab, and remains
+ * valid until it is destroyed.
  */
 const char *
-dt_symbol_name(dt_symtab_t *symtab _dt_unused_, dt_symbol_t *symbol)
+dt_symbol_name(dt_symtab_t *symtab, dt_symbol_t *symbol)
 {
-	if (symtab->dtst_flags & DT_ST_PACKED)
-		return &symtab->dtst_strtab[symbol->dts_name.off];
-	else
-		return symbol->dts_name.str;
+	return dt_symtab_name(symtab, dt_symbol_idx(symtab, symbol));
 }
 
 void
-dt_symbol_to_elfsym64(dtrace_hdl_t *dtp, dt_symbol_t *symbol, Elf64_Sym *elf_symp)
+dt_symbol_to_elfsym64(dtrace_hdl_t *dtp, dt_symtab_t *symtab,
+    dt_symbol_t *symbol, Elf64_Sym *elf_symp)
 {
-	elf_symp->st_info = symbol->dts_info;
-	elf_symp->st_value = symbol->dts_addr;
-	elf_symp->st_size = symbol->dts_size;
+	uint32_t i = dt_symbol_idx(symtab, symbol);
+
+	elf_symp->st_info = symtab->dtst_info[i];
+	elf_symp->st_value = symtab->dtst_addrs[i];
+	elf_symp->st_size = symtab->dtst_sizes[i];
 	elf_symp->st_shndx = 1; /* 'not SHN_UNDEF' is all we guarantee */
 }
 
 void
-dt_symbol_to_elfsym32(dtrace_hdl_t *dtp, dt_symbol_t *symbol, Elf32_Sym *elf_symp)
+dt_symbol_to_elfsym32(dtrace_hdl_t *dtp, dt_symtab_t *symtab,
+    dt_symbol_t *symbol, Elf32_Sym *elf_symp)
 {
-	elf_symp->st_info = symbol->dts_info;
-	elf_symp->st_value = symbol->dts_addr;
-	elf_symp->st_size = symbol->dts_size;
+	uint32_t i = dt_symbol_idx(symtab, symbol);
+
+	elf_symp->st_info = symtab->dtst_info[i];
+	elf_symp->st_value = symtab->dtst_addrs[i];
+	elf_symp->st_size = symtab->dtst_sizes[i];
 	elf_symp->st_shndx = 1; /* 'not SHN_UNDEF' is all we guarantee */
 }
 
 void
-dt_symbol_to_elfsym(dtrace_hdl_t *dtp, dt_symbol_t *symbol, GElf_Sym *elf_symp)
+dt_symbol_to_elfsym(dtrace_hdl_t *dtp, dt_symtab_t *symtab,
+    dt_symbol_t *symbol, GElf_Sym *elf_symp)
 {
 	switch (dtp->dt_conf.dtc_ctfmodel) {
-	case CTF_MODEL_LP64: dt_symbol_to_elfsym64(dtp, symbol, (Elf64_Sym *) elf_symp);
+	case CTF_MODEL_LP64: dt_symbol_to_elfsym64(dtp, symtab, symbol,
+		(Elf64_Sym *) elf_symp);
 		break;
-	case CTF_MODEL_ILP32: dt_symbol_to_elfsym32(dtp, symbol, (Elf32_Sym *)elf_symp);
+	case CTF_MODEL_ILP32: dt_symbol_to_elfsym32(dtp, symtab, symbol,
+		(Elf32_Sym *)elf_symp);
 		break;
 	default:;
 		/* unknown model, fall out with nothing changed */
@@ -44,8 +44,8 @@ extern void dt_symtab_purge(dt_symtab_t *symtab);
 extern void dt_symtab_pack(dt_symtab_t *symtab);
 
 extern const char *dt_symbol_name(dt_symtab_t *symtab, dt_symbol_t *symbol);
-extern void dt_symbol_to_elfsym(dtrace_hdl_t *dtp, dt_symbol_t *symbol,
-    GElf_Sym *elf_symp);
+extern void dt_symbol_to_elfsym(dtrace_hdl_t *dtp, dt_symtab_t *symtab,
+    dt_symbol_t *symbol, GElf_Sym *elf_symp);
 
 #ifdef	__cplusplus
 }
@@ -10,6 +10,10 @@
 #include <errno.h>
 #include <assert.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <libproc.h>
 #include <port.h>
 
@@ -23,15 +27,14 @@ static const struct {
 	{ DTRACEOPT_MAX, 0 }
 };
 
-void
-dtrace_sleep(dtrace_hdl_t *dtp)
+/*
+ * The time at which dtrace_work() next has something to do.
+ */
+static hrtime_t
+dt_work_deadline(dtrace_hdl_t *dtp)
 {
-	dt_proc_hash_t *dph = dtp->dt_procs;
 	dtrace_optval_t policy = dtp->dt_options[DTRACEOPT_BUFPOLICY];
-	dt_proc_notify_t *dprn;
-
 	hrtime_t earliest = INT64_MAX;
-	struct timespec tv;
 	int i;
 
 	for (i = 0; _dtrace_sleeptab[i].dtslt_option < DTRACEOPT_MAX; i++) {
@@ -52,19 +55,19 @@ dtrace_sleep(dtrace_hdl_t *dtp)
 			earliest = *((hrtime_t *)a) + interval;
 	}
 
-	(void) pthread_mutex_lock(&dph->dph_lock);
+	return earliest;
+}
 
-	tv.tv_sec = earliest / NANOSEC;
-	tv.tv_nsec = earliest % NANOSEC;
+/*
+ * Iterate over any pending process notifications and process them.  Must be
+ * called under the dph_lock.
+ */
+static void
+dt_work_notify(dtrace_hdl_t *dtp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	dt_proc_notify_t *dprn;
 
-	/*
-	 * Wait until the time specified by "earliest" has arrived, or until we
-	 * receive notification that a process is in an interesting state; also
-	 * make sure that any synchronous notifications of process exit are
-	 * received.  Regardless of why we awaken, iterate over any pending
-	 * notifications and process them.
-	 */
-	(void) pthread_cond_timedwait(&dph->dph_cv, &dph->dph_lock, &tv);
 	(void) dt_proc_enqueue_exits(dtp);
 
 	while ((dprn = dph->dph_notify) != NULL) {
@@ -101,10 +104,141 @@ dtrace_sleep(dtrace_hdl_t *dtp)
 		dph->dph_notify = dprn->dprn_next;
 		dt_free(dtp, dprn);
 	}
+}
+
+void
+dtrace_sleep(dtrace_hdl_t *dtp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	hrtime_t earliest = dt_work_deadline(dtp);
+	struct timespec tv;
+
+	(void) pthread_mutex_lock(&dph->dph_lock);
+
+	tv.tv_sec = earliest / NANOSEC;
+	tv.tv_nsec = earliest % NANOSEC;
+
+	/*
+	 * Wait until the time specified by "earliest" has arrived, or until we
+	 * receive notification that a process is in an interesting state; also
+	 * make sure that any synchronous notifications of process exit are
+	 * received.  Regardless of why we awaken, iterate over any pending
+	 * notifications and process them.
+	 */
+	(void) pthread_cond_timedwait(&dph->dph_cv, &dph->dph_lock, &tv);
+	dt_work_notify(dtp);
 
 	(void) pthread_mutex_unlock(&dph->dph_lock);
 }
 
+/*
+ * Arm the timerfd for the next deadline.  The deadline is on the same clock as
+ * gethrtime().
+ */
+static void
+dt_work_arm(dtrace_hdl_t *dtp)
+{
+	hrtime_t earliest = dt_work_deadline(dtp);
+	struct itimerspec its = { 0 };
+
+	/*
+	 * An it_value of zero would disarm the timer, rather than firing it
+	 * at once.
+	 */
+	if (earliest <= 0)
+		earliest = 1;
+
+	its.it_value.tv_sec = earliest / NANOSEC;
+	its.it_value.tv_nsec = earliest % NANOSEC;
+	(void) timerfd_settime(dtp->dt_timer_fd, TFD_TIMER_ABSTIME, &its,
+	    NULL);
+}
+
+/*
+ * The poll fd is an epoll fd watching an eventfd written whenever a process
+ * notification is enqueued, and a timerfd armed for the next deadline.
+ */
+int
+dtrace_pollfd(dtrace_hdl_t *dtp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	struct epoll_event ev;
+	int epfd = -1, efd = -1, tfd = -1;
+
+	if (dtp->dt_poll_fd >= 0)
+		return (dtp->dt_poll_fd);
+
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+	    (efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+	    (tfd = timerfd_create(CLOCK_REALTIME,
+		TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+		goto err;
+
+	ev.events = EPOLLIN;
+	ev.data.fd = efd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev) < 0)
+		goto err;
+
+	ev.data.fd = tfd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ev) < 0)
+		goto err;
+
+	dtp->dt_poll_fd = epfd;
+	dtp->dt_timer_fd = tfd;
+	dt_work_arm(dtp);
+
+	/*
+	 * Notifications may already be pending.
+	 */
+	(void) pthread_mutex_lock(&dph->dph_lock);
+	dph->dph_notify_fd = efd;
+	if (dph->dph_notify != NULL) {
+		uint64_t one = 1;
+
+		(void) write(efd, &one, sizeof (one));
+	}
+	(void) pthread_mutex_unlock(&dph->dph_lock);
+
+	return (epfd);
+
+err:
+	dt_set_errno(dtp, errno);
+	if (tfd >= 0)
+		close(tfd);
+	if (efd >= 0)
+		close(efd);
+	if (epfd >= 0)
+		close(epfd);
+	return (-1);
+}
+
+void
+dtrace_poll(dtrace_hdl_t *dtp)
+{
+	dt_proc_hash_t *dph = dtp->dt_procs;
+	uint64_t count;
+
+	if (dtp->dt_poll_fd < 0) {
+		(void) pthread_mutex_lock(&dph->dph_lock);
+		dt_work_notify(dtp);
+		(void) pthread_mutex_unlock(&dph->dph_lock);
+		return;
+	}
+
+	/*
+	 * Clear both descriptors before handling what they signalled, so that
+	 * nothing signalled after this point is lost.
+	 */
+	(void) read(dtp->dt_timer_fd, &count, sizeof (count));
+
+	(void) pthread_mutex_lock(&dph->dph_lock);
+	(void) read(dph->dph_notify_fd, &count, sizeof (count));
+	dt_work_notify(dtp);
+	(void) pthread_mutex_unlock(&dph->dph_lock);
+
+	dt_work_arm(dtp);
+}
+
 int
 dtrace_status(dtrace_hdl_t *dtp)
 {
@@ -240,9 +374,8 @@ dtrace_stop(dtrace_hdl_t *dtp)
 	return (0);
 }
 
-
-dtrace_workstatus_t
-dtrace_work(dtrace_hdl_t *dtp, FILE *fp,
+static dtrace_workstatus_t
+dt_work(dtrace_hdl_t *dtp, FILE *fp,
     dtrace_consume_probe_f *pfunc, dtrace_consume_rec_f *rfunc, void *arg)
 {
 	int status = dtrace_status(dtp);
@@ -292,3 +425,19 @@ dtrace_work(dtrace_hdl_t *dtp, FILE *fp,
 
 	return (rval);
 }
+
+dtrace_workstatus_t
+dtrace_work(dtrace_hdl_t *dtp, FILE *fp,
+    dtrace_consume_probe_f *pfunc, dtrace_consume_rec_f *rfunc, void *arg)
+{
+	dtrace_workstatus_t rval = dt_work(dtp, fp, pfunc, rfunc, arg);
+
+	/*
+	 * The work done may have moved the deadlines on: if so, the timer
+	 * behind dtrace_pollfd() must move on with them.
+	 */
+	if (dtp->dt_timer_fd >= 0)
+		dt_work_arm(dtp);
+
+	return (rval);
+}
@@ -50,6 +50,17 @@ extern int dtrace_stop(dtrace_hdl_t *dtp);
 extern void dtrace_sleep(dtrace_hdl_t *dtp);
 extern void dtrace_close(dtrace_hdl_t *dtp);
 
+/*
+ * For consumers with event loops of their own: dtrace_pollfd() returns a file
+ * descriptor that becomes readable whenever dtrace_sleep() would have woken up,
+ * that is, when a process notification is pending or a status, aggregation or
+ * buffer-switch deadline is due.  When it is readable, call dtrace_poll(),
+ * which never blocks but otherwise does what dtrace_sleep() does, and then
+ * dtrace_work().  Do not read the descriptor or close it.
+ */
+extern int dtrace_pollfd(dtrace_hdl_t *dtp);
+extern void dtrace_poll(dtrace_hdl_t *dtp);
+
 extern int dtrace_errno(dtrace_hdl_t *dtp);
 extern const char *dtrace_errmsg(dtrace_hdl_t *dtp, int error);
 extern const char *dtrace_faultstr(dtrace_hdl_t *dtp, int fault);
@@ -459,6 +470,28 @@ extern void dtrace_proc_continue(dtrace_hdl_t *dtp,
 extern pid_t dtrace_proc_getpid(dtrace_hdl_t *dtp,
     struct dtrace_proc *proc);
 
+/*
+ * Process-handle cache statistics.  Processes under control (-p, -c, pid
+ * probes) are cached up to a count set by -xpgmax; processes grabbed only to
+ * symbolize their addresses are cached up to a memory size set by
+ * -xsymcachesize.
+ */
+typedef struct dtrace_proc_cachestat {
+	uint64_t dtpc_hits;		/* controlled: grabs of cached handles */
+	uint64_t dtpc_misses;		/* controlled: grabs making new handles */
+	uint64_t dtpc_evictions;	/* controlled: handles retired */
+	uint64_t dtpc_handles;		/* controlled: handles not retired */
+	uint64_t dtpc_sym_hits;		/* symbolization: grabs of cached handles */
+	uint64_t dtpc_sym_misses;	/* symbolization: grabs making handles */
+	uint64_t dtpc_sym_evictions;	/* symbolization: handles dropped */
+	uint64_t dtpc_sym_handles;	/* symbolization: handles cached */
+	uint64_t dtpc_sym_size;		/* symbolization: estimated bytes held */
+	uint64_t dtpc_sym_limit;	/* symbolization: limit on that */
+} dtrace_proc_cachestat_t;
+
+extern void dtrace_proc_cachestat(dtrace_hdl_t *dtp,
+    dtrace_proc_cachestat_t *stat);
+
 /*
  * DTrace Object, Symbol, and Type Interfaces
  *
@@ -518,6 +551,9 @@ extern int dtrace_lookup_by_name(dtrace_hdl_t *dtp, const char *object,
 extern int dtrace_lookup_by_addr(dtrace_hdl_t *dtp, GElf_Addr addr,
     GElf_Sym *symp, dtrace_syminfo_t *sip);
 
+extern int dtrace_lookup_by_addrs(dtrace_hdl_t *dtp, const GElf_Addr *addrs,
+    size_t naddrs, GElf_Sym *syms, dtrace_syminfo_t *sips);
+
 typedef struct dtrace_typeinfo {
 	const char *dtt_object;			/* object containing type */
 	ctf_file_t *dtt_ctfp;			/* CTF container handle */
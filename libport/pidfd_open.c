@@ -0,0 +1,28 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+#include <config.h>				/* for HAVE_* */
+
+#ifndef HAVE_PIDFD_OPEN
+#include <unistd.h>				/* for syscall() */
+#include <sys/syscall.h>			/* for __NR_* */
+#include <sys/types.h>
+
+/*
+ * pidfd_open() has the same number on every architecture.
+ */
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+int
+pidfd_open(pid_t pid, unsigned int flags)
+{
+	return syscall(__NR_pidfd_open, pid, flags);
+}
+
+#endif
@@ -25,6 +25,7 @@
 #include <sys/ptrace.h>
 #include <sys/types.h>
 #include <sys/resource.h>
+#include <sys/uio.h>
 #include <sys/param.h>
 #include <sys/stat.h>
 #include <sys/user.h>
@@ -52,6 +53,7 @@ static void ignored_child_flush(struct ps_prochandle *P, pid_t pid);
 static prev_states_t *Ppush_state(struct ps_prochandle *P, int state);
 static int Ppop_state(struct ps_prochandle *P);
 static int Pwait_handle_waitpid(struct ps_prochandle *P, int status);
+static pid_t Pwaitpid(struct ps_prochandle *P, int *status, int options);
 static int bkpt_handle(struct ps_prochandle *P, uintptr_t addr);
 static int bkpt_handle_start(struct ps_prochandle *P, bkpt_t *bkpt);
 static int bkpt_handle_post_singlestep(struct ps_prochandle *P, bkpt_t *bkpt);
@@ -70,6 +72,7 @@ static void delete_bkpt_handler(struct bkpt *bkpt);
 static jmp_buf **single_thread_unwinder_pad(struct ps_prochandle *unused);
 
 static ptrace_lock_hook_fun *ptrace_lock_hook;
+static pwait_block_hook_fun *pwait_block_hook;
 libproc_unwinder_pad_fun *libproc_unwinder_pad = single_thread_unwinder_pad;
 
 #define LIBPROC_PTRACE_OPTIONS PTRACE_O_TRACEEXEC | \
@@ -134,9 +137,11 @@ Pcreate(
 		free(P);
 		return (NULL);
 	}
+	P->bkpts_nbuckets = BKPT_HASH_BUCKETS;
 
 	P->wrap_arg = wrap_arg;
 	Pset_ptrace_wrapper(P, NULL);
+	Pset_ptrace_batch_wrapper(P, NULL);
 	Pset_pwait_wrapper(P, NULL);
 	if (pipe(forkblock) < 0) {
 		*perr = errno;
@@ -212,7 +217,7 @@ Pcreate(
 	}
 	close(forkblock[1]);
 
-	waitpid(pid, &status, 0);
+	Pwaitpid(P, &status, 0);
 	if (!WIFSTOPPED(status) || WSTOPSIG(status) != SIGTRAP ||
 	    (status >> 8) != (SIGTRAP | PTRACE_EVENT_EXEC << 8)) {
 		rc = ENOENT;
@@ -305,8 +310,10 @@ Pgrab(pid_t pid, int noninvasiveness, int already_ptraced, void *wrap_arg,
 	P->bkpts = calloc(BKPT_HASH_BUCKETS, sizeof (struct bkpt_t *));
 	if (!P->bkpts)
 		goto bad;
+	P->bkpts_nbuckets = BKPT_HASH_BUCKETS;
 	P->wrap_arg = wrap_arg;
 	Pset_ptrace_wrapper(P, NULL);
+	Pset_ptrace_batch_wrapper(P, NULL);
 	Pset_pwait_wrapper(P, NULL);
 
 	P->memfd = -1;
@@ -384,6 +391,21 @@ bad:
 static void
 Pfree_internal(struct ps_prochandle *P)
 {
+	prhashstats_t bkpt_stats, map_stats;
+
+	Pbkpt_hash_stats(P, &bkpt_stats);
+	Pmap_hash_stats(P, &map_stats);
+	_dprintf("%i: breakpoint hash: %llu lookups, %llu probes, %zi buckets, "
+	    "longest chain %zi\n", P->pid,
+	    (unsigned long long)bkpt_stats.phs_lookups,
+	    (unsigned long long)bkpt_stats.phs_probes,
+	    bkpt_stats.phs_buckets, bkpt_stats.phs_maxchain);
+	_dprintf("%i: mapping hash: %llu lookups, %llu probes, %zi buckets, "
+	    "longest chain %zi\n", P->pid,
+	    (unsigned long long)map_stats.phs_lookups,
+	    (unsigned long long)map_stats.phs_probes,
+	    map_stats.phs_buckets, map_stats.phs_maxchain);
+
 	rd_free(P->rap);
 	Pclose(P);
 	Psym_free(P);
@@ -676,7 +698,7 @@ Pwait_internal(struct ps_prochandle *P, boolean_t block)
 	do
 	{
 		errno = 0;
-		err = waitpid(P->pid, &status, __WALL | (!block ? WNOHANG : 0));
+		err = Pwaitpid(P, &status, __WALL | (!block ? WNOHANG : 0));
 
 		switch (err) {
 		case 0:
@@ -709,6 +731,26 @@ Pwait_internal(struct ps_prochandle *P, boolean_t block)
 	return (num_waits + 1);
 }
 
+/*
+ * waitpid() for the process, letting the blocking-wait hook, if any, do the
+ * waiting for a blocking call.
+ */
+static pid_t
+Pwaitpid(struct ps_prochandle *P, int *status, int options)
+{
+	pid_t ret;
+
+	if (pwait_block_hook == NULL || (options & WNOHANG))
+		return waitpid(P->pid, status, options);
+
+	while ((ret = waitpid(P->pid, status, options | WNOHANG)) == 0) {
+		if (pwait_block_hook(P, P->wrap_arg) < 0)
+			return waitpid(P->pid, status, options);
+	}
+
+	return ret;
+}
+
 /*
  * Change the process status according to the status word returned by waitpid().
  *
@@ -944,6 +986,8 @@ Pwait_handle_waitpid(struct ps_prochandle *P, int status)
 		P->bkpt_consume = 0;
 		P->r_debug_addr = 0;
 		P->info_valid = 0;
+		if (P->rap)
+			P->rap->lm_gen++;
 		P->group_stopped = 0;
 		P->listening = 0;
 		if ((P->ptrace_count == 0) && ptrace_lock_hook)
@@ -1487,6 +1531,69 @@ Puntrace(struct ps_prochandle *P, int leave_stopped)
 		ptrace_lock_hook(P, P->wrap_arg, 0);
 }
 
+/*
+ * Grow the breakpoint hash if it has more entries than buckets.  Failure to
+ * grow is harmless: the chains just get longer.
+ */
+static void
+bkpt_hash_grow(struct ps_prochandle *P)
+{
+	uint_t nbuckets = P->bkpts_nbuckets * 2 + 1;
+	bkpt_t **bkpts;
+	uint_t i;
+
+	if (P->num_bkpts <= P->bkpts_nbuckets)
+		return;
+
+	if ((bkpts = calloc(nbuckets, sizeof (struct bkpt_t *))) == NULL)
+		return;
+
+	for (i = 0; i < P->bkpts_nbuckets; i++) {
+		bkpt_t *bkpt, *next_bkpt;
+
+		for (bkpt = P->bkpts[i]; bkpt != NULL; bkpt = next_bkpt) {
+			uint_t h = bkpt->bkpt_addr % nbuckets;
+
+			next_bkpt = bkpt->bkpt_next;
+			bkpt->bkpt_next = bkpts[h];
+			bkpts[h] = bkpt;
+		}
+	}
+
+	_dprintf("%i: Grew breakpoint hash to %u buckets\n", P->pid, nbuckets);
+	free(P->bkpts);
+	P->bkpts = bkpts;
+	P->bkpts_nbuckets = nbuckets;
+}
+
+/*
+ * Report statistics on the breakpoint hash.
+ */
+void
+Pbkpt_hash_stats(struct ps_prochandle *P, prhashstats_t *stats)
+{
+	uint_t i;
+
+	memset(stats, 0, sizeof (prhashstats_t));
+	stats->phs_lookups = P->bkpts_lookups;
+	stats->phs_probes = P->bkpts_probes;
+	stats->phs_buckets = P->bkpts_nbuckets;
+
+	for (i = 0; i < P->bkpts_nbuckets; i++) {
+		bkpt_t *bkpt;
+		size_t len = 0;
+
+		for (bkpt = P->bkpts[i]; bkpt != NULL; bkpt = bkpt->bkpt_next)
+			len++;
+
+		stats->phs_entries += len;
+		if (len > 0)
+			stats->phs_used++;
+		if (len > stats->phs_maxchain)
+			stats->phs_maxchain = len;
+	}
+}
+
 /*
  * Given a breakpoint address, find the corresponding bkpt structure, or NULL if
  * none.  If delete is set, remove it from the hash too.
@@ -1495,11 +1602,13 @@ static bkpt_t
 *bkpt_by_addr(struct ps_prochandle *P, uintptr_t addr,
 	int delete)
 {
-	uint_t h = addr % BKPT_HASH_BUCKETS;
+	uint_t h = addr % P->bkpts_nbuckets;
 	bkpt_t *last_bkpt = NULL;
 	bkpt_t *bkpt;
 
+	P->bkpts_lookups++;
 	for (bkpt = P->bkpts[h]; bkpt != NULL; bkpt = bkpt->bkpt_next) {
+		P->bkpts_probes++;
 		if (bkpt->bkpt_addr == addr) {
 			if (delete) {
 				if (last_bkpt)
@@ -1598,8 +1707,8 @@ add_bkpt(struct ps_prochandle *P, uintptr_t addr, int after_singlestep,
     void *data)
 {
 	bkpt_t *bkpt = bkpt_by_addr(P, addr, FALSE);
-	uint_t h = addr % BKPT_HASH_BUCKETS;
 	bkpt_handler_t *notifier = NULL;
+	uint_t h;
 	int err;
 
 	/*
@@ -1672,9 +1781,11 @@ add_bkpt(struct ps_prochandle *P, uintptr_t addr, int after_singlestep,
 		goto err;
 	}
 
+	P->num_bkpts++;
+	bkpt_hash_grow(P);
+	h = addr % P->bkpts_nbuckets;
 	bkpt->bkpt_next = P->bkpts[h];
 	P->bkpts[h] = bkpt;
-	P->num_bkpts++;
 
 	_dprintf("%i: Added breakpoint on %lx\n", P->pid, addr);
 
@@ -1889,7 +2000,7 @@ bkpt_flush(struct ps_prochandle *P, pid_t pid, int gone) {
 	if (!pid)
 		state = Ptrace(P, 1);
 
-	for (i = 0; i < BKPT_HASH_BUCKETS; i++) {
+	for (i = 0; i < P->bkpts_nbuckets; i++) {
 		bkpt_t *bkpt;
 		bkpt_t *old_bkpt = NULL;
 
@@ -2404,12 +2515,54 @@ uintptr_t Pbkpt_addr(struct ps_prochandle *P)
 	return P->tracing_bkpt;
 }
 
+/*
+ * Read from the process with process_vm_readv(), which needs no file
+ * descriptor, works at any address, and can gather many regions in one call.
+ * Returns -1 with errno set to ENOSYS if it cannot be used, in which case the
+ * caller should fall back to /proc/<pid>/mem.
+ */
+static ssize_t
+Pvm_readv(struct ps_prochandle *P, const struct iovec *local,
+    const struct iovec *remote, size_t n)
+{
+	ssize_t ret;
+
+	if (P->no_vm_readv) {
+		errno = ENOSYS;
+		return (-1);
+	}
+
+	ret = process_vm_readv(P->pid, local, n, remote, n, 0);
+	if (ret < 0 && (errno == ENOSYS || errno == EPERM)) {
+		_dprintf("%i: process_vm_readv() unusable (%s): falling back "
+		    "to /proc/%i/mem\n", P->pid, strerror(errno), P->pid);
+		P->no_vm_readv = 1;
+		errno = ENOSYS;
+	}
+
+	return (ret);
+}
+
 ssize_t
 Pread(struct ps_prochandle *P,
 	void *buf,		/* caller's buffer */
 	size_t nbyte,		/* number of bytes to read */
 	uintptr_t address)	/* address in process */
 {
+	struct iovec local = { buf, nbyte };
+	struct iovec remote = { (void *)address, nbyte };
+	ssize_t ret;
+
+	/*
+	 * If part of the region is unmapped, process_vm_readv() returns a short
+	 * count up to the first page it could not read, which is passed back
+	 * as-is, as a short pread() would be.  Only an outright failure (the
+	 * first page is unreadable, or the syscall is unusable) falls back to
+	 * the slower paths below.
+	 */
+	if ((ret = Pvm_readv(P, &local, &remote, 1)) >= 0)
+		return (ret);
+
 	if (address < LONG_MAX)
 		return (pread(Pmemfd(P), buf, nbyte, (loff_t)address));
 	else {
@@ -2421,6 +2574,7 @@ Pread(struct ps_prochandle *P,
 		 * is exceptionally painful and inefficient.
 		 */
 
+		enum { PEEK_BATCH = 64 };
 		int state;
 		uintptr_t saddr = (address & ~((uintptr_t) sizeof (long) - 1));
 		size_t i, sz;
@@ -2446,13 +2600,33 @@ Pread(struct ps_prochandle *P,
 			return 0;
 		}
 
-		errno = 0;
-		for (i = 0, sz = 0; sz < len; i++, sz += sizeof (long)) {
-			long data = wrapped_ptrace(P, PTRACE_PEEKDATA, P->pid,
-			    saddr + sz, NULL);
-			if (errno != 0)
+		/*
+		 * Peek in batches, so that a caller proxying ptrace() to
+		 * another thread pays one round trip per batch, not per word.
+		 */
+		for (i = 0, sz = 0; sz < len; ) {
+			ptrace_req_t reqs[PEEK_BATCH];
+			size_t j, n;
+			long done;
+
+			for (n = 0; n < PEEK_BATCH && sz + n * sizeof (long) < len;
+			     n++) {
+				reqs[n].pr_request = PTRACE_PEEKDATA;
+				reqs[n].pr_pid = P->pid;
+				reqs[n].pr_addr = (void *)(saddr + sz +
+				    n * sizeof (long));
+				reqs[n].pr_data = NULL;
+			}
+
+			if ((done = wrapped_ptrace_batch(P, reqs, n)) < 0)
+				break;
+			for (j = 0; j < (size_t)done && reqs[j].pr_errno == 0;
+			     j++) {
+				rbuf[i++] = reqs[j].pr_ret;
+				sz += sizeof (long);
+			}
+			if (j < n)
 				break;
-			rbuf[i] = data;
 		}
 
 		nbyte = (sz > nbyte) ? nbyte : sz;
@@ -2465,16 +2639,67 @@ Pread(struct ps_prochandle *P,
 	}
 }
 
+/*
+ * Read N regions of the process's memory, ADDRS[i] into IOV[i], in as few
+ * system calls as possible.  Returns the total number of bytes read, which is
+ * short if some region could not be read in full (in which case no later
+ * region is read), or -1 if nothing could be read at all.
+ */
+ssize_t
+Preadv(struct ps_prochandle *P,
+	const struct iovec *iov,	/* caller's buffers */
+	const uintptr_t *addrs,		/* addresses in process */
+	size_t n)			/* number of regions */
+{
+	enum { BATCH = 64 };
+	struct iovec remote[BATCH];
+	size_t i, j, batch, want;
+	ssize_t total = 0, ret;
+
+	for (i = 0; i < n; i += batch) {
+		batch = (n - i > BATCH) ? BATCH : n - i;
+
+		for (j = 0, want = 0; j < batch; j++) {
+			remote[j].iov_base = (void *)addrs[i + j];
+			remote[j].iov_len = iov[i + j].iov_len;
+			want += iov[i + j].iov_len;
+		}
+
+		ret = Pvm_readv(P, &iov[i], remote, batch);
+		if (ret >= 0) {
+			total += ret;
+			if (ret != want)
+				return (total);
+			continue;
+		}
+
+		if (errno != ENOSYS)
+			return (total ? total : -1);
+
+		for (j = 0; j < batch; j++) {
+			ret = Pread(P, iov[i + j].iov_base, iov[i + j].iov_len,
+			    addrs[i + j]);
+			if (ret > 0)
+				total += ret;
+			if (ret != iov[i + j].iov_len)
+				return (total ? total : -1);
+		}
+	}
+
+	return (total);
+}
+
 ssize_t
 Pread_string(struct ps_prochandle *P,
 	char *buf, 		/* caller's buffer */
 	size_t size,		/* upper limit on bytes to read */
 	uintptr_t addr)		/* address in process */
 {
-	enum { STRSZ = 40 };
-	char string[STRSZ + 1];
+	enum { STRSZ = 4096 };
 	ssize_t leng = 0;
-	int nbyte;
+	ssize_t nbyte;
+	size_t chunk;
+	char *nul;
 
 	if (size < 2) {
 		errno = EINVAL;
@@ -2483,20 +2708,31 @@ Pread_string(struct ps_prochandle *P,
 
 	size--;			/* ensure trailing null fits in buffer */
 
-	*buf = '\0';
-	string[STRSZ] = '\0';
+	/*
+	 * Read straight into the caller's buffer, never crossing a page
+	 * boundary in one read so that a string that ends just before an
+	 * unmapped page can still be read in full.
+	 */
+	while (leng < size) {
+		chunk = STRSZ - (addr % STRSZ);
+		if (chunk > size - leng)
+			chunk = size - leng;
 
-	for (nbyte = STRSZ; nbyte == STRSZ && leng < size; addr += STRSZ) {
-		if ((nbyte = Pread(P, string, STRSZ, addr)) <= 0) {
+		if ((nbyte = Pread(P, buf + leng, chunk, addr)) <= 0) {
 			buf[leng] = '\0';
 			return (leng ? leng : -1);
 		}
-		if ((nbyte = strlen(string)) > 0) {
-			if (leng + nbyte > size)
-				nbyte = size - leng;
-			(void) strncpy(buf + leng, string, nbyte);
-			leng += nbyte;
+
+		if ((nul = memchr(buf + leng, '\0', nbyte)) != NULL) {
+			leng = nul - buf;
+			break;
 		}
+
+		leng += nbyte;
+		addr += nbyte;
+
+		if (nbyte < chunk)
+			break;
 	}
 	buf[leng] = '\0';
 	return (leng);
@@ -2629,6 +2865,15 @@ Pset_ptrace_lock_hook(ptrace_lock_hook_fun *hook)
 	ptrace_lock_hook = hook;
 }
 
+/*
+ * Set the blocking-wait hook.
+ */
+void
+Pset_pwait_block_hook(pwait_block_hook_fun *hook)
+{
+	pwait_block_hook = hook;
+}
+
 /*
  * Return 1 if the process is invasively grabbed, and thus ptrace()able.
  */
@@ -2717,6 +2962,48 @@ Phastty(pid_t pid)
 	return (tty != 0);
 }
 
+/*
+ * Return the start time of this process, in clock ticks since boot, or 0 if
+ * it cannot be determined.  Together with the pid, this identifies a process
+ * uniquely, even across pid reuse.
+ */
+unsigned long long
+Pstart_time(pid_t pid)
+{
+	char procname[PATH_MAX];
+	char *buf = NULL;
+	char *s;
+	size_t n;
+	FILE *fp;
+	unsigned long long start;
+
+	snprintf(procname, sizeof (procname), "%s/%d/stat",
+	    procfs_path, pid);
+
+	if ((fp = fopen(procname, "r")) == NULL)
+		return 0;
+
+	if (getline(&buf, &n, fp) < 0) {
+		free(buf);
+		fclose(fp);
+		return 0;
+	}
+
+	fclose(fp);
+
+	/*
+	 * The process name may contain spaces and parentheses: skip past the
+	 * last close paren, then over fields 3 to 21.
+	 */
+	s = strrchr(buf, ')');
+	if (!s || sscanf(s + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+		"%*u %*u %*d %*d %*d %*d %*d %*d %llu", &start) != 1)
+		start = 0;
+
+	free(buf);
+	return start;
+}
+
 /*
  * Get a specific field out of /proc/$pid/status and return the portion after
  * the colon in a new dynamically allocated string, or NULL if no field matches.
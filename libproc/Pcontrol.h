@@ -21,6 +21,7 @@
 #include <dtrace.h>
 #include <dt_list.h>
 #include <setjmp.h>
+#include <time.h>
 #include <sys/ptrace.h>
 
 #include <sys/auxv.h>
@@ -54,7 +55,30 @@ extern libproc_unwinder_pad_fun *libproc_unwinder_pad;
  * that is aware of the two tables and makes them look like a single table
  * to the caller.
  *
+ * The section data itself is not copied: libelf hands back pointers into its
+ * read-only mapping of the file.  The sorted lists hold just enough of each
+ * symbol to search them, so a lookup only calls symtab_getsym() once, on the
+ * symbol it finally returns.
+ *
+ * Address lookups do not search the sorted list itself, but a flat array of
+ * disjoint address intervals derived from it, each naming the one symbol that
+ * a lookup anywhere in that interval should return.  Nested symbols and
+ * aliases are resolved once, when the array is built, rather than at every
+ * lookup.
  */
+typedef struct sym_entry {	/* sorted symbol table entry */
+	GElf_Addr se_value;	/* symbol value */
+	GElf_Xword se_size;	/* symbol size */
+	uint_t	se_name;	/* string table offset of symbol name */
+	uint_t	se_index;	/* symbol index, for symtab_getsym() */
+} sym_entry_t;
+
+typedef struct sym_interval {	/* address interval covered by one symbol */
+	GElf_Addr si_start;	/* first address in the interval */
+	GElf_Addr si_end;	/* first address beyond the interval */
+	uint_t	si_sym;		/* sym_byaddr index of the symbol */
+} sym_interval_t;
+
 typedef struct sym_tbl {	/* symbol table */
 	Elf_Data *sym_data_pri;	/* primary table */
 	Elf_Data *sym_data_aux;	/* auxiliary table */
@@ -65,11 +89,42 @@ typedef struct sym_tbl {	/* symbol table */
 	GElf_Shdr sym_hdr_pri;	/* primary symbol table section header */
 	GElf_Shdr sym_hdr_aux;	/* auxiliary symbol table section header */
 	GElf_Shdr sym_strhdr;	/* string table section header */
-	uint_t	*sym_byname;	/* symbols sorted by name */
-	uint_t	*sym_byaddr;	/* symbols sorted by addr */
+	uint_t	*sym_byname;	/* sym_byaddr indexes, sorted by name */
+	sym_entry_t *sym_byaddr; /* symbols sorted by addr */
 	size_t	sym_count;	/* number of symbols in each sorted list */
+	sym_interval_t *sym_intervals; /* address intervals, sorted */
+	size_t	sym_nintervals;	/* number of address intervals */
 } sym_tbl_t;
 
+/*
+ * The parts of a mapped file's symbol information that depend only on the
+ * file's contents: its ELF handle, sorted symbol tables, section header string
+ * table and lowest loadable address.  These are shared between every
+ * file_info_t, in every process, that maps the same file, identified by device,
+ * inode, size and modification time, so that a library mapped into many
+ * processes is only read and sorted once.  Reference-counted by fs_ref, and
+ * deallocated only when this reaches zero.
+ *
+ * Nothing in here changes after the file_syms_t is built.
+ */
+typedef struct file_syms {
+	struct file_syms *fs_next; /* hash chain */
+	dev_t	fs_dev;		/* device number of file */
+	ino_t	fs_inum;	/* inode number of file */
+	off_t	fs_size;	/* size of file */
+	struct timespec fs_mtime; /* modification time of file */
+	int	fs_ref;		/* references from file_info_t structures */
+	GElf_Half fs_etype;	/* ELF e_type from ehdr */
+	Elf	*fs_elf;	/* ELF handle */
+	sym_tbl_t fs_symtab;	/* symbol table */
+	sym_tbl_t fs_dynsym;	/* dynamic symbol table */
+	char	*fs_shstrs;	/* section header string table */
+	size_t	fs_shstrsz;	/* section header string table size */
+	GElf_Addr fs_lowest_vaddr; /* lowest PT_LOAD vaddr, or -1 if none */
+} file_syms_t;
+
+#define FILE_SYMS_BUCKETS	127
+
 /*
  * This structure persists even across shared library loads and unloads: it is
  * reference-counted by file_ref and deallocated only when this reaches zero.
@@ -80,8 +135,11 @@ typedef struct sym_tbl {	/* symbol table */
  * carried out (generally right after info_valid becomes 1 again).  Within the
  * file_lo, rl_scope is also dynamically allocated, but is freed and reallocated
  * whenever map_iter() is run.
+ *
+ * file_syms is NULL if this is not an ELF file, or if its symbols could not be
+ * read.
  */
-struct map_info;
+
 typedef struct file_info {	/* symbol information for a mapped file */
 	dt_list_t file_list;	/* linked list */
 	ssize_t	file_map; 	/* primary (text) mapping idx, or -1 if none */
@@ -90,18 +148,13 @@ typedef struct file_info {	/* symbol information for a mapped file */
 	ino_t	file_inum;	/* inode number of file */
 	int	file_ref;	/* references from map_info_t structures */
 	int	file_init;	/* 0: initialization yet to be performed */
-	GElf_Half file_etype;	/* ELF e_type from ehdr */
 	rd_loadobj_t *file_lo;	/* load object structure from rtld_db */
 	char	*file_lname;	/* load object name from rtld_db */
 	char	*file_lbase;	/* pointer to basename of file_lname */
-	Elf	*file_elf;	/* ELF handle */
+	file_syms_t *file_syms;	/* shared symbol information */
 	struct file_info **file_symsearch; /* Symbol search path */
 	unsigned int file_nsymsearch; /* number of items therein */
-	sym_tbl_t file_symtab;	/* symbol table */
-	sym_tbl_t file_dynsym;	/* dynamic symbol table */
 	uintptr_t file_dyn_base;	/* load address for ET_DYN files */
-	char	*file_shstrs;	/* section header string table */
-	size_t	file_shstrsz;	/* section header string table size */
 } file_info_t;
 
 /*
@@ -117,9 +170,25 @@ typedef struct map_info {	/* description of an address space mapping */
 } map_info_t;
 
 /*
- * Number of buckets in our hashes of process -> mapping name and
+ * One line of /proc/<pid>/maps, as parsed by Pupdate_maps().  The strings are
+ * not copied: they point into the buffer the maps file was read into, and are
+ * only duplicated for mappings that were not already known.
+ */
+typedef struct map_line {	/* parsed /proc/<pid>/maps line */
+	uintptr_t ml_vaddr;	/* virtual address of mapping */
+	size_t	ml_size;	/* size of mapping in bytes */
+	int	ml_mflags;	/* protection flags (MA_*) */
+	dev_t	ml_dev;		/* device number */
+	ino_t	ml_inum;	/* inode number */
+	char	*ml_addrname;	/* address text */
+	char	*ml_name;	/* mapped file name */
+} map_line_t;
+
+/*
+ * Initial number of buckets in our hashes of process -> mapping name and
  * address->breakpoint.  (We expect quite a lot of mappings, and
- * very few breakpoints.)
+ * very few breakpoints.)  Both hashes grow whenever they hold more entries
+ * than they have buckets.
  */
 
 #define MAP_HASH_BUCKETS	277
@@ -162,6 +231,29 @@ typedef struct bkpt {
 	int pending_removal;		/* some handler has called Punbkpt() */
 } bkpt_t;
 
+/*
+ * A cached link map node, as last read from the child by rd_loadobj_iter().
+ */
+typedef struct rd_lm_node {
+	uintptr_t lmn_addr;		/* address of the link map */
+	struct link_map lmn_map;	/* l_addr, l_name, l_ld and l_next */
+	uintptr_t lmn_searchlist;	/* address of the l_searchlist array */
+	unsigned int lmn_nscopes;	/* number of elements in it */
+	uintptr_t *lmn_scope;		/* copy of the l_searchlist array */
+	int lmn_valid;			/* 1 if unchanged since last read */
+} rd_lm_node_t;
+
+/*
+ * The cached link map chain for one lmid.
+ */
+typedef struct rd_lm_cache {
+	rd_lm_node_t *lmc_nodes;	/* nodes, in link map order */
+	size_t lmc_count;		/* number of nodes */
+	size_t lmc_size;		/* number of nodes allocated */
+	rd_lm_node_t *lmc_old;		/* previous nodes, during a refresh */
+	size_t lmc_nold;		/* number of previous nodes */
+} rd_lm_cache_t;
+
 /*
  * librtld_db agent state.
  */
@@ -197,6 +289,18 @@ struct rd_agent {
 					   rd_ldso_nonzero_lmid_consistent_begin(). */
 	int	lmid_bkpted;		/* halted on bkpt by rlnlcb(). */
 	int	lmid_incompatible_glibc; /* glibc data structure change. */
+
+	/*
+	 * Link map chains as of the last rd_loadobj_iter(), one per lmid.
+	 * lm_gen is bumped on every r_brk hit and every time monitoring of
+	 * r_brk starts or stops: if it is unchanged since the cache was filled
+	 * and monitoring is still on, no link map can have changed.
+	 */
+	rd_lm_cache_t *lm_cache;	/* array of lm_ncache caches */
+	size_t	lm_ncache;		/* number of lmids cached */
+	unsigned long lm_gen;		/* link map generation */
+	unsigned long lm_cache_gen;	/* generation the cache was filled at */
+	int	lm_cache_valid;		/* 1 if lm_cache_gen is meaningful */
 };
 
 /*
@@ -231,6 +335,7 @@ struct ps_prochandle {
 	int	detach;		/* whether to detach when !ptraced and !bkpts */
 	int	no_dyn;		/* true if this is probably statically linked */
 	int	memfd;		/* /proc/<pid>/mem filedescriptor */
+	int	no_vm_readv;	/* true if process_vm_readv() is unusable */
 	int	mapfilefd;	/* /proc/<pid>/map_files directory fd */
 	int	info_valid;	/* if zero, map and file info need updating */
 	int	lmids_valid;	/* 0 if we haven't yet scanned the link map */
@@ -239,12 +344,23 @@ struct ps_prochandle {
 	map_info_t *mappings;	/* process mappings, sorted by address */
 	size_t	num_mappings;	/* number of mappings */
 	prmap_file_t **map_files; /* hash of mappings by filename */
+	uint_t	map_files_nbuckets; /* number of buckets in map_files */
+	uint_t	num_map_files;	/* number of entries in map_files */
+	uint64_t map_files_lookups; /* lookups in map_files */
+	uint64_t map_files_probes; /* chain entries examined in map_files */
+	char	*maps_buf;	/* buffer /proc/<pid>/maps is read into */
+	size_t	maps_bufsz;	/* size of maps_buf */
+	map_line_t *maps_lines;	/* lines parsed out of maps_buf */
+	size_t	maps_nlines;	/* allocated size of maps_lines */
 	uint_t  num_files;	/* number of file elements in file_list */
 	dt_list_t file_list;	/* list of mapped files w/ symbol table info */
 	auxv_t	*auxv;		/* the process's aux vector */
 	int	nauxv;		/* number of aux vector entries */
 	bkpt_t	**bkpts;	/* hash of active breakpoints by address */
 	uint_t	num_bkpts;	/* number of active breakpoints */
+	uint_t	bkpts_nbuckets;	/* number of buckets in bkpts */
+	uint64_t bkpts_lookups;	/* lookups in bkpts */
+	uint64_t bkpts_probes;	/* chain entries examined in bkpts */
 	uintptr_t tracing_bkpt;	/* address of breakpoint we are single-stepping
 				   past, if any */
 	int	bkpt_halted;	/* halted at breakpoint by handler */
@@ -254,6 +370,7 @@ struct ps_prochandle {
 	ssize_t map_exec;	/* the index of the executable mapping */
 	ssize_t map_ldso;	/* the index of the ld.so mapping */
 	ptrace_fun *ptrace_wrap; /* ptrace() wrapper */
+	ptrace_batch_fun *ptrace_batch_wrap; /* ptrace() batch wrapper */
 	pwait_fun *pwait_wrap;	 /* pwait() wrapper */
 	void *wrap_arg;		 /* args for hooks and wrappers */
 };
@@ -286,6 +403,8 @@ extern	char	procfs_path[PATH_MAX];
  */
 extern	long wrapped_ptrace(struct ps_prochandle *P, enum __ptrace_request request,
     pid_t pid, ...);
+extern	long wrapped_ptrace_batch(struct ps_prochandle *P, ptrace_req_t *reqs,
+    size_t n);
 
 /*
  * Poison all calls to ptrace() from everywhere but the ptrace hook.
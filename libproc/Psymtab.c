@@ -42,7 +42,10 @@ static map_info_t *object_name_to_map(struct ps_prochandle *,
 static GElf_Sym *sym_by_name(sym_tbl_t *, const char *, GElf_Sym *, uint_t *);
 static file_info_t *file_info_new(struct ps_prochandle *, map_info_t *);
 static int byaddr_cmp_common(GElf_Sym *a, char *aname, GElf_Sym *b, char *bname);
-static void optimize_symtab(sym_tbl_t *);
+static void optimize_symtabs(sym_tbl_t *, sym_tbl_t *);
+static void symtab_build_intervals(sym_tbl_t *);
+static GElf_Sym *symtab_getsym(sym_tbl_t *, int, GElf_Sym *);
+static void file_syms_release(file_syms_t *);
 static void Pbuild_file_symtab(struct ps_prochandle *, file_info_t *);
 static map_info_t *Paddr2mptr(struct ps_prochandle *P, uintptr_t addr);
 static int Pxlookup_by_name_internal(struct ps_prochandle *P, Lmid_t lmid,
@@ -109,11 +112,9 @@ file_info_del(struct ps_prochandle *P, file_info_t *fptr)
 	    fptr->file_pname);
 
 	dt_list_delete(&P->file_list, fptr);
-	free(fptr->file_symtab.sym_byname);
-	free(fptr->file_symtab.sym_byaddr);
 
-	free(fptr->file_dynsym.sym_byname);
-	free(fptr->file_dynsym.sym_byaddr);
+	if (fptr->file_syms)
+		file_syms_release(fptr->file_syms);
 
 	if (fptr->file_lo)
 		free(fptr->file_lo->rl_scope);
@@ -122,7 +123,6 @@ file_info_del(struct ps_prochandle *P, file_info_t *fptr)
 	free(fptr->file_lname);
 	free(fptr->file_pname);
 	free(fptr->file_symsearch);
-	elf_end(fptr->file_elf);
 	free(fptr);
 	P->num_files--;
 }
@@ -171,7 +171,7 @@ mapping_purge(struct ps_prochandle *P)
 	}
 	P->num_mappings = 0;
 
-	for (i = 0; i < MAP_HASH_BUCKETS; i++) {
+	for (i = 0; i < P->map_files_nbuckets; i++) {
 		prmap_file_t *prf;
 		prmap_file_t *old_prf = NULL;
 
@@ -184,7 +184,9 @@ mapping_purge(struct ps_prochandle *P)
 		free(old_prf);
 	}
 
-	memset(P->map_files, 0, sizeof (struct prmap_file *) * MAP_HASH_BUCKETS);
+	memset(P->map_files, 0,
+	    sizeof (struct prmap_file *) * P->map_files_nbuckets);
+	P->num_map_files = 0;
 
 	for (i = 0, fptr = dt_list_next(&P->file_list);
 	     i < P->num_files; i++, fptr = dt_list_next(fptr)) {
@@ -211,6 +213,7 @@ Psym_init(struct ps_prochandle *P)
 		_dprintf("Out of memory initializing map_files hash\n");
 		return -ENOMEM;
 	}
+	P->map_files_nbuckets = MAP_HASH_BUCKETS;
 	return 0;
 }
 
@@ -222,6 +225,7 @@ Psym_free(struct ps_prochandle *P)
 {
 	free(P->map_files);
 	P->map_files = NULL;
+	P->map_files_nbuckets = 0;
 }
 
 /*
@@ -231,16 +235,136 @@ Psym_free(struct ps_prochandle *P)
 static prmap_file_t *Pprmap_file_by_name(struct ps_prochandle *P,
     const char *name)
 {
-	uint_t h = string_hash(name) % MAP_HASH_BUCKETS;
+	uint_t h = string_hash(name) % P->map_files_nbuckets;
 	prmap_file_t *prf;
 
-	for (prf = P->map_files[h]; prf != NULL; prf = prf->prf_next)
+	P->map_files_lookups++;
+	for (prf = P->map_files[h]; prf != NULL; prf = prf->prf_next) {
+		P->map_files_probes++;
 		if (strcmp(prf->prf_mapname, name) == 0)
 			return (prf);
+	}
 
 	return NULL;
 }
 
+/*
+ * Grow the map_files hash if it has more entries than buckets.  Failure to grow
+ * is harmless: the chains just get longer.
+ */
+static void
+Pprmap_file_hash_grow(struct ps_prochandle *P)
+{
+	uint_t nbuckets = P->map_files_nbuckets * 2 + 1;
+	prmap_file_t **map_files;
+	uint_t i;
+
+	if (P->num_map_files <= P->map_files_nbuckets)
+		return;
+
+	if ((map_files = calloc(nbuckets, sizeof (prmap_file_t *))) == NULL)
+		return;
+
+	for (i = 0; i < P->map_files_nbuckets; i++) {
+		prmap_file_t *prf, *next_prf;
+
+		for (prf = P->map_files[i]; prf != NULL; prf = next_prf) {
+			uint_t h = string_hash(prf->prf_mapname) % nbuckets;
+
+			next_prf = prf->prf_next;
+			prf->prf_next = map_files[h];
+			map_files[h] = prf;
+		}
+	}
+
+	_dprintf("%i: Grew mapping-name hash to %u buckets\n", P->pid,
+	    nbuckets);
+	free(P->map_files);
+	P->map_files = map_files;
+	P->map_files_nbuckets = nbuckets;
+}
+
+/*
+ * Report statistics on the map_files hash.
+ */
+void
+Pmap_hash_stats(struct ps_prochandle *P, prhashstats_t *stats)
+{
+	uint_t i;
+
+	memset(stats, 0, sizeof (prhashstats_t));
+	stats->phs_lookups = P->map_files_lookups;
+	stats->phs_probes = P->map_files_probes;
+	stats->phs_buckets = P->map_files_nbuckets;
+
+	for (i = 0; i < P->map_files_nbuckets; i++) {
+		prmap_file_t *prf;
+		size_t len = 0;
+
+		for (prf = P->map_files[i]; prf != NULL; prf = prf->prf_next)
+			len++;
+
+		stats->phs_entries += len;
+		if (len > 0)
+			stats->phs_used++;
+		if (len > stats->phs_maxchain)
+			stats->phs_maxchain = len;
+	}
+}
+
+/*
+ * The memory used by one symbol table, not counting the section data, which
+ * libelf maps from the file.
+ */
+static size_t
+sym_tbl_memsize(const sym_tbl_t *symp)
+{
+	return symp->sym_count * (sizeof (sym_entry_t) + sizeof (uint_t)) +
+	    symp->sym_nintervals * sizeof (sym_interval_t);
+}
+
+/*
+ * Estimate the memory held by a process handle: its mappings, mapped-file
+ * information and libproc bookkeeping, plus its share of every symbol table it
+ * uses.  Symbol tables shared with other handles are divided evenly between
+ * them, so the estimates of all handles sum to roughly their total footprint.
+ */
+size_t
+Pmemsize(struct ps_prochandle *P)
+{
+	size_t size = sizeof (struct ps_prochandle);
+	file_info_t *fptr;
+	size_t i;
+
+	size += P->num_mappings * (sizeof (map_info_t) + sizeof (prmap_t));
+	size += P->map_files_nbuckets * sizeof (prmap_file_t *);
+	size += P->num_map_files * sizeof (prmap_file_t);
+	size += P->maps_bufsz + P->maps_nlines * sizeof (map_line_t);
+	size += P->bkpts_nbuckets * sizeof (bkpt_t *);
+	size += P->num_bkpts * sizeof (bkpt_t);
+
+	for (i = 0, fptr = dt_list_next(&P->file_list);
+	     i < P->num_files; i++, fptr = dt_list_next(fptr)) {
+		file_syms_t *fsp = fptr->file_syms;
+
+		size += sizeof (file_info_t);
+		if (fptr->file_pname != NULL)
+			size += strlen(fptr->file_pname) + 1;
+		if (fptr->file_lname != NULL)
+			size += strlen(fptr->file_lname) + 1;
+		if (fptr->file_lo != NULL)
+			size += sizeof (rd_loadobj_t);
+		size += fptr->file_nsymsearch * sizeof (file_info_t *);
+
+		if (fsp != NULL && fsp->fs_ref > 0)
+			size += (sizeof (file_syms_t) +
+			    sym_tbl_memsize(&fsp->fs_symtab) +
+			    sym_tbl_memsize(&fsp->fs_dynsym)) / fsp->fs_ref;
+	}
+
+	return size;
+}
+
 /*
  * Call-back function for librtld_db to iterate through all of its shared
  * libraries and determine their load object names and lmids.
@@ -441,362 +565,594 @@ Pupdate_symsearch(struct ps_prochandle *P, struct file_info *fptr)
 }
 
 /*
- * Go through all the address space mappings, validating or updating
- * the information already gathered, or gathering new information.
- *
- * This function is only called when we suspect that the mappings have changed
- * because of rtld activity, or when a process is referenced for the first time.
+ * Read all of /proc/<pid>/maps into P->maps_buf, and parse it in place into
+ * P->maps_lines, skipping anonymous mappings and special mappings like the
+ * stack, heap, and vdso.  Returns the number of lines parsed, or -1 on error.
  */
-void
-Pupdate_maps(struct ps_prochandle *P)
+static ssize_t
+Pread_maps(struct ps_prochandle *P)
 {
 	char mapfile[PATH_MAX];
-	char exefile[PATH_MAX + 10] = "";	/* strlen(" (deleted)") */
-	FILE *fp;
+	size_t used = 0;
+	ssize_t n;
+	size_t nlines = 0;
+	char *line, *end;
+	int fd;
 
-	size_t old_num_mappings = P->num_mappings;
-	size_t i = 0;
-	char *fn = NULL;
-	char *mapaddrname = NULL;
-	char *line = NULL;
-	size_t len;
+	(void) snprintf(mapfile, sizeof (mapfile), "%s/%d/maps",
+	    procfs_path, (int)P->pid);
+	if ((fd = open(mapfile, O_RDONLY | O_CLOEXEC)) < 0)
+		return (-1);
 
-	if (P->info_valid)
-		return;
+	for (;;) {
+		if (used + 1 >= P->maps_bufsz) {
+			size_t new_sz = P->maps_bufsz ? P->maps_bufsz * 2 : 65536;
+			char *new_buf = realloc(P->maps_buf, new_sz);
 
-	if (P->state == PS_DEAD)
-		return;
+			if (new_buf == NULL) {
+				close(fd);
+				return (-1);
+			}
+			P->maps_buf = new_buf;
+			P->maps_bufsz = new_sz;
+		}
 
-	_dprintf("Updating mappings for PID %i\n", P->pid);
+		n = read(fd, P->maps_buf + used, P->maps_bufsz - used - 1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			close(fd);
+			return (-1);
+		}
+		if (n == 0)
+			break;
+		used += n;
+	}
+	close(fd);
+	P->maps_buf[used] = '\0';
 
 	/*
-	 * For now, just throw away and reconstruct all the mappings from
-	 * scratch.  This is theoretically inefficient, as a dlopen() or
-	 * dlclose() will normally change only a few mappings: but it is much
-	 * simpler to implement than the alternatives, and it ends up being
-	 * cheaper than expected because we can avoid having to resort any of
-	 * the mappings arrays (since /proc/$pid/maps is always sorted by
-	 * address).  We are left with allocator overhead and nothing else.
+	 * Each line looks like
 	 *
-	 * Because it is much more expensive to recompute the file_info_t, we
-	 * preserve them (with zero reference count) and reuse them where
-	 * possible.
+	 * laddr-haddr perms offset major:minor inode    name
+	 *
+	 * The address text and the name are terminated in place.
 	 */
-	mapping_purge(P);
+	for (line = P->maps_buf; *line != '\0'; line = end) {
+		map_line_t *ml;
+		unsigned long laddr, haddr;
+		unsigned int major, minor;
+		char *p, *name, *perms;
+
+		if ((end = strchr(line, '\n')) != NULL)
+			*end++ = '\0';
+		else
+			end = line + strlen(line);
 
-	(void) snprintf(mapfile, sizeof (mapfile), "%s/%d/maps",
-	    procfs_path, (int)P->pid);
-	if ((fp = fopen(mapfile, "r")) == NULL) {
-		Preset_maps(P);
-		return;
-	}
+		laddr = strtoul(line, &p, 16);
+		if (*p != '-')
+			continue;
+		haddr = strtoul(p + 1, &p, 16);
+		if (*p != ' ')
+			continue;
+		*p++ = '\0';
 
-	snprintf(exefile, sizeof (exefile), "%s/%d/exe", procfs_path,
-	    (int)P->pid);
+		perms = p;
+		if (strlen(perms) < 5 || perms[4] != ' ')
+			continue;
+		p = perms + 5;
 
-	if ((len = readlink(exefile, exefile, sizeof (exefile))) > 0)
-		exefile[len] = '\0';
+		(void) strtoul(p, &p, 16);		/* offset */
+		major = strtoul(p, &p, 16);
+		if (*p != ':')
+			continue;
+		minor = strtoul(p + 1, &p, 16);
 
-	while (getline(&line, &len, fp) >= 0) {
-		unsigned long laddr, haddr, offset;
-		ino_t	inode;
-		unsigned int major;
-		unsigned int minor;
-		char	perms[5];
-		const char *first_space;
-		map_info_t *mptr;
-		prmap_file_t *prf;
-		prmap_t *pmptr;
-		struct prmap **new_prf_mappings;
+		if (nlines >= P->maps_nlines) {
+			size_t new_n = P->maps_nlines ? P->maps_nlines * 2 : 256;
+			map_line_t *new_lines = realloc(P->maps_lines,
+			    new_n * sizeof (map_line_t));
 
-		/*
-		 * gcc complains:
-		 *   warning: ISO C does not support the 'm' scanf flag
-		 */
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wformat"
-		sscanf(line, "%lx-%lx %s %lx %x:%x %lu %ms",
-		    &laddr, &haddr, perms, &offset, &major, &minor, &inode,
-		    &fn);
-#pragma GCC diagnostic pop
+			if (new_lines == NULL)
+				return (-1);
+			P->maps_lines = new_lines;
+			P->maps_nlines = new_n;
+		}
+
+		ml = &P->maps_lines[nlines];
+		ml->ml_inum = strtoul(p, &p, 10);
 
 		/*
-		 * Skip anonymous mappings, and special mappings like the stack,
-		 * heap, and vdso; also skip on OOM.
+		 * The name runs to the next whitespace: anything after it (like
+		 * " (deleted)") is not part of it.
 		 */
-		first_space = strchr(line, ' ');
-		mapaddrname = strndup(line, first_space - line);
-		if ((fn == NULL) || (mapaddrname == NULL) || (fn[0] == '[')) {
-			free(fn);
-			free(mapaddrname);
+		while (*p == ' ' || *p == '\t')
+			p++;
+		name = p;
+		while (*p != '\0' && *p != ' ' && *p != '\t')
+			p++;
+		*p = '\0';
+
+		if (name[0] == '\0' || name[0] == '[')
 			continue;
-		}
 
-		/*
-		 * Allocate a new map_info, and see if we need to allocate a new
-		 * map_file.  Expand the map_info region only if necessary.
-		 * (This makes multiple sequential unmaps cheaper, though
-		 * nothing we can do can make multiple sequential maps cheap.)
-		 */
+		ml->ml_vaddr = laddr;
+		ml->ml_size = haddr - laddr;
+		ml->ml_dev = makedev(major, minor);
+		ml->ml_addrname = line;
+		ml->ml_name = name;
+		ml->ml_mflags = 0;
+		if (perms[0] == 'r')
+			ml->ml_mflags |= MA_READ;
+		if (perms[1] == 'w')
+			ml->ml_mflags |= MA_WRITE;
+		if (perms[2] == 'x')
+			ml->ml_mflags |= MA_EXEC;
+		nlines++;
+	}
 
-		if (P->num_mappings >= old_num_mappings) {
-			map_info_t *mappings = realloc(P->mappings,
-			    sizeof (struct map_info) * (P->num_mappings + 1));
-			if (!mappings)
-				goto err;
-			P->mappings = mappings;
-		}
+	return (nlines);
+}
 
-		mptr = &P->mappings[P->num_mappings];
-		memset(mptr, 0, sizeof (struct map_info));
+/*
+ * Recompute the primary text and data mappings of a prmap_file_t.
+ *
+ * Both ld.so and the kernel follow the rule that the first executable mapping
+ * they establish is the primary text mapping, and the first writable mapping is
+ * the primary data mapping.  The primary text mapping must correspond to an
+ * on-disk mapping somewhere (since we cannot mmap() nor create a file_info for
+ * anonymous mappings).  This is universally true in any case.
+ */
+static void
+prmap_file_set_primary(prmap_file_t *prf)
+{
+	size_t i;
 
-		mptr->map_pmap = malloc(sizeof (struct prmap));
-		if (!mptr->map_pmap)
-			goto err;
-		pmptr = mptr->map_pmap;
-		memset(pmptr, 0, sizeof (struct prmap));
+	prf->prf_text_map = NULL;
+	prf->prf_data_map = NULL;
 
-		if ((prf = Pprmap_file_by_name(P, fn)) == NULL) {
-			uint_t h = string_hash(fn) % MAP_HASH_BUCKETS;
+	for (i = 0; i < prf->prf_num_mappings; i++) {
+		prmap_t *pmptr = prf->prf_mappings[i];
 
-			if ((prf = malloc(sizeof (struct prmap_file))) == NULL) {
-				free(mptr->map_pmap);
-				goto err;
-			}
+		if ((pmptr->pr_mflags & MA_WRITE) && prf->prf_data_map == NULL)
+			prf->prf_data_map = pmptr;
+		if ((pmptr->pr_mflags & MA_EXEC) && prf->prf_text_map == NULL &&
+		    prf->prf_mapname[0] == '/')
+			prf->prf_text_map = pmptr;
+	}
+}
 
-			memset(prf, 0, sizeof(struct prmap_file));
-			prf->prf_mapname = fn;
-			prf->prf_next = P->map_files[h];
-			P->map_files[h] = prf;
-		}
-		else {
-			free(fn);
-			fn = NULL;
-		}
+/*
+ * Drop a mapping that has gone away: unlink its prmap_t from its prmap_file_t
+ * (freeing that too if it is now empty), drop its reference to its file_info_t
+ * (which is left for file_info_purge()), and free it.
+ */
+static void
+mapping_remove(struct ps_prochandle *P, map_info_t *mptr)
+{
+	prmap_t *pmptr = mptr->map_pmap;
+	prmap_file_t *prf = pmptr->pr_file;
+	size_t i;
 
-		new_prf_mappings = realloc(prf->prf_mappings,
-		    (prf->prf_num_mappings + 1) * sizeof (struct prmap_t *));
+	if (mptr->map_file != NULL)
+		mptr->map_file->file_ref--;
 
-		if (new_prf_mappings == NULL) {
-			free(mptr->map_pmap);
-			goto err;
+	for (i = 0; i < prf->prf_num_mappings; i++) {
+		if (prf->prf_mappings[i] == pmptr) {
+			memmove(&prf->prf_mappings[i], &prf->prf_mappings[i + 1],
+			    (prf->prf_num_mappings - i - 1) *
+			    sizeof (struct prmap *));
+			prf->prf_num_mappings--;
+			break;
 		}
+	}
 
-		prf->prf_mappings = new_prf_mappings;
-		prf->prf_mappings[prf->prf_num_mappings] = pmptr;
-		prf->prf_num_mappings++;
-
-		pmptr->pr_vaddr = laddr;
-		pmptr->pr_size = haddr - laddr;
-		pmptr->pr_mapaddrname = mapaddrname;
+	if (prf->prf_num_mappings == 0) {
+		prmap_file_t **prev;
 
-		/*
-		 * Both ld.so and the kernel follow the rule that the first
-		 * executable mapping they establish is the primary text
-		 * mapping, and the first writable mapping is the primary data
-		 * mapping.
-		 */
-		if (perms[0] == 'r')
-			pmptr->pr_mflags |= MA_READ;
-		if (perms[1] == 'w') {
-			pmptr->pr_mflags |= MA_WRITE;
-			if (prf->prf_data_map == NULL)
-				prf->prf_data_map = pmptr;
+		for (prev = &P->map_files[string_hash(prf->prf_mapname) %
+			P->map_files_nbuckets];
+		     *prev != NULL; prev = &(*prev)->prf_next) {
+			if (*prev == prf) {
+				*prev = prf->prf_next;
+				P->num_map_files--;
+				break;
+			}
 		}
-		if (perms[2] == 'x') {
-			char *basename = strrchr(prf->prf_mapname, '/');
-			char *suffix = strrchr(prf->prf_mapname, '.');
+		free(prf->prf_mappings);
+		free(prf->prf_mapname);
+		free(prf);
+	} else if (prf->prf_text_map == pmptr || prf->prf_data_map == pmptr)
+		prmap_file_set_primary(prf);
+
+	free(pmptr->pr_mapaddrname);
+	free(pmptr);
+	mptr->map_pmap = NULL;
+	mptr->map_file = NULL;
+}
 
-			pmptr->pr_mflags |= MA_EXEC;
+/*
+ * Set up a new mapping described by a line of /proc/<pid>/maps, finding or
+ * creating its prmap_file_t and file_info_t.  Returns -1 on OOM.
+ */
+static int
+mapping_add(struct ps_prochandle *P, map_info_t *mptr, const map_line_t *ml)
+{
+	prmap_file_t *prf;
+	prmap_t *pmptr;
+	struct prmap **new_prf_mappings;
+	size_t i;
 
-			/*
-			 * The primary text mapping must correspond to an
-			 * on-disk mapping somewhere (since we cannot mmap()
-			 * nor create a file_info for anonymous mappings).
-			 * This is universally true in any case.
-			 */
-			if ((prf->prf_text_map == NULL) &&
-			    (prf->prf_mapname[0] == '/'))
-				prf->prf_text_map = pmptr;
+	memset(mptr, 0, sizeof (struct map_info));
 
-			/*
-			 * Heuristic to recognize the dynamic linker.  Works
-			 * for /lib, /lib64, and Debian multiarch as well as
-			 * conventional /lib/ld-2.13.so style systems.	(All
-			 * versions of glibc 2.x name their dynamic linker
-			 * something like ld-*.so.)
-			 *
-			 * If this heuristic fails, object_name_to_map() can use
-			 * the AT_BASE auxv entry to come up with another guess
-			 * (though this is likely to be stymied by dynamic
-			 * linker relocation for non-statically-linked
-			 * programs).
-			 */
+	if ((pmptr = calloc(1, sizeof (struct prmap))) == NULL)
+		return (-1);
 
-			if (basename && suffix && P->map_ldso == -1 &&
-			    !P->no_dyn &&
-			    (strncmp(prf->prf_mapname, "/lib", 4) == 0) &&
-			    (strncmp(basename, "/ld-", 4) == 0) &&
-			    (strcmp(suffix, ".so") == 0))
-				P->map_ldso = P->num_mappings;
+	if ((pmptr->pr_mapaddrname = strdup(ml->ml_addrname)) == NULL) {
+		free(pmptr);
+		return (-1);
+	}
 
-			/*
-			 * Recognize the executable mapping.
-			 */
+	if ((prf = Pprmap_file_by_name(P, ml->ml_name)) == NULL) {
+		uint_t h;
 
-			if (exefile[0] != '\0' && P->map_exec == -1 &&
-			    (strcmp(prf->prf_mapname, exefile) == 0))
-				P->map_exec = P->num_mappings;
+		if ((prf = calloc(1, sizeof (struct prmap_file))) == NULL ||
+		    (prf->prf_mapname = strdup(ml->ml_name)) == NULL) {
+			free(prf);
+			free(pmptr->pr_mapaddrname);
+			free(pmptr);
+			return (-1);
 		}
-		pmptr->pr_dev = makedev(major, minor);
-		pmptr->pr_inum = inode;
-		pmptr->pr_file = prf;
-
-		/*
-		 * We try to merge any file information we may have for existing
-		 * mappings, to avoid having to rebuild the file info.
-		 *
-		 * This is quite expensive if we have a lot of mappings, so we
-		 * avoid doing it for those mappings that cannot possibly
-		 * correspond to on-disk files.	 (It is still not guaranteed
-		 * that all our file_info_t's correspond to ELF files.)
-		 */
-
-		if (prf->prf_mapname[0] == '/') {
-			file_info_t *fptr;
 
-			for (i = 0, fptr = dt_list_next(&P->file_list);
-			     i < P->num_files; i++, fptr = dt_list_next(fptr)) {
-
-				if (fptr->file_dev == pmptr->pr_dev &&
-				    fptr->file_inum == pmptr->pr_inum &&
-				    (strcmp(fptr->file_pname,
-					prf->prf_mapname) == 0)) {
-					/*
-					 * This mapping matches. Revive it.
-					 */
-
-					fptr->file_ref++;
-					mptr->map_file = fptr;
-					break;
-				}
-			}
+		P->num_map_files++;
+		Pprmap_file_hash_grow(P);
+		h = string_hash(ml->ml_name) % P->map_files_nbuckets;
+		prf->prf_next = P->map_files[h];
+		P->map_files[h] = prf;
+	}
 
-			if ((mptr->map_file == NULL) &&
-			    (mptr->map_file = file_info_new(P, mptr)) == NULL) {
-				_dprintf("failed to allocate a new "
-				    "file_info_t for %s\n", prf->prf_mapname);
-				/*
-				 * Keep going: we can still work out other
-				 * mappings.
-				 */
-			}
+	new_prf_mappings = realloc(prf->prf_mappings,
+	    (prf->prf_num_mappings + 1) * sizeof (struct prmap *));
 
-			if (mptr->map_file &&
-			    mptr->map_file->file_map == -1 &&
-			    mptr->map_pmap->pr_file->prf_text_map == mptr->map_pmap)
-				mptr->map_file->file_map = P->num_mappings;
+	if (new_prf_mappings == NULL) {
+		if (prf->prf_num_mappings == 0) {
+			P->map_files[string_hash(ml->ml_name) %
+			    P->map_files_nbuckets] = prf->prf_next;
+			P->num_map_files--;
+			free(prf->prf_mapname);
+			free(prf);
 		}
-
-		_dprintf("Added mapping for %s: %lx(%lx)\n", prf->prf_mapname,
-		    pmptr->pr_vaddr, pmptr->pr_size);
-		P->num_mappings++;
+		free(pmptr->pr_mapaddrname);
+		free(pmptr);
+		return (-1);
 	}
 
+	pmptr->pr_vaddr = ml->ml_vaddr;
+	pmptr->pr_size = ml->ml_size;
+	pmptr->pr_mflags = ml->ml_mflags;
+	pmptr->pr_dev = ml->ml_dev;
+	pmptr->pr_inum = ml->ml_inum;
+	pmptr->pr_file = prf;
+
 	/*
-	 * Drop file_info_t's corresponding to closed mappings, which will still
-	 * have a zero refcount.
+	 * Keep the file's mappings sorted by address.  New mappings are
+	 * usually above all the existing ones.
 	 */
-	file_info_purge(P);
+	prf->prf_mappings = new_prf_mappings;
+	for (i = prf->prf_num_mappings; i > 0 &&
+		 prf->prf_mappings[i - 1]->pr_vaddr > pmptr->pr_vaddr; i--)
+		prf->prf_mappings[i] = prf->prf_mappings[i - 1];
+	prf->prf_mappings[i] = pmptr;
+	prf->prf_num_mappings++;
+	prmap_file_set_primary(prf);
+
+	mptr->map_pmap = pmptr;
 
 	/*
-	 * Note that we need to iterate across all mappings and recompute their
-	 * lmids and sonames when we do a lookup that might depend on any such
-	 * thing.  (That is, pretty much all lookups other than PR_OBJ_LDSO.)
+	 * We try to merge any file information we may have for existing
+	 * mappings, to avoid having to rebuild the file info.
 	 *
-	 * We do this lazily not for efficiency's sake but because rtld_db
-	 * itself does a name lookup of _rtld_global inside ld.so to determine
-	 * whether link maps are consistent, and iteration across load objects
-	 * requires link map consistency.
+	 * This is quite expensive if we have a lot of mappings, so we avoid
+	 * doing it for those mappings that cannot possibly correspond to
+	 * on-disk files.  (It is still not guaranteed that all our
+	 * file_info_t's correspond to ELF files.)
 	 */
+	if (prf->prf_mapname[0] == '/') {
+		file_info_t *fptr;
 
-	P->info_valid = 1;
+		for (i = 0, fptr = dt_list_next(&P->file_list);
+		     i < P->num_files; i++, fptr = dt_list_next(fptr)) {
 
-	if (!P->no_dyn)
-		P->lmids_valid = 0;
+			if (fptr->file_dev == pmptr->pr_dev &&
+			    fptr->file_inum == pmptr->pr_inum &&
+			    (strcmp(fptr->file_pname, prf->prf_mapname) == 0)) {
+				/*
+				 * This mapping matches. Revive it.
+				 */
 
-	fclose(fp);
-	free(line);
+				fptr->file_ref++;
+				mptr->map_file = fptr;
+				break;
+			}
+		}
 
-	return;
+		if ((mptr->map_file == NULL) &&
+		    (mptr->map_file = file_info_new(P, mptr)) == NULL) {
+			_dprintf("failed to allocate a new file_info_t for "
+			    "%s\n", prf->prf_mapname);
+			/*
+			 * Keep going: we can still work out other mappings.
+			 */
+		}
+	}
 
-err:
-	fclose(fp);
-	free(fn);
-	free(mapaddrname);
-	free(line);
-	Preset_maps(P);
-	return;
+	_dprintf("Added mapping for %s: %lx(%lx)\n", prf->prf_mapname,
+	    pmptr->pr_vaddr, pmptr->pr_size);
+
+	return (0);
 }
 
 /*
- * Iterate across all mappings and recompute their lmids and sonames.
- * (Mappings which the dynamic linker does not know about, such as that
- * for the dynamic linker itself, will be left in lmid 0 by default.
- * This is almost certainly correct, since lmid use is vanishingly rare
- * on Linux.)
- *
- * Don't do this if we know this is a statically linked binary, since
- * they have no analogue of lmids at all.  (If we are not sure, rd_new()
- * will compute it.  The rd_new() initialization process itself can call
- * back into symbol lookup if this turns out to be a statically linked
- * binary, to prevent unnecessary recursion.)
+ * Return nonzero if an existing mapping is the same as the one described by a
+ * line of /proc/<pid>/maps.
  */
-static void
-Pupdate_lmids(struct ps_prochandle *P)
+static int
+mapping_matches(const map_info_t *mptr, const map_line_t *ml)
 {
-	if (P->info_valid && !P->noninvasive &&
-	    !P->no_dyn && !P->lmids_valid) {
-		if (P->rap == NULL)
-			P->rap = rd_new(P);
-
-		if (P->rap != NULL)
-			rd_loadobj_iter(P->rap, map_iter, P);
-
-		P->lmids_valid = 1;
-	}
+	const prmap_t *pmptr = mptr->map_pmap;
+
+	return (pmptr->pr_vaddr == ml->ml_vaddr &&
+	    pmptr->pr_size == ml->ml_size &&
+	    pmptr->pr_inum == ml->ml_inum &&
+	    pmptr->pr_dev == ml->ml_dev &&
+	    pmptr->pr_mflags == ml->ml_mflags &&
+	    strcmp(pmptr->pr_file->prf_mapname, ml->ml_name) == 0);
 }
 
 /*
- * Update all of the mappings as if by Pupdate_maps(), and then forcibly cache
- * all of the symbol tables associated with all object files.
+ * Go through all the address space mappings, validating or updating
+ * the information already gathered, or gathering new information.
+ *
+ * This function is only called when we suspect that the mappings have changed
+ * because of rtld activity, or when a process is referenced for the first time.
  */
 void
-Pupdate_syms(struct ps_prochandle *P)
+Pupdate_maps(struct ps_prochandle *P)
 {
+	char exefile[PATH_MAX + 10] = "";	/* strlen(" (deleted)") */
+	map_info_t *old_mappings = P->mappings;
+	size_t old_num_mappings = P->num_mappings;
+	map_info_t *mappings;
 	file_info_t *fptr;
-	int i;
+	ssize_t nread, len;
+	size_t nlines, i, j, n;
+
+	if (P->info_valid)
+		return;
 
 	if (P->state == PS_DEAD)
 		return;
 
-	P->info_valid = 0;
-	Pupdate_maps(P);
-	Pupdate_lmids(P);
+	_dprintf("Updating mappings for PID %i\n", P->pid);
 
-	for (i = 0, fptr = dt_list_next(&P->file_list);
-	     i < P->num_files; i++, fptr = dt_list_next(fptr))
-		Pbuild_file_symtab(P, fptr);
-}
+	/*
+	 * A dlopen() or dlclose() normally changes only a few mappings, so
+	 * rather than throwing them all away and reconstructing them, we parse
+	 * the maps file into scratch space and walk it alongside the existing
+	 * mappings (both are sorted by address), keeping the map_info_t and
+	 * prmap_t of every mapping whose address, size, inode and permissions
+	 * are unchanged, and only allocating for the ones that are new.
+	 *
+	 * Because it is much more expensive to recompute the file_info_t, we
+	 * preserve those of removed mappings (with zero reference count) and
+	 * reuse them where possible.
+	 */
+	if ((nread = Pread_maps(P)) < 0) {
+		Preset_maps(P);
+		return;
+	}
+	nlines = nread;
 
-/*
- * Return the librtld_db agent handle for the victim process.
- * The handle will become invalid at the next successful exec() and the
- * client (caller of proc_rd_agent()) must not use it beyond that point.
- * If the process is already dead or noninvasively grabbed, there's
- * nothing we can do: just return the rd_agent if already available.
- */
-rd_agent_t *
+	snprintf(exefile, sizeof (exefile), "%s/%d/exe", procfs_path,
+	    (int)P->pid);
+
+	if ((len = readlink(exefile, exefile, sizeof (exefile) - 1)) > 0)
+		exefile[len] = '\0';
+	else
+		exefile[0] = '\0';
+
+	mappings = malloc(sizeof (struct map_info) * (nlines > 0 ? nlines : 1));
+	if (mappings == NULL) {
+		Preset_maps(P);
+		return;
+	}
+
+	for (i = 0, j = 0, n = 0; j < nlines; j++) {
+		const map_line_t *ml = &P->maps_lines[j];
+
+		while (i < old_num_mappings &&
+		    old_mappings[i].map_pmap->pr_vaddr < ml->ml_vaddr)
+			mapping_remove(P, &old_mappings[i++]);
+
+		if (i < old_num_mappings &&
+		    mapping_matches(&old_mappings[i], ml)) {
+			mappings[n++] = old_mappings[i++];
+			continue;
+		}
+
+		if (i < old_num_mappings &&
+		    old_mappings[i].map_pmap->pr_vaddr == ml->ml_vaddr)
+			mapping_remove(P, &old_mappings[i++]);
+
+		if (mapping_add(P, &mappings[n], ml) < 0)
+			break;
+		n++;
+	}
+
+	while (i < old_num_mappings)
+		mapping_remove(P, &old_mappings[i++]);
+
+	free(old_mappings);
+	P->mappings = mappings;
+	P->num_mappings = n;
+
+	if (j < nlines) {
+		Preset_maps(P);
+		return;
+	}
+
+	/*
+	 * The indexes of the primary text mappings, the executable and the
+	 * dynamic linker may all have moved, and the symbol search paths may
+	 * point at file_info_t's that are about to go away: recompute them.
+	 */
+	for (i = 0, fptr = dt_list_next(&P->file_list);
+	     i < P->num_files; i++, fptr = dt_list_next(fptr)) {
+		fptr->file_map = -1;
+		if (fptr->file_symsearch) {
+			free(fptr->file_symsearch);
+			fptr->file_symsearch = NULL;
+			fptr->file_nsymsearch = 0;
+		}
+	}
+
+	P->map_exec = -1;
+	P->map_ldso = -1;
+
+	for (i = 0; i < P->num_mappings; i++) {
+		map_info_t *mptr = &P->mappings[i];
+		prmap_file_t *prf = mptr->map_pmap->pr_file;
+		char *basename, *suffix;
+
+		if (mptr->map_file &&
+		    mptr->map_file->file_map == -1 &&
+		    prf->prf_text_map == mptr->map_pmap)
+			mptr->map_file->file_map = i;
+
+		if (!(mptr->map_pmap->pr_mflags & MA_EXEC))
+			continue;
+
+		/*
+		 * Heuristic to recognize the dynamic linker.  Works for /lib,
+		 * /lib64, and Debian multiarch as well as conventional
+		 * /lib/ld-2.13.so style systems.  (All versions of glibc 2.x
+		 * name their dynamic linker something like ld-*.so.)
+		 *
+		 * If this heuristic fails, object_name_to_map() can use the
+		 * AT_BASE auxv entry to come up with another guess (though this
+		 * is likely to be stymied by dynamic linker relocation for
+		 * non-statically-linked programs).
+		 */
+		basename = strrchr(prf->prf_mapname, '/');
+		suffix = strrchr(prf->prf_mapname, '.');
+
+		if (basename && suffix && P->map_ldso == -1 &&
+		    !P->no_dyn &&
+		    (strncmp(prf->prf_mapname, "/lib", 4) == 0) &&
+		    (strncmp(basename, "/ld-", 4) == 0) &&
+		    (strcmp(suffix, ".so") == 0))
+			P->map_ldso = i;
+
+		/*
+		 * Recognize the executable mapping.
+		 */
+		if (exefile[0] != '\0' && P->map_exec == -1 &&
+		    (strcmp(prf->prf_mapname, exefile) == 0))
+			P->map_exec = i;
+	}
+
+	/*
+	 * Drop file_info_t's corresponding to closed mappings, which will still
+	 * have a zero refcount.
+	 */
+	file_info_purge(P);
+
+	/*
+	 * Note that we need to iterate across all mappings and recompute their
+	 * lmids and sonames when we do a lookup that might depend on any such
+	 * thing.  (That is, pretty much all lookups other than PR_OBJ_LDSO.)
+	 *
+	 * We do this lazily not for efficiency's sake but because rtld_db
+	 * itself does a name lookup of _rtld_global inside ld.so to determine
+	 * whether link maps are consistent, and iteration across load objects
+	 * requires link map consistency.
+	 */
+
+	P->info_valid = 1;
+
+	if (!P->no_dyn)
+		P->lmids_valid = 0;
+}
+
+/*
+ * Iterate across all mappings and recompute their lmids and sonames.
+ * (Mappings which the dynamic linker does not know about, such as that
+ * for the dynamic linker itself, will be left in lmid 0 by default.
+ * This is almost certainly correct, since lmid use is vanishingly rare
+ * on Linux.)
+ *
+ * Don't do this if we know this is a statically linked binary, since
+ * they have no analogue of lmids at all.  (If we are not sure, rd_new()
+ * will compute it.  The rd_new() initialization process itself can call
+ * back into symbol lookup if this turns out to be a statically linked
+ * binary, to prevent unnecessary recursion.)
+ */
+static void
+Pupdate_lmids(struct ps_prochandle *P)
+{
+	if (P->info_valid && !P->noninvasive &&
+	    !P->no_dyn && !P->lmids_valid) {
+		if (P->rap == NULL)
+			P->rap = rd_new(P);
+
+		if (P->rap != NULL)
+			rd_loadobj_iter(P->rap, map_iter, P);
+
+		P->lmids_valid = 1;
+	}
+}
+
+/*
+ * Update all of the mappings as if by Pupdate_maps(), and then forcibly cache
+ * all of the symbol tables associated with all object files.
+ */
+void
+Pupdate_syms(struct ps_prochandle *P)
+{
+	file_info_t *fptr;
+	int i;
+
+	if (P->state == PS_DEAD)
+		return;
+
+	P->info_valid = 0;
+	Pupdate_maps(P);
+	Pupdate_lmids(P);
+
+	for (i = 0, fptr = dt_list_next(&P->file_list);
+	     i < P->num_files; i++, fptr = dt_list_next(fptr))
+		Pbuild_file_symtab(P, fptr);
+}
+
+/*
+ * Mark the mappings as possibly out of date.  The next Pupdate_maps() rereads
+ * them, keeping the file information and symbol tables for mappings which have
+ * not changed.
+ */
+void
+Pinvalidate_maps(struct ps_prochandle *P)
+{
+	P->info_valid = 0;
+}
+
+/*
+ * Return the librtld_db agent handle for the victim process.
+ * The handle will become invalid at the next successful exec() and the
+ * client (caller of proc_rd_agent()) must not use it beyond that point.
+ * If the process is already dead or noninvasively grabbed, there's
+ * nothing we can do: just return the rd_agent if already available.
+ */
+rd_agent_t *
 Prd_agent(struct ps_prochandle *P)
 {
 	if (P->state == PS_DEAD)
@@ -860,11 +1216,31 @@ Pname_to_map(struct ps_prochandle *P, const char *name)
 }
 
 /*
- * We wouldn't need these if qsort(3C) took an argument for the callback...
+ * Symbol tables with at least this many symbols are sorted by address and by
+ * name on separate threads, and alongside the other symbol table of the same
+ * file.  Below this, the thread creation costs more than it saves.
+ */
+#define	SYMTAB_PARALLEL_MIN	65536
+
+/*
+ * A symbol name and its symbol index, for sorting by name independently of (and
+ * perhaps at the same time as) the sort by address.
  */
-static mutex_t sort_mtx = DEFAULTMUTEX;
-static char *sort_strs;
-static GElf_Sym *sort_syms;
+typedef struct name_entry {
+	uint_t	ne_name;	/* string table offset of symbol name */
+	uint_t	ne_index;	/* symbol index */
+} name_entry_t;
+
+/*
+ * The state of the sorting of one symbol table, passed explicitly to the
+ * comparators.
+ */
+typedef struct symtab_sort {
+	sym_tbl_t *ss_symtab;		/* symbol table being sorted */
+	sym_entry_t *ss_entries;	/* symbols, to be sorted by address */
+	name_entry_t *ss_names;		/* names, to be sorted by name */
+	size_t	ss_count;		/* number of symbols in each */
+} symtab_sort_t;
 
 static int
 byaddr_cmp_common(GElf_Sym *a, char *aname, GElf_Sym *b, char *bname)
@@ -931,25 +1307,36 @@ byaddr_cmp_common(GElf_Sym *a, char *aname, GElf_Sym *b, char *bname)
 }
 
 static int
-byaddr_cmp(const void *aa, const void *bb)
+byaddr_cmp(const void *aa, const void *bb, void *arg)
 {
-	GElf_Sym *a = &sort_syms[*(uint_t *)aa];
-	GElf_Sym *b = &sort_syms[*(uint_t *)bb];
-	char *aname = sort_strs + a->st_name;
-	char *bname = sort_strs + b->st_name;
+	const sym_entry_t *a = aa;
+	const sym_entry_t *b = bb;
+	sym_tbl_t *symtab = arg;
+	GElf_Sym asym, bsym;
+
+	if (a->se_value < b->se_value)
+		return (-1);
+	if (a->se_value > b->se_value)
+		return (1);
+
+	/*
+	 * Aliases need the symbols' types and bindings to pick between them.
+	 */
+	symtab_getsym(symtab, a->se_index, &asym);
+	symtab_getsym(symtab, b->se_index, &bsym);
 
-	return (byaddr_cmp_common(a, aname, b, bname));
+	return (byaddr_cmp_common(&asym, symtab->sym_strs + a->se_name,
+		&bsym, symtab->sym_strs + b->se_name));
 }
 
 static int
-byname_cmp(const void *aa, const void *bb)
+byname_cmp(const void *aa, const void *bb, void *arg)
 {
-	GElf_Sym *a = &sort_syms[*(uint_t *)aa];
-	GElf_Sym *b = &sort_syms[*(uint_t *)bb];
-	char *aname = sort_strs + a->st_name;
-	char *bname = sort_strs + b->st_name;
+	const name_entry_t *a = aa;
+	const name_entry_t *b = bb;
+	const char *strs = arg;
 
-	return (strcmp(aname, bname));
+	return (strcmp(strs + a->ne_name, strs + b->ne_name));
 }
 
 /*
@@ -1001,240 +1388,474 @@ debug_dump_status(struct ps_prochandle *P)
 	free(status);
 }
 
+/*
+ * Add the interval [start, end) covered by the sym_byaddr entry sym to the
+ * end of the interval array, merging it with its predecessor if that is a
+ * contiguous interval covered by the same symbol.
+ */
 static void
-optimize_symtab(sym_tbl_t *symtab)
+symtab_add_interval(sym_interval_t *ivs, size_t *nivs, GElf_Addr start,
+    GElf_Addr end, uint_t sym)
 {
-	GElf_Sym *symp, *syms;
-	uint_t i, *indexa, *indexb;
-	size_t symn, strsz, count;
+	sym_interval_t *last = *nivs > 0 ? &ivs[*nivs - 1] : NULL;
 
-	if (symtab == NULL || symtab->sym_data_pri == NULL ||
-	    symtab->sym_byaddr != NULL)
+	if (start >= end)
 		return;
 
-	symn = symtab->sym_symn;
-	strsz = symtab->sym_strsz;
-
-	symp = syms = malloc(sizeof (GElf_Sym) * symn);
-	if (symp == NULL) {
-		_dprintf("optimize_symtab: failed to malloc symbol array");
+	if (last != NULL && last->si_sym == sym && last->si_end == start) {
+		last->si_end = end;
 		return;
 	}
 
-	/*
-	 * First record all the symbols into a table and count up the ones
-	 * that we're interested in. We mark symbols as invalid by setting
-	 * the st_name to an illegal value.
-	 */
-	for (i = 0, count = 0; i < symn; i++, symp++) {
-		if (symtab_getsym(symtab, i, symp) != NULL &&
-		    symp->st_name < strsz &&
-		    IS_DATA_TYPE(GELF_ST_TYPE(symp->st_info)))
-			count++;
-		else
-			symp->st_name = strsz;
-	}
+	ivs[*nivs].si_start = start;
+	ivs[*nivs].si_end = end;
+	ivs[*nivs].si_sym = sym;
+	(*nivs)++;
+}
 
-	/*
-	 * Allocate sufficient space for both tables and populate them
-	 * with the same symbols we just counted.
-	 */
-	symtab->sym_count = count;
-	indexa = symtab->sym_byaddr = calloc(sizeof (uint_t), count);
-	indexb = symtab->sym_byname = calloc(sizeof (uint_t), count);
-	if (indexa == NULL || indexb == NULL) {
-		_dprintf(
-		    "optimize_symtab: failed to malloc symbol index arrays");
-		symtab->sym_count = 0;
-		if (indexa != NULL) {	/* First alloc succeeded. Free it */
-			free(indexa);
-			symtab->sym_byaddr = NULL;
-		}
-		free(syms);
+/*
+ * The address one past the end of a sorted symbol, clamped so that a symbol
+ * at the top of the address space cannot wrap.
+ */
+static GElf_Addr
+symtab_entry_end(const sym_entry_t *entp)
+{
+	if (entp->se_value + entp->se_size < entp->se_value)
+		return ((GElf_Addr)-1);
+	return (entp->se_value + entp->se_size);
+}
+
+/*
+ * Build the address interval array from the address-sorted symbol list.
+ *
+ * The answer sym_by_addr() wants for any address is the containing symbol with
+ * the highest start address, and among aliases starting at the same address
+ * the first one in sym_byaddr order that still contains it.  We sweep upwards
+ * through the symbols keeping a stack of those that are still open, with the
+ * preferred symbol on top, and emit an interval every time the top of the
+ * stack changes.  Each symbol is pushed and popped at most once, and each
+ * interval ends either where a symbol is popped or where a new group of
+ * aliases begins, so there are at most twice as many intervals as symbols.
+ *
+ * Failure to allocate is not fatal: lookups by address will then find nothing,
+ * just as they do when sorting the symbol table itself fails.
+ */
+static void
+symtab_build_intervals(sym_tbl_t *symtab)
+{
+	sym_entry_t *byaddr = symtab->sym_byaddr;
+	size_t count = symtab->sym_count;
+	sym_interval_t *ivs, *shrunk;
+	size_t nivs = 0, i, j, k;
+	uint_t *stack;
+	size_t sp = 0;
+	GElf_Addr pos = 0;
+
+	if (count == 0)
+		return;
+
+	ivs = malloc(sizeof (sym_interval_t) * (2 * count + 1));
+	stack = malloc(sizeof (uint_t) * count);
+	if (ivs == NULL || stack == NULL) {
+		_dprintf("optimize_symtab: failed to malloc interval array");
+		free(ivs);
+		free(stack);
 		return;
-	}
-	for (i = 0, symp = syms; i < symn; i++, symp++) {
-		if (symp->st_name < strsz)
-			*indexa++ = *indexb++ = i;
 	}
 
-	/*
-	 * Sort the two tables according to the appropriate criteria.
-	 */
-	(void) mutex_lock(&sort_mtx);
-	sort_strs = symtab->sym_strs;
-	sort_syms = syms;
+	for (i = 0; i <= count; i = j) {
+		GElf_Addr limit = (i < count) ? byaddr[i].se_value : (GElf_Addr)-1;
+
+		/*
+		 * Emit intervals for the open symbols up to the start of the
+		 * next group of aliases, discarding those that end before it.
+		 */
+		while (sp > 0) {
+			uint_t top = stack[sp - 1];
+			GElf_Addr end = symtab_entry_end(&byaddr[top]);
+
+			if (end <= pos) {
+				sp--;
+				continue;
+			}
+
+			if (end <= limit) {
+				symtab_add_interval(ivs, &nivs, pos, end, top);
+				pos = end;
+				sp--;
+				continue;
+			}
+
+			symtab_add_interval(ivs, &nivs, pos, limit, top);
+			break;
+		}
+
+		if (i == count)
+			break;
+
+		if (pos < limit)
+			pos = limit;
+
+		/*
+		 * Push the group of aliases in reverse, so the preferred one
+		 * ends up on top.  Zero-sized symbols never contain anything.
+		 */
+		for (j = i; j < count && byaddr[j].se_value == limit; j++)
+			continue;
+
+		for (k = j; k > i; k--) {
+			if (byaddr[k - 1].se_size > 0)
+				stack[sp++] = k - 1;
+		}
+	}
 
-	qsort(symtab->sym_byaddr, count, sizeof (uint_t), byaddr_cmp);
-	qsort(symtab->sym_byname, count, sizeof (uint_t), byname_cmp);
+	free(stack);
 
-	sort_strs = NULL;
-	sort_syms = NULL;
-	(void) mutex_unlock(&sort_mtx);
+	if (nivs > 0 && nivs < 2 * count + 1) {
+		shrunk = realloc(ivs, sizeof (sym_interval_t) * nivs);
+		if (shrunk != NULL)
+			ivs = shrunk;
+	}
 
-	free(syms);
+	symtab->sym_intervals = ivs;
+	symtab->sym_nintervals = nivs;
 }
 
 /*
- * Build the symbol table for the given mapped file.
+ * Gather the symbols of a symbol table that we are interested in, ready for
+ * sorting.  Returns -1 if there is nothing to sort.
  */
-static void
-Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
+static int
+symtab_sort_prepare(sym_tbl_t *symtab, symtab_sort_t *ss)
 {
-	size_t i;
-
-	GElf_Ehdr ehdr;
+	GElf_Sym sym;
+	sym_entry_t *entp;
+	name_entry_t *namep;
+	uint_t i;
+	size_t symn, strsz;
 
-	volatile int fd = -1;
-	Elf_Data *shdata;
-	Elf_Scn *scn;
-	Elf *elf = NULL;
-	volatile Elf *velf = NULL;
-	size_t nshdrs, shstrndx;
-	int mapfilefd;
-	int err;
-	jmp_buf * volatile old_exec_jmp;
-	jmp_buf **jmp_pad, this_exec_jmp;
+	memset(ss, 0, sizeof (symtab_sort_t));
 
-	struct {
-		GElf_Shdr c_shdr;
-		Elf_Data *c_data;
-		const char *c_name;
-	} *cp, *cache = NULL;
+	if (symtab == NULL || symtab->sym_data_pri == NULL ||
+	    symtab->sym_byaddr != NULL)
+		return (-1);
 
-	if (!fptr) /* no file */
-		return;
+	symn = symtab->sym_symn;
+	strsz = symtab->sym_strsz;
 
-	if (fptr->file_init)
-		return;	/* We've already processed this file */
+	entp = ss->ss_entries = malloc(sizeof (sym_entry_t) * symn);
+	namep = ss->ss_names = malloc(sizeof (name_entry_t) * symn);
+	if (entp == NULL || namep == NULL) {
+		_dprintf("optimize_symtab: failed to malloc symbol array");
+		free(ss->ss_entries);
+		free(ss->ss_names);
+		return (-1);
+	}
 
 	/*
-	 * Mark the file_info struct as having the symbol table initialized
-	 * even if we fail below.  We tried once; we don't try again.
+	 * Record the address, size, name and index of all the symbols we're
+	 * interested in: nothing else is needed to sort or search them.
 	 */
-	fptr->file_init = 1;
+	for (i = 0; i < symn; i++) {
+		if (symtab_getsym(symtab, i, &sym) == NULL ||
+		    sym.st_name >= strsz ||
+		    !IS_DATA_TYPE(GELF_ST_TYPE(sym.st_info)))
+			continue;
 
-	if (elf_version(EV_CURRENT) == EV_NONE) {
-		_dprintf("libproc ELF version is more recent than libelf\n");
-		return;
+		entp->se_value = sym.st_value;
+		entp->se_size = sym.st_size;
+		entp->se_name = sym.st_name;
+		entp->se_index = i;
+		entp++;
+		namep->ne_name = sym.st_name;
+		namep->ne_index = i;
+		namep++;
 	}
 
-	/*
-	 * If we spot an exec() in this function, free everything and rethrow.
-	 */
-	jmp_pad = libproc_unwinder_pad(P);
-	old_exec_jmp = *jmp_pad;
-	if (setjmp(this_exec_jmp)) {
-		if (fd > -1)
-			close(fd);
-		if (velf)
-			elf_end((Elf *) velf);
-		fptr->file_dyn_base = 0;
-		free(cache);
-		fptr->file_elf = NULL;
+	ss->ss_symtab = symtab;
+	ss->ss_count = entp - ss->ss_entries;
 
-		if (old_exec_jmp)
-			longjmp(*old_exec_jmp, 1);
-		*jmp_pad = old_exec_jmp;
+	if (ss->ss_count > 0 && ss->ss_count < symn) {
+		sym_entry_t *shrunk;
+
+		shrunk = realloc(ss->ss_entries,
+		    sizeof (sym_entry_t) * ss->ss_count);
+		if (shrunk != NULL)
+			ss->ss_entries = shrunk;
+	}
+
+	return (0);
+}
+
+/*
+ * Sort a symbol table by address, and build its address intervals.
+ */
+static void *
+symtab_sort_byaddr(void *arg)
+{
+	symtab_sort_t *ss = arg;
+	sym_tbl_t *symtab = ss->ss_symtab;
+
+	qsort_r(ss->ss_entries, ss->ss_count, sizeof (sym_entry_t),
+	    byaddr_cmp, symtab);
+
+	symtab->sym_byaddr = ss->ss_entries;
+	symtab->sym_count = ss->ss_count;
+
+	symtab_build_intervals(symtab);
+	return (NULL);
+}
+
+/*
+ * Sort a symbol table's names.  This touches nothing that the sort by address
+ * does, so the two can run at once.
+ */
+static void *
+symtab_sort_byname(void *arg)
+{
+	symtab_sort_t *ss = arg;
+
+	qsort_r(ss->ss_names, ss->ss_count, sizeof (name_entry_t),
+	    byname_cmp, ss->ss_symtab->sym_strs);
+	return (NULL);
+}
 
+/*
+ * Once both sorts are done, turn the sorted names into the by-name index into
+ * the by-address array.  If that fails, lookups by name find nothing, but
+ * lookups by address still work.
+ */
+static void
+symtab_sort_finish(symtab_sort_t *ss)
+{
+	sym_tbl_t *symtab = ss->ss_symtab;
+	uint_t *byname, *pos;
+	size_t i;
+
+	byname = calloc(sizeof (uint_t), ss->ss_count);
+	pos = malloc(sizeof (uint_t) * symtab->sym_symn);
+	if (byname == NULL || pos == NULL) {
+		_dprintf(
+		    "optimize_symtab: failed to malloc symbol index array");
+		free(byname);
+		free(pos);
+		free(ss->ss_names);
 		return;
 	}
-	*jmp_pad = &this_exec_jmp;
 
-	if (P->state == PS_DEAD) {
-		/*
-		 * If we're not live, there is nothing we can do.  (This should
-		 * never happen in DTrace anyway.)
-		 */
-		_dprintf("cannot work over dead process\n");
-		goto bad;
+	for (i = 0; i < ss->ss_count; i++)
+		pos[ss->ss_entries[i].se_index] = i;
+
+	for (i = 0; i < ss->ss_count; i++)
+		byname[i] = pos[ss->ss_names[i].ne_index];
+
+	free(pos);
+	free(ss->ss_names);
+	symtab->sym_byname = byname;
+}
+
+/*
+ * Sort a file's symbol tables by address and by name.  There are up to four
+ * independent sorts: if the tables are large, they run concurrently, one on
+ * this thread and the rest on short-lived helper threads.  (If a thread cannot
+ * be created, its sort just runs here instead.)
+ */
+static void
+optimize_symtabs(sym_tbl_t *symtab, sym_tbl_t *dynsym)
+{
+	symtab_sort_t ss[2];
+	struct {
+		void *(*fn)(void *);
+		void *arg;
+		pthread_t tid;
+		int threaded;
+	} jobs[4];
+	size_t njobs = 0, total = 0, i;
+
+	if (symtab_sort_prepare(symtab, &ss[0]) == 0)
+		total += ss[0].ss_count;
+	if (symtab_sort_prepare(dynsym, &ss[1]) == 0)
+		total += ss[1].ss_count;
+
+	for (i = 0; i < 2; i++) {
+		if (ss[i].ss_symtab == NULL)
+			continue;
+
+		jobs[njobs].fn = symtab_sort_byaddr;
+		jobs[njobs].arg = &ss[i];
+		jobs[njobs].threaded = 0;
+		njobs++;
+		jobs[njobs].fn = symtab_sort_byname;
+		jobs[njobs].arg = &ss[i];
+		jobs[njobs].threaded = 0;
+		njobs++;
 	}
 
-	if (fptr->file_map == -1) {
-		/*
-		 * No primary text mapping for this file?  OK, we can't use it
-		 * for symbol lookup yet.
-		 */
-		_dprintf("no primary text mapping for %s yet\n", fptr->file_pname);
-		goto bad;
+	if (total >= SYMTAB_PARALLEL_MIN) {
+		for (i = 1; i < njobs; i++)
+			jobs[i].threaded = pthread_create(&jobs[i].tid, NULL,
+			    jobs[i].fn, jobs[i].arg) == 0;
 	}
 
-	/*
-	 * Acquire an fd to this mapping.  This may require ptrace()ing, but
-	 * first, try to use the upstream /proc/$pid/map_files interface.
-	 * Then create the elf file and get the elf header and .shstrtab data
-	 * buffer so we can process sections by name.  If we're 'grabbing'
-	 * without ptracing, without a monitor thread, and without map_files
-	 * support, try to open the ELF object directly, though this is less
-	 * reliable and can fail in the presence of deleted files and running
-	 * executables for which we don't have read permission.  If we can't
-	 * even do that, there is no way for us to read any kind of symbol table
-	 * out of this executable.
-	 *
-	 * Note: This Ptrace() call may trigger breakpoint handlers, which can
-	 * look up addresses, which can call this function: so temporarily mark
-	 * this file as not initialized, in case of such a recursive call, and
-	 * drop out immediately afterwards if it is marked as done now.  The
-	 * same is true of the Puntrace().  There is no danger of infinite
-	 * recursion because once a breakpoint is being processed, the victim is
-	 * no longer running and thus cannot trigger another breakpoint.
-	 */
-	if ((mapfilefd = Pmapfilefd(P)) > -1)
-		fd = openat(mapfilefd,
-		    P->mappings[fptr->file_map].map_pmap->pr_mapaddrname,
-		    O_RDONLY);
+	for (i = 0; i < njobs; i++) {
+		if (!jobs[i].threaded)
+			jobs[i].fn(jobs[i].arg);
+	}
 
-	if ((!P->noninvasive) && (fd < 0)) {
-		long pfd;
+	for (i = 0; i < njobs; i++) {
+		if (jobs[i].threaded)
+			pthread_join(jobs[i].tid, NULL);
+	}
 
-		fptr->file_init = 0;
-		err = Ptrace(P, 1);
-		if (fptr->file_init == 1) {
-			if (err >= 0)
-				Puntrace(P, 0);
-			goto ret;
-		}
-		fptr->file_init = 1;
+	for (i = 0; i < 2; i++) {
+		if (ss[i].ss_symtab != NULL)
+			symtab_sort_finish(&ss[i]);
+	}
+}
 
-		/*
-		 * Even this can fail: fd table overflow, for instance.
-		 * Fall back, if so.
-		 */
-		if (err >= 0) {
-			if (wrapped_ptrace(P, PTRACE_GETMAPFD, P->pid,
-				P->mappings[fptr->file_map].map_pmap->pr_vaddr,
-				&pfd) < 0)
-				fd = -1;
-			else
-				fd = pfd;
+/*
+ * The cache of file_syms_t's, shared by every process handle.  Only the hash
+ * and the reference counts are protected by the lock: the file_syms_t's
+ * themselves are immutable once built.
+ */
+static mutex_t file_syms_mtx = DEFAULTMUTEX;
+static file_syms_t *file_syms_hash[FILE_SYMS_BUCKETS];
+
+static uint_t
+file_syms_bucket(dev_t dev, ino_t inum)
+{
+	return ((uint_t)((dev * 31 + inum) % FILE_SYMS_BUCKETS));
+}
+
+static int
+file_syms_match(const file_syms_t *fsp, const struct stat *st)
+{
+	return (fsp->fs_dev == st->st_dev && fsp->fs_inum == st->st_ino &&
+	    fsp->fs_size == st->st_size &&
+	    fsp->fs_mtime.tv_sec == st->st_mtim.tv_sec &&
+	    fsp->fs_mtime.tv_nsec == st->st_mtim.tv_nsec);
+}
+
+/*
+ * Look up the file_syms_t for the file with the given stat() results, taking
+ * a reference to it.  Returns NULL if none is cached.
+ */
+static file_syms_t *
+file_syms_lookup(const struct stat *st)
+{
+	file_syms_t *fsp;
+
+	(void) mutex_lock(&file_syms_mtx);
+	for (fsp = file_syms_hash[file_syms_bucket(st->st_dev, st->st_ino)];
+	     fsp != NULL; fsp = fsp->fs_next) {
+		if (file_syms_match(fsp, st)) {
+			fsp->fs_ref++;
+			break;
 		}
+	}
+	(void) mutex_unlock(&file_syms_mtx);
 
-		fptr->file_init = 0;
-		Puntrace(P, 0);
-		if (fptr->file_init == 1) {
-			close(fd);
-			goto ret;
+	return (fsp);
+}
+
+/*
+ * Add a newly-built file_syms_t to the cache.  If another thread has cached
+ * the same file in the meantime, throw the new one away and return (a new
+ * reference to) that one instead.
+ */
+static file_syms_t *
+file_syms_insert(file_syms_t *new, const struct stat *st)
+{
+	file_syms_t *fsp;
+	uint_t h = file_syms_bucket(st->st_dev, st->st_ino);
+
+	(void) mutex_lock(&file_syms_mtx);
+	for (fsp = file_syms_hash[h]; fsp != NULL; fsp = fsp->fs_next) {
+		if (file_syms_match(fsp, st)) {
+			fsp->fs_ref++;
+			break;
 		}
-		fptr->file_init = 1;
 	}
 
-	if (fd < 0) {
-		const char pname[PATH_MAX + 20] = "";
-		struct stat s;
+	if (fsp == NULL) {
+		new->fs_ref = 1;
+		new->fs_next = file_syms_hash[h];
+		file_syms_hash[h] = new;
+	}
+	(void) mutex_unlock(&file_syms_mtx);
 
-		snprintf(pname, sizeof (pname), "/%s/%d/root/%s", procfs_path,
-		    (int)P->pid, fptr->file_pname);
+	if (fsp != NULL) {
+		new->fs_ref = 1;
+		file_syms_release(new);
+		return (fsp);
+	}
 
-		if ((stat(pname, &s) < 0) ||
-		    s.st_dev != fptr->file_dev ||
-		    s.st_ino != fptr->file_inum ||
-		    ((fd = open(pname, O_RDONLY)) < 0)) {
-			_dprintf("%i: cannot open %s in non-ptrace()d "
-			    "process: replaced file or open() error\n",
-			    P->pid, fptr->file_pname);
-			goto bad;
+	return (new);
+}
+
+/*
+ * Drop a reference to a file_syms_t, freeing it if it was the last.
+ */
+static void
+file_syms_release(file_syms_t *fsp)
+{
+	file_syms_t **prev;
+	int last;
+
+	(void) mutex_lock(&file_syms_mtx);
+	last = (--fsp->fs_ref == 0);
+	if (last) {
+		for (prev = &file_syms_hash[file_syms_bucket(fsp->fs_dev,
+			    fsp->fs_inum)];
+		     *prev != NULL; prev = &(*prev)->fs_next) {
+			if (*prev == fsp) {
+				*prev = fsp->fs_next;
+				break;
+			}
 		}
 	}
+	(void) mutex_unlock(&file_syms_mtx);
+
+	if (!last)
+		return;
+
+	free(fsp->fs_symtab.sym_byname);
+	free(fsp->fs_symtab.sym_byaddr);
+	free(fsp->fs_symtab.sym_intervals);
+
+	free(fsp->fs_dynsym.sym_byname);
+	free(fsp->fs_dynsym.sym_byaddr);
+	free(fsp->fs_dynsym.sym_intervals);
+
+	elf_end(fsp->fs_elf);
+	free(fsp);
+}
+
+/*
+ * Read the symbol tables out of the ELF file open on fd (whose stat() results
+ * are in st) and sort them, returning a new, uncached file_syms_t, or NULL if
+ * this is not a usable ELF file.  Makes no calls on the process at all, so it
+ * can never be interrupted by an exec().
+ */
+static file_syms_t *
+file_syms_build(const char *pname, int fd, const struct stat *st)
+{
+	size_t i;
+
+	GElf_Ehdr ehdr;
+
+	Elf_Data *shdata;
+	Elf_Scn *scn;
+	Elf *elf = NULL;
+	file_syms_t *fsp = NULL;
+	size_t nshdrs, shstrndx, nphdrs;
+	int err;
+
+	struct {
+		GElf_Shdr c_shdr;
+		Elf_Data *c_data;
+		const char *c_name;
+	} *cp, *cache = NULL;
 
 	/*
 	 * Don't hold the fd open forever. (ELF_C_READ followed by
@@ -1251,24 +1872,27 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 	    (shdata = elf_getdata(scn, NULL)) == NULL) {
 		err = elf_errno();
 
-		close(fd);
 		_dprintf("failed to process ELF file %s: %s\n",
-		    fptr->file_pname, (err == 0) ? "<null>" : elf_errmsg(err));
+		    pname, (err == 0) ? "<null>" : elf_errmsg(err));
 		goto bad;
 	}
-	velf = elf;
-	close(fd);
-	if ((cache = malloc(nshdrs * sizeof (*cache))) == NULL) {
+
+	if ((fsp = calloc(1, sizeof (file_syms_t))) == NULL ||
+	    (cache = malloc(nshdrs * sizeof (*cache))) == NULL) {
 		_dprintf("failed to malloc section cache for mapping of %s\n",
-		    fptr->file_pname);
+		    pname);
 		goto bad;
 	}
 
-	_dprintf("processing ELF file %s\n", fptr->file_pname);
-	fptr->file_etype = ehdr.e_type;
-	fptr->file_elf = elf;
-	fptr->file_shstrs = shdata->d_buf;
-	fptr->file_shstrsz = shdata->d_size;
+	_dprintf("processing ELF file %s\n", pname);
+	fsp->fs_dev = st->st_dev;
+	fsp->fs_inum = st->st_ino;
+	fsp->fs_size = st->st_size;
+	fsp->fs_mtime = st->st_mtim;
+	fsp->fs_etype = ehdr.e_type;
+	fsp->fs_elf = elf;
+	fsp->fs_shstrs = shdata->d_buf;
+	fsp->fs_shstrsz = shdata->d_size;
 
 	/*
 	 * Iterate through each section, caching its section header, data
@@ -1277,19 +1901,19 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 	for (cp = cache + 1, scn = NULL; (scn = elf_nextscn(elf, scn)) != NULL;
 	     cp++) {
 		if (gelf_getshdr(scn, &cp->c_shdr) == NULL) {
-			_dprintf("Pbuild_file_symtab: Failed to get section "
+			_dprintf("file_syms_build: Failed to get section "
 			    "header\n");
 			goto bad; /* Failed to get section header */
 		}
 
 		if ((cp->c_data = elf_getdata(scn, NULL)) == NULL) {
-			_dprintf("Pbuild_file_symtab: Failed to get section "
+			_dprintf("file_syms_build: Failed to get section "
 			    "data\n");
 			goto bad; /* Failed to get section data */
 		}
 
 		if (cp->c_shdr.sh_name >= shdata->d_size) {
-			_dprintf("Pbuild_file_symtab: corrupt section name");
+			_dprintf("file_syms_build: corrupt section name");
 			goto bad; /* Corrupt section name */
 		}
 
@@ -1305,7 +1929,7 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 
 		if (shp->sh_type == SHT_SYMTAB || shp->sh_type == SHT_DYNSYM) {
 			sym_tbl_t *symp = shp->sh_type == SHT_SYMTAB ?
-			    &fptr->file_symtab : &fptr->file_dynsym;
+			    &fsp->fs_symtab : &fsp->fs_dynsym;
 			/*
 			 * It's possible that the we already got the symbol
 			 * table from the core file itself.  We'll just be
@@ -1314,8 +1938,7 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 			 * check isn't essential, but it's a good idea.
 			 */
 			if (symp->sym_data_pri == NULL) {
-				_dprintf("Symbol table found for %s\n",
-				    fptr->file_pname);
+				_dprintf("Symbol table found for %s\n", pname);
 				symp->sym_data_pri = cp->c_data;
 				symp->sym_symn +=
 				    shp->sh_size / shp->sh_entsize;
@@ -1327,24 +1950,23 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 				symp->sym_strhdr = cache[shp->sh_link].c_shdr;
 			} else {
 				_dprintf("Symbol table already there for %s\n",
-				    fptr->file_pname);
+				    pname);
 			}
 #ifdef LATER
 		} else if (shp->sh_type == SHT_SUNW_LDYNSYM) {
 			/* .SUNW_ldynsym section is auxiliary to .dynsym */
-			if (fptr->file_dynsym.sym_data_aux == NULL) {
+			if (fsp->fs_dynsym.sym_data_aux == NULL) {
 				_dprintf(".SUNW_ldynsym symbol table"
-				    " found for %s\n",
-				    fptr->file_pname);
-				fptr->file_dynsym.sym_data_aux = cp->c_data;
-				fptr->file_dynsym.sym_symn_aux =
+				    " found for %s\n", pname);
+				fsp->fs_dynsym.sym_data_aux = cp->c_data;
+				fsp->fs_dynsym.sym_symn_aux =
 				    shp->sh_size / shp->sh_entsize;
-				fptr->file_dynsym.sym_symn +=
-				    fptr->file_dynsym.sym_symn_aux;
-				fptr->file_dynsym.sym_hdr_aux = cp->c_shdr;
+				fsp->fs_dynsym.sym_symn +=
+				    fsp->fs_dynsym.sym_symn_aux;
+				fsp->fs_dynsym.sym_hdr_aux = cp->c_shdr;
 			} else {
 				_dprintf(".SUNW_ldynsym symbol table already"
-				    " there for %s\n", fptr->file_pname);
+				    " there for %s\n", pname);
 			}
 #endif
 		}
@@ -1356,33 +1978,15 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 	 * was included in the core file. Before we perform any lookups, we
 	 * create sorted versions to optimize for lookups.
 	 */
-	optimize_symtab(&fptr->file_symtab);
-	optimize_symtab(&fptr->file_dynsym);
+	optimize_symtabs(&fsp->fs_symtab, &fsp->fs_dynsym);
 
 	free(cache);
 
 	/*
-	 * Fill in the base address of the text mapping and entry point address
-	 * for relocatable objects.
-	 *
-	 * If the object is a shared library or other dynamic object, set
-	 * file_dyn_base to the dynamic linker's idea of its load bias, rather
-	 * than engaging in a tiresome search through the object file.  ld.so
-	 * itself never gets this treatment, since it relocates itself without
-	 * setting its rl_diff_addr: we must always compute its base address the
-	 * tiresome way.
+	 * Find the lowest loadable address, from which the load bias of
+	 * objects that ld.so cannot tell us about is computed.
 	 */
-	if (fptr->file_etype == ET_DYN &&
-	    fptr->file_lo != NULL &&
-	    fptr->file_map != P->map_ldso) {
-	       fptr->file_dyn_base = fptr->file_lo->rl_diff_addr;
-	       _dprintf("%s: ld.so says file_dyn_base is %lx\n",
-		   fptr->file_pname, fptr->file_dyn_base);
-	       goto ret;
-	}
-
-	size_t nphdrs;
-	GElf_Addr lowest_vaddr = (GElf_Addr) -1;
+	fsp->fs_lowest_vaddr = (GElf_Addr) -1;
 
 	if (elf_getphdrnum(elf, &nphdrs) < 0)
 		goto elf_bad_noaddr;
@@ -1391,51 +1995,250 @@ Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
 		GElf_Phdr hdr;
 		GElf_Phdr *phdr = gelf_getphdr(elf, i, &hdr);
 
-		if (!phdr)
+		if (!phdr) {
+			fsp->fs_lowest_vaddr = (GElf_Addr) -1;
 			goto elf_bad_noaddr;
+		}
 
 		if (phdr->p_type == PT_LOAD &&
-		    phdr->p_vaddr < lowest_vaddr)
-			lowest_vaddr = phdr->p_vaddr;
+		    phdr->p_vaddr < fsp->fs_lowest_vaddr)
+			fsp->fs_lowest_vaddr = phdr->p_vaddr;
 	}
 
-	if (lowest_vaddr == (GElf_Addr) -1) {
-		_dprintf("%s: no loadable sections.\n", fptr->file_pname);
-		goto elf_bad_noaddr;
+	if (fsp->fs_lowest_vaddr == (GElf_Addr) -1)
+		_dprintf("%s: no loadable sections.\n", pname);
+
+	return (fsp);
+
+elf_bad_noaddr:
+	err = elf_errno();
+
+	_dprintf("failed to read program headers of ELF file %s: %s\n",
+	    pname, (err == 0) ? "<null>" : elf_errmsg(err));
+	return (fsp);
+
+bad:
+	free(cache);
+	free(fsp);
+	elf_end(elf);
+	return (NULL);
+}
+
+/*
+ * Build the symbol table for the given mapped file, or pick it up from the
+ * cache if this file has been seen before, by this process or any other.
+ */
+static void
+Pbuild_file_symtab(struct ps_prochandle *P, file_info_t *fptr)
+{
+	volatile int fd = -1;
+	struct stat st;
+	file_syms_t *fsp;
+	int mapfilefd;
+	int err;
+	jmp_buf * volatile old_exec_jmp;
+	jmp_buf **jmp_pad, this_exec_jmp;
+
+	if (!fptr) /* no file */
+		return;
+
+	if (fptr->file_init)
+		return;	/* We've already processed this file */
+
+	/*
+	 * Mark the file_info struct as having the symbol table initialized
+	 * even if we fail below.  We tried once; we don't try again.
+	 */
+	fptr->file_init = 1;
+
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		_dprintf("libproc ELF version is more recent than libelf\n");
+		return;
 	}
 
-	fptr->file_dyn_base = P->mappings[fptr->file_map].map_pmap->pr_vaddr -
-	    lowest_vaddr;
+	/*
+	 * If we spot an exec() in this function, free everything and rethrow.
+	 */
+	jmp_pad = libproc_unwinder_pad(P);
+	old_exec_jmp = *jmp_pad;
+	if (setjmp(this_exec_jmp)) {
+		if (fd > -1)
+			close(fd);
+		fptr->file_dyn_base = 0;
 
-	_dprintf("setting file_dyn_base for %s to %lx, "
-	    "from vaddr of %lx and lowest_addr of %lx\n",
-	    fptr->file_pname, (long)fptr->file_dyn_base,
-	    P->mappings[fptr->file_map].map_pmap->pr_vaddr,
-	    lowest_vaddr);
+		if (old_exec_jmp)
+			longjmp(*old_exec_jmp, 1);
+		*jmp_pad = old_exec_jmp;
 
-ret:
-	*jmp_pad = old_exec_jmp;
-	return;
+		return;
+	}
+	*jmp_pad = &this_exec_jmp;
+
+	if (P->state == PS_DEAD) {
+		/*
+		 * If we're not live, there is nothing we can do.  (This should
+		 * never happen in DTrace anyway.)
+		 */
+		_dprintf("cannot work over dead process\n");
+		goto bad;
+	}
+
+	if (fptr->file_map == -1) {
+		/*
+		 * No primary text mapping for this file?  OK, we can't use it
+		 * for symbol lookup yet.
+		 */
+		_dprintf("no primary text mapping for %s yet\n", fptr->file_pname);
+		goto bad;
+	}
 
-elf_bad_noaddr:
 	/*
-	 * Can't reliably derive the base address.  Symbol lookup is quite
-	 * unlikely to work, but we can still try with a zero base address.
+	 * Acquire an fd to this mapping.  This may require ptrace()ing, but
+	 * first, try to use the upstream /proc/$pid/map_files interface.
+	 * Then create the elf file and get the elf header and .shstrtab data
+	 * buffer so we can process sections by name.  If we're 'grabbing'
+	 * without ptracing, without a monitor thread, and without map_files
+	 * support, try to open the ELF object directly, though this is less
+	 * reliable and can fail in the presence of deleted files and running
+	 * executables for which we don't have read permission.  If we can't
+	 * even do that, there is no way for us to read any kind of symbol table
+	 * out of this executable.
+	 *
+	 * Note: This Ptrace() call may trigger breakpoint handlers, which can
+	 * look up addresses, which can call this function: so temporarily mark
+	 * this file as not initialized, in case of such a recursive call, and
+	 * drop out immediately afterwards if it is marked as done now.  The
+	 * same is true of the Puntrace().  There is no danger of infinite
+	 * recursion because once a breakpoint is being processed, the victim is
+	 * no longer running and thus cannot trigger another breakpoint.
 	 */
-	err = elf_errno();
+	if ((mapfilefd = Pmapfilefd(P)) > -1)
+		fd = openat(mapfilefd,
+		    P->mappings[fptr->file_map].map_pmap->pr_mapaddrname,
+		    O_RDONLY);
+
+	if ((!P->noninvasive) && (fd < 0)) {
+		long pfd;
+
+		fptr->file_init = 0;
+		err = Ptrace(P, 1);
+		if (fptr->file_init == 1) {
+			if (err >= 0)
+				Puntrace(P, 0);
+			goto ret;
+		}
+		fptr->file_init = 1;
+
+		/*
+		 * Even this can fail: fd table overflow, for instance.
+		 * Fall back, if so.
+		 */
+		if (err >= 0) {
+			if (wrapped_ptrace(P, PTRACE_GETMAPFD, P->pid,
+				P->mappings[fptr->file_map].map_pmap->pr_vaddr,
+				&pfd) < 0)
+				fd = -1;
+			else
+				fd = pfd;
+		}
+
+		fptr->file_init = 0;
+		Puntrace(P, 0);
+		if (fptr->file_init == 1) {
+			close(fd);
+			goto ret;
+		}
+		fptr->file_init = 1;
+	}
+
+	if (fd < 0) {
+		const char pname[PATH_MAX + 20] = "";
+		struct stat s;
+
+		snprintf(pname, sizeof (pname), "/%s/%d/root/%s", procfs_path,
+		    (int)P->pid, fptr->file_pname);
+
+		if ((stat(pname, &s) < 0) ||
+		    s.st_dev != fptr->file_dev ||
+		    s.st_ino != fptr->file_inum ||
+		    ((fd = open(pname, O_RDONLY)) < 0)) {
+			_dprintf("%i: cannot open %s in non-ptrace()d "
+			    "process: replaced file or open() error\n",
+			    P->pid, fptr->file_pname);
+			goto bad;
+		}
+	}
+
+	/*
+	 * The file may already have been read on behalf of this process or
+	 * another one.  If not, read it now and cache it.
+	 */
+	if (fstat(fd, &st) < 0) {
+		_dprintf("cannot stat %s: %s\n", fptr->file_pname,
+		    strerror(errno));
+		close(fd);
+		goto bad;
+	}
+
+	if ((fsp = file_syms_lookup(&st)) != NULL)
+		_dprintf("reusing symbol tables for %s\n", fptr->file_pname);
+	else if ((fsp = file_syms_build(fptr->file_pname, fd, &st)) != NULL)
+		fsp = file_syms_insert(fsp, &st);
+
+	close(fd);
+	fd = -1;
+
+	if (fsp == NULL)
+		goto bad;
+
+	fptr->file_syms = fsp;
+
+	/*
+	 * Fill in the base address of the text mapping and entry point address
+	 * for relocatable objects.
+	 *
+	 * If the object is a shared library or other dynamic object, set
+	 * file_dyn_base to the dynamic linker's idea of its load bias, rather
+	 * than engaging in a tiresome search through the object file.  ld.so
+	 * itself never gets this treatment, since it relocates itself without
+	 * setting its rl_diff_addr: we must always compute its base address the
+	 * tiresome way.
+	 */
+	if (fsp->fs_etype == ET_DYN &&
+	    fptr->file_lo != NULL &&
+	    fptr->file_map != P->map_ldso) {
+	       fptr->file_dyn_base = fptr->file_lo->rl_diff_addr;
+	       _dprintf("%s: ld.so says file_dyn_base is %lx\n",
+		   fptr->file_pname, fptr->file_dyn_base);
+	       goto ret;
+	}
+
+	if (fsp->fs_lowest_vaddr == (GElf_Addr) -1) {
+		/*
+		 * Can't reliably derive the base address.  Symbol lookup is
+		 * quite unlikely to work, but we can still try with a zero base
+		 * address.
+		 */
+		_dprintf("failed to get base address for ELF file %s, symbol "
+		    "lookup likely broken\n", fptr->file_pname);
+		fptr->file_dyn_base = 0;
+		goto ret;
+	}
+
+	fptr->file_dyn_base = P->mappings[fptr->file_map].map_pmap->pr_vaddr -
+	    fsp->fs_lowest_vaddr;
 
-	_dprintf("failed to get base address for ELF file %s, symbol lookup "
-	    "likely broken: %s\n", fptr->file_pname, (err == 0) ? "<null>" :
-	    elf_errmsg(err));
-	fptr->file_dyn_base = 0;
-	free(cache);
+	_dprintf("setting file_dyn_base for %s to %lx, "
+	    "from vaddr of %lx and lowest_addr of %lx\n",
+	    fptr->file_pname, (long)fptr->file_dyn_base,
+	    P->mappings[fptr->file_map].map_pmap->pr_vaddr,
+	    fsp->fs_lowest_vaddr);
+
+ret:
 	*jmp_pad = old_exec_jmp;
 	return;
 
 bad:
-	free(cache);
-	elf_end(elf);
-	fptr->file_elf = NULL;
 	*jmp_pad = old_exec_jmp;
 }
 
@@ -1633,7 +2436,10 @@ sym_prefer(GElf_Sym *sym1, char *name1, GElf_Sym *sym2, char *name2)
 
 /*
  * Look up a symbol by address in the specified symbol table, using a binary
- * search.
+ * search of its address intervals.  Nested symbols and aliases have already
+ * been resolved in favour of the innermost, preferred symbol when the intervals
+ * were built, so the search is over a dense array and only the symbol found
+ * needs converting.
  *
  * Adjustment to 'addr' must already have been made for the
  * offset of the symbol if this is a dynamic library symbol table.
@@ -1641,64 +2447,33 @@ sym_prefer(GElf_Sym *sym1, char *name1, GElf_Sym *sym2, char *name2)
 static GElf_Sym *
 sym_by_addr(sym_tbl_t *symtab, GElf_Addr addr, GElf_Sym *symp, uint_t *idp)
 {
-	GElf_Sym sym, osym;
-	uint_t i, oid = 0, *byaddr = symtab->sym_byaddr;
-	int min, max, mid, omid = 0, found = 0;
+	sym_interval_t *base = symtab->sym_intervals;
+	size_t n = symtab->sym_nintervals;
+	sym_entry_t *sym;
 
-	if (symtab->sym_data_pri == NULL || symtab->sym_count == 0)
+	if (symtab->sym_data_pri == NULL || n == 0 || addr < base->si_start)
 		return (NULL);
 
-	min = 0;
-	max = symtab->sym_count - 1;
-	osym.st_value = 0;
-
 	/*
-	 * We can't return when we've found a match, we have to continue
-	 * searching for the closest matching symbol.
+	 * Find the last interval starting at or below addr.
 	 */
-	while (min <= max) {
-		mid = (max + min) / 2;
+	while (n > 1) {
+		size_t half = n / 2;
 
-		i = byaddr[mid];
-		if ((symtab_getsym(symtab, i, &sym)) &&
-		    (addr >= sym.st_value &&
-			addr < sym.st_value + sym.st_size &&
-			(!found || sym.st_value > osym.st_value))) {
-			osym = sym;
-			omid = mid;
-			oid = i;
-			found = 1;
-		}
-
-		if (addr < sym.st_value)
-			max = mid - 1;
-		else
-			min = mid + 1;
+		if (base[half].si_start <= addr)
+			base += half;
+		n -= half;
 	}
 
-	if (!found)
+	if (addr >= base->si_end)
 		return (NULL);
 
-	/*
-	 * There may be many symbols with identical values so we walk
-	 * backward in the byaddr table to find the best match.
-	 */
-	do {
-		sym = osym;
-		i = oid;
-
-		if (omid == 0)
-			break;
-
-		oid = byaddr[--omid];
-		symtab_getsym(symtab, oid, &osym);
-	} while (addr >= osym.st_value &&
-	    addr < sym.st_value + osym.st_size &&
-	    osym.st_value == sym.st_value);
+	sym = &symtab->sym_byaddr[base->si_sym];
+	if (symtab_getsym(symtab, sym->se_index, symp) == NULL)
+		return (NULL);
 
-	*symp = sym;
 	if (idp != NULL)
-		*idp = i;
+		*idp = sym->se_index;
 	return (symp);
 }
 
@@ -1710,10 +2485,10 @@ static GElf_Sym *
 sym_by_name(sym_tbl_t *symtab, const char *name, GElf_Sym *symp, uint_t *idp)
 {
 	char *strs = symtab->sym_strs;
-	uint_t i, *byname = symtab->sym_byname;
+	uint_t *byname = symtab->sym_byname;
 	int min, mid, max, cmp;
 
-	if (symtab->sym_data_pri == NULL || strs == NULL ||
+	if (symtab->sym_data_pri == NULL || strs == NULL || byname == NULL ||
 	    symtab->sym_count == 0)
 		return (NULL);
 
@@ -1721,17 +2496,19 @@ sym_by_name(sym_tbl_t *symtab, const char *name, GElf_Sym *symp, uint_t *idp)
 	max = symtab->sym_count - 1;
 
 	while (min <= max) {
-		GElf_Sym *sym;
+		sym_entry_t *sym;
 		mid = (max + min) / 2;
 
-		i = byname[mid];
-		sym = symtab_getsym(symtab, i, symp);
-		if (sym == NULL)
-			_dprintf("null sym %i!\n", i);
+		sym = &symtab->sym_byaddr[byname[mid]];
+
+		if ((cmp = strcmp(name, strs + sym->se_name)) == 0) {
+			if (symtab_getsym(symtab, sym->se_index, symp) == NULL) {
+				_dprintf("null sym %i!\n", sym->se_index);
+				return (NULL);
+			}
 
-		if ((cmp = strcmp(name, strs + symp->st_name)) == 0) {
 			if (idp != NULL)
-				*idp = i;
+				*idp = sym->se_index;
 			return (symp);
 		}
 
@@ -1828,6 +2605,56 @@ sym_search_next(struct ps_prochandle *P, file_info_t *fptr,
 	return NULL;
 }
 
+/*
+ * Look up an address in a file's symbol tables, symtab first, then dynsym,
+ * returning the preferred symbol (with its value adjusted for the load object
+ * base address) and its name, or NULL if there is none.
+ */
+static GElf_Sym *
+file_lookup_by_addr(file_info_t *fptr, uintptr_t addr, GElf_Sym *symbolp,
+    char **namep)
+{
+	file_syms_t	*fsp;
+	GElf_Sym	*symp;
+	GElf_Sym	sym1, *sym1p = NULL;
+	GElf_Sym	sym2, *sym2p = NULL;
+	char		*name1 = NULL;
+	char		*name2 = NULL;
+	uint_t		i1;
+	uint_t		i2;
+
+	if (fptr == NULL || fptr->file_syms == NULL)	/* not an ELF file */
+		return (NULL);
+
+	/*
+	 * Adjust the address by the load object base address in case the
+	 * address turns out to be in a shared library.  (This will likely fail
+	 * or work only erratically for noninvasive grabs, since we cannot
+	 * determine the runtime value of file_dyn_base in that case.)
+	 */
+	addr -= fptr->file_dyn_base;
+	fsp = fptr->file_syms;
+
+	/*
+	 * Search both symbol tables, symtab first, then dynsym.
+	 */
+	if ((sym1p = sym_by_addr(&fsp->fs_symtab, addr, &sym1, &i1)) != NULL)
+		name1 = fsp->fs_symtab.sym_strs + sym1.st_name;
+	if ((sym2p = sym_by_addr(&fsp->fs_dynsym, addr, &sym2, &i2)) != NULL)
+		name2 = fsp->fs_dynsym.sym_strs + sym2.st_name;
+
+	if ((symp = sym_prefer(sym1p, name1, sym2p, name2)) == NULL)
+		return (NULL);
+
+	*namep = (symp == sym1p) ? name1 : name2;
+	*symbolp = *symp;
+
+	if (GELF_ST_TYPE(symbolp->st_info) != STT_TLS)
+		symbolp->st_value += fptr->file_dyn_base;
+
+	return (symbolp);
+}
+
 /*
  * Search the process symbol tables looking for a symbol whose
  * value to value+size contain the address specified by addr.
@@ -1840,14 +2667,7 @@ int
 Plookup_by_addr(struct ps_prochandle *P, uintptr_t addr, char *sym_name_buffer,
     size_t bufsize, GElf_Sym *symbolp)
 {
-	GElf_Sym	*symp;
 	char		*name;
-	GElf_Sym	sym1, *sym1p = NULL;
-	GElf_Sym	sym2, *sym2p = NULL;
-	char		*name1 = NULL;
-	char		*name2 = NULL;
-	uint_t		i1;
-	uint_t		i2;
 	map_info_t	*mptr;
 	file_info_t	*fptr;
 
@@ -1864,41 +2684,112 @@ Plookup_by_addr(struct ps_prochandle *P, uintptr_t addr, char *sym_name_buffer,
 
 	Pbuild_file_symtab(P, fptr);
 
-	if (fptr->file_elf == NULL)			/* not an ELF file */
-		return (-1);
-
-	/*
-	 * Adjust the address by the load object base address in case the
-	 * address turns out to be in a shared library.  (This will likely fail
-	 * or work only erratically for noninvasive grabs, since we cannot
-	 * determine the runtime value of file_dyn_base in that case.)
-	 */
-	addr -= fptr->file_dyn_base;
-
-	/*
-	 * Search both symbol tables, symtab first, then dynsym.
-	 */
-	if ((sym1p = sym_by_addr(&fptr->file_symtab, addr, &sym1, &i1)) != NULL)
-		name1 = fptr->file_symtab.sym_strs + sym1.st_name;
-	if ((sym2p = sym_by_addr(&fptr->file_dynsym, addr, &sym2, &i2)) != NULL)
-		name2 = fptr->file_dynsym.sym_strs + sym2.st_name;
-
-	if ((symp = sym_prefer(sym1p, name1, sym2p, name2)) == NULL)
+	if (file_lookup_by_addr(fptr, addr, symbolp, &name) == NULL)
 		return (-1);
 
-	name = (symp == sym1p) ? name1 : name2;
 	if (bufsize > 0) {
 		(void) strncpy(sym_name_buffer, name, bufsize);
 		sym_name_buffer[bufsize - 1] = '\0';
 	}
 
-	*symbolp = *symp;
+	return (0);
+}
 
-	if (GELF_ST_TYPE(symbolp->st_info) != STT_TLS)
-		symbolp->st_value += fptr->file_dyn_base;
+static int
+addrinfo_cmp(const void *aa, const void *bb)
+{
+	const praddrinfo_t *a = *(const praddrinfo_t **)aa;
+	const praddrinfo_t *b = *(const praddrinfo_t **)bb;
 
+	if (a->pra_addr < b->pra_addr)
+		return (-1);
+	if (a->pra_addr > b->pra_addr)
+		return (1);
 	return (0);
 }
+
+/*
+ * Batch form of Plookup_by_addr(), Pobjname() and Paddr_to_map(): given an
+ * array of praddrinfo_t with their pra_addr filled in, fill in the mapping,
+ * object name and (if one is found) symbol for each.
+ *
+ * The addresses are visited in sorted order, so that runs of addresses in the
+ * same mapping (the common case for stacks) locate the mapping and build its
+ * file's symbol tables only once, and duplicate addresses are only looked up
+ * once.  The array itself is not reordered.
+ *
+ * The pointers filled in are only valid until the next call to Pupdate_maps().
+ * Returns the number of addresses resolved to symbols, or -1 on failure.
+ */
+int
+Plookup_by_addrs(struct ps_prochandle *P, praddrinfo_t *addrs, size_t n)
+{
+	praddrinfo_t **sorted;
+	map_info_t *mptr = NULL;
+	size_t i;
+	int found = 0;
+
+	if (P->state == PS_DEAD)
+		return (-1);
+
+	if ((sorted = malloc(n * sizeof (praddrinfo_t *))) == NULL)
+		return (-1);
+
+	Pupdate_maps(P);
+	Pupdate_lmids(P);
+
+	for (i = 0; i < n; i++) {
+		addrs[i].pra_map = NULL;
+		addrs[i].pra_object = NULL;
+		addrs[i].pra_name = NULL;
+		sorted[i] = &addrs[i];
+	}
+
+	qsort(sorted, n, sizeof (praddrinfo_t *), addrinfo_cmp);
+
+	for (i = 0; i < n; i++) {
+		praddrinfo_t *pra = sorted[i];
+		file_info_t *fptr;
+		char *name;
+
+		if (i > 0 && sorted[i - 1]->pra_addr == pra->pra_addr) {
+			*pra = *sorted[i - 1];
+			if (pra->pra_name != NULL)
+				found++;
+			continue;
+		}
+
+		if (mptr == NULL ||
+		    (pra->pra_addr - mptr->map_pmap->pr_vaddr) >=
+		    mptr->map_pmap->pr_size)
+			mptr = Paddr2mptr(P, pra->pra_addr);
+
+		if (mptr == NULL)
+			continue;
+
+		pra->pra_map = mptr->map_pmap;
+
+		if ((fptr = mptr->map_file) == NULL)
+			continue;
+
+		if (fptr->file_lname != NULL)
+			pra->pra_object = fptr->file_lname;
+		else
+			pra->pra_object = fptr->file_pname;
+
+		Pbuild_file_symtab(P, fptr);
+
+		if (file_lookup_by_addr(fptr, pra->pra_addr, &pra->pra_sym,
+			&name) != NULL) {
+			pra->pra_name = name;
+			found++;
+		}
+	}
+
+	free(sorted);
+	return (found);
+}
+
 /*
  * Search a specific symbol table looking for a symbol whose name matches the
  * specified name and whose object and link map optionally match the specified
@@ -1972,15 +2863,16 @@ Pxlookup_by_name_internal(
 	while ((fptr = sym_search_next(P, fptr, &state, just_one)) != NULL) {
 		Pbuild_file_symtab(P, fptr);
 
-		if (fptr->file_elf == NULL)
+		if (fptr->file_syms == NULL)
 			continue;
 
 		if (lmid != PR_LMID_EVERY && fptr->file_lo != NULL &&
 		    lmid != fptr->file_lo->rl_lmident)
 			continue;
 
-		if (fptr->file_symtab.sym_data_pri != NULL &&
-		    sym_by_name(&fptr->file_symtab, sname, symp, &id)) {
+		if (fptr->file_syms->fs_symtab.sym_data_pri != NULL &&
+		    sym_by_name(&fptr->file_syms->fs_symtab, sname, symp,
+			&id)) {
 			if (sip != NULL) {
 				sip->prs_id = id;
 				sip->prs_table = PR_SYMTAB;
@@ -1989,8 +2881,9 @@ Pxlookup_by_name_internal(
 				sip->prs_lmid = fptr->file_lo == NULL ?
 				    LM_ID_BASE : fptr->file_lo->rl_lmident;
 			}
-		} else if (fptr->file_dynsym.sym_data_pri != NULL &&
-		    sym_by_name(&fptr->file_dynsym, sname, symp, &id)) {
+		} else if (fptr->file_syms->fs_dynsym.sym_data_pri != NULL &&
+		    sym_by_name(&fptr->file_syms->fs_dynsym, sname, symp,
+			&id)) {
 			if (sip != NULL) {
 				sip->prs_id = id;
 				sip->prs_table = PR_DYNSYM;
@@ -2153,114 +3046,237 @@ Plmid(struct ps_prochandle *P, uintptr_t addr, Lmid_t *lmidp)
 }
 
 /*
- * Given an object name, iterate over the object's symbols.
- * If which == PR_SYMTAB, search the normal symbol table.
- * If which == PR_DYNSYM, search the dynamic symbol table.
+ * Find the symbol table of the given object for the Psymbol_iter_*() functions.
+ * If which == PR_SYMTAB, use the normal symbol table.
+ * If which == PR_DYNSYM, use the dynamic symbol table.
  */
-int
-Psymbol_iter_by_addr(struct ps_prochandle *P,
-    const char *object_name, int which, int mask, proc_sym_f *func, void *cd)
+static sym_tbl_t *
+symbol_iter_symtab(struct ps_prochandle *P, const char *object_name,
+    int which, file_info_t **fptrp)
 {
-#if STT_NUM != (STT_TLS + 1)
-#error "STT_NUM has grown. update Psymbol_iter_com()"
-#endif
-
-	GElf_Sym sym;
-	GElf_Shdr shdr;
 	map_info_t *mptr;
 	file_info_t *fptr;
+	file_syms_t *fsp;
 	sym_tbl_t *symtab;
-	size_t count;
-	const char *strs;
-	size_t strsz;
-	int rv;
-	uint_t *map, i, ndx;
 
 	if (P->state == PS_DEAD)
-		return (-1);
+		return (NULL);
 
 	if ((mptr = object_name_to_map(P, PR_LMID_EVERY, object_name)) == NULL)
-		return (-1);
+		return (NULL);
 
 	fptr = mptr->map_file;
 	Pbuild_file_symtab(P, fptr);
 
-	if (fptr->file_elf == NULL)			/* not an ELF file */
-		return (-1);
+	if ((fsp = fptr->file_syms) == NULL)		/* not an ELF file */
+		return (NULL);
 
-	/*
-	 * Search the specified symbol table.
-	 */
 	switch (which) {
 	case PR_SYMTAB:
-		symtab = &fptr->file_symtab;
+		symtab = &fsp->fs_symtab;
 		break;
 	case PR_DYNSYM:
-		symtab = &fptr->file_dynsym;
+		symtab = &fsp->fs_dynsym;
 		break;
 	default:
-		return (-1);
+		return (NULL);
 	}
 
-	strs = symtab->sym_strs;
-	strsz = symtab->sym_strsz;
-	map = symtab->sym_byaddr;
-	count = symtab->sym_count;
+	if (symtab->sym_data_pri == NULL || symtab->sym_strs == NULL ||
+	    symtab->sym_count == 0)
+		return (NULL);
+
+	*fptrp = fptr;
+	return (symtab);
+}
+
+/*
+ * Call the iteration function on one symbol, given its index, if its type and
+ * binding are in the mask.  Return what the function returned, or 0 if it was
+ * not called.
+ */
+static int
+symbol_iter_one(file_info_t *fptr, sym_tbl_t *symtab, uint_t ndx, int mask,
+    proc_sym_f *func, void *cd)
+{
+#if STT_NUM != (STT_TLS + 1)
+#error "STT_NUM has grown. update Psymbol_iter_com()"
+#endif
+
+	file_syms_t *fsp = fptr->file_syms;
+	GElf_Sym sym;
+	GElf_Shdr shdr;
+	uint_t s_bind, s_type, type;
+	const char *prs_name;
+
+	if (symtab_getsym(symtab, ndx, &sym) == NULL)
+		return (0);
+
+	if (sym.st_name >= symtab->sym_strsz)	/* invalid st_name */
+		return (0);
+
+	s_bind = GELF_ST_BIND(sym.st_info);
+	s_type = GELF_ST_TYPE(sym.st_info);
+
+	/*
+	 * In case you haven't already guessed, this relies on the bitmask used
+	 * in <libproc.h> for encoding symbol type and binding matching the
+	 * order of STB and STT constants in <sys/elf.h>.  Changes to ELF must
+	 * maintain binary compatibility, so I think this is reasonably fair
+	 * game.
+	 */
+	if (s_bind < STB_NUM && s_type < STT_NUM) {
+		type = (1 << (s_type + 8)) | (1 << s_bind);
+		if ((type & ~mask) != 0)
+			return (0);
+	} else
+		return (0); /* Invalid type or binding */
+
+	if (GELF_ST_TYPE(sym.st_info) != STT_TLS)
+		sym.st_value += fptr->file_dyn_base;
+
+	prs_name = symtab->sym_strs + sym.st_name;
+
+	/*
+	 * If symbol's type is STT_SECTION, then try to lookup the name of the
+	 * corresponding section.
+	 */
+	if (GELF_ST_TYPE(sym.st_info) == STT_SECTION &&
+	    fsp->fs_shstrs != NULL &&
+	    gelf_getshdr(elf_getscn(fsp->fs_elf, sym.st_shndx), &shdr) != NULL &&
+	    shdr.sh_name != 0 &&
+	    shdr.sh_name < fsp->fs_shstrsz)
+		prs_name = fsp->fs_shstrs + shdr.sh_name;
+
+	return (func(cd, &sym, prs_name));
+}
 
-	if (symtab->sym_data_pri == NULL || strs == NULL || count == 0)
+/*
+ * Given an object name, iterate over the object's symbols in address order.
+ * If which == PR_SYMTAB, search the normal symbol table.
+ * If which == PR_DYNSYM, search the dynamic symbol table.
+ */
+int
+Psymbol_iter_by_addr(struct ps_prochandle *P,
+    const char *object_name, int which, int mask, proc_sym_f *func, void *cd)
+{
+	file_info_t *fptr;
+	sym_tbl_t *symtab;
+	sym_entry_t *map;
+	uint_t i, ndx;
+	int rv = 0;
+
+	if ((symtab = symbol_iter_symtab(P, object_name, which, &fptr)) == NULL)
 		return (-1);
 
-	rv = 0;
+	map = symtab->sym_byaddr;
 
-	for (i = 0; i < count; i++) {
-		ndx = map == NULL ? i : map[i];
-		if (symtab_getsym(symtab, ndx, &sym) != NULL) {
-			uint_t s_bind, s_type, type;
-			const char *prs_name;
+	for (i = 0; i < symtab->sym_count; i++) {
+		ndx = map == NULL ? i : map[i].se_index;
+		if ((rv = symbol_iter_one(fptr, symtab, ndx, mask, func,
+			    cd)) != 0)
+			break;
+	}
 
-			if (sym.st_name >= strsz)	/* invalid st_name */
-				continue;
+	return (rv);
+}
 
-			s_bind = GELF_ST_BIND(sym.st_info);
-			s_type = GELF_ST_TYPE(sym.st_info);
+static int
+uint_cmp(const void *aa, const void *bb)
+{
+	uint_t a = *(const uint_t *)aa;
+	uint_t b = *(const uint_t *)bb;
 
-			/*
-			 * In case you haven't already guessed, this relies on
-			 * the bitmask used in <libproc.h> for encoding symbol
-			 * type and binding matching the order of STB and STT
-			 * constants in <sys/elf.h>.  Changes to ELF must
-			 * maintain binary compatibility, so I think this is
-			 * reasonably fair game.
-			 */
-			if (s_bind < STB_NUM && s_type < STT_NUM) {
-				type = (1 << (s_type + 8)) | (1 << s_bind);
-				if ((type & ~mask) != 0)
-					continue;
-			} else
-				continue; /* Invalid type or binding */
+	return (a < b ? -1 : a > b);
+}
 
-			if (GELF_ST_TYPE(sym.st_info) != STT_TLS)
-				sym.st_value += fptr->file_dyn_base;
+/*
+ * As Psymbol_iter_by_addr(), but only over the symbols whose names begin with
+ * the given prefix.  These are found by binary search of the by-name index
+ * rather than by a scan of the whole table, and are still visited in address
+ * order.  Without that index, fall back to a scan.
+ */
+int
+Psymbol_iter_by_prefix(struct ps_prochandle *P, const char *object_name,
+    int which, int mask, const char *prefix, proc_sym_f *func, void *cd)
+{
+	file_info_t *fptr;
+	sym_tbl_t *symtab;
+	const char *strs;
+	uint_t *byname, *range;
+	size_t len = strlen(prefix);
+	int min, mid, max;
+	uint_t i, lo, hi, ndx;
+	int rv = 0;
 
-			prs_name = strs + sym.st_name;
+	if ((symtab = symbol_iter_symtab(P, object_name, which, &fptr)) == NULL)
+		return (-1);
 
-			/*
-			 * If symbol's type is STT_SECTION, then try to lookup
-			 * the name of the corresponding section.
-			 */
-			if (GELF_ST_TYPE(sym.st_info) == STT_SECTION &&
-			    fptr->file_shstrs != NULL &&
-			    gelf_getshdr(elf_getscn(fptr->file_elf,
-			    sym.st_shndx), &shdr) != NULL &&
-			    shdr.sh_name != 0 &&
-			    shdr.sh_name < fptr->file_shstrsz)
-				prs_name = fptr->file_shstrs + shdr.sh_name;
-
-			if ((rv = func(cd, &sym, prs_name)) != 0)
+	strs = symtab->sym_strs;
+	byname = symtab->sym_byname;
+
+	if (byname == NULL) {
+		sym_entry_t *map = symtab->sym_byaddr;
+
+		for (i = 0; i < symtab->sym_count; i++) {
+			GElf_Sym sym;
+
+			ndx = map == NULL ? i : map[i].se_index;
+			if (symtab_getsym(symtab, ndx, &sym) == NULL ||
+			    sym.st_name >= symtab->sym_strsz ||
+			    strncmp(strs + sym.st_name, prefix, len) != 0)
+				continue;
+
+			if ((rv = symbol_iter_one(fptr, symtab, ndx, mask, func,
+				    cd)) != 0)
 				break;
 		}
+		return (rv);
+	}
+
+	/*
+	 * Names beginning with the prefix sort together, starting at the first
+	 * name not less than the prefix itself.
+	 */
+	min = 0;
+	max = symtab->sym_count - 1;
+	while (min <= max) {
+		mid = (max + min) / 2;
+
+		if (strcmp(strs + symtab->sym_byaddr[byname[mid]].se_name,
+			prefix) < 0)
+			min = mid + 1;
+		else
+			max = mid - 1;
+	}
+
+	for (lo = hi = min; hi < symtab->sym_count; hi++) {
+		if (strncmp(strs + symtab->sym_byaddr[byname[hi]].se_name,
+			prefix, len) != 0)
+			break;
+	}
+
+	if (lo == hi)
+		return (0);
+
+	/*
+	 * The by-name index holds positions in the by-address array, so
+	 * sorting them puts the symbols back in address order.
+	 */
+	if ((range = malloc(sizeof (uint_t) * (hi - lo))) == NULL)
+		return (-1);
+
+	memcpy(range, &byname[lo], sizeof (uint_t) * (hi - lo));
+	qsort(range, hi - lo, sizeof (uint_t), uint_cmp);
+
+	for (i = 0; i < hi - lo; i++) {
+		ndx = symtab->sym_byaddr[range[i]].se_index;
+		if ((rv = symbol_iter_one(fptr, symtab, ndx, mask, func,
+			    cd)) != 0)
+			break;
 	}
 
+	free(range);
 	return (rv);
 }
 
@@ -2325,6 +3341,13 @@ Preset_maps(struct ps_prochandle *P)
 	free(P->mappings);
 	P->mappings = NULL;
 
+	free(P->maps_buf);
+	P->maps_buf = NULL;
+	P->maps_bufsz = 0;
+	free(P->maps_lines);
+	P->maps_lines = NULL;
+	P->maps_nlines = 0;
+
 	file_info_purge(P);
 
 	P->info_valid = 0;
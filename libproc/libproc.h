@@ -32,6 +32,7 @@
 #include <sys/socket.h>
 #include <sys/utsname.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/user.h>
 
 #include <sys/compiler.h>
@@ -79,6 +80,8 @@ extern	int	Pmemfd(struct ps_prochandle *);
 extern	long	Pwait(struct ps_prochandle *, boolean_t block);
 extern	int	Pstate(struct ps_prochandle *);
 extern	ssize_t	Pread(struct ps_prochandle *, void *, size_t, uintptr_t);
+extern	ssize_t	Preadv(struct ps_prochandle *, const struct iovec *,
+    const uintptr_t *, size_t);
 extern	ssize_t Pread_string(struct ps_prochandle *, char *, size_t, uintptr_t);
 extern 	ssize_t	Pread_scalar(struct ps_prochandle *P, void *buf, size_t nbyte,
     size_t nscalar, uintptr_t address);
@@ -96,6 +99,7 @@ extern	int	Pelf64(struct ps_prochandle *);
  */
 extern int Pexists(pid_t pid);
 extern int Psystem_daemon(pid_t pid, uid_t useruid, const char *sysslice);
+extern unsigned long long Pstart_time(pid_t pid);
 
 /*
  * Read the first argument of the function at which the process P is
@@ -120,6 +124,30 @@ typedef long ptrace_fun(enum __ptrace_request request, void *arg, pid_t pid,
 extern	void	Pset_ptrace_wrapper(struct ps_prochandle *P,
     ptrace_fun *wrapper);
 
+/*
+ * A batch of ptrace() requests.  They are issued in order, each with errno
+ * cleared beforehand; the batch stops after the first request that sets errno.
+ * pr_ret and pr_errno receive each result.
+ *
+ * Route such batches via the specified wrapper function, which returns the
+ * number of requests issued.  Without one, batches go through the ptrace()
+ * wrapper a request at a time; a program that proxies ptrace() to another
+ * thread can instead proxy a whole batch at once.
+ */
+typedef struct ptrace_req {
+	enum __ptrace_request pr_request;
+	pid_t pr_pid;
+	void *pr_addr;
+	void *pr_data;
+	long pr_ret;
+	int pr_errno;
+} ptrace_req_t;
+
+typedef long ptrace_batch_fun(ptrace_req_t *reqs, void *arg, size_t n);
+
+extern	void	Pset_ptrace_batch_wrapper(struct ps_prochandle *P,
+    ptrace_batch_fun *wrapper);
+
 /*
  * Likewise, but for Pwait().
  *
@@ -154,6 +182,21 @@ typedef	void	ptrace_lock_hook_fun(struct ps_prochandle *P, void *arg,
 
 extern	void	Pset_ptrace_lock_hook(ptrace_lock_hook_fun *hook);
 
+/*
+ * Register a function to be called by blocking waits for a process to change
+ * state, instead of blocking in waitpid(): this covers Pwait() (including the
+ * waits within Ptrace()) and the waits in Pcreate() and Pgrab().  It should
+ * return once waitpid() may have something to report, after which the wait is
+ * retried, or -1 if it cannot wait for this process, in which case the wait
+ * blocks in waitpid() as usual.  A program that multiplexes many processes on
+ * one thread can use it to serve the others meanwhile.
+ *
+ * Like the lock hook, this function is global, but P and the arg are not.
+ */
+typedef	int	pwait_block_hook_fun(struct ps_prochandle *P, void *arg);
+
+extern	void	Pset_pwait_block_hook(pwait_block_hook_fun *hook);
+
 /*
  * Register a function that returns the address of a per-thread pointer-sized
  * area suitable for storing a jmp_buf, to be called on exec() to register a
@@ -185,6 +228,27 @@ extern	void	Punbkpt(struct ps_prochandle *P, uintptr_t address);
 extern	int	Pbkpt_continue(struct ps_prochandle *P);
 extern 	uintptr_t Pbkpt_addr(struct ps_prochandle *P);
 
+/*
+ * Statistics on the breakpoint and mapping-name hashes, for diagnosing slow
+ * lookups in processes with very many breakpoints or mappings.
+ */
+typedef struct prhashstats {
+	uint64_t	phs_lookups;	/* number of lookups */
+	uint64_t	phs_probes;	/* chain entries examined by lookups */
+	size_t		phs_entries;	/* entries in the hash */
+	size_t		phs_buckets;	/* buckets in the hash */
+	size_t		phs_used;	/* nonempty buckets */
+	size_t		phs_maxchain;	/* length of the longest chain */
+} prhashstats_t;
+
+extern	void	Pbkpt_hash_stats(struct ps_prochandle *P, prhashstats_t *);
+extern	void	Pmap_hash_stats(struct ps_prochandle *P, prhashstats_t *);
+
+/*
+ * Approximate memory held by a process handle, for sizing handle caches.
+ */
+extern	size_t	Pmemsize(struct ps_prochandle *P);
+
 /*
  * Symbol table interfaces.
  */
@@ -213,6 +277,19 @@ extern 	uintptr_t Pbkpt_addr(struct ps_prochandle *P);
 extern int Plookup_by_addr(struct ps_prochandle *,
     uintptr_t, char *, size_t, GElf_Sym *);
 
+/*
+ * One address for Plookup_by_addrs() to look up, and its results.
+ */
+typedef struct praddrinfo {
+	uintptr_t	pra_addr;		/* address to look up */
+	const prmap_t	*pra_map;		/* mapping, or NULL */
+	const char	*pra_object;		/* object name, or NULL */
+	const char	*pra_name;		/* symbol name, or NULL */
+	GElf_Sym	pra_sym;		/* symbol, if pra_name is set */
+} praddrinfo_t;
+
+extern int Plookup_by_addrs(struct ps_prochandle *, praddrinfo_t *, size_t);
+
 typedef struct prsyminfo {
 	const char	*prs_object;		/* object name */
 	const char	*prs_name;		/* symbol name */
@@ -244,6 +321,8 @@ typedef int proc_sym_f(void *, const GElf_Sym *, const char *);
 
 extern int Psymbol_iter_by_addr(struct ps_prochandle *,
     const char *, int, int, proc_sym_f *, void *);
+extern int Psymbol_iter_by_prefix(struct ps_prochandle *,
+    const char *, int, int, const char *, proc_sym_f *, void *);
 
 /*
  * 'which' selects which symbol table and can be one of the following.
@@ -275,6 +354,13 @@ extern int Psymbol_iter_by_addr(struct ps_prochandle *,
 extern void Pupdate_maps(struct ps_prochandle *);
 extern void Pupdate_syms(struct ps_prochandle *);
 
+/*
+ * Noninvasively-grabbed processes get no rtld events, so libproc cannot tell
+ * when their mappings change.  This marks the mappings as possibly stale, so
+ * that the next lookup rereads them (reusing whatever is unchanged).
+ */
+extern void Pinvalidate_maps(struct ps_prochandle *);
+
 /*
  * This must be called after the victim process performs a successful
  * exec() if any of the symbol table interface functions have been called
@@ -39,6 +39,16 @@
 	    sizeof(((struct structure *)0)->field),			\
 	    addr + offsets[offsetof(struct structure, field)].offset[P->elf64])
 
+/*
+ * Set up IOV and ADDRP for a Preadv() of FIELD from STRUCTURE into BUF, as
+ * read_scalar_child() would read it.  Evaluates to the number of bytes read.
+ */
+#define scalar_iov_child(P, iov, addrp, buf, addr, offsets, structure, field) \
+	scalar_iov(iov, addrp, buf,					\
+	    offsets[offsetof(struct structure, field)].size[P->elf64],	\
+	    sizeof(((struct structure *)0)->field),			\
+	    addr + offsets[offsetof(struct structure, field)].offset[P->elf64])
+
 /*
  * Tripped when ld.so hits our breakpoint on r_brk (used for consistency
  * checking and rtld event reporting).
@@ -75,6 +85,11 @@ static int rd_ldso_consistent_begin(rd_agent_t *rd);
 static void rd_ldso_consistent_end(rd_agent_t *rd);
 static void rd_ldso_consistent_reset(rd_agent_t *rd);
 
+/*
+ * Free the cached link maps.
+ */
+static void rd_lm_cache_free(rd_agent_t *rd);
+
 /* Internal functions. */
 
 static void
@@ -470,21 +485,47 @@ find_l_searchlist(rd_agent_t *rd)
 }
 
 /*
- * Get a link map, given an address.
+ * Set up an iovec and address to read a scalar of NBYTE bytes at ADDR in the
+ * child into the NSCALAR-byte BUF with Preadv(), zero-extending it as
+ * Pread_scalar() does.  Returns NBYTE.
+ */
+static size_t
+scalar_iov(struct iovec *iov, uintptr_t *addrp, void *buf, size_t nbyte,
+    size_t nscalar, uintptr_t addr)
+{
+	memset(buf, 0, nscalar);
+#if __BYTE_ORDER == __BIG_ENDIAN
+	buf = (char *) buf + nscalar - nbyte;
+#endif
+	iov->iov_base = buf;
+	iov->iov_len = nbyte;
+	*addrp = addr;
+
+	return nbyte;
+}
+
+/*
+ * Get a link map, given an address.  All the fields are read in one go.
  */
 static struct link_map *
 rd_get_link_map(rd_agent_t *rd, struct link_map *buf, uintptr_t addr)
 {
-	if ((read_scalar_child(rd->P, &buf->l_addr, addr,
-		    link_map_offsets, link_map, l_addr) <= 0) ||
-	    (read_scalar_child(rd->P, &buf->l_name, addr,
-		link_map_offsets, link_map, l_name) <= 0) ||
-	    (read_scalar_child(rd->P, &buf->l_ld, addr,
-		link_map_offsets, link_map, l_ld) <= 0) ||
-	    (read_scalar_child(rd->P, &buf->l_next, addr,
-		link_map_offsets, link_map, l_next) <= 0) ||
-	    (read_scalar_child(rd->P, &buf->l_prev, addr,
-		link_map_offsets, link_map, l_prev) <= 0))
+	struct iovec iov[5];
+	uintptr_t addrs[5];
+	size_t want = 0;
+
+	want += scalar_iov_child(rd->P, &iov[0], &addrs[0], &buf->l_addr,
+	    addr, link_map_offsets, link_map, l_addr);
+	want += scalar_iov_child(rd->P, &iov[1], &addrs[1], &buf->l_name,
+	    addr, link_map_offsets, link_map, l_name);
+	want += scalar_iov_child(rd->P, &iov[2], &addrs[2], &buf->l_ld,
+	    addr, link_map_offsets, link_map, l_ld);
+	want += scalar_iov_child(rd->P, &iov[3], &addrs[3], &buf->l_next,
+	    addr, link_map_offsets, link_map, l_next);
+	want += scalar_iov_child(rd->P, &iov[4], &addrs[4], &buf->l_prev,
+	    addr, link_map_offsets, link_map, l_prev);
+
+	if (Preadv(rd->P, iov, addrs, 5) != want)
 		return NULL;
 
 	return buf;
@@ -496,14 +537,20 @@ rd_get_link_map(rd_agent_t *rd, struct link_map *buf, uintptr_t addr)
  * The rl_scope array in the returned structure is realloc()ed as needed, should
  * be NULL to start with, and must be freed by the caller when done.
  *
- * rl_lmident is not populated.
+ * rl_lmident is not populated.  If SEARCHLISTP is non-NULL, the address of the
+ * scopes array is stored there.
  */
 static struct rd_loadobj *
 rd_get_loadobj_link_map(rd_agent_t *rd, rd_loadobj_t *buf,
-    struct link_map *map, uintptr_t addr)
+    struct link_map *map, uintptr_t addr, uintptr_t *searchlistp)
 {
+	enum { SCOPE_BATCH = 32 };
+	struct iovec iov[SCOPE_BATCH];
+	uintptr_t addrs[SCOPE_BATCH];
+	size_t link_map_ptr_size = rd->P->elf64 ? L_NEXT_64_SIZE :
+	    L_NEXT_32_SIZE;
 	uintptr_t searchlist;
-	size_t i;
+	size_t i, j, n, want;
 
 	jmp_buf * volatile old_exec_jmp;
 	jmp_buf **jmp_pad, this_exec_jmp;
@@ -540,15 +587,14 @@ rd_get_loadobj_link_map(rd_agent_t *rd, rd_loadobj_t *buf,
 	 * pointers to link maps -- like L_NEXT.
 	 */
 
-	if (Pread_scalar(rd->P, &searchlist, rd->P->elf64 ?
-		L_NEXT_64_SIZE : L_NEXT_32_SIZE,
-		sizeof (uintptr_t), addr + rd->l_searchlist_offset) < 0)
-		goto fail;
+	want = scalar_iov(&iov[0], &addrs[0], &searchlist,
+	    link_map_ptr_size, sizeof (uintptr_t),
+	    addr + rd->l_searchlist_offset);
+	want += scalar_iov(&iov[1], &addrs[1], &buf->rl_nscopes,
+	    rd->P->elf64 ? UINT_64_SIZE : UINT_32_SIZE, sizeof (unsigned int),
+	    addr + rd->l_searchlist_offset + link_map_ptr_size);
 
-	if (Pread_scalar(rd->P, &buf->rl_nscopes, rd->P->elf64 ?
-		UINT_64_SIZE : UINT_32_SIZE,
-		sizeof (unsigned int), addr + rd->l_searchlist_offset +
-		(rd->P->elf64 ? L_NEXT_64_SIZE : L_NEXT_32_SIZE)) < 0)
+	if (Preadv(rd->P, iov, addrs, 2) != want)
 		goto fail;
 
 	if (buf->rl_nscopes_alloced < buf->rl_nscopes) {
@@ -566,16 +612,27 @@ rd_get_loadobj_link_map(rd_agent_t *rd, rd_loadobj_t *buf,
 		buf->rl_nscopes_alloced = buf->rl_nscopes;
 	}
 
-	for (i = 0; i < buf->rl_nscopes; i++) {
-		size_t link_map_ptr_size = rd->P->elf64 ? L_NEXT_64_SIZE :
-		    L_NEXT_32_SIZE;
-
-		if (Pread_scalar(rd->P, &buf->rl_scope[i], link_map_ptr_size,
-			sizeof (uintptr_t), searchlist +
-			(i * link_map_ptr_size)) < 0)
+	/*
+	 * Read the scopes a batch at a time.
+	 */
+	for (i = 0; i < buf->rl_nscopes; i += n) {
+		n = buf->rl_nscopes - i;
+		if (n > SCOPE_BATCH)
+			n = SCOPE_BATCH;
+
+		for (j = 0, want = 0; j < n; j++)
+			want += scalar_iov(&iov[j], &addrs[j],
+			    &buf->rl_scope[i + j], link_map_ptr_size,
+			    sizeof (uintptr_t),
+			    searchlist + ((i + j) * link_map_ptr_size));
+
+		if (Preadv(rd->P, iov, addrs, n) != want)
 			goto fail;
 	}
 
+	if (searchlistp)
+		*searchlistp = searchlist;
+
 	*jmp_pad = old_exec_jmp;
 	rd_ldso_consistent_end(rd);
 	return buf;
@@ -889,6 +946,7 @@ rd_ldso_consistent_end(rd_agent_t *rd)
 	if (!rd->rd_event_fun) {
 		Punbkpt(rd->P, rd->r_brk_addr);
 		rd->rd_monitoring = FALSE;
+		rd->lm_gen++;
 	}
 
 	/*
@@ -1101,6 +1159,7 @@ rd_ldso_consistent_reset(rd_agent_t *rd)
 {
 	rd->no_inconsistent = 0;
 	rd->rd_monitoring = FALSE;
+	rd->lm_gen++;
 	rd->stop_on_consistent = 0;
 	rd->lmid_halted = 0;
 	rd->lmid_bkpted = 0;
@@ -1118,6 +1177,7 @@ rd_brk_trap(uintptr_t addr, void *rd_data)
 	int ret = PS_RUN;
 
 	rd->ic_transitioned = 1;
+	rd->lm_gen++;
 
 	/*
 	 * Block if inconsistent state transitions are barred, and we are
@@ -1256,8 +1316,9 @@ rd_start_trap(uintptr_t addr, void *rd_data)
 	 * Reactivate the rd_monitoring breakpoint, if it should be active (e.g.
 	 * if it was active before an exec()).  Silently disable monitoring if
 	 * we cannot reactivate the breakpoint.  Automatically trigger a
-	 * dlopen() callback.
+	 * dlopen() callback.  Any cached link maps are from before the exec().
 	 */
+	rd->lm_gen++;
 	if (rd->rd_monitoring) {
 		if (Pbkpt(rd->P, rd->r_brk_addr, FALSE, rd_brk_trap,
 			NULL, rd) != 0)
@@ -1442,6 +1503,7 @@ rd_free(rd_agent_t *rd)
 	if (rd == rd->P->rap)
 		rd->P->rap = NULL;
 
+	rd_lm_cache_free(rd);
 	free(rd);
 }
 
@@ -1456,6 +1518,7 @@ rd_event_enable(rd_agent_t *rd, rd_event_fun fun, void *data)
 
 	rd->rd_event_fun = fun;
 	rd->rd_event_data = data;
+	rd->lm_gen++;
 
 	if ((rd->rd_monitoring) || (rd->rd_monitor_suppressed))
 		return RD_OK;
@@ -1490,6 +1553,7 @@ rd_event_disable(rd_agent_t *rd)
 
 	rd->rd_event_fun = NULL;
 	rd->rd_event_data = NULL;
+	rd->lm_gen++;
 	if (rd->rd_monitoring && rd->no_inconsistent == 0) {
 		Punbkpt(rd->P, rd->r_brk_addr);
 		rd->rd_monitoring = 0;
@@ -1513,6 +1577,7 @@ rd_event_suppress(rd_agent_t *rd)
 
 	rd->rd_event_fun = NULL;
 	rd->rd_event_data = NULL;
+	rd->lm_gen++;
 	if (rd->rd_monitoring && rd->no_inconsistent == 0) {
 		Punbkpt(rd->P, rd->r_brk_addr);
 		rd->rd_monitoring = 0;
@@ -1522,6 +1587,332 @@ rd_event_suppress(rd_agent_t *rd)
 	_dprintf("%i: disabled rtld activity monitoring.\n", rd->P->pid);
 }
 
+/*
+ * Free the cached link map chain for one lmid.
+ */
+static void
+rd_lm_cache_clear(rd_lm_cache_t *lmc)
+{
+	size_t i;
+
+	for (i = 0; i < lmc->lmc_count; i++)
+		free(lmc->lmc_nodes[i].lmn_scope);
+	for (i = 0; i < lmc->lmc_nold; i++)
+		free(lmc->lmc_old[i].lmn_scope);
+
+	free(lmc->lmc_old);
+	lmc->lmc_old = NULL;
+	lmc->lmc_nold = 0;
+	lmc->lmc_count = 0;
+}
+
+/*
+ * Free all cached link map chains.
+ */
+static void
+rd_lm_cache_free(rd_agent_t *rd)
+{
+	size_t i;
+
+	for (i = 0; i < rd->lm_ncache; i++) {
+		rd_lm_cache_clear(&rd->lm_cache[i]);
+		free(rd->lm_cache[i].lmc_nodes);
+	}
+	free(rd->lm_cache);
+	rd->lm_cache = NULL;
+	rd->lm_ncache = 0;
+	rd->lm_cache_valid = 0;
+}
+
+/*
+ * Make sure there is a link map cache for each of NNS lmids, and none for any
+ * lmids beyond that.
+ */
+static int
+rd_lm_cache_resize(rd_agent_t *rd, size_t nns)
+{
+	rd_lm_cache_t *lm_cache;
+	size_t i;
+
+	for (i = nns; i < rd->lm_ncache; i++) {
+		rd_lm_cache_clear(&rd->lm_cache[i]);
+		free(rd->lm_cache[i].lmc_nodes);
+	}
+
+	if (nns > rd->lm_ncache) {
+		lm_cache = realloc(rd->lm_cache, nns * sizeof(rd_lm_cache_t));
+		if (lm_cache == NULL)
+			return -1;
+
+		memset(&lm_cache[rd->lm_ncache], 0,
+		    (nns - rd->lm_ncache) * sizeof(rd_lm_cache_t));
+		rd->lm_cache = lm_cache;
+	}
+	rd->lm_ncache = nns;
+
+	return 0;
+}
+
+/*
+ * Re-read the link map fields and scopes arrays of all the cached nodes in LMC
+ * in as few reads as possible, and set lmn_valid on those that are unchanged
+ * (updating their l_next, which is all that a dlopen() or dlclose() of some
+ * other object can change).  Returns -1 if the nodes cannot be read.
+ */
+static int
+rd_lm_cache_validate(rd_agent_t *rd, rd_lm_cache_t *lmc)
+{
+	size_t ptr_size = rd->P->elf64 ? L_NEXT_64_SIZE : L_NEXT_32_SIZE;
+	size_t n = lmc->lmc_count;
+	size_t i, j, k, off, nscopes = 0, want = 0;
+	rd_lm_node_t *fresh;
+	struct iovec *iov;
+	uintptr_t *addrs;
+	char *scopes = NULL;
+	int ret = -1;
+
+	fresh = calloc(n, sizeof(rd_lm_node_t));
+	iov = malloc(n * 6 * sizeof(struct iovec));
+	addrs = malloc(n * 6 * sizeof(uintptr_t));
+	if (fresh == NULL || iov == NULL || addrs == NULL)
+		goto out;
+
+	for (i = 0, j = 0; i < n; i++, j += 6) {
+		struct link_map *map = &fresh[i].lmn_map;
+		uintptr_t addr = lmc->lmc_nodes[i].lmn_addr;
+		uintptr_t slist = addr + rd->l_searchlist_offset;
+
+		want += scalar_iov_child(rd->P, &iov[j], &addrs[j],
+		    &map->l_addr, addr, link_map_offsets, link_map, l_addr);
+		want += scalar_iov_child(rd->P, &iov[j + 1], &addrs[j + 1],
+		    &map->l_name, addr, link_map_offsets, link_map, l_name);
+		want += scalar_iov_child(rd->P, &iov[j + 2], &addrs[j + 2],
+		    &map->l_ld, addr, link_map_offsets, link_map, l_ld);
+		want += scalar_iov_child(rd->P, &iov[j + 3], &addrs[j + 3],
+		    &map->l_next, addr, link_map_offsets, link_map, l_next);
+		want += scalar_iov(&iov[j + 4], &addrs[j + 4],
+		    &fresh[i].lmn_searchlist, ptr_size, sizeof (uintptr_t),
+		    slist);
+		want += scalar_iov(&iov[j + 5], &addrs[j + 5],
+		    &fresh[i].lmn_nscopes,
+		    rd->P->elf64 ? UINT_64_SIZE : UINT_32_SIZE,
+		    sizeof (unsigned int), slist + ptr_size);
+	}
+
+	if (Preadv(rd->P, iov, addrs, n * 6) != want)
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		rd_lm_node_t *node = &lmc->lmc_nodes[i];
+
+		node->lmn_valid =
+		    fresh[i].lmn_map.l_addr == node->lmn_map.l_addr &&
+		    fresh[i].lmn_map.l_name == node->lmn_map.l_name &&
+		    fresh[i].lmn_map.l_ld == node->lmn_map.l_ld &&
+		    fresh[i].lmn_searchlist == node->lmn_searchlist &&
+		    fresh[i].lmn_nscopes == node->lmn_nscopes;
+
+		if (node->lmn_valid)
+			nscopes += node->lmn_nscopes;
+	}
+
+	/*
+	 * The scopes arrays of the nodes that still look the same are read
+	 * next, each in one piece: their contents can change without anything
+	 * else in the link map changing (e.g. the global scope, on a dlopen()
+	 * with RTLD_GLOBAL).
+	 */
+	if (nscopes > 0 && (scopes = malloc(nscopes * ptr_size)) == NULL)
+		goto out;
+
+	for (i = 0, j = 0, want = 0; i < n; i++) {
+		rd_lm_node_t *node = &lmc->lmc_nodes[i];
+
+		if (!node->lmn_valid || node->lmn_nscopes == 0)
+			continue;
+
+		iov[j].iov_base = scopes + want;
+		iov[j].iov_len = node->lmn_nscopes * ptr_size;
+		addrs[j] = node->lmn_searchlist;
+		want += iov[j].iov_len;
+		j++;
+	}
+
+	if (j > 0 && Preadv(rd->P, iov, addrs, j) != want)
+		goto out;
+
+	for (i = 0, off = 0; i < n; i++) {
+		rd_lm_node_t *node = &lmc->lmc_nodes[i];
+
+		if (!node->lmn_valid)
+			continue;
+
+		for (k = 0; k < node->lmn_nscopes; k++, off += ptr_size) {
+			uintptr_t scope;
+
+			if (ptr_size == sizeof (uint64_t))
+				scope = *(uint64_t *) (scopes + off);
+			else
+				scope = *(uint32_t *) (scopes + off);
+
+			if (scope != node->lmn_scope[k])
+				node->lmn_valid = 0;
+		}
+
+		if (node->lmn_valid)
+			node->lmn_map.l_next = fresh[i].lmn_map.l_next;
+	}
+	ret = 0;
+
+out:
+	free(scopes);
+	free(addrs);
+	free(iov);
+	free(fresh);
+	return ret;
+}
+
+/*
+ * Bring the cached link map chain for LMID up to date, given the address of its
+ * first link map and (for nonzero lmids) the number of objects loaded into it.
+ * Unchanged nodes are reused: only new or changed ones are read in full.  On
+ * error, the cache for this lmid is emptied.
+ */
+static int
+rd_lm_cache_refresh(rd_agent_t *rd, Lmid_t lmid, uintptr_t loadobj,
+    unsigned int nloaded)
+{
+	rd_lm_cache_t *lmc = &rd->lm_cache[lmid];
+	size_t i, j = 0;
+
+	if (lmc->lmc_count > 0 && rd_lm_cache_validate(rd, lmc) < 0) {
+		_dprintf("%i: cannot validate cached link maps for LMID %li\n",
+		    rd->P->pid, lmid);
+		rd_lm_cache_clear(lmc);
+	}
+
+	/*
+	 * Build the new chain from the nodes of the old one, which is kept in
+	 * lmc_old meanwhile so that an exec() spotted halfway does not leak it.
+	 */
+	lmc->lmc_old = lmc->lmc_nodes;
+	lmc->lmc_nold = lmc->lmc_count;
+	lmc->lmc_nodes = NULL;
+	lmc->lmc_count = 0;
+	lmc->lmc_size = 0;
+
+	while ((loadobj != 0) &&
+	    (lmid == 0 || (lmid > 0 && lmc->lmc_count < nloaded))) {
+		rd_lm_node_t *node;
+		size_t k = j;
+
+		if (lmc->lmc_count == lmc->lmc_size) {
+			size_t size = lmc->lmc_size ? lmc->lmc_size * 2 : 16;
+			rd_lm_node_t *nodes;
+
+			nodes = realloc(lmc->lmc_nodes,
+			    size * sizeof(rd_lm_node_t));
+			if (nodes == NULL) {
+				_dprintf("Out of memory allocating link map "
+				    "cache of %lu entries\n", size);
+				goto err;
+			}
+			lmc->lmc_nodes = nodes;
+			lmc->lmc_size = size;
+		}
+		node = &lmc->lmc_nodes[lmc->lmc_count];
+
+		/*
+		 * Objects are mostly added at the end of the chain and removed
+		 * from anywhere in it, so look for this one in the old chain
+		 * from just after the last one found.
+		 */
+		while (k < lmc->lmc_nold && lmc->lmc_old[k].lmn_addr != loadobj)
+			k++;
+
+		if (k < lmc->lmc_nold)
+			j = k + 1;
+
+		if (k < lmc->lmc_nold && lmc->lmc_old[k].lmn_valid) {
+			*node = lmc->lmc_old[k];
+			lmc->lmc_old[k].lmn_scope = NULL;
+		} else {
+			rd_loadobj_t obj = {0};
+
+			memset(node, 0, sizeof(rd_lm_node_t));
+			node->lmn_addr = loadobj;
+
+			if (rd_get_link_map(rd, &node->lmn_map, loadobj) == NULL ||
+			    rd_get_loadobj_link_map(rd, &obj, &node->lmn_map,
+				loadobj, &node->lmn_searchlist) == NULL) {
+				free(obj.rl_scope);
+				goto err;
+			}
+			node->lmn_nscopes = obj.rl_nscopes;
+			node->lmn_scope = obj.rl_scope;
+		}
+
+		lmc->lmc_count++;
+		loadobj = (uintptr_t) node->lmn_map.l_next;
+	}
+
+	for (i = 0; i < lmc->lmc_nold; i++)
+		free(lmc->lmc_old[i].lmn_scope);
+	free(lmc->lmc_old);
+	lmc->lmc_old = NULL;
+	lmc->lmc_nold = 0;
+
+	return 0;
+
+err:
+	rd_lm_cache_clear(lmc);
+	return -1;
+}
+
+/*
+ * Call FUN for every object in the cached link map chain for LMID, numbering
+ * them from *NUM onwards.  Returns -1 if FUN asks for iteration to stop.
+ */
+static int
+rd_lm_cache_iter(rd_agent_t *rd, Lmid_t lmid, rl_iter_f *fun, void *state,
+    size_t *num)
+{
+	rd_lm_cache_t *lmc = &rd->lm_cache[lmid];
+	rd_loadobj_t obj = {0};
+	size_t i;
+
+	for (i = 0; i < lmc->lmc_count; i++) {
+		rd_lm_node_t *node = &lmc->lmc_nodes[i];
+
+		obj.rl_diff_addr = node->lmn_map.l_addr;
+		obj.rl_nameaddr = (uintptr_t) node->lmn_map.l_name;
+		obj.rl_dyn = (uintptr_t) node->lmn_map.l_ld;
+		obj.rl_lmident = lmid;
+
+		/*
+		 * The first library in this lmid's searchlist is used as the
+		 * default for all those libraries that do not have searchlists
+		 * already.
+		 */
+		if (node->lmn_nscopes == 0) {
+			obj.rl_scope = lmc->lmc_nodes[0].lmn_scope;
+			obj.rl_nscopes = lmc->lmc_nodes[0].lmn_nscopes;
+			obj.rl_default_scope = 1;
+		} else {
+			obj.rl_scope = node->lmn_scope;
+			obj.rl_nscopes = node->lmn_nscopes;
+			obj.rl_default_scope = 0;
+		}
+		obj.rl_nscopes_alloced = obj.rl_nscopes;
+
+		if (fun(&obj, *num, state) == 0)
+			return -1;
+		(*num)++;
+	}
+
+	return 0;
+}
+
 /*
  * Enable iteration over the link maps.
  *
@@ -1537,11 +1928,9 @@ rd_loadobj_iter(rd_agent_t *rd, rl_iter_f *fun, void *state)
 	size_t nns;
 	int found_any = FALSE;
 	size_t num = 0;
+	unsigned long gen;
 	jmp_buf * volatile old_exec_jmp;
 	jmp_buf **jmp_pad, this_exec_jmp;
-	rd_loadobj_t obj = {0};
-	uintptr_t *primary_scope = NULL;
-	uintptr_t primary_nscopes = 0; /* quash a warning */
 
 	if (rd->released)
 		return RD_ERR;
@@ -1573,6 +1962,33 @@ rd_loadobj_iter(rd_agent_t *rd, rl_iter_f *fun, void *state)
 		return RD_NOMAPS;
 	}
 
+	/*
+	 * If r_brk has been continuously monitored since the link maps were
+	 * cached and has not been hit since, no link map can have changed:
+	 * replay them from the cache without stopping the process at all.
+	 */
+	if (rd->lm_cache_valid && rd->lm_cache_gen == rd->lm_gen &&
+	    rd->rd_monitoring && rd->rd_event_fun) {
+		*jmp_pad = old_exec_jmp;
+
+		_dprintf("%i: iterating over cached link maps in %li "
+		    "namespaces.\n", rd->P->pid, rd->lm_ncache);
+
+		for (lmid = 0; lmid < rd->lm_ncache; lmid++)
+			if (rd_lm_cache_iter(rd, lmid, fun, state, &num) < 0)
+				return RD_ERR;
+
+		return num > 0 ? RD_OK : RD_NOMAPS;
+	}
+
+	/*
+	 * Note the generation before waiting for consistency: a transition
+	 * spotted while waiting leaves the cache stale, which forces a
+	 * revalidation next time.
+	 */
+	gen = rd->lm_gen;
+	rd->lm_cache_valid = 0;
+
 	if (rd_ldso_consistent_begin(rd) != 0) {
 		*jmp_pad = old_exec_jmp;
 
@@ -1586,11 +2002,13 @@ rd_loadobj_iter(rd_agent_t *rd, rl_iter_f *fun, void *state)
 	_dprintf("%i: iterating over link maps in %li namespaces.\n",
 	    rd->P->pid, nns);
 
+	if (rd_lm_cache_resize(rd, nns) < 0)
+		goto err;
+
 	for (lmid = 0; lmid < nns; lmid++) {
 
 		uintptr_t loadobj;
 		unsigned int nloaded = 0;
-		unsigned int n = 0;
 
 		if (!nonzero_consistent && nns > 1) {
 			nonzero_consistent = TRUE;
@@ -1607,8 +2025,9 @@ rd_loadobj_iter(rd_agent_t *rd, rl_iter_f *fun, void *state)
 		Pwait(rd->P, FALSE);
 
 		/*
-		 * Read this link map out of the child.  If link map zero cannot
-		 * be read, the link maps are not yet ready.
+		 * Read this link map out of the child, reusing whatever parts
+		 * of it are unchanged since last time.  If link map zero
+		 * cannot be read, the link maps are not yet ready.
 		 */
 
 		loadobj = first_link_map(rd, lmid);
@@ -1627,82 +2046,18 @@ rd_loadobj_iter(rd_agent_t *rd, rl_iter_f *fun, void *state)
 			return RD_NOMAPS;
 		}
 
-		while ((loadobj != 0) &&
-		    (lmid == 0 || (lmid > 0 && n < nloaded))) {
-			struct link_map map;
-			uintptr_t *real_scope = NULL;
-			unsigned int real_nscopes;
+		if (rd_lm_cache_refresh(rd, lmid, loadobj, nloaded) < 0)
+			goto err;
 
+		if (rd->lm_cache[lmid].lmc_count > 0)
 			found_any = TRUE;
 
-			if (rd_get_link_map(rd, &map, loadobj) == NULL)
-			    goto err;
-
-			obj.rl_lmident = lmid;
-			if (rd_get_loadobj_link_map(rd, &obj, &map,
-				loadobj) == NULL)
-				goto err;
-
-			/*
-			 * If this is the first library in this lmid, its
-			 * searchlist is used as the default for all those
-			 * libraries that do not have searchlists already.
-			 */
-			if (!primary_scope) {
-				size_t nscopes_size = obj.rl_nscopes *
-				    sizeof(uintptr_t);
-
-				primary_scope = malloc(nscopes_size);
-				primary_nscopes = obj.rl_nscopes;
-
-				if (!primary_scope) {
-					fprintf(stderr, "Out of memory allocating "
-					    "primary scopes list of length %lu "
-					    "bytes\n", nscopes_size);
-					goto err;
-				}
-				memcpy(primary_scope, obj.rl_scope,
-				    nscopes_size);
-			}
-
-			if (obj.rl_nscopes == 0) {
-				real_scope = obj.rl_scope;
-				real_nscopes = obj.rl_nscopes;
-				obj.rl_scope = primary_scope;
-				obj.rl_nscopes = primary_nscopes;
-				obj.rl_default_scope = 1;
-			} else
-				obj.rl_default_scope = 0;
-
-			if (fun(&obj, num, state) == 0) {
-				if (real_scope)
-					obj.rl_scope = real_scope;
-				goto err;
-			}
-
-			if (real_scope) {
-				obj.rl_scope = real_scope;
-				obj.rl_nscopes = real_nscopes;
-			}
-
-			num++;
-			n++;
-
-			loadobj = (uintptr_t) map.l_next;
-		}
-
-		/*
-		 * The assignments to NULL below are crucial -- we could spot an
-		 * exec() after this point, and longjmp() into spotted_exec:,
-		 * which free()s them again.
-		 */
-
-		free(primary_scope);
-		primary_scope = NULL;
+		if (rd_lm_cache_iter(rd, lmid, fun, state, &num) < 0)
+			goto err;
 	}
 
-	free(obj.rl_scope);
-	obj.rl_scope = NULL;
+	rd->lm_cache_gen = gen;
+	rd->lm_cache_valid = 1;
 
 	if (nonzero_consistent)
 		rd_ldso_nonzero_lmid_consistent_end(rd);
@@ -1722,11 +2077,6 @@ err:
 		rd_ldso_nonzero_lmid_consistent_end(rd);
 	rd_ldso_consistent_end(rd);
 
-	free(primary_scope);
-	free(obj.rl_scope);
-	primary_scope = NULL;
-	obj.rl_scope = NULL;
-
 	/*
 	 * It is possible we have just died or exec()ed in the middle of
 	 * iteration.  Pwait() to pick that up.
@@ -1750,8 +2100,7 @@ err:
  spotted_exec:
 	_dprintf("%i: spotted exec() in rd_loadobj_iter()\n", rd->P->pid);
 	rd_ldso_consistent_reset(rd);
-	free(primary_scope);
-	free(obj.rl_scope);
+	rd_lm_cache_free(rd);
 	if (old_exec_jmp)
 		longjmp(*old_exec_jmp, 1);
 
@@ -1786,7 +2135,7 @@ rd_get_scope(rd_agent_t *rd, rd_loadobj_t *buf, const rd_loadobj_t *obj,
 		return NULL;
 
 	if (rd_get_loadobj_link_map(rd, buf, &map,
-		obj->rl_scope[scope]) == NULL)
+		obj->rl_scope[scope], NULL) == NULL)
 		return NULL;
 
 	buf->rl_lmident = obj->rl_lmident;
@@ -12,6 +12,7 @@
 #define DO_NOT_POISON_PTRACE 1
 
 #include <sys/ptrace.h>
+#include <errno.h>
 #include <stdarg.h>
 #include "Pcontrol.h"
 
@@ -50,6 +51,40 @@ wrapped_ptrace(struct ps_prochandle *P, enum __ptrace_request request, pid_t pid
 	return P->ptrace_wrap(request, P->wrap_arg, pid, addr, data);
 }
 
+/*
+ * Default ptrace() batch wrapper: one request at a time, via the ptrace()
+ * wrapper.
+ */
+static long
+default_ptrace_batch_wrapper(ptrace_req_t *reqs, void *arg, size_t n)
+{
+	struct ps_prochandle *P = arg;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		errno = 0;
+		reqs[i].pr_ret = P->ptrace_wrap(reqs[i].pr_request, P->wrap_arg,
+		    reqs[i].pr_pid, reqs[i].pr_addr, reqs[i].pr_data);
+		reqs[i].pr_errno = errno;
+		if (errno != 0)
+			return i + 1;
+	}
+
+	return n;
+}
+
+/*
+ * Issue a batch of ptrace() requests using the batch wrapper.
+ */
+long
+wrapped_ptrace_batch(struct ps_prochandle *P, ptrace_req_t *reqs, size_t n)
+{
+	if (P->ptrace_batch_wrap == default_ptrace_batch_wrapper)
+		return default_ptrace_batch_wrapper(reqs, P, n);
+
+	return P->ptrace_batch_wrap(reqs, P->wrap_arg, n);
+}
+
 /*
  * Default (degenerate) Pwait() wrapper.
  */
@@ -80,6 +115,18 @@ Pset_ptrace_wrapper(struct ps_prochandle *P, ptrace_fun *wrapper)
 		P->ptrace_wrap = default_ptrace_wrapper;
 }
 
+/*
+ * Set the ptrace() batch wrapper.
+ */
+void
+Pset_ptrace_batch_wrapper(struct ps_prochandle *P, ptrace_batch_fun *wrapper)
+{
+	if (wrapper != NULL)
+		P->ptrace_batch_wrap = wrapper;
+	else
+		P->ptrace_batch_wrap = default_ptrace_batch_wrapper;
+}
+
 /*
  * Set the Pwait() wrapper.
  */
@@ -0,0 +1 @@
+Lookups consistent.
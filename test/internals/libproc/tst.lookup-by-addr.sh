@@ -0,0 +1,22 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# This script tests that address lookups in a grabbed process resolve to a
+# containing function everywhere inside every function, and reports (on
+# stderr) how long a lookup takes.
+#
+
+test/triggers/libproc-sleeper &
+SLEEPER=$!
+disown %+
+while [[ $(readlink /proc/$SLEEPER/exe) =~ bash ]]; do :; done
+test/triggers/libproc-lookup-by-addr $SLEEPER
+EXIT=$?
+kill $SLEEPER
+exit $EXIT
@@ -0,0 +1,159 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Check that every address inside every function in the executable and libc of
+ * a grabbed process symbolizes to a function containing it, then time a large
+ * number of random address lookups.  The timing goes to stderr, so it does not
+ * affect the test results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <elf.h>
+
+#include <libproc.h>
+
+#define	NLOOKUPS	1000000
+
+typedef struct func_range {
+	uintptr_t fr_start;
+	uintptr_t fr_size;
+} func_range_t;
+
+static func_range_t *funcs;
+static size_t nfuncs;
+static size_t funcs_sz;
+
+static int
+note_func(void *cd, const GElf_Sym *sym, const char *name)
+{
+	if (sym->st_size == 0)
+		return 0;
+
+	if (nfuncs == funcs_sz) {
+		func_range_t *new_funcs;
+
+		funcs_sz = funcs_sz == 0 ? 1024 : funcs_sz * 2;
+		new_funcs = realloc(funcs, funcs_sz * sizeof(func_range_t));
+		if (new_funcs == NULL) {
+			fprintf(stderr, "Out of memory.\n");
+			exit(1);
+		}
+		funcs = new_funcs;
+	}
+
+	funcs[nfuncs].fr_start = sym->st_value;
+	funcs[nfuncs].fr_size = sym->st_size;
+	nfuncs++;
+
+	return 0;
+}
+
+static int
+check_lookup(struct ps_prochandle *P, uintptr_t addr)
+{
+	GElf_Sym sym;
+	char name[256];
+
+	if (Plookup_by_addr(P, addr, name, sizeof(name), &sym) < 0) {
+		fprintf(stderr, "No symbol found for %lx\n", addr);
+		return -1;
+	}
+
+	if (addr < sym.st_value || addr >= sym.st_value + sym.st_size) {
+		fprintf(stderr, "%lx symbolized to %s (%lx, size %lx), which "
+		    "does not contain it\n", addr, name, sym.st_value,
+		    sym.st_size);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct ps_prochandle *P;
+	struct timespec start, end;
+	GElf_Sym sym;
+	char name[256];
+	size_t i, errors = 0;
+	long pid;
+	int err;
+	double ns;
+
+	if (argc < 2) {
+		fprintf(stderr, "Syntax: libproc-lookup-by-addr PID\n");
+		exit(1);
+	}
+
+	pid = strtol(argv[1], NULL, 10);
+
+	P = Pgrab(pid, 0, 0, NULL, &err);
+	if (!P) {
+		fprintf(stderr, "Cannot grab %li: %s\n", pid, strerror(err));
+		exit(1);
+	}
+
+	Ptrace_set_detached(P, 1);
+	Puntrace(P, 0);
+
+	Psymbol_iter_by_addr(P, PR_OBJ_EXEC, PR_SYMTAB, BIND_ANY | TYPE_FUNC,
+	    note_func, NULL);
+	Psymbol_iter_by_addr(P, "libc.so.6", PR_SYMTAB, BIND_ANY | TYPE_FUNC,
+	    note_func, NULL);
+	Psymbol_iter_by_addr(P, "libc.so.6", PR_DYNSYM, BIND_ANY | TYPE_FUNC,
+	    note_func, NULL);
+
+	if (nfuncs == 0) {
+		fprintf(stderr, "No functions found.\n");
+		exit(1);
+	}
+
+	/*
+	 * The first, last and middle byte of every function must all resolve
+	 * to some function containing them.
+	 */
+	for (i = 0; i < nfuncs; i++) {
+		func_range_t *fr = &funcs[i];
+
+		if (check_lookup(P, fr->fr_start) < 0 ||
+		    check_lookup(P, fr->fr_start + fr->fr_size / 2) < 0 ||
+		    check_lookup(P, fr->fr_start + fr->fr_size - 1) < 0)
+			errors++;
+	}
+
+	/*
+	 * Now time lookups of random addresses within random functions.
+	 */
+	srand(1);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < NLOOKUPS; i++) {
+		func_range_t *fr = &funcs[rand() % nfuncs];
+
+		Plookup_by_addr(P, fr->fr_start + rand() % fr->fr_size,
+		    name, sizeof(name), &sym);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	fprintf(stderr, "%zi functions, %.1f ns per lookup\n", nfuncs,
+	    ns / NLOOKUPS);
+
+	if (errors == 0)
+		printf("Lookups consistent.\n");
+	else
+		printf("%zi functions had inconsistent lookups.\n", errors);
+
+	Prelease(P, PS_RELEASE_NORMAL);
+	Pfree(P);
+
+	return errors != 0;
+}
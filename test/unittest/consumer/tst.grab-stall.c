@@ -0,0 +1,208 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Grab a process that cannot stop for several seconds, because it is waiting
+ * in vfork() for its child, and check that while the grab waits for it to stop,
+ * its control thread still notices the death of another process it serves.
+ */
+
+/* @@timeout: 60 */
+/* @@link: -ldtrace -lpthread */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <dtrace.h>
+
+/*
+ * Processes are spread over the (by default four) control threads least-loaded
+ * first, so the process grabbed after NPROCS of them shares a thread with the
+ * first.
+ */
+#define	NPROCS		4
+#define	STALL_SECS	5
+
+static pid_t pids[NPROCS];
+static int pollfd;
+static hrtime_t notified;
+
+static hrtime_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (hrtime_t)ts.tv_sec * NANOSEC + ts.tv_nsec;
+}
+
+/*
+ * Once the grab is under way, kill the first process, and note when its death
+ * is notified.
+ */
+static void *
+killer(void *arg)
+{
+	struct pollfd pfd;
+
+	usleep(500000);
+	kill(pids[0], SIGKILL);
+
+	pfd.fd = pollfd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 2 * STALL_SECS * 1000) < 0) {
+		if (errno != EINTR)
+			return NULL;
+	}
+
+	if (pfd.revents & POLLIN)
+		notified = now_ns();
+
+	return NULL;
+}
+
+/*
+ * Fork a process that sits in vfork() for STALL_SECS seconds.  Its child
+ * shares its memory and stack, so makes the raw syscall and nothing else.
+ */
+static pid_t
+staller(void)
+{
+	struct timespec ts = { STALL_SECS, 0 };
+	int fds[2];
+	pid_t pid;
+	char c;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	if ((pid = fork()) == 0) {
+		close(fds[0]);
+		write(fds[1], "", 1);
+		close(fds[1]);
+		if (vfork() == 0) {
+			syscall(SYS_nanosleep, &ts, NULL);
+			_exit(0);
+		}
+		for (;;)
+			pause();
+	}
+
+	close(fds[1]);
+	if (pid > 0)
+		read(fds[0], &c, 1);
+	close(fds[0]);
+
+	/*
+	 * Give it time to get into vfork().
+	 */
+	usleep(200000);
+
+	return pid;
+}
+
+int
+main(int argc, char **argv)
+{
+	dtrace_hdl_t *dtp;
+	struct dtrace_proc *procs[NPROCS + 1] = { NULL };
+	pthread_t tid;
+	hrtime_t start, grabbed;
+	pid_t stalled;
+	int err, i, ret = 1;
+
+	for (i = 0; i < NPROCS; i++) {
+		if ((pids[i] = fork()) == 0) {
+			for (;;)
+				pause();
+		}
+	}
+
+	if ((stalled = staller()) < 0) {
+		perror("fork");
+		goto out;
+	}
+
+	if ((dtp = dtrace_open(DTRACE_VERSION, 0, &err)) == NULL) {
+		printf("ERROR: dtrace_open: %s\n", dtrace_errmsg(NULL, err));
+		goto out;
+	}
+
+	if ((pollfd = dtrace_pollfd(dtp)) < 0) {
+		printf("ERROR: dtrace_pollfd: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		goto close;
+	}
+
+	for (i = 0; i < NPROCS; i++) {
+		if ((procs[i] = dtrace_proc_grab_pid(dtp, pids[i],
+			    DTRACE_PROC_WAITING)) == NULL) {
+			printf("ERROR: cannot grab %i: %s\n", pids[i],
+			    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+			goto close;
+		}
+	}
+
+	if (pthread_create(&tid, NULL, killer, NULL) != 0) {
+		perror("pthread_create");
+		goto close;
+	}
+
+	start = now_ns();
+	procs[NPROCS] = dtrace_proc_grab_pid(dtp, stalled, DTRACE_PROC_WAITING);
+	grabbed = now_ns();
+	pthread_join(tid, NULL);
+
+	if (procs[NPROCS] == NULL) {
+		printf("ERROR: cannot grab %i: %s\n", stalled,
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		goto close;
+	}
+
+	if (grabbed - start < (hrtime_t)(STALL_SECS - 2) * NANOSEC) {
+		printf("ERROR: grab of %i took only %lli ms: not stalled\n",
+		    stalled, (long long)(grabbed - start) / MICROSEC);
+		goto close;
+	}
+
+	if (notified == 0) {
+		printf("ERROR: death of %i never notified\n", pids[0]);
+		goto close;
+	}
+
+	if (notified > grabbed) {
+		printf("ERROR: death of %i only notified %lli ms after the "
+		    "grab of %i\n", pids[0],
+		    (long long)(notified - grabbed) / MICROSEC, stalled);
+		goto close;
+	}
+
+	ret = 0;
+
+close:
+	for (i = 0; i <= NPROCS; i++) {
+		if (procs[i] != NULL)
+			dtrace_proc_release(dtp, procs[i]);
+	}
+	dtrace_close(dtp);
+out:
+	for (i = 0; i < NPROCS; i++)
+		kill(pids[i], SIGKILL);
+	if (stalled > 0)
+		kill(stalled, SIGKILL);
+	while (wait(NULL) > 0 || errno == EINTR)
+		;
+
+	return ret;
+}
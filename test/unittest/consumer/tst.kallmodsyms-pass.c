@@ -0,0 +1,165 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Look up, all at once, addresses in vmlinux on either side of a symbol in a
+ * built-in module, as a stack through the two might contain, and check that
+ * they resolve correctly and that /proc/kallmodsyms is read at most once to
+ * build the symbol tables they need: vmlinux coming up twice in the batch
+ * must not force a rescan.
+ */
+
+/* @@timeout: 60 */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dtrace.h>
+
+typedef struct ksym {
+	unsigned long long addr;
+	char name[256];
+	char mod[256];
+} ksym_t;
+
+/*
+ * Find a text symbol in a built-in module with vmlinux text symbols just below
+ * and above it.  Built-in modules are listed before the first loadable
+ * module's symbols; vmlinux symbols have no module name.
+ */
+static int
+find_syms(ksym_t *syms)
+{
+	char *line = NULL;
+	size_t line_n = 0;
+	ksym_t prev = { 0 }, sym;
+	unsigned long long size;
+	int found = 0, have_mod = 0;
+	FILE *fd;
+	char type;
+
+	if ((fd = fopen("/proc/kallmodsyms", "r")) == NULL)
+		return 0;
+
+	while (!found && getline(&line, &line_n, fd) > 0) {
+		strcpy(sym.mod, "vmlinux]");
+		if (sscanf(line, "%llx %llx %c %255s [%255s", &sym.addr, &size,
+			&type, sym.name, sym.mod) < 4)
+			break;
+		if (type != 't' && type != 'T')
+			continue;
+		sym.mod[strlen(sym.mod) - 1] = '\0';
+
+		if (strcmp(sym.mod, "vmlinux") != 0) {
+			if (prev.addr != 0 && sym.addr > prev.addr &&
+			    !have_mod) {
+				syms[1] = sym;
+				have_mod = 1;
+			}
+			continue;
+		}
+
+		if (have_mod && sym.addr > syms[1].addr) {
+			syms[0] = prev;
+			syms[2] = sym;
+			found = 1;
+		}
+		have_mod = 0;
+		prev = sym;
+	}
+
+	free(line);
+	fclose(fd);
+	return found;
+}
+
+int
+main(int argc, char **argv)
+{
+	dtrace_hdl_t *dtp;
+	ksym_t syms[3];
+	GElf_Addr addrs[3];
+	GElf_Sym elfsyms[3];
+	dtrace_syminfo_t sips[3];
+	FILE *log;
+	char *line = NULL;
+	size_t line_n = 0;
+	int err, i, stderr_fd, passes = 0, rescans = 0, ret = 1;
+
+	if (!find_syms(syms)) {
+		printf("no built-in module text between vmlinux text\n");
+		return 0;
+	}
+
+	for (i = 0; i < 3; i++)
+		addrs[i] = syms[i].addr;
+
+	if ((dtp = dtrace_open(DTRACE_VERSION, 0, &err)) == NULL) {
+		printf("ERROR: dtrace_open: %s\n", dtrace_errmsg(NULL, err));
+		return 1;
+	}
+
+	/*
+	 * Capture the debugging output of the lookup alone.
+	 */
+	if ((log = tmpfile()) == NULL) {
+		perror("tmpfile");
+		goto out;
+	}
+	fflush(stderr);
+	stderr_fd = dup(2);
+	dup2(fileno(log), 2);
+	_dtrace_debug = 1;
+
+	err = dtrace_lookup_by_addrs(dtp, addrs, 3, elfsyms, sips);
+
+	_dtrace_debug = 0;
+	fflush(stderr);
+	dup2(stderr_fd, 2);
+	close(stderr_fd);
+
+	if (err != 3) {
+		printf("ERROR: %i of 3 addresses resolved\n", err);
+		goto out;
+	}
+
+	/*
+	 * Aliases may resolve to another name at the same address.
+	 */
+	for (i = 0; i < 3; i++) {
+		if (strcmp(sips[i].dts_object, syms[i].mod) != 0 ||
+		    elfsyms[i].st_value != syms[i].addr) {
+			printf("ERROR: %llx resolved to %s`%s, not %s`%s\n",
+			    syms[i].addr, sips[i].dts_object, sips[i].dts_name,
+			    syms[i].mod, syms[i].name);
+			goto out;
+		}
+	}
+
+	rewind(log);
+	while (getline(&line, &line_n, log) > 0) {
+		if (strstr(line, "reading /proc/kallmodsyms for") != NULL)
+			passes++;
+		if (strstr(line, "/proc/kallmodsyms changed") != NULL)
+			rescans++;
+	}
+	free(line);
+
+	if (passes > 1 || rescans > 0) {
+		printf("ERROR: %i passes and %i rescans of /proc/kallmodsyms\n",
+		    passes, rescans);
+		goto out;
+	}
+
+	ret = 0;
+out:
+	if (log != NULL)
+		fclose(log);
+	dtrace_close(dtp);
+	return ret;
+}
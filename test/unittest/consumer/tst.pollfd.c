@@ -0,0 +1,145 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Drive a tracing session from a poll() loop on dtrace_pollfd(), never calling
+ * dtrace_sleep(), and check that the death of a created process is notified
+ * and that the program runs to completion.
+ */
+
+/* @@timeout: 30 */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dtrace.h>
+
+static int dead;
+
+static void
+prochandler(pid_t pid, const char *msg, void *arg)
+{
+	if (pid < 0)
+		dead++;
+}
+
+static int
+chew(const dtrace_probedata_t *data, void *arg)
+{
+	return DTRACE_CONSUME_THIS;
+}
+
+static int
+chewrec(const dtrace_probedata_t *data, const dtrace_recdesc_t *rec,
+    void *arg)
+{
+	return rec == NULL ? DTRACE_CONSUME_NEXT : DTRACE_CONSUME_THIS;
+}
+
+int
+main(int argc, char **argv)
+{
+	char *const true_argv[] = { "/bin/true", NULL };
+	dtrace_hdl_t *dtp;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	struct dtrace_proc *proc;
+	struct pollfd pfd;
+	int err, done = 0, wakeups = 0;
+
+	if ((dtp = dtrace_open(DTRACE_VERSION, 0, &err)) == NULL) {
+		printf("ERROR: dtrace_open: %s\n", dtrace_errmsg(NULL, err));
+		return 1;
+	}
+
+	(void) dtrace_setopt(dtp, "bufsize", "64k");
+	(void) dtrace_setopt(dtp, "aggsize", "64k");
+	(void) dtrace_setopt(dtp, "switchrate", "50ms");
+
+	if (dtrace_handle_proc(dtp, prochandler, NULL) == -1) {
+		printf("ERROR: dtrace_handle_proc: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		goto fail;
+	}
+
+	if ((pfd.fd = dtrace_pollfd(dtp)) < 0) {
+		printf("ERROR: dtrace_pollfd: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		goto fail;
+	}
+	pfd.events = POLLIN;
+
+	if ((proc = dtrace_proc_create(dtp, true_argv[0], true_argv, 0)) ==
+	    NULL) {
+		printf("ERROR: dtrace_proc_create: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		goto fail;
+	}
+
+	if ((prog = dtrace_program_strcompile(dtp,
+		    "tick-10ms { @ = count(); } tick-1s { exit(0); }",
+		    DTRACE_PROBESPEC_NAME, 0, 0, NULL)) == NULL ||
+	    dtrace_program_exec(dtp, prog, &info) == -1 ||
+	    dtrace_go(dtp) == -1) {
+		printf("ERROR: cannot start tracing: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		goto fail;
+	}
+
+	dtrace_proc_continue(dtp, proc);
+
+	while (!done) {
+		switch (poll(&pfd, 1, 5000)) {
+		case 0:
+			printf("ERROR: poll fd not readable within 5s\n");
+			goto fail;
+		case -1:
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			goto fail;
+		}
+
+		wakeups++;
+		dtrace_poll(dtp);
+
+		switch (dtrace_work(dtp, NULL, chew, chewrec, NULL)) {
+		case DTRACE_WORKSTATUS_DONE:
+			done = 1;
+			break;
+		case DTRACE_WORKSTATUS_OKAY:
+			break;
+		default:
+			printf("ERROR: dtrace_work: %s\n",
+			    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+			goto fail;
+		}
+	}
+
+	if (dead != 1) {
+		printf("ERROR: %d death notifications, expected 1\n", dead);
+		goto fail;
+	}
+
+	/*
+	 * A second of tracing at a 50ms switchrate needs about twenty wakeups:
+	 * far more means the descriptor stayed readable when nothing was due.
+	 */
+	if (wakeups > 1000) {
+		printf("ERROR: %d wakeups\n", wakeups);
+		goto fail;
+	}
+
+	dtrace_proc_release(dtp, proc);
+	dtrace_close(dtp);
+	return 0;
+
+fail:
+	dtrace_close(dtp);
+	return 1;
+}
@@ -7,6 +7,10 @@
 
 /*
  * Check mappings between symbol names and addresses using /proc/kallmodsyms.
+ *
+ * Also report the resident-memory cost of dtrace_open() and the latency of
+ * symbol lookups by address and by name, so that changes to the symbol table
+ * representation can be compared.  These figures are not checked.
  */
 
 /* @@timeout: 60 */
@@ -14,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <dtrace.h>
 
 int nchecks = 0, nerrors = 0;
@@ -309,14 +314,67 @@ int check_lookup_by_name(dtrace_hdl_t *h, int specify_module) {
 	printf("  %6d symbols not checked due to duplicate name\n", n_dupl);
 }
 
+/*
+ * Return our resident set size in kilobytes, or -1.
+ */
+long rss_kb(void) {
+	char *line = NULL;
+	size_t line_n = 0;
+	long kb = -1;
+	FILE *fd;
+
+	if ((fd = fopen("/proc/self/status", "r")) == NULL)
+		return -1;
+	while ((getline(&line, &line_n, fd)) > 0)
+		if (sscanf(line, "VmRSS: %ld kB", &kb) == 1)
+			break;
+	free(line);
+	fclose(fd);
+	return kb;
+}
+
+double now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1.0e9 + ts.tv_nsec;
+}
+
+void time_lookups(dtrace_hdl_t *h) {
+	int i;
+	double t0, t1;
+	GElf_Sym sym;
+	dtrace_syminfo_t si;
+
+	t0 = now_ns();
+	for (i = 0; i < nsymbols; i++)
+		dtrace_lookup_by_addr(h, (GElf_Addr) symbols[i].addr,
+		    &sym, &si);
+	t1 = now_ns();
+	printf("lookup by address: %d symbols, %.0f ns/lookup\n", nsymbols,
+	    nsymbols ? (t1 - t0) / nsymbols : 0);
+
+	t0 = now_ns();
+	for (i = 0; i < nsymbols; i++)
+		dtrace_lookup_by_name(h, symbols[i].modname,
+		    symbols[i].symname, &sym, &si);
+	t1 = now_ns();
+	printf("lookup by name:    %d symbols, %.0f ns/lookup\n", nsymbols,
+	    nsymbols ? (t1 - t0) / nsymbols : 0);
+}
+
 int main(int argc, char **argv) {
 	int err;
+	long rss_before = rss_kb(), rss_after;
 	dtrace_hdl_t *h = dtrace_open(DTRACE_VERSION, 0, &err);
 	if (h == NULL) {
 		printf("ERROR: dtrace_open %d |%s|\n",
 		    err, dtrace_errmsg(h, err));
 		return 1;
 	}
+	rss_after = rss_kb();
+	printf("RSS after dtrace_open(): %ld kB (+%ld kB)\n", rss_after,
+	    rss_after - rss_before);
 
 	if (read_symbols() != 0)
 		return 1;
@@ -325,6 +383,7 @@ int main(int argc, char **argv) {
 	check_lookup_by_addr(h);
 	check_lookup_by_name(h, 1);
 /*	check_lookup_by_name(h, 0); */ /* do not expect this to pass */
+	time_lookups(h);
 
 	dtrace_close(h);
 
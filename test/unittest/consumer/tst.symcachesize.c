@@ -0,0 +1,156 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Symbolize addresses in several processes through dtrace_uaddr2str(), and
+ * check with dtrace_proc_cachestat() that symbolization handles are kept and
+ * reused under the default cache size, but dropped as soon as they are
+ * released when -xsymcachesize is too small to hold any of them.
+ */
+
+/* @@timeout: 30 */
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <dtrace.h>
+
+#define	NPROCS	4
+
+static pid_t pids[NPROCS];
+
+int main(int argc, char **argv);
+
+/*
+ * Symbolize main() in every child twice.  Returns nonzero on failure.
+ */
+static int
+lookup_all(dtrace_hdl_t *dtp)
+{
+	char buf[256];
+	int i, j;
+
+	for (j = 0; j < 2; j++) {
+		for (i = 0; i < NPROCS; i++) {
+			dtrace_uaddr2str(dtp, pids[i], (uintptr_t)main, buf,
+			    sizeof(buf));
+			if (strstr(buf, "`main") == NULL) {
+				printf("ERROR: %i: main symbolized as %s\n",
+				    pids[i], buf);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static dtrace_hdl_t *
+open_dtrace(const char *cachesize)
+{
+	dtrace_hdl_t *dtp;
+	int err;
+
+	if ((dtp = dtrace_open(DTRACE_VERSION, 0, &err)) == NULL) {
+		printf("ERROR: dtrace_open: %s\n", dtrace_errmsg(NULL, err));
+		return NULL;
+	}
+
+	if (cachesize != NULL &&
+	    dtrace_setopt(dtp, "symcachesize", cachesize) != 0) {
+		printf("ERROR: cannot set symcachesize: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		dtrace_close(dtp);
+		return NULL;
+	}
+
+	return dtp;
+}
+
+int
+main(int argc, char **argv)
+{
+	dtrace_hdl_t *dtp;
+	dtrace_proc_cachestat_t st;
+	int i, ret = 1;
+
+	for (i = 0; i < NPROCS; i++) {
+		if ((pids[i] = fork()) < 0) {
+			perror("fork");
+			goto out;
+		}
+		if (pids[i] == 0) {
+			pause();
+			_exit(0);
+		}
+	}
+
+	/*
+	 * With the default cache, each process is grabbed once and its handle
+	 * reused for the second lookup.
+	 */
+	if ((dtp = open_dtrace(NULL)) == NULL)
+		goto out;
+
+	if (lookup_all(dtp) != 0) {
+		dtrace_close(dtp);
+		goto out;
+	}
+
+	dtrace_proc_cachestat(dtp, &st);
+	dtrace_close(dtp);
+
+	if (st.dtpc_sym_misses != NPROCS || st.dtpc_sym_hits < NPROCS ||
+	    st.dtpc_sym_evictions != 0 || st.dtpc_sym_handles != NPROCS) {
+		printf("ERROR: default cache: %" PRIu64 " misses, %" PRIu64
+		    " hits, %" PRIu64 " evictions, %" PRIu64 " handles\n",
+		    st.dtpc_sym_misses, st.dtpc_sym_hits,
+		    st.dtpc_sym_evictions, st.dtpc_sym_handles);
+		goto out;
+	}
+
+	/*
+	 * With a one-byte cache, every handle is dropped when released, so
+	 * every lookup makes a new one.
+	 */
+	if ((dtp = open_dtrace("1")) == NULL)
+		goto out;
+
+	if (lookup_all(dtp) != 0) {
+		dtrace_close(dtp);
+		goto out;
+	}
+
+	dtrace_proc_cachestat(dtp, &st);
+	dtrace_close(dtp);
+
+	if (st.dtpc_sym_misses != 2 * NPROCS || st.dtpc_sym_hits != 0 ||
+	    st.dtpc_sym_evictions != 2 * NPROCS || st.dtpc_sym_handles != 0 ||
+	    st.dtpc_sym_size > st.dtpc_sym_limit) {
+		printf("ERROR: one-byte cache: %" PRIu64 " misses, %" PRIu64
+		    " hits, %" PRIu64 " evictions, %" PRIu64 " handles, %" PRIu64
+		    " bytes held\n",
+		    st.dtpc_sym_misses, st.dtpc_sym_hits,
+		    st.dtpc_sym_evictions, st.dtpc_sym_handles,
+		    st.dtpc_sym_size);
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	for (i = 0; i < NPROCS && pids[i] > 0; i++) {
+		kill(pids[i], SIGKILL);
+		waitpid(pids[i], NULL, 0);
+	}
+
+	return ret;
+}
@@ -0,0 +1,151 @@
+/*
+ * Oracle Linux DTrace.
+ * Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+ * Licensed under the Universal Permissive License v 1.0 as shown at
+ * http://oss.oracle.com/licenses/upl.
+ */
+
+/*
+ * Aggregate on ustack() in a process that is neither created nor grabbed, and
+ * check that its frames are symbolized through a symbolization handle alone:
+ * dtrace_proc_cachestat() must show symbolization-handle misses, and no
+ * controlled handles at all.
+ */
+
+/* @@timeout: 30 */
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <dtrace.h>
+
+__attribute__((__noinline__)) void
+spin(void)
+{
+	volatile unsigned long i;
+
+	for (;;)
+		for (i = 0; i < 1000000; i++)
+			;
+}
+
+static int
+chew(const dtrace_probedata_t *data, void *arg)
+{
+	return DTRACE_CONSUME_THIS;
+}
+
+static int
+chewrec(const dtrace_probedata_t *data, const dtrace_recdesc_t *rec,
+    void *arg)
+{
+	return rec == NULL ? DTRACE_CONSUME_NEXT : DTRACE_CONSUME_THIS;
+}
+
+int
+main(int argc, char **argv)
+{
+	dtrace_hdl_t *dtp = NULL;
+	dtrace_prog_t *prog;
+	dtrace_proginfo_t info;
+	dtrace_proc_cachestat_t st;
+	char src[256];
+	char *line = NULL;
+	size_t line_n = 0;
+	FILE *out = NULL;
+	pid_t pid;
+	int err, done = 0, found = 0, ret = 1;
+
+	if ((pid = fork()) < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (pid == 0)
+		spin();
+
+	if ((dtp = dtrace_open(DTRACE_VERSION, 0, &err)) == NULL) {
+		printf("ERROR: dtrace_open: %s\n", dtrace_errmsg(NULL, err));
+		goto out;
+	}
+
+	(void) dtrace_setopt(dtp, "bufsize", "64k");
+	(void) dtrace_setopt(dtp, "aggsize", "64k");
+
+	snprintf(src, sizeof(src), "profile-997 /pid == %i/ "
+	    "{ @[ustack(3)] = count(); } tick-2s { exit(0); }", pid);
+
+	if ((prog = dtrace_program_strcompile(dtp, src,
+		    DTRACE_PROBESPEC_NAME, 0, 0, NULL)) == NULL ||
+	    dtrace_program_exec(dtp, prog, &info) == -1 ||
+	    dtrace_go(dtp) == -1) {
+		printf("ERROR: cannot start tracing: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		goto out;
+	}
+
+	while (!done) {
+		dtrace_sleep(dtp);
+
+		switch (dtrace_work(dtp, NULL, chew, chewrec, NULL)) {
+		case DTRACE_WORKSTATUS_DONE:
+			done = 1;
+			break;
+		case DTRACE_WORKSTATUS_OKAY:
+			break;
+		default:
+			printf("ERROR: dtrace_work: %s\n",
+			    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+			goto out;
+		}
+	}
+	dtrace_stop(dtp);
+
+	if ((out = tmpfile()) == NULL) {
+		perror("tmpfile");
+		goto out;
+	}
+
+	if (dtrace_aggregate_print(dtp, out, NULL) == -1) {
+		printf("ERROR: dtrace_aggregate_print: %s\n",
+		    dtrace_errmsg(dtp, dtrace_errno(dtp)));
+		goto out;
+	}
+
+	rewind(out);
+	while (getline(&line, &line_n, out) > 0) {
+		if (strstr(line, "`spin") != NULL)
+			found = 1;
+	}
+	free(line);
+
+	if (!found) {
+		printf("ERROR: no frame symbolized as spin()\n");
+		goto out;
+	}
+
+	dtrace_proc_cachestat(dtp, &st);
+	if (st.dtpc_sym_misses == 0 || st.dtpc_misses != 0 ||
+	    st.dtpc_handles != 0) {
+		printf("ERROR: %" PRIu64 " symbolization-handle misses, %"
+		    PRIu64 " controlled-handle misses, %" PRIu64
+		    " controlled handles\n", st.dtpc_sym_misses,
+		    st.dtpc_misses, st.dtpc_handles);
+		goto out;
+	}
+
+	ret = 0;
+
+out:
+	if (out != NULL)
+		fclose(out);
+	if (dtp != NULL)
+		dtrace_close(dtp);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+
+	return ret;
+}
@@ -0,0 +1,15 @@
+go*:
+go
+go_a
+go_b
+gone
+go_?:
+go_a
+go_b
+go\_a:
+go_a
+*go:
+ago
+go
+g:
+g
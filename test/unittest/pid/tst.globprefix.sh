@@ -0,0 +1,53 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# This test verifies that function globs with a literal prefix, which only
+# visit the symbols beginning with that prefix, match exactly the functions
+# that a full scan would.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+DIR=$tmpdir/globprefix.$$
+
+mkdir $DIR
+
+cat > $DIR/main.c <<EOF
+void go(void) { }
+void go_a(void) { }
+void go_b(void) { }
+void gone(void) { }
+void ago(void) { }
+void g(void) { }
+
+int
+main(int argc, char **argv)
+{
+	go(); go_a(); go_b(); gone(); ago(); g();
+	return 0;
+}
+EOF
+
+cc -O0 -o $DIR/main $DIR/main.c
+if [ $? -ne 0 ]; then
+	echo "failed to build" >&2
+	exit 1
+fi
+
+for func in 'go*' 'go_?' 'go\_a' '*go' 'g'; do
+	echo "$func:"
+	$dtrace $dt_flags -l -n "pid\$target:a.out:$func:entry" -c $DIR/main |
+	    awk 'NR > 1 { print $4; }' | sort
+done
+
+rm -rf $DIR
+
+exit 0
@@ -0,0 +1,41 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# This script tests that when more processes are grabbed than there are
+# process-control threads, the death of every one of them is still noticed,
+# so that dtrace exits once they are all gone.
+#
+# If this fails, the script will run indefinitely; it relies on the harness
+# to time it out.
+#
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+nprocs=16
+pids=
+pargs=
+
+for i in $(seq $nprocs); do
+	sleep 10000 &
+	pids="$pids $!"
+	pargs="$pargs -p $!"
+	disown %+
+done
+
+(sleep 5; kill $pids) &
+disown %+
+
+$dtrace $dt_flags $pargs -qn 'tick-1s {}'
+status=$?
+
+kill $pids 2>/dev/null
+
+exit $status
@@ -0,0 +1,48 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# This script tests that a process created and monitored through a pidfd
+# rather than a waitfd can exec() repeatedly: each exec() is a ptrace() stop,
+# which only the polling of pidfd processes can notice.  It also checks that
+# the pidfd really was used.
+#
+# If this fails, the script will run indefinitely; it relies on the harness
+# to time it out.
+#
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+
+DEBUGLOG=$tmpdir/pidfd-exec.debug.$$
+
+DTRACE_DEBUG=t $dtrace $dt_flags -xprocmon=pidfd \
+    -c 'test/triggers/libproc-execing-bkpts-victim 100' -qn '
+proc:::exec-success
+/pid == $target/
+{
+	execs++;
+}
+
+END
+{
+	printf("%s\n", execs > 0 ? "execs seen" : "no execs seen");
+}' 2> $DEBUGLOG
+status=$?
+
+# If pidfd_open() failed, the process would quietly not have been monitored.
+if ! grep -q 'monitoring via pidfd' $DEBUGLOG ||
+   grep -q 'monitoring via waitfd' $DEBUGLOG; then
+	echo "victim was not monitored through a pidfd" >&2
+	grep -E 'monitoring via|pidfd' $DEBUGLOG >&2
+	status=1
+fi
+
+rm -f $DEBUGLOG
+exit $status
@@ -0,0 +1,43 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# This script tests that a process grabbed and monitored through a pidfd
+# rather than a waitfd is seen to exit, and that the pidfd really was used.
+#
+# If this fails, the script will run indefinitely; it relies on the harness
+# to time it out.
+#
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+
+test/triggers/libproc-sleeper &
+SLEEPER=$!
+disown %+
+while [[ $(readlink /proc/$SLEEPER/exe) =~ bash ]]; do :; done
+
+DEBUGLOG=$tmpdir/pidfd-grab.debug.$$
+
+DTRACE_DEBUG=t $dtrace $dt_flags -xprocmon=pidfd -p $SLEEPER -qn '
+BEGIN
+{
+	printf("grabbed\n");
+}' 2> $DEBUGLOG
+status=$?
+
+# If pidfd_open() failed, the grab would quietly have become noninvasive.
+if ! grep -q "$SLEEPER: monitoring via pidfd" $DEBUGLOG; then
+	echo "$SLEEPER was not monitored through a pidfd" >&2
+	grep -E 'monitoring via|pidfd' $DEBUGLOG >&2
+	status=1
+fi
+
+rm -f $DEBUGLOG
+exit $status
@@ -0,0 +1,5 @@
+test:fire1:1
+test:fire2:2
+test:fire3:3
+test:fire4:4
+
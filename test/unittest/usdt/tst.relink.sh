@@ -0,0 +1,151 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+# Check that objects processed by an earlier dtrace -G are left untouched by
+# a later one, that they still contribute their probes, and that the DOF does
+# not depend on which objects had to be rewritten.  Some objects are also
+# named twice, directly or through links, and must come through intact.
+#
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+dtrace=$1
+CC=/usr/bin/gcc
+CFLAGS=
+
+DIRNAME="$tmpdir/usdt-relink.$$.$RANDOM"
+mkdir -p $DIRNAME
+cd $DIRNAME
+
+cat > prov.d <<EOF
+provider test_prov {
+	probe go(int);
+};
+EOF
+
+$dtrace -h -s prov.d
+if [ $? -ne 0 ]; then
+	echo "failed to generate header file" >& 2
+	exit 1
+fi
+
+for i in 1 2 3 4; do
+	cat > obj$i.c <<EOF
+#include <sys/types.h>
+#include "prov.h"
+
+static void
+fire$i(void)
+{
+	TEST_PROV_GO($i);
+}
+
+void
+go$i(void)
+{
+	fire$i();
+}
+EOF
+done
+
+cat > test.c <<EOF
+extern void go1(void), go2(void), go3(void), go4(void);
+
+int
+main(int argc, char **argv)
+{
+	go1();
+	go2();
+	go3();
+	go4();
+
+	return (0);
+}
+EOF
+
+objs="obj1.o obj2.o obj3.o obj4.o"
+allobjs="$objs obj1.o hard2.o sym4.o"
+
+${CC} ${CFLAGS} -c test.c obj1.c obj2.c obj3.c obj4.c
+if [ $? -ne 0 ]; then
+	echo "failed to compile" >& 2
+	exit 1
+fi
+ln obj2.o hard2.o
+ln -s obj4.o sym4.o
+
+$dtrace -xlinktype=dof -G -o first.dof -s prov.d $allobjs
+if [ $? -ne 0 ]; then
+	echo "failed to create DOF" >& 2
+	exit 1
+fi
+cksum $objs > first.sum
+
+$dtrace -xlinktype=dof -G -o second.dof -s prov.d $allobjs
+if [ $? -ne 0 ]; then
+	echo "failed to create DOF again" >& 2
+	exit 1
+fi
+cksum $objs > second.sum
+
+if ! cmp -s first.sum second.sum; then
+	echo "processed objects were rewritten" >& 2
+	exit 1
+fi
+
+if ! cmp -s first.dof second.dof; then
+	echo "DOF differs between links" >& 2
+	exit 1
+fi
+
+# An object named twice defines its sites twice, as it did when every name
+# was processed separately.
+$dtrace -xlinktype=dof -G -o once.dof -s prov.d obj1.o &&
+$dtrace -xlinktype=dof -G -o twice.dof -s prov.d obj1.o obj1.o
+if [ $? -ne 0 ]; then
+	echo "failed to create DOF for a repeated object" >& 2
+	exit 1
+fi
+
+if [ $(stat -c %s twice.dof) -le $(stat -c %s once.dof) ]; then
+	echo "repeated object did not define its sites again" >& 2
+	exit 1
+fi
+
+# Rebuild one object: only that one needs rewriting again.
+${CC} ${CFLAGS} -c obj3.c
+if [ $? -ne 0 ]; then
+	echo "failed to recompile obj3.c" >& 2
+	exit 1
+fi
+
+$dtrace -G -s prov.d $objs
+if [ $? -ne 0 ]; then
+	echo "failed to create DOF after recompiling" >& 2
+	exit 1
+fi
+cksum $objs > third.sum
+
+if [ "$(grep -v obj3.o first.sum)" != "$(grep -v obj3.o third.sum)" ]; then
+	echo "unchanged objects were rewritten" >& 2
+	exit 1
+fi
+
+${CC} ${CFLAGS} -o test test.o $objs prov.o
+if [ $? -ne 0 ]; then
+	echo "failed to link final executable" >& 2
+	exit 1
+fi
+
+$dtrace -c ./test -qs /dev/stdin <<EOF
+test_prov\$target:::go
+{
+	printf("%s:%s:%d\n", probemod, probefunc, arg0);
+}
+EOF
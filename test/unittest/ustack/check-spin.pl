@@ -0,0 +1,52 @@
+#!/usr/bin/perl -w
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+#
+
+#
+# check-spin.pl
+#
+# Check the ustack(4) aggregation of test/triggers/ustack-tst-spin printed as
+# "START%kEND": every stack must be baz, bar, foo, main, and there must be at
+# least one.  If the output starts with a "TOTAL n" line, at least 1000 samples
+# must have been taken.  Exit status is 0 if the output is as expected.
+#
+
+use strict;
+
+my $found = 0;
+
+$_ = <>;
+if (defined($_) && /^TOTAL/) {
+	chomp;
+	die "output problem\n" unless /^TOTAL (\d+)/;
+	die "too few samples ($1)\n" unless $1 >= 1000;
+	$_ = <>;
+}
+
+while (defined($_)) {
+	chomp;
+
+	if (/^$/) {
+		$_ = <>;
+		next;
+	}
+
+	die "expected START at $.\n" unless /^START/;
+
+	foreach my $fn ('baz', 'bar', 'foo', 'main') {
+		$_ = <>;
+		die "expected $fn at $.\n" unless defined($_) && /`$fn\+?/;
+	}
+
+	$_ = <>;
+	die "expected END at $.\n" unless defined($_) && /^END$/;
+	$found++;
+	$_ = <>;
+}
+
+die "no stacks found\n" unless $found > 0;
+exit 0;
@@ -1,7 +1,7 @@
 #!/bin/bash
 #
 # Oracle Linux DTrace.
-# Copyright (c) 2006, 2014, Oracle and/or its affiliates. All rights reserved.
+# Copyright (c) 2006, 2025, Oracle and/or its affiliates. All rights reserved.
 # Licensed under the Universal Permissive License v 1.0 as shown at
 # http://oss.oracle.com/licenses/upl.
 
@@ -12,6 +12,7 @@ if [ $# != 1 ]; then
 	exit 2
 fi
 
+testdir="$(dirname $_test)"
 file=$tmpdir/out.$$
 dtrace=$1
 
@@ -74,44 +75,7 @@ if [ "$status" -ne 0 ]; then
 	exit $status
 fi
 
-perl /dev/stdin $file <<EOF
-	\$_ = <>;
-	chomp;
-	die "output problem\n" unless /^TOTAL (\d+)/;
-	\$count = \$1;
-	die "too few samples (\$count)\n" unless \$count >= 1000;
-
-	while (<>) {
-		chomp;
-
-		last if /^$/;
-
-		die "expected START at \$.\n" unless /^START/;
-
-
-		\$_ = <>;
-		chomp;
-		die "expected END at \$.\n" unless /\`baz\+?/;
-
-		\$_ = <>;
-		chomp;
-		die "expected END at \$.\n" unless /\`bar\+?/;
-
-		\$_ = <>;
-		chomp;
-		die "expected END at \$.\n" unless /\`foo\+?/;
-
-		\$_ = <>;
-		chomp;
-		die "expected END at \$.\n" unless /\`main\+?/;
-
-		\$_ = <>;
-		chomp;
-		die "expected END at \$.\n" unless /^END\$/;
-	}
-
-EOF
-
+perl $testdir/check-spin.pl $file
 status=$?
 rm -f $file
 
@@ -0,0 +1,84 @@
+#!/bin/bash
+#
+# Oracle Linux DTrace.
+# Copyright (c) 2025, Oracle and/or its affiliates. All rights reserved.
+# Licensed under the Universal Permissive License v 1.0 as shown at
+# http://oss.oracle.com/licenses/upl.
+
+#
+# Check that with -xusnapshot, ustack() aggregation keys are symbolized even
+# when the process has exited before they are printed, and that without it
+# they are not.
+#
+# @@tags: unstable
+
+if [ $# != 1 ]; then
+	echo expected one argument: '<'dtrace-path'>'
+	exit 2
+fi
+
+testdir="$(dirname $_test)"
+file=$tmpdir/out.$$
+dtrace=$1
+
+#
+# The target is timeout(1): the spinning process is its child, which DTrace
+# neither creates nor grabs, and which has been killed and reaped by the time
+# END prints the stacks.  The only chance to read its symbols is while the
+# aggregation is snapshotted every 100ms as it runs.
+#
+run()
+{
+	rm -f $file
+	$dtrace $dt_flags "$@" -xaggrate=100ms -o $file \
+	    -c "timeout 3 test/triggers/ustack-tst-spin" -s /dev/stdin <<EOF
+	#pragma D option quiet
+
+	profile-1999
+	/execname == "ustack-tst-spin"/
+	{
+		@stacks[ustack(4)] = count();
+	}
+
+	END
+	{
+		printa("START%kEND\n", @stacks);
+	}
+EOF
+}
+
+if ! run -xusnapshot; then
+	echo $tst: dtrace failed with -xusnapshot
+	rm -f $file
+	exit 1
+fi
+
+if ! perl $testdir/check-spin.pl $file; then
+	echo $tst: stacks not symbolized with -xusnapshot
+	cat $file
+	rm -f $file
+	exit 1
+fi
+
+if ! run; then
+	echo $tst: dtrace failed without -xusnapshot
+	rm -f $file
+	exit 1
+fi
+
+if ! grep -q '^START' $file; then
+	echo $tst: no stacks recorded without -xusnapshot
+	rm -f $file
+	exit 1
+fi
+
+if perl $testdir/check-spin.pl $file 2>/dev/null; then
+	echo $tst: stacks symbolized without -xusnapshot
+	cat $file
+	rm -f $file
+	exit 1
+fi
+
+rm -f $file
+
+exit 0